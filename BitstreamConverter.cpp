@@ -178,9 +178,23 @@ int CBitstreamConverter::nal_bs_read_ue(nal_bitstream *bs)
 
 void CBitstreamConverter::parseh264_sps(uint8_t *sps, uint32_t sps_size, bool *interlaced, int32_t *max_ref_frames)
 {
-  nal_bitstream bs;
   sps_info_struct sps_info;
 
+  if (!parseh264_sps(sps, sps_size, &sps_info))
+    return;
+
+  *interlaced = !sps_info.frame_mbs_only_flag;
+  *max_ref_frames = sps_info.max_num_ref_frames;
+}
+
+bool CBitstreamConverter::parseh264_sps(uint8_t *sps, uint32_t sps_size, sps_info_struct *info)
+{
+  nal_bitstream bs;
+  sps_info_struct &sps_info = *info;
+
+  memset(info, 0, sizeof(*info));
+  // defaults when not coded (non High profiles): 4:2:0, 8 bit
+  sps_info.chroma_format_idc = 1;
   nal_bs_init(&bs, sps, sps_size);
 
   sps_info.profile_idc  = nal_bs_read(&bs, 8);
@@ -210,13 +224,28 @@ void CBitstreamConverter::parseh264_sps(uint8_t *sps, uint32_t sps_size, bool *i
     sps_info.seq_scaling_matrix_present_flag = nal_bs_read (&bs, 1);
     if (sps_info.seq_scaling_matrix_present_flag)
     {
-      /* TODO: unfinished */
+      // skip the lists, only needed to find the fields after them
+      int lists = sps_info.chroma_format_idc != 3 ? 8 : 12;
+      for (int i = 0; i < lists; i++)
+      {
+        if (!nal_bs_read(&bs, 1))
+          continue;
+        int size = i < 6 ? 16 : 64;
+        int last = 8, next = 8;
+        for (int j = 0; j < size && next != 0; j++)
+        {
+          int code  = nal_bs_read_ue(&bs);
+          int delta = (code & 1) ? (code + 1) / 2 : -(code / 2);
+          next = (last + delta + 256) % 256;
+          last = next ? next : last;
+        }
+      }
     }
   }
   sps_info.log2_max_frame_num_minus4 = nal_bs_read_ue(&bs);
   if (sps_info.log2_max_frame_num_minus4 > 12)
   { // must be between 0 and 12
-    return;
+    return false;
   }
   sps_info.pic_order_cnt_type = nal_bs_read_ue(&bs);
   if (sps_info.pic_order_cnt_type == 0)
@@ -224,16 +253,15 @@ void CBitstreamConverter::parseh264_sps(uint8_t *sps, uint32_t sps_size, bool *i
     sps_info.log2_max_pic_order_cnt_lsb_minus4 = nal_bs_read_ue(&bs);
   }
   else if (sps_info.pic_order_cnt_type == 1)
-  { // TODO: unfinished
-    /*
-    delta_pic_order_always_zero_flag = gst_nal_bs_read (bs, 1);
-    offset_for_non_ref_pic = gst_nal_bs_read_se (bs);
-    offset_for_top_to_bottom_field = gst_nal_bs_read_se (bs);
-
-    num_ref_frames_in_pic_order_cnt_cycle = gst_nal_bs_read_ue (bs);
-    for( i = 0; i < num_ref_frames_in_pic_order_cnt_cycle; i++ )
-    offset_for_ref_frame[i] = gst_nal_bs_read_se (bs);
-    */
+  {
+    nal_bs_read(&bs, 1);     // delta_pic_order_always_zero_flag
+    nal_bs_read_ue(&bs);     // offset_for_non_ref_pic
+    nal_bs_read_ue(&bs);     // offset_for_top_to_bottom_field
+    int cycle = nal_bs_read_ue(&bs); // num_ref_frames_in_pic_order_cnt_cycle
+    if (cycle > 255)
+      return false;
+    for (int i = 0; i < cycle; i++)
+      nal_bs_read_ue(&bs);   // offset_for_ref_frame[i]
   }
 
   sps_info.max_num_ref_frames             = nal_bs_read_ue(&bs);
@@ -256,8 +284,7 @@ void CBitstreamConverter::parseh264_sps(uint8_t *sps, uint32_t sps_size, bool *i
     sps_info.frame_crop_bottom_offset     = nal_bs_read_ue(&bs);
   }
 
-  *interlaced = !sps_info.frame_mbs_only_flag;
-  *max_ref_frames = sps_info.max_num_ref_frames;
+  return true;
 }
 
 const uint8_t *CBitstreamConverter::avc_find_startcode_internal(const uint8_t *p, const uint8_t *end)
@@ -442,7 +469,7 @@ bool CBitstreamConverter::Open(enum AVCodecID codec, uint8_t *in_extradata, int
     case AV_CODEC_ID_H264:
       if (in_extrasize < 7 || in_extradata == NULL)
       {
-        CLog::Log(LOGERROR, "CBitstreamConverter::Open avcC data too small or missing\n");
+        CLOG(LOGERROR, "CBitstreamConverter::Open avcC data too small or missing\n");
         return false;
       }
       // valid avcC data (bitstream) always starts with the value 1 (version)
@@ -450,7 +477,7 @@ bool CBitstreamConverter::Open(enum AVCodecID codec, uint8_t *in_extradata, int
       {
         if ( *(char*)in_extradata == 1 )
         {
-          CLog::Log(LOGINFO, "CBitstreamConverter::Open bitstream to annexb init\n");
+          CLOG(LOGINFO, "CBitstreamConverter::Open bitstream to annexb init\n");
           m_convert_bitstream = BitstreamConvertInit(in_extradata, in_extrasize);
           return true;
         }
@@ -462,7 +489,7 @@ bool CBitstreamConverter::Open(enum AVCodecID codec, uint8_t *in_extradata, int
         {
           if (in_extradata[0] == 0 && in_extradata[1] == 0 && in_extradata[2] == 0 && in_extradata[3] == 1)
           {
-            CLog::Log(LOGINFO, "CBitstreamConverter::Open annexb to bitstream init\n");
+            CLOG(LOGINFO, "CBitstreamConverter::Open annexb to bitstream init\n");
             // video content is from x264 or from bytestream h264 (AnnexB format)
             // NAL reformating to bitstream format needed
 
@@ -486,7 +513,7 @@ bool CBitstreamConverter::Open(enum AVCodecID codec, uint8_t *in_extradata, int
           }
           else
           {
-            CLog::Log(LOGNOTICE, "CBitstreamConverter::Open invalid avcC atom data");
+            CLOG(LOGNOTICE, "CBitstreamConverter::Open invalid avcC atom data");
             return false;
           }
         }
@@ -494,7 +521,7 @@ bool CBitstreamConverter::Open(enum AVCodecID codec, uint8_t *in_extradata, int
         {
           if (in_extradata[4] == 0xFE)
           {
-            CLog::Log(LOGINFO, "CBitstreamConverter::Open annexb to bitstream init 3 byte to 4 byte nal\n");
+            CLOG(LOGINFO, "CBitstreamConverter::Open annexb to bitstream init 3 byte to 4 byte nal\n");
             // video content is from so silly encoder that think 3 byte NAL sizes
             // are valid, setup to convert 3 byte NAL sizes to 4 byte.
 
@@ -590,7 +617,7 @@ bool CBitstreamConverter::Convert(uint8_t *pData, int iSize)
             Close();
             m_inputBuffer = pData;
             m_inputSize   = iSize;
-            CLog::Log(LOGERROR, "CBitstreamConverter::Convert error converting. disable converter\n");
+            CLOG(LOGERROR, "CBitstreamConverter::Convert error converting. disable converter\n");
           }
         }
         else
@@ -678,6 +705,18 @@ int CBitstreamConverter::GetConvertSize()
     return m_inputSize; 
 }
 
+uint8_t *CBitstreamConverter::DetachConvertBuffer()
+{
+  // only the avcC -> Annex B output comes from realloc, the others are av_malloc'ed
+  if(!m_to_annexb || !m_convert_bitstream || m_convertBuffer == NULL)
+    return NULL;
+
+  uint8_t *buffer = m_convertBuffer;
+  m_convertBuffer = NULL;
+  m_convertSize   = 0;
+  return buffer;
+}
+
 uint8_t *CBitstreamConverter::GetExtraData()
 {
   return m_extradata;
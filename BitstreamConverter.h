@@ -127,9 +127,14 @@ public:
   bool Convert(uint8_t *pData, int iSize);
   uint8_t *GetConvertBuffer(void);
   int GetConvertSize();
+  // hands the converted (Annex B) buffer to the caller, to free() when done.
+  // NULL when there is none or it isn't malloc'ed; call GetConvertSize first
+  uint8_t *DetachConvertBuffer(void);
   uint8_t *GetExtraData(void);
   int GetExtraSize();
   void parseh264_sps(uint8_t *sps, uint32_t sps_size, bool *interlaced, int32_t *max_ref_frames);
+  // sps is the NAL payload, after the nal_unit_type byte
+  bool parseh264_sps(uint8_t *sps, uint32_t sps_size, sps_info_struct *info);
 protected:
   // bytestream (Annex B) to bistream conversion support.
   void nal_bs_init(nal_bitstream *bs, const uint8_t *data, size_t size);
@@ -0,0 +1,173 @@
+#pragma once
+/*
+ * Copyright (c) 2019/01 truong <truongptk30a3@gmail.com>
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ */
+
+// Fixed capacity ring of the buffer headers available on an OMX port.
+//
+// One consumer takes buffers (the thread feeding/draining the port), buffers
+// come back from the IL callback thread. Push/Pop are a single producer,
+// single consumer ring and don't lock: the indexes are published with
+// release/acquire atomics. The few paths that hand buffers back from other
+// threads (error paths, releasing shared buffers) use Return, a list behind
+// a mutex that Pop only looks at when something is in it.
+//
+// Waiting is futex based and only costs a syscall when the ring is empty:
+// a waiter takes a token (WaitToken), retries Pop, then sleeps in Wait until
+// the token changes. Push only calls into the kernel when someone sleeps.
+
+#include <vector>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+template <typename T>
+class COMXBufferRing
+{
+public:
+    COMXBufferRing() : m_head(0), m_tail(0), m_returned_count(0), m_seq(0), m_waiters(0)
+    {
+        pthread_mutex_init(&m_returned_lock, NULL);
+    }
+    ~COMXBufferRing() { pthread_mutex_destroy(&m_returned_lock); }
+
+    // not thread safe, the port has no buffer in flight
+    void Reset(unsigned int capacity)
+    {
+        m_slots.assign(capacity, T());
+        m_head = m_tail = 0;
+        m_returned.clear();
+        m_returned.reserve(capacity);
+        m_returned_count = 0;
+    }
+
+    unsigned int Capacity() const { return m_slots.size(); }
+    unsigned int Size() const
+    {
+        return __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&m_head, __ATOMIC_ACQUIRE) +
+               __atomic_load_n(&m_returned_count, __ATOMIC_ACQUIRE);
+    }
+    bool Empty() const { return Size() == 0; }
+
+    // The producer: the IL callback thread, or the setup before the port
+    // runs. false when full, which means a buffer was returned twice.
+    bool Push(const T &value)
+    {
+        unsigned int tail = __atomic_load_n(&m_tail, __ATOMIC_RELAXED);
+        if (!m_slots.size() || tail - __atomic_load_n(&m_head, __ATOMIC_ACQUIRE) >= m_slots.size())
+            return false;
+        m_slots[tail % m_slots.size()] = value;
+        __atomic_store_n(&m_tail, tail + 1, __ATOMIC_RELEASE);
+        WakeAll();
+        return true;
+    }
+
+    // any other thread: a buffer that never reached the component
+    bool Return(const T &value)
+    {
+        pthread_mutex_lock(&m_returned_lock);
+        bool ok = Size() < m_slots.size();
+        if (ok)
+        {
+            m_returned.push_back(value);
+            __atomic_store_n(&m_returned_count, (unsigned int)m_returned.size(), __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&m_returned_lock);
+
+        if (ok)
+            WakeAll();
+        return ok;
+    }
+
+    bool Pop(T &value)
+    {
+        unsigned int head = __atomic_load_n(&m_head, __ATOMIC_RELAXED);
+        if (head != __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE))
+        {
+            value = m_slots[head % m_slots.size()];
+            __atomic_store_n(&m_head, head + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+        if (!__atomic_load_n(&m_returned_count, __ATOMIC_ACQUIRE))
+            return false;
+
+        pthread_mutex_lock(&m_returned_lock);
+        bool ok = !m_returned.empty();
+        if (ok)
+        {
+            value = m_returned.back();
+            m_returned.pop_back();
+            __atomic_store_n(&m_returned_count, (unsigned int)m_returned.size(), __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&m_returned_lock);
+        return ok;
+    }
+
+    int WaitToken() const { return __atomic_load_n(&m_seq, __ATOMIC_SEQ_CST); }
+
+    // Sleep until something is pushed (or WakeAll) since token was taken.
+    // endtime is absolute CLOCK_MONOTONIC, false once it has passed.
+    bool Wait(int token, const struct timespec &endtime)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        struct timespec rel;
+        rel.tv_sec  = endtime.tv_sec - now.tv_sec;
+        rel.tv_nsec = endtime.tv_nsec - now.tv_nsec;
+        if (rel.tv_nsec < 0)
+        {
+            rel.tv_sec  -= 1;
+            rel.tv_nsec += 1000000000;
+        }
+        else if (rel.tv_nsec >= 1000000000)
+        {
+            rel.tv_sec  += 1;
+            rel.tv_nsec -= 1000000000;
+        }
+        if (rel.tv_sec < 0 || (rel.tv_sec == 0 && rel.tv_nsec == 0))
+            return false;
+
+        __atomic_add_fetch(&m_waiters, 1, __ATOMIC_SEQ_CST);
+        long ret = syscall(SYS_futex, &m_seq, FUTEX_WAIT_PRIVATE, token, &rel, NULL, 0);
+        int err = errno;
+        __atomic_sub_fetch(&m_waiters, 1, __ATOMIC_SEQ_CST);
+
+        return ret == 0 || err != ETIMEDOUT;
+    }
+
+    // wake the waiters, e.g. so they notice a flush or an error
+    void WakeAll()
+    {
+        __atomic_add_fetch(&m_seq, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&m_waiters, __ATOMIC_SEQ_CST))
+            syscall(SYS_futex, &m_seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+
+private:
+    COMXBufferRing(const COMXBufferRing &);
+    COMXBufferRing &operator=(const COMXBufferRing &);
+
+    std::vector<T> m_slots;
+    unsigned int   m_head;
+    unsigned int   m_tail;
+    // Return()ed from outside the callback thread
+    pthread_mutex_t m_returned_lock;
+    std::vector<T> m_returned;
+    unsigned int   m_returned_count;
+    int            m_seq;
+    int            m_waiters;
+};
@@ -26,6 +26,7 @@
 #include "OMXCore.h"
 #include "utils/log.h"
 #include "XMemUtils.h"
+#include "OMXSoftCore.h"
 
 //#define OMX_DEBUG_EVENTS
 //#define OMX_DEBUG_EVENTHANDLER
@@ -79,8 +80,8 @@ OMX_ERRORTYPE COMXCoreTunel::Deestablish(bool noWait)
         omx_err = m_src_component->DisablePort(m_src_port, false);
         if(omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, "COMXCoreTunel::Deestablish - Error disable port %d on component %s omx_err(0x%08x)",
-                      m_src_port, m_src_component->GetName().c_str(), (int)omx_err);
+            CLOG(LOGERROR, "COMXCoreTunel::Deestablish - Error disable port %d on component %s omx_err(0x%08x)",
+                 m_src_port, m_src_component->GetName().c_str(), (int)omx_err);
         }
     }
 
@@ -89,8 +90,8 @@ OMX_ERRORTYPE COMXCoreTunel::Deestablish(bool noWait)
         omx_err = m_dst_component->DisablePort(m_dst_port, false);
         if(omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, "COMXCoreTunel::Deestablish - Error disable port %d on component %s omx_err(0x%08x)",
-                      m_dst_port, m_dst_component->GetName().c_str(), (int)omx_err);
+            CLOG(LOGERROR, "COMXCoreTunel::Deestablish - Error disable port %d on component %s omx_err(0x%08x)",
+                 m_dst_port, m_dst_component->GetName().c_str(), (int)omx_err);
         }
     }
 
@@ -99,8 +100,8 @@ OMX_ERRORTYPE COMXCoreTunel::Deestablish(bool noWait)
         omx_err = m_src_component->WaitForCommand(OMX_CommandPortDisable, m_src_port);
         if(omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, "COMXCoreTunel::Deestablish - Error WaitForCommand port %d on component %s omx_err(0x%08x)",
-                      m_dst_port, m_src_component->GetName().c_str(), (int)omx_err);
+            CLOG(LOGERROR, "COMXCoreTunel::Deestablish - Error WaitForCommand port %d on component %s omx_err(0x%08x)",
+                 m_dst_port, m_src_component->GetName().c_str(), (int)omx_err);
             return omx_err;
         }
     }
@@ -110,29 +111,29 @@ OMX_ERRORTYPE COMXCoreTunel::Deestablish(bool noWait)
         omx_err = m_dst_component->WaitForCommand(OMX_CommandPortDisable, m_dst_port);
         if(omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, "COMXCoreTunel::Deestablish - Error WaitForCommand port %d on component %s omx_err(0x%08x)",
-                      m_dst_port, m_dst_component->GetName().c_str(), (int)omx_err);
+            CLOG(LOGERROR, "COMXCoreTunel::Deestablish - Error WaitForCommand port %d on component %s omx_err(0x%08x)",
+                 m_dst_port, m_dst_component->GetName().c_str(), (int)omx_err);
             return omx_err;
         }
     }
 
     if(m_src_component->GetComponent())
     {
-        omx_err = OMX_SetupTunnel(m_src_component->GetComponent(), m_src_port, NULL, 0);
+        omx_err = COMXCore::SetupTunnel(m_src_component->GetComponent(), m_src_port, NULL, 0);
         if(omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, "COMXCoreTunel::Deestablish - could not unset tunnel on comp src %s port %d omx_err(0x%08x)\n",
-                      m_src_component->GetName().c_str(), m_src_port, (int)omx_err);
+            CLOG(LOGERROR, "COMXCoreTunel::Deestablish - could not unset tunnel on comp src %s port %d omx_err(0x%08x)\n",
+                 m_src_component->GetName().c_str(), m_src_port, (int)omx_err);
         }
     }
 
     if(m_dst_component->GetComponent())
     {
-        omx_err = OMX_SetupTunnel(m_dst_component->GetComponent(), m_dst_port, NULL, 0);
+        omx_err = COMXCore::SetupTunnel(m_dst_component->GetComponent(), m_dst_port, NULL, 0);
         if(omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, "COMXCoreTunel::Deestablish - could not unset tunnel on comp dst %s port %d omx_err(0x%08x)\n",
-                      m_dst_component->GetName().c_str(), m_dst_port, (int)omx_err);
+            CLOG(LOGERROR, "COMXCoreTunel::Deestablish - could not unset tunnel on comp dst %s port %d omx_err(0x%08x)\n",
+                 m_dst_component->GetName().c_str(), m_dst_port, (int)omx_err);
         }
     }
 
@@ -158,7 +159,7 @@ OMX_ERRORTYPE COMXCoreTunel::Establish(bool enable_ports /* = true */, bool disa
     //   omx_err = m_src_component->SetStateForComponent(OMX_StateIdle);
     //   if(omx_err != OMX_ErrorNone)
     //   {
-    //     CLog::Log(LOGERROR, "COMXCoreTunel::Establish - Error setting state to idle %s omx_err(0x%08x)", 
+    //     CLOG(LOGERROR, "COMXCoreTunel::Establish - Error setting state to idle %s omx_err(0x%08x)", 
     //         m_src_component->GetName().c_str(), (int)omx_err);
     //     return omx_err;
     //   }
@@ -169,8 +170,8 @@ OMX_ERRORTYPE COMXCoreTunel::Establish(bool enable_ports /* = true */, bool disa
         omx_err = m_src_component->DisablePort(m_src_port, false);
         if(omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, "COMXCoreTunel::Establish - Error disable port %d on component %s omx_err(0x%08x)",
-                      m_src_port, m_src_component->GetName().c_str(), (int)omx_err);
+            CLOG(LOGERROR, "COMXCoreTunel::Establish - Error disable port %d on component %s omx_err(0x%08x)",
+                 m_src_port, m_src_component->GetName().c_str(), (int)omx_err);
         }
     }
 
@@ -179,8 +180,8 @@ OMX_ERRORTYPE COMXCoreTunel::Establish(bool enable_ports /* = true */, bool disa
         omx_err = m_dst_component->DisablePort(m_dst_port, false);
         if(omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, "COMXCoreTunel::Establish - Error disable port %d on component %s omx_err(0x%08x)",
-                      m_dst_port, m_dst_component->GetName().c_str(), (int)omx_err);
+            CLOG(LOGERROR, "COMXCoreTunel::Establish - Error disable port %d on component %s omx_err(0x%08x)",
+                 m_dst_port, m_dst_component->GetName().c_str(), (int)omx_err);
         }
     }
 
@@ -189,8 +190,8 @@ OMX_ERRORTYPE COMXCoreTunel::Establish(bool enable_ports /* = true */, bool disa
         omx_err = m_src_component->WaitForCommand(OMX_CommandPortDisable, m_src_port);
         if(omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, "COMXCoreTunel::Establish - Error WaitForCommand port %d on component %s omx_err(0x%08x)",
-                      m_dst_port, m_src_component->GetName().c_str(), (int)omx_err);
+            CLOG(LOGERROR, "COMXCoreTunel::Establish - Error WaitForCommand port %d on component %s omx_err(0x%08x)",
+                 m_dst_port, m_src_component->GetName().c_str(), (int)omx_err);
             return omx_err;
         }
     }
@@ -200,25 +201,25 @@ OMX_ERRORTYPE COMXCoreTunel::Establish(bool enable_ports /* = true */, bool disa
         omx_err = m_dst_component->WaitForCommand(OMX_CommandPortDisable, m_dst_port);
         if(omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, "COMXCoreTunel::Establish - Error WaitForCommand port %d on component %s omx_err(0x%08x)",
-                      m_dst_port, m_dst_component->GetName().c_str(), (int)omx_err);
+            CLOG(LOGERROR, "COMXCoreTunel::Establish - Error WaitForCommand port %d on component %s omx_err(0x%08x)",
+                 m_dst_port, m_dst_component->GetName().c_str(), (int)omx_err);
             return omx_err;
         }
     }
 
     if(m_src_component->GetComponent() && m_dst_component->GetComponent())
     {
-        omx_err = OMX_SetupTunnel(m_src_component->GetComponent(), m_src_port, m_dst_component->GetComponent(), m_dst_port);
+        omx_err = COMXCore::SetupTunnel(m_src_component->GetComponent(), m_src_port, m_dst_component->GetComponent(), m_dst_port);
         if(omx_err != OMX_ErrorNone) 
         {
-            CLog::Log(LOGERROR, "COMXCoreTunel::Establish - could not setup tunnel src %s port %d dst %s port %d omx_err(0x%08x)\n", 
-                      m_src_component->GetName().c_str(), m_src_port, m_dst_component->GetName().c_str(), m_dst_port, (int)omx_err);
+            CLOG(LOGERROR, "COMXCoreTunel::Establish - could not setup tunnel src %s port %d dst %s port %d omx_err(0x%08x)\n", 
+                 m_src_component->GetName().c_str(), m_src_port, m_dst_component->GetName().c_str(), m_dst_port, (int)omx_err);
             return omx_err;
         }    
     }
     else
     {
-        CLog::Log(LOGERROR, "COMXCoreTunel::Establish - could not setup tunnel\n");
+        CLOG(LOGERROR, "COMXCoreTunel::Establish - could not setup tunnel\n");
         return OMX_ErrorUndefined;
     }
 
@@ -229,8 +230,8 @@ OMX_ERRORTYPE COMXCoreTunel::Establish(bool enable_ports /* = true */, bool disa
         omx_err = m_src_component->EnablePort(m_src_port, false);
         if(omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, "COMXCoreTunel::Establish - Error enable port %d on component %s omx_err(0x%08x)", 
-                      m_src_port, m_src_component->GetName().c_str(), (int)omx_err);
+            CLOG(LOGERROR, "COMXCoreTunel::Establish - Error enable port %d on component %s omx_err(0x%08x)", 
+                 m_src_port, m_src_component->GetName().c_str(), (int)omx_err);
             return omx_err;
         }
     }
@@ -240,8 +241,8 @@ OMX_ERRORTYPE COMXCoreTunel::Establish(bool enable_ports /* = true */, bool disa
         omx_err = m_dst_component->EnablePort(m_dst_port, false);
         if(omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, "COMXCoreTunel::Establish - Error enable port %d on component %s omx_err(0x%08x)", 
-                      m_dst_port, m_dst_component->GetName().c_str(), (int)omx_err);
+            CLOG(LOGERROR, "COMXCoreTunel::Establish - Error enable port %d on component %s omx_err(0x%08x)", 
+                 m_dst_port, m_dst_component->GetName().c_str(), (int)omx_err);
             return omx_err;
         }
     }
@@ -259,7 +260,7 @@ OMX_ERRORTYPE COMXCoreTunel::Establish(bool enable_ports /* = true */, bool disa
         //   omx_err = m_dst_component->SetStateForComponent(OMX_StateIdle);
         //   if(omx_err != OMX_ErrorNone)
         //   {
-        //     CLog::Log(LOGERROR, "COMXCoreComponent::Establish - Error setting state to idle %s omx_err(0x%08x)", 
+        //     CLOG(LOGERROR, "COMXCoreComponent::Establish - Error setting state to idle %s omx_err(0x%08x)", 
         //         m_src_component->GetName().c_str(), (int)omx_err);
         //     return omx_err;
         //   }
@@ -307,12 +308,12 @@ COMXCoreComponent::COMXCoreComponent()
     m_omx_events.clear();
     m_ignore_error = OMX_ErrorNone;
 
-    pthread_mutex_init(&m_omx_input_mutex, NULL);
-    pthread_mutex_init(&m_omx_output_mutex, NULL);
+    m_enc_private_cb     = NULL;
+    m_enc_private_opaque = NULL;
+    m_enc_private_output = 0;
+
     pthread_mutex_init(&m_omx_event_mutex, NULL);
     pthread_mutex_init(&m_omx_eos_mutex, NULL);
-    pthread_cond_init(&m_input_buffer_cond, NULL);
-    pthread_cond_init(&m_output_buffer_cond, NULL);
     pthread_cond_init(&m_omx_event_cond, NULL);
 
 }
@@ -321,12 +322,8 @@ COMXCoreComponent::~COMXCoreComponent()
 {
     Deinitialize();
 
-    pthread_mutex_destroy(&m_omx_input_mutex);
-    pthread_mutex_destroy(&m_omx_output_mutex);
     pthread_mutex_destroy(&m_omx_event_mutex);
     pthread_mutex_destroy(&m_omx_eos_mutex);
-    pthread_cond_destroy(&m_input_buffer_cond);
-    pthread_cond_destroy(&m_output_buffer_cond);
     pthread_cond_destroy(&m_omx_event_cond);
 }
 
@@ -347,7 +344,7 @@ OMX_ERRORTYPE COMXCoreComponent::EmptyThisBuffer(OMX_BUFFERHEADERTYPE *omx_buffe
     OMX_ERRORTYPE omx_err = OMX_ErrorNone;
 
 #if defined(OMX_DEBUG_EVENTHANDLER)
-    CLog::Log(LOGDEBUG, "COMXCoreComponent::EmptyThisBuffer component(%s) %p\n", m_componentName.c_str(), omx_buffer);
+    CLOG(LOGDEBUG, "COMXCoreComponent::EmptyThisBuffer component(%s) %p\n", m_componentName.c_str(), omx_buffer);
 #endif
     if(!m_handle || !omx_buffer)
         return OMX_ErrorUndefined;
@@ -355,8 +352,8 @@ OMX_ERRORTYPE COMXCoreComponent::EmptyThisBuffer(OMX_BUFFERHEADERTYPE *omx_buffe
     omx_err = OMX_EmptyThisBuffer(m_handle, omx_buffer);
     if (omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "COMXCoreComponent::EmptyThisBuffer component(%s) - failed with result(0x%x)\n", 
-                  m_componentName.c_str(), omx_err);
+        CLOG(LOGERROR, "COMXCoreComponent::EmptyThisBuffer component(%s) - failed with result(0x%x)\n", 
+             m_componentName.c_str(), omx_err);
     }
 
     return omx_err;
@@ -367,7 +364,7 @@ OMX_ERRORTYPE COMXCoreComponent::FillThisBuffer(OMX_BUFFERHEADERTYPE *omx_buffer
     OMX_ERRORTYPE omx_err = OMX_ErrorNone;
 
 #if defined(OMX_DEBUG_EVENTHANDLER)
-    CLog::Log(LOGDEBUG, "COMXCoreComponent::FillThisBuffer component(%s) %p\n", m_componentName.c_str(), omx_buffer);
+    CLOG(LOGDEBUG, "COMXCoreComponent::FillThisBuffer component(%s) %p\n", m_componentName.c_str(), omx_buffer);
 #endif
     if(!m_handle || !omx_buffer)
         return OMX_ErrorUndefined;
@@ -375,8 +372,8 @@ OMX_ERRORTYPE COMXCoreComponent::FillThisBuffer(OMX_BUFFERHEADERTYPE *omx_buffer
     omx_err = OMX_FillThisBuffer(m_handle, omx_buffer);
     if (omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "COMXCoreComponent::FillThisBuffer component(%s) - failed with result(0x%x)\n", 
-                  m_componentName.c_str(), omx_err);
+        CLOG(LOGERROR, "COMXCoreComponent::FillThisBuffer component(%s) - failed with result(0x%x)\n", 
+             m_componentName.c_str(), omx_err);
     }
 
     return omx_err;
@@ -392,8 +389,8 @@ OMX_ERRORTYPE COMXCoreComponent::FreeOutputBuffer(OMX_BUFFERHEADERTYPE *omx_buff
     omx_err = OMX_FreeBuffer(m_handle, m_output_port, omx_buffer);
     if (omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "COMXCoreComponent::FreeOutputBuffer component(%s) - failed with result(0x%x)\n",
-                  m_componentName.c_str(), omx_err);
+        CLOG(LOGERROR, "COMXCoreComponent::FreeOutputBuffer component(%s) - failed with result(0x%x)\n",
+             m_componentName.c_str(), omx_err);
     }
 
     return omx_err;
@@ -416,14 +413,14 @@ void COMXCoreComponent::FlushInput()
 
     if(omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "COMXCoreComponent::FlushInput - Error on component %s omx_err(0x%08x)", 
-                  m_componentName.c_str(), (int)omx_err);
+        CLOG(LOGERROR, "COMXCoreComponent::FlushInput - Error on component %s omx_err(0x%08x)", 
+             m_componentName.c_str(), (int)omx_err);
     }
     omx_err = WaitForCommand(OMX_CommandFlush, m_input_port);
     if(omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "COMXCoreComponent::FlushInput - %s WaitForCommand omx_err(0x%08x)",
-                  m_componentName.c_str(), (int)omx_err);
+        CLOG(LOGERROR, "COMXCoreComponent::FlushInput - %s WaitForCommand omx_err(0x%08x)",
+             m_componentName.c_str(), (int)omx_err);
     }
 }
 
@@ -438,106 +435,113 @@ void COMXCoreComponent::FlushOutput()
 
     if(omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "COMXCoreComponent::FlushOutput - Error on component %s omx_err(0x%08x)", 
-                  m_componentName.c_str(), (int)omx_err);
+        CLOG(LOGERROR, "COMXCoreComponent::FlushOutput - Error on component %s omx_err(0x%08x)", 
+             m_componentName.c_str(), (int)omx_err);
     }
     omx_err = WaitForCommand(OMX_CommandFlush, m_output_port);
     if(omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "COMXCoreComponent::FlushOutput - %s WaitForCommand omx_err(0x%08x)",
-                  m_componentName.c_str(), (int)omx_err);
+        CLOG(LOGERROR, "COMXCoreComponent::FlushOutput - %s WaitForCommand omx_err(0x%08x)",
+             m_componentName.c_str(), (int)omx_err);
     }
 }
 
 // timeout in milliseconds
-OMX_BUFFERHEADERTYPE *COMXCoreComponent::GetInputBuffer(long timeout /*=200*/)
+OMX_BUFFERHEADERTYPE *COMXCoreComponent::GetInputBuffer(long timeout /*=200*/, bool log_timeout /*=true*/)
 {
     OMX_BUFFERHEADERTYPE *omx_input_buffer = NULL;
 
     if(!m_handle)
         return NULL;
 
-    pthread_mutex_lock(&m_omx_input_mutex);
     struct timespec endtime;
-    clock_gettime(CLOCK_REALTIME, &endtime);
+    clock_gettime(CLOCK_MONOTONIC, &endtime);
     add_timespecs(endtime, timeout);
     while (!m_flush_input)
     {
         if (m_resource_error)
             break;
-        if(!m_omx_input_avaliable.empty())
-        {
-            omx_input_buffer = m_omx_input_avaliable.front();
-            m_omx_input_avaliable.pop();
+        int token = m_omx_input_avaliable.WaitToken();
+        if(m_omx_input_avaliable.Pop(omx_input_buffer))
             break;
-        }
 
-        int retcode = pthread_cond_timedwait(&m_input_buffer_cond, &m_omx_input_mutex, &endtime);
-        if (retcode != 0) {
-            if (timeout != 0)
-                CLog::Log(LOGERROR, "COMXCoreComponent::GetInputBuffer %s wait event timeout\n", m_componentName.c_str());
+        if (!m_omx_input_avaliable.Wait(token, endtime)) {
+            if (timeout != 0 && log_timeout)
+                CLOG(LOGERROR, "COMXCoreComponent::GetInputBuffer %s wait event timeout\n", m_componentName.c_str());
             break;
         }
     }
-    pthread_mutex_unlock(&m_omx_input_mutex);
     return omx_input_buffer;
 }
 
-OMX_BUFFERHEADERTYPE *COMXCoreComponent::GetOutputBuffer(long timeout /*=200*/)
+OMX_BUFFERHEADERTYPE *COMXCoreComponent::GetOutputBuffer(long timeout /*=200*/, bool log_timeout /*=true*/)
 {
     OMX_BUFFERHEADERTYPE *omx_output_buffer = NULL;
     if(!m_handle)
         return NULL;
 
-    pthread_mutex_lock(&m_omx_output_mutex);
     struct timespec endtime;
-    clock_gettime(CLOCK_REALTIME, &endtime);
+    clock_gettime(CLOCK_MONOTONIC, &endtime);
     add_timespecs(endtime, timeout);
     while (!m_flush_output)
     {
         if (m_resource_error)
             break;
-        if(!m_omx_output_available.empty())
-        {
-            omx_output_buffer = m_omx_output_available.front();
-            m_omx_output_available.pop();
+        int token = m_omx_output_available.WaitToken();
+        if(m_omx_output_available.Pop(omx_output_buffer))
             break;
-        }
 
-        int retcode = pthread_cond_timedwait(&m_output_buffer_cond, &m_omx_output_mutex, &endtime);
-        if (retcode != 0) {
-            if (timeout != 0)
-                CLog::Log(LOGERROR, "COMXCoreComponent::GetOutputBuffer %s wait event timeout\n", m_componentName.c_str());
+        if (!m_omx_output_available.Wait(token, endtime)) {
+            if (timeout != 0 && log_timeout)
+                CLOG(LOGERROR, "COMXCoreComponent::GetOutputBuffer %s wait event timeout\n", m_componentName.c_str());
             break;
         }
     }
-    pthread_mutex_unlock(&m_omx_output_mutex);
 
     return omx_output_buffer;
 }
 
 
+bool COMXCoreComponent::WaitForInputSpace(unsigned int bytes, long timeout)
+{
+    if(!m_handle)
+        return false;
+
+    struct timespec endtime;
+    clock_gettime(CLOCK_MONOTONIC, &endtime);
+    add_timespecs(endtime, timeout);
+
+    int token = m_omx_input_avaliable.WaitToken();
+    if(m_omx_input_avaliable.Size() * m_input_buffer_size >= bytes)
+        return true;
+    if(m_flush_input || m_resource_error)
+        return false;
+
+    m_omx_input_avaliable.Wait(token, endtime);
+    return m_omx_input_avaliable.Size() * m_input_buffer_size >= bytes;
+}
+
 OMX_ERRORTYPE COMXCoreComponent::WaitForInputDone(long timeout /*=200*/)
 {
     OMX_ERRORTYPE omx_err = OMX_ErrorNone;
 
-    pthread_mutex_lock(&m_omx_input_mutex);
     struct timespec endtime;
-    clock_gettime(CLOCK_REALTIME, &endtime);
+    clock_gettime(CLOCK_MONOTONIC, &endtime);
     add_timespecs(endtime, timeout);
-    while (m_input_buffer_count != m_omx_input_avaliable.size())
+    while (true)
     {
         if (m_resource_error)
             break;
-        int retcode = pthread_cond_timedwait(&m_input_buffer_cond, &m_omx_input_mutex, &endtime);
-        if (retcode != 0) {
+        int token = m_omx_input_avaliable.WaitToken();
+        if (m_input_buffer_count == m_omx_input_avaliable.Size())
+            break;
+        if (!m_omx_input_avaliable.Wait(token, endtime)) {
             if (timeout != 0)
-                CLog::Log(LOGERROR, "COMXCoreComponent::WaitForInputDone %s wait event timeout\n", m_componentName.c_str());
+                CLOG(LOGERROR, "COMXCoreComponent::WaitForInputDone %s wait event timeout\n", m_componentName.c_str());
             omx_err = OMX_ErrorTimeout;
             break;
         }
     }
-    pthread_mutex_unlock(&m_omx_input_mutex);
     return omx_err;
 }
 
@@ -546,32 +550,33 @@ OMX_ERRORTYPE COMXCoreComponent::WaitForOutputDone(long timeout /*=200*/)
 {
     OMX_ERRORTYPE omx_err = OMX_ErrorNone;
 
-    pthread_mutex_lock(&m_omx_output_mutex);
     struct timespec endtime;
-    clock_gettime(CLOCK_REALTIME, &endtime);
+    clock_gettime(CLOCK_MONOTONIC, &endtime);
     add_timespecs(endtime, timeout);
-    while (m_output_buffer_count != m_omx_output_available.size())
+    while (true)
     {
         if (m_resource_error)
             break;
-        int retcode = pthread_cond_timedwait(&m_output_buffer_cond, &m_omx_output_mutex, &endtime);
-        if (retcode != 0) {
+        int token = m_omx_output_available.WaitToken();
+        if (m_output_buffer_count == m_omx_output_available.Size())
+            break;
+        if (!m_omx_output_available.Wait(token, endtime)) {
             if (timeout != 0)
-                CLog::Log(LOGERROR, "COMXCoreComponent::WaitForOutputDone %s wait event timeout\n", m_componentName.c_str());
+                CLOG(LOGERROR, "COMXCoreComponent::WaitForOutputDone %s wait event timeout\n", m_componentName.c_str());
             omx_err = OMX_ErrorTimeout;
             break;
         }
     }
-    pthread_mutex_unlock(&m_omx_output_mutex);
     return omx_err;
 }
 
 
-OMX_ERRORTYPE COMXCoreComponent::AllocInputBuffers(bool use_buffers /* = false **/)
+OMX_ERRORTYPE COMXCoreComponent::AllocInputBuffers(bool use_buffers /* = false **/, const std::vector<OMX_BUFFERHEADERTYPE*> *shared /* = NULL */)
 {
     OMX_ERRORTYPE omx_err = OMX_ErrorNone;
 
-    m_omx_input_use_buffers = use_buffers; 
+    // shared memory is freed by the port that allocated it
+    m_omx_input_use_buffers = use_buffers && !shared;
 
     if(!m_handle)
         return OMX_ErrorUndefined;
@@ -584,7 +589,9 @@ OMX_ERRORTYPE COMXCoreComponent::AllocInputBuffers(bool use_buffers /* = false *
     if(omx_err != OMX_ErrorNone)
         return omx_err;
 
-    if(GetState() != OMX_StateIdle)
+    // buffers for a port re-enabled while running (PortSettingsChanged) must
+    // not bounce the component through Loaded
+    if(GetState() != OMX_StateIdle && GetState() != OMX_StateExecuting)
     {
         if(GetState() != OMX_StateLoaded)
             SetStateForComponent(OMX_StateLoaded);
@@ -600,16 +607,32 @@ OMX_ERRORTYPE COMXCoreComponent::AllocInputBuffers(bool use_buffers /* = false *
     m_input_buffer_count  = portFormat.nBufferCountActual;
     m_input_buffer_size   = portFormat.nBufferSize;
 
-    CLog::Log(LOGDEBUG, "COMXCoreComponent::AllocInputBuffers component(%s) - port(%d), nBufferCountMin(%u), nBufferCountActual(%u), nBufferSize(%u), nBufferAlignmen(%u)\n",
-              m_componentName.c_str(), GetInputPort(), portFormat.nBufferCountMin,
-              portFormat.nBufferCountActual, portFormat.nBufferSize, portFormat.nBufferAlignment);
+    CLOG(LOGDEBUG, "COMXCoreComponent::AllocInputBuffers component(%s) - port(%d), nBufferCountMin(%u), nBufferCountActual(%u), nBufferSize(%u), nBufferAlignmen(%u)\n",
+         m_componentName.c_str(), GetInputPort(), portFormat.nBufferCountMin,
+         portFormat.nBufferCountActual, portFormat.nBufferSize, portFormat.nBufferAlignment);
+
+    if(shared && shared->size() != portFormat.nBufferCountActual)
+    {
+        CLOG(LOGERROR, "COMXCoreComponent::AllocInputBuffers component(%s) - %u shared buffers for %u\n",
+             m_componentName.c_str(), (unsigned int)shared->size(), portFormat.nBufferCountActual);
+        return OMX_ErrorBadParameter;
+    }
+
+    m_omx_input_avaliable.Reset(portFormat.nBufferCountActual);
 
     for (size_t i = 0; i < portFormat.nBufferCountActual; i++)
     {
         OMX_BUFFERHEADERTYPE *buffer = NULL;
         OMX_U8* data = NULL;
 
-        if(m_omx_input_use_buffers)
+        if(shared)
+        {
+            if((*shared)[i]->nAllocLen < portFormat.nBufferSize)
+                omx_err = OMX_ErrorBadParameter;
+            else
+                omx_err = OMX_UseBuffer(m_handle, &buffer, m_input_port, NULL, portFormat.nBufferSize, (*shared)[i]->pBuffer);
+        }
+        else if(m_omx_input_use_buffers)
         {
             data = (OMX_U8*)_aligned_malloc(portFormat.nBufferSize, m_input_alignment);
             omx_err = OMX_UseBuffer(m_handle, &buffer, m_input_port, NULL, portFormat.nBufferSize, data);
@@ -620,8 +643,8 @@ OMX_ERRORTYPE COMXCoreComponent::AllocInputBuffers(bool use_buffers /* = false *
         }
         if(omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, "COMXCoreComponent::AllocInputBuffers component(%s) - OMX_UseBuffer failed with omx_err(0x%x)\n",
-                      m_componentName.c_str(), omx_err);
+            CLOG(LOGERROR, "COMXCoreComponent::AllocInputBuffers component(%s) - OMX_UseBuffer failed with omx_err(0x%x)\n",
+                 m_componentName.c_str(), omx_err);
 
             if(m_omx_input_use_buffers && data)
                 _aligned_free(data);
@@ -633,13 +656,13 @@ OMX_ERRORTYPE COMXCoreComponent::AllocInputBuffers(bool use_buffers /* = false *
         buffer->nOffset         = 0;
         buffer->pAppPrivate     = (void*)i;  
         m_omx_input_buffers.push_back(buffer);
-        m_omx_input_avaliable.push(buffer);
+        m_omx_input_avaliable.Push(buffer);
     }
 
     omx_err = WaitForCommand(OMX_CommandPortEnable, m_input_port);
     if(omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "COMXCoreComponent::AllocInputBuffers WaitForCommand:OMX_CommandPortEnable failed on %s omx_err(0x%08x)\n", m_componentName.c_str(), omx_err);
+        CLOG(LOGERROR, "COMXCoreComponent::AllocInputBuffers WaitForCommand:OMX_CommandPortEnable failed on %s omx_err(0x%08x)\n", m_componentName.c_str(), omx_err);
         return omx_err;
     }
 
@@ -665,7 +688,9 @@ OMX_ERRORTYPE COMXCoreComponent::AllocOutputBuffers(bool use_buffers /* = false
     if(omx_err != OMX_ErrorNone)
         return omx_err;
 
-    if(GetState() != OMX_StateIdle)
+    // buffers for a port re-enabled while running (PortSettingsChanged) must
+    // not bounce the component through Loaded
+    if(GetState() != OMX_StateIdle && GetState() != OMX_StateExecuting)
     {
         if(GetState() != OMX_StateLoaded)
             SetStateForComponent(OMX_StateLoaded);
@@ -681,9 +706,11 @@ OMX_ERRORTYPE COMXCoreComponent::AllocOutputBuffers(bool use_buffers /* = false
     m_output_buffer_count  = portFormat.nBufferCountActual;
     m_output_buffer_size   = portFormat.nBufferSize;
 
-    CLog::Log(LOGDEBUG, "COMXCoreComponent::AllocOutputBuffers component(%s) - port(%d), nBufferCountMin(%u), nBufferCountActual(%u), nBufferSize(%u) nBufferAlignmen(%u)\n",
-              m_componentName.c_str(), m_output_port, portFormat.nBufferCountMin,
-              portFormat.nBufferCountActual, portFormat.nBufferSize, portFormat.nBufferAlignment);
+    CLOG(LOGDEBUG, "COMXCoreComponent::AllocOutputBuffers component(%s) - port(%d), nBufferCountMin(%u), nBufferCountActual(%u), nBufferSize(%u) nBufferAlignmen(%u)\n",
+         m_componentName.c_str(), m_output_port, portFormat.nBufferCountMin,
+         portFormat.nBufferCountActual, portFormat.nBufferSize, portFormat.nBufferAlignment);
+
+    m_omx_output_available.Reset(portFormat.nBufferCountActual);
 
     for (size_t i = 0; i < portFormat.nBufferCountActual; i++)
     {
@@ -701,8 +728,8 @@ OMX_ERRORTYPE COMXCoreComponent::AllocOutputBuffers(bool use_buffers /* = false
         }
         if(omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, "COMXCoreComponent::AllocOutputBuffers component(%s) - OMX_UseBuffer failed with omx_err(0x%x)\n",
-                      m_componentName.c_str(), omx_err);
+            CLOG(LOGERROR, "COMXCoreComponent::AllocOutputBuffers component(%s) - OMX_UseBuffer failed with omx_err(0x%x)\n",
+                 m_componentName.c_str(), omx_err);
 
             if(m_omx_output_use_buffers && data)
                 _aligned_free(data);
@@ -714,13 +741,13 @@ OMX_ERRORTYPE COMXCoreComponent::AllocOutputBuffers(bool use_buffers /* = false
         buffer->nOffset          = 0;
         buffer->pAppPrivate      = (void*)i;
         m_omx_output_buffers.push_back(buffer);
-        m_omx_output_available.push(buffer);
+        m_omx_output_available.Push(buffer);
     }
 
     omx_err = WaitForCommand(OMX_CommandPortEnable, m_output_port);
     if(omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "COMXCoreComponent::AllocOutputBuffers WaitForCommand:OMX_CommandPortEnable failed on %s omx_err(0x%08x)\n", m_componentName.c_str(), omx_err);
+        CLOG(LOGERROR, "COMXCoreComponent::AllocOutputBuffers WaitForCommand:OMX_CommandPortEnable failed on %s omx_err(0x%08x)\n", m_componentName.c_str(), omx_err);
         return omx_err;
     }
 
@@ -743,8 +770,7 @@ OMX_ERRORTYPE COMXCoreComponent::FreeInputBuffers()
 
     omx_err = DisablePort(m_input_port, false);
 
-    pthread_mutex_lock(&m_omx_input_mutex);
-    pthread_cond_broadcast(&m_input_buffer_cond);
+    m_omx_input_avaliable.WakeAll();
 
     for (size_t i = 0; i < m_omx_input_buffers.size(); i++)
     {
@@ -757,33 +783,27 @@ OMX_ERRORTYPE COMXCoreComponent::FreeInputBuffers()
 
         if(omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, "COMXCoreComponent::FreeInputBuffers error deallocate omx input buffer on component %s omx_err(0x%08x)\n", m_componentName.c_str(), omx_err);
+            CLOG(LOGERROR, "COMXCoreComponent::FreeInputBuffers error deallocate omx input buffer on component %s omx_err(0x%08x)\n", m_componentName.c_str(), omx_err);
         }
     }
-    pthread_mutex_unlock(&m_omx_input_mutex);
 
     omx_err = WaitForCommand(OMX_CommandPortDisable, m_input_port);
     if(omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "COMXCoreComponent::FreeInputBuffers WaitForCommand:OMX_CommandPortDisable failed on %s omx_err(0x%08x)\n", m_componentName.c_str(), omx_err);
+        CLOG(LOGERROR, "COMXCoreComponent::FreeInputBuffers WaitForCommand:OMX_CommandPortDisable failed on %s omx_err(0x%08x)\n", m_componentName.c_str(), omx_err);
     }
 
     WaitForInputDone(1000);
 
-    pthread_mutex_lock(&m_omx_input_mutex);
-    assert(m_omx_input_buffers.size() == m_omx_input_avaliable.size());
+    assert(m_omx_input_buffers.size() == m_omx_input_avaliable.Size());
 
     m_omx_input_buffers.clear();
-
-    while (!m_omx_input_avaliable.empty())
-        m_omx_input_avaliable.pop();
+    m_omx_input_avaliable.Reset(0);
 
     m_input_alignment     = 0;
     m_input_buffer_size   = 0;
     m_input_buffer_count  = 0;
 
-    pthread_mutex_unlock(&m_omx_input_mutex);
-
     return omx_err;
 }
 
@@ -801,8 +821,7 @@ OMX_ERRORTYPE COMXCoreComponent::FreeOutputBuffers()
 
     omx_err = DisablePort(m_output_port, false);
 
-    pthread_mutex_lock(&m_omx_output_mutex);
-    pthread_cond_broadcast(&m_output_buffer_cond);
+    m_omx_output_available.WakeAll();
 
     for (size_t i = 0; i < m_omx_output_buffers.size(); i++)
     {
@@ -815,33 +834,27 @@ OMX_ERRORTYPE COMXCoreComponent::FreeOutputBuffers()
 
         if(omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, "COMXCoreComponent::FreeOutputBuffers error deallocate omx output buffer on component %s omx_err(0x%08x)\n", m_componentName.c_str(), omx_err);
+            CLOG(LOGERROR, "COMXCoreComponent::FreeOutputBuffers error deallocate omx output buffer on component %s omx_err(0x%08x)\n", m_componentName.c_str(), omx_err);
         }
     }
-    pthread_mutex_unlock(&m_omx_output_mutex);
 
     omx_err = WaitForCommand(OMX_CommandPortDisable, m_output_port);
     if(omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "COMXCoreComponent::FreeOutputBuffers WaitForCommand:OMX_CommandPortDisable failed on %s omx_err(0x%08x)\n", m_componentName.c_str(), omx_err);
+        CLOG(LOGERROR, "COMXCoreComponent::FreeOutputBuffers WaitForCommand:OMX_CommandPortDisable failed on %s omx_err(0x%08x)\n", m_componentName.c_str(), omx_err);
     }
 
     WaitForOutputDone(1000);
 
-    pthread_mutex_lock(&m_omx_output_mutex);
-    assert(m_omx_output_buffers.size() == m_omx_output_available.size());
+    assert(m_omx_output_buffers.size() == m_omx_output_available.Size());
 
     m_omx_output_buffers.clear();
-
-    while (!m_omx_output_available.empty())
-        m_omx_output_available.pop();
+    m_omx_output_available.Reset(0);
 
     m_output_alignment    = 0;
     m_output_buffer_size  = 0;
     m_output_buffer_count = 0;
 
-    pthread_mutex_unlock(&m_omx_output_mutex);
-
     return omx_err;
 }
 
@@ -885,8 +898,8 @@ OMX_ERRORTYPE COMXCoreComponent::DisableAllPorts()
                 omx_err = OMX_SendCommand(m_handle, OMX_CommandPortDisable, ports.nStartPortNumber+j, NULL);
                 if(omx_err != OMX_ErrorNone)
                 {
-                    CLog::Log(LOGERROR, "COMXCoreComponent::DisableAllPorts - Error disable port %d on component %s omx_err(0x%08x)", 
-                              (int)(ports.nStartPortNumber) + j, m_componentName.c_str(), (int)omx_err);
+                    CLOG(LOGERROR, "COMXCoreComponent::DisableAllPorts - Error disable port %d on component %s omx_err(0x%08x)", 
+                         (int)(ports.nStartPortNumber) + j, m_componentName.c_str(), (int)omx_err);
                 }
                 omx_err = WaitForCommand(OMX_CommandPortDisable, ports.nStartPortNumber+j);
                 if(omx_err != OMX_ErrorNone && omx_err != OMX_ErrorSameState)
@@ -929,8 +942,8 @@ OMX_ERRORTYPE COMXCoreComponent::AddEvent(OMX_EVENTTYPE eEvent, OMX_U32 nData1,
     pthread_mutex_unlock(&m_omx_event_mutex);
 
 #ifdef OMX_DEBUG_EVENTS
-    CLog::Log(LOGDEBUG, "COMXCoreComponent::AddEvent %s add event event.eEvent 0x%08x event.nData1 0x%08x event.nData2 %d\n",
-              m_componentName.c_str(), (int)event.eEvent, (int)event.nData1, (int)event.nData2);
+    CLOG(LOGDEBUG, "COMXCoreComponent::AddEvent %s add event event.eEvent 0x%08x event.nData1 0x%08x event.nData2 %d\n",
+         m_componentName.c_str(), (int)event.eEvent, (int)event.nData1, (int)event.nData2);
 #endif
 
     return OMX_ErrorNone;
@@ -940,8 +953,8 @@ OMX_ERRORTYPE COMXCoreComponent::AddEvent(OMX_EVENTTYPE eEvent, OMX_U32 nData1,
 OMX_ERRORTYPE COMXCoreComponent::WaitForEvent(OMX_EVENTTYPE eventType, long timeout)
 {
 #ifdef OMX_DEBUG_EVENTS
-    CLog::Log(LOGDEBUG, "COMXCoreComponent::WaitForEvent %s wait event 0x%08x\n",
-              m_componentName.c_str(), (int)eventType);
+    CLOG(LOGDEBUG, "COMXCoreComponent::WaitForEvent %s wait event 0x%08x\n",
+         m_componentName.c_str(), (int)eventType);
 #endif
 
     pthread_mutex_lock(&m_omx_event_mutex);
@@ -955,16 +968,16 @@ OMX_ERRORTYPE COMXCoreComponent::WaitForEvent(OMX_EVENTTYPE eventType, long time
             omx_event event = *it;
 
 #ifdef OMX_DEBUG_EVENTS
-            CLog::Log(LOGDEBUG, "COMXCoreComponent::WaitForEvent %s inlist event event.eEvent 0x%08x event.nData1 0x%08x event.nData2 %d\n",
-                      m_componentName.c_str(), (int)event.eEvent, (int)event.nData1, (int)event.nData2);
+            CLOG(LOGDEBUG, "COMXCoreComponent::WaitForEvent %s inlist event event.eEvent 0x%08x event.nData1 0x%08x event.nData2 %d\n",
+                 m_componentName.c_str(), (int)event.eEvent, (int)event.nData1, (int)event.nData2);
 #endif
 
 
             if(event.eEvent == OMX_EventError && event.nData1 == (OMX_U32)OMX_ErrorSameState && event.nData2 == 1)
             {
 #ifdef OMX_DEBUG_EVENTS
-                CLog::Log(LOGDEBUG, "COMXCoreComponent::WaitForEvent %s remove event event.eEvent 0x%08x event.nData1 0x%08x event.nData2 %d\n",
-                          m_componentName.c_str(), (int)event.eEvent, (int)event.nData1, (int)event.nData2);
+                CLOG(LOGDEBUG, "COMXCoreComponent::WaitForEvent %s remove event event.eEvent 0x%08x event.nData1 0x%08x event.nData2 %d\n",
+                     m_componentName.c_str(), (int)event.eEvent, (int)event.nData1, (int)event.nData2);
 #endif
                 m_omx_events.erase(it);
                 pthread_mutex_unlock(&m_omx_event_mutex);
@@ -979,8 +992,8 @@ OMX_ERRORTYPE COMXCoreComponent::WaitForEvent(OMX_EVENTTYPE eventType, long time
             else if(event.eEvent == eventType) 
             {
 #ifdef OMX_DEBUG_EVENTS
-                CLog::Log(LOGDEBUG, "COMXCoreComponent::WaitForEvent %s remove event event.eEvent 0x%08x event.nData1 0x%08x event.nData2 %d\n",
-                          m_componentName.c_str(), (int)event.eEvent, (int)event.nData1, (int)event.nData2);
+                CLOG(LOGDEBUG, "COMXCoreComponent::WaitForEvent %s remove event event.eEvent 0x%08x event.nData1 0x%08x event.nData2 %d\n",
+                     m_componentName.c_str(), (int)event.eEvent, (int)event.nData1, (int)event.nData2);
 #endif
 
                 m_omx_events.erase(it);
@@ -995,8 +1008,8 @@ OMX_ERRORTYPE COMXCoreComponent::WaitForEvent(OMX_EVENTTYPE eventType, long time
         if (retcode != 0) 
         {
             if (timeout > 0)
-                CLog::Log(LOGERROR, "COMXCoreComponent::WaitForEvent %s wait event 0x%08x timeout %ld\n",
-                          m_componentName.c_str(), (int)eventType, timeout);
+                CLOG(LOGERROR, "COMXCoreComponent::WaitForEvent %s wait event 0x%08x timeout %ld\n",
+                     m_componentName.c_str(), (int)eventType, timeout);
             pthread_mutex_unlock(&m_omx_event_mutex);
             return OMX_ErrorTimeout;
         }
@@ -1009,8 +1022,8 @@ OMX_ERRORTYPE COMXCoreComponent::WaitForEvent(OMX_EVENTTYPE eventType, long time
 OMX_ERRORTYPE COMXCoreComponent::WaitForCommand(OMX_U32 command, OMX_U32 nData2, long timeout)
 {
 #ifdef OMX_DEBUG_EVENTS
-    CLog::Log(LOGDEBUG, "COMXCoreComponent::WaitForCommand %s wait event.eEvent 0x%08x event.command 0x%08x event.nData2 %d\n", 
-              m_componentName.c_str(), (int)OMX_EventCmdComplete, (int)command, (int)nData2);
+    CLOG(LOGDEBUG, "COMXCoreComponent::WaitForCommand %s wait event.eEvent 0x%08x event.command 0x%08x event.nData2 %d\n", 
+         m_componentName.c_str(), (int)OMX_EventCmdComplete, (int)command, (int)nData2);
 #endif
 
     pthread_mutex_lock(&m_omx_event_mutex);
@@ -1024,14 +1037,14 @@ OMX_ERRORTYPE COMXCoreComponent::WaitForCommand(OMX_U32 command, OMX_U32 nData2,
             omx_event event = *it;
 
 #ifdef OMX_DEBUG_EVENTS
-            CLog::Log(LOGDEBUG, "COMXCoreComponent::WaitForCommand %s inlist event event.eEvent 0x%08x event.nData1 0x%08x event.nData2 %d\n",
-                      m_componentName.c_str(), (int)event.eEvent, (int)event.nData1, (int)event.nData2);
+            CLOG(LOGDEBUG, "COMXCoreComponent::WaitForCommand %s inlist event event.eEvent 0x%08x event.nData1 0x%08x event.nData2 %d\n",
+                 m_componentName.c_str(), (int)event.eEvent, (int)event.nData1, (int)event.nData2);
 #endif
             if(event.eEvent == OMX_EventError && event.nData1 == (OMX_U32)OMX_ErrorSameState && event.nData2 == 1)
             {
 #ifdef OMX_DEBUG_EVENTS
-                CLog::Log(LOGDEBUG, "COMXCoreComponent::WaitForCommand %s remove event event.eEvent 0x%08x event.nData1 0x%08x event.nData2 %d\n",
-                          m_componentName.c_str(), (int)event.eEvent, (int)event.nData1, (int)event.nData2);
+                CLOG(LOGDEBUG, "COMXCoreComponent::WaitForCommand %s remove event event.eEvent 0x%08x event.nData1 0x%08x event.nData2 %d\n",
+                     m_componentName.c_str(), (int)event.eEvent, (int)event.nData1, (int)event.nData2);
 #endif
 
                 m_omx_events.erase(it);
@@ -1048,8 +1061,8 @@ OMX_ERRORTYPE COMXCoreComponent::WaitForCommand(OMX_U32 command, OMX_U32 nData2,
             {
 
 #ifdef OMX_DEBUG_EVENTS
-                CLog::Log(LOGDEBUG, "COMXCoreComponent::WaitForCommand %s remove event event.eEvent 0x%08x event.nData1 0x%08x event.nData2 %d\n",
-                          m_componentName.c_str(), (int)event.eEvent, (int)event.nData1, (int)event.nData2);
+                CLOG(LOGDEBUG, "COMXCoreComponent::WaitForCommand %s remove event event.eEvent 0x%08x event.nData1 0x%08x event.nData2 %d\n",
+                     m_componentName.c_str(), (int)event.eEvent, (int)event.nData1, (int)event.nData2);
 #endif
 
                 m_omx_events.erase(it);
@@ -1062,8 +1075,8 @@ OMX_ERRORTYPE COMXCoreComponent::WaitForCommand(OMX_U32 command, OMX_U32 nData2,
             break;
         int retcode = pthread_cond_timedwait(&m_omx_event_cond, &m_omx_event_mutex, &endtime);
         if (retcode != 0) {
-            CLog::Log(LOGERROR, "COMXCoreComponent::WaitForCommand %s wait timeout event.eEvent 0x%08x event.command 0x%08x event.nData2 %d\n", 
-                      m_componentName.c_str(), (int)OMX_EventCmdComplete, (int)command, (int)nData2);
+            CLOG(LOGERROR, "COMXCoreComponent::WaitForCommand %s wait timeout event.eEvent 0x%08x event.command 0x%08x event.nData2 %d\n", 
+                 m_componentName.c_str(), (int)OMX_EventCmdComplete, (int)command, (int)nData2);
       
             pthread_mutex_unlock(&m_omx_event_mutex);
             return OMX_ErrorTimeout;
@@ -1089,14 +1102,14 @@ OMX_ERRORTYPE COMXCoreComponent::SetStateForComponent(OMX_STATETYPE state)
     {
         if(omx_err == OMX_ErrorSameState)
         {
-            CLog::Log(LOGERROR, "COMXCoreComponent::SetStateForComponent - %s same state\n",
-                      m_componentName.c_str());
+            CLOG(LOGERROR, "COMXCoreComponent::SetStateForComponent - %s same state\n",
+                 m_componentName.c_str());
             omx_err = OMX_ErrorNone;
         }
         else
         {
-            CLog::Log(LOGERROR, "COMXCoreComponent::SetStateForComponent - %s failed with omx_err(0x%x)\n", 
-                      m_componentName.c_str(), omx_err);
+            CLOG(LOGERROR, "COMXCoreComponent::SetStateForComponent - %s failed with omx_err(0x%x)\n", 
+                 m_componentName.c_str(), omx_err);
         }
     }
     else 
@@ -1104,8 +1117,8 @@ OMX_ERRORTYPE COMXCoreComponent::SetStateForComponent(OMX_STATETYPE state)
         omx_err = WaitForCommand(OMX_CommandStateSet, state);
         if (omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, "COMXCoreComponent::WaitForCommand - %s failed with omx_err(0x%x)\n",
-                      m_componentName.c_str(), omx_err);
+            CLOG(LOGERROR, "COMXCoreComponent::WaitForCommand - %s failed with omx_err(0x%x)\n",
+                 m_componentName.c_str(), omx_err);
         }
     }
     return omx_err;
@@ -1121,8 +1134,8 @@ OMX_STATETYPE COMXCoreComponent::GetState() const
     OMX_ERRORTYPE omx_err = OMX_GetState(m_handle, &state);
     if (omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "COMXCoreComponent::GetState - %s failed with omx_err(0x%x)\n",
-                  m_componentName.c_str(), omx_err);
+        CLOG(LOGERROR, "COMXCoreComponent::GetState - %s failed with omx_err(0x%x)\n",
+             m_componentName.c_str(), omx_err);
     }
     return state;
 }
@@ -1137,8 +1150,8 @@ OMX_ERRORTYPE COMXCoreComponent::SetParameter(OMX_INDEXTYPE paramIndex, OMX_PTR
     omx_err = OMX_SetParameter(m_handle, paramIndex, paramStruct);
     if(omx_err != OMX_ErrorNone) 
     {
-        CLog::Log(LOGERROR, "COMXCoreComponent::SetParameter - %s failed with omx_err(0x%x)\n", 
-                  m_componentName.c_str(), omx_err);
+        CLOG(LOGERROR, "COMXCoreComponent::SetParameter - %s failed with omx_err(0x%x)\n", 
+             m_componentName.c_str(), omx_err);
     }
     return omx_err;
 }
@@ -1153,8 +1166,8 @@ OMX_ERRORTYPE COMXCoreComponent::GetParameter(OMX_INDEXTYPE paramIndex, OMX_PTR
     omx_err = OMX_GetParameter(m_handle, paramIndex, paramStruct);
     if(omx_err != OMX_ErrorNone) 
     {
-        CLog::Log(LOGERROR, "COMXCoreComponent::GetParameter - %s failed with omx_err(0x%x)\n", 
-                  m_componentName.c_str(), omx_err);
+        CLOG(LOGERROR, "COMXCoreComponent::GetParameter - %s failed with omx_err(0x%x)\n", 
+             m_componentName.c_str(), omx_err);
     }
     return omx_err;
 }
@@ -1169,8 +1182,8 @@ OMX_ERRORTYPE COMXCoreComponent::SetConfig(OMX_INDEXTYPE configIndex, OMX_PTR co
     omx_err = OMX_SetConfig(m_handle, configIndex, configStruct);
     if(omx_err != OMX_ErrorNone) 
     {
-        CLog::Log(LOGERROR, "COMXCoreComponent::SetConfig - %s failed with omx_err(0x%x)\n", 
-                  m_componentName.c_str(), omx_err);
+        CLOG(LOGERROR, "COMXCoreComponent::SetConfig - %s failed with omx_err(0x%x)\n", 
+             m_componentName.c_str(), omx_err);
     }
     return omx_err;
 }
@@ -1185,8 +1198,8 @@ OMX_ERRORTYPE COMXCoreComponent::GetConfig(OMX_INDEXTYPE configIndex, OMX_PTR co
     omx_err = OMX_GetConfig(m_handle, configIndex, configStruct);
     if(omx_err != OMX_ErrorNone) 
     {
-        CLog::Log(LOGERROR, "COMXCoreComponent::GetConfig - %s failed with omx_err(0x%x)\n", 
-                  m_componentName.c_str(), omx_err);
+        CLOG(LOGERROR, "COMXCoreComponent::GetConfig - %s failed with omx_err(0x%x)\n", 
+             m_componentName.c_str(), omx_err);
     }
     return omx_err;
 }
@@ -1201,8 +1214,8 @@ OMX_ERRORTYPE COMXCoreComponent::SendCommand(OMX_COMMANDTYPE cmd, OMX_U32 cmdPar
     omx_err = OMX_SendCommand(m_handle, cmd, cmdParam, cmdParamData);
     if(omx_err != OMX_ErrorNone) 
     {
-        CLog::Log(LOGERROR, "COMXCoreComponent::SendCommand - %s failed with omx_err(0x%x)\n", 
-                  m_componentName.c_str(), omx_err);
+        CLOG(LOGERROR, "COMXCoreComponent::SendCommand - %s failed with omx_err(0x%x)\n", 
+             m_componentName.c_str(), omx_err);
     }
     return omx_err;
 }
@@ -1221,8 +1234,8 @@ OMX_ERRORTYPE COMXCoreComponent::EnablePort(unsigned int port,  bool wait)
     omx_err = OMX_GetParameter(m_handle, OMX_IndexParamPortDefinition, &portFormat);
     if(omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "COMXCoreComponent::EnablePort - Error get port %d status on component %s omx_err(0x%08x)", 
-                  port, m_componentName.c_str(), (int)omx_err);
+        CLOG(LOGERROR, "COMXCoreComponent::EnablePort - Error get port %d status on component %s omx_err(0x%08x)", 
+             port, m_componentName.c_str(), (int)omx_err);
     }
 
     if(portFormat.bEnabled == OMX_FALSE)
@@ -1230,8 +1243,8 @@ OMX_ERRORTYPE COMXCoreComponent::EnablePort(unsigned int port,  bool wait)
         omx_err = OMX_SendCommand(m_handle, OMX_CommandPortEnable, port, NULL);
         if(omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, "COMXCoreComponent::EnablePort - Error enable port %d on component %s omx_err(0x%08x)", 
-                      port, m_componentName.c_str(), (int)omx_err);
+            CLOG(LOGERROR, "COMXCoreComponent::EnablePort - Error enable port %d on component %s omx_err(0x%08x)", 
+                 port, m_componentName.c_str(), (int)omx_err);
             return omx_err;
         }
         else
@@ -1257,8 +1270,8 @@ OMX_ERRORTYPE COMXCoreComponent::DisablePort(unsigned int port, bool wait)
     omx_err = OMX_GetParameter(m_handle, OMX_IndexParamPortDefinition, &portFormat);
     if(omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "COMXCoreComponent::DisablePort - Error get port %d status on component %s omx_err(0x%08x)", 
-                  port, m_componentName.c_str(), (int)omx_err);
+        CLOG(LOGERROR, "COMXCoreComponent::DisablePort - Error get port %d status on component %s omx_err(0x%08x)", 
+             port, m_componentName.c_str(), (int)omx_err);
     }
 
     if(portFormat.bEnabled == OMX_TRUE)
@@ -1266,8 +1279,8 @@ OMX_ERRORTYPE COMXCoreComponent::DisablePort(unsigned int port, bool wait)
         omx_err = OMX_SendCommand(m_handle, OMX_CommandPortDisable, port, NULL);
         if(omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, "COMXCoreComponent::DIsablePort - Error disable port %d on component %s omx_err(0x%08x)", 
-                      port, m_componentName.c_str(), (int)omx_err);
+            CLOG(LOGERROR, "COMXCoreComponent::DIsablePort - Error disable port %d on component %s omx_err(0x%08x)", 
+                 port, m_componentName.c_str(), (int)omx_err);
             return omx_err;
         }
         else
@@ -1309,8 +1322,8 @@ OMX_ERRORTYPE COMXCoreComponent::UseEGLImage(OMX_BUFFERHEADERTYPE** ppBufferHdr,
         omx_err = EnablePort(m_output_port, false);
         if(omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, "%s::%s - %s EnablePort failed with omx_err(0x%x)", CLASSNAME, __func__,
-                      m_componentName.c_str(), omx_err);
+            CLOG(LOGERROR, "%s::%s - %s EnablePort failed with omx_err(0x%x)", CLASSNAME, __func__,
+                 m_componentName.c_str(), omx_err);
             return omx_err;
         }
 
@@ -1320,22 +1333,24 @@ OMX_ERRORTYPE COMXCoreComponent::UseEGLImage(OMX_BUFFERHEADERTYPE** ppBufferHdr,
 
         if (portFormat.nBufferCountActual != 1)
         {
-            CLog::Log(LOGERROR, "%s::%s - %s nBufferCountActual unexpected %d", CLASSNAME, __func__,
-                      m_componentName.c_str(), portFormat.nBufferCountActual);
+            CLOG(LOGERROR, "%s::%s - %s nBufferCountActual unexpected %d", CLASSNAME, __func__,
+                 m_componentName.c_str(), portFormat.nBufferCountActual);
             return omx_err;
         }
 
-        CLog::Log(LOGDEBUG, "%s::%s component(%s) - port(%d), nBufferCountMin(%u), nBufferCountActual(%u), nBufferSize(%u) nBufferAlignmen(%u)\n",
-                  CLASSNAME, __func__, m_componentName.c_str(), m_output_port, portFormat.nBufferCountMin,
-                  portFormat.nBufferCountActual, portFormat.nBufferSize, portFormat.nBufferAlignment);
+        CLOG(LOGDEBUG, "%s::%s component(%s) - port(%d), nBufferCountMin(%u), nBufferCountActual(%u), nBufferSize(%u) nBufferAlignmen(%u)\n",
+             CLASSNAME, __func__, m_componentName.c_str(), m_output_port, portFormat.nBufferCountMin,
+             portFormat.nBufferCountActual, portFormat.nBufferSize, portFormat.nBufferAlignment);
+
+        m_omx_output_available.Reset(portFormat.nBufferCountActual);
 
         for (size_t i = 0; i < portFormat.nBufferCountActual; i++)
         {
             omx_err = OMX_UseEGLImage(m_handle, ppBufferHdr, nPortIndex, pAppPrivate, eglImage);
             if(omx_err != OMX_ErrorNone)
             {
-                CLog::Log(LOGERROR, "%s::%s - %s failed with omx_err(0x%x)\n",
-                          CLASSNAME, __func__, m_componentName.c_str(), omx_err);
+                CLOG(LOGERROR, "%s::%s - %s failed with omx_err(0x%x)\n",
+                     CLASSNAME, __func__, m_componentName.c_str(), omx_err);
                 return omx_err;
             }
 
@@ -1345,14 +1360,14 @@ OMX_ERRORTYPE COMXCoreComponent::UseEGLImage(OMX_BUFFERHEADERTYPE** ppBufferHdr,
             buffer->nOffset          = 0;
             buffer->pAppPrivate      = (void*)i;
             m_omx_output_buffers.push_back(buffer);
-            m_omx_output_available.push(buffer);
+            m_omx_output_available.Push(buffer);
         }
 
         omx_err = WaitForCommand(OMX_CommandPortEnable, m_output_port);
         if(omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, " %s::%s - %s EnablePort failed with omx_err(0x%x)\n",
-                      CLASSNAME, __func__, m_componentName.c_str(), omx_err);
+            CLOG(LOGERROR, " %s::%s - %s EnablePort failed with omx_err(0x%x)\n",
+                 CLASSNAME, __func__, m_componentName.c_str(), omx_err);
             return omx_err;
         }
         m_flush_output = false;
@@ -1365,21 +1380,24 @@ OMX_ERRORTYPE COMXCoreComponent::UseEGLImage(OMX_BUFFERHEADERTYPE** ppBufferHdr,
         omx_err = OMX_UseEGLImage(m_handle, ppBufferHdr, nPortIndex, pAppPrivate, eglImage);
         if(omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, "%s::%s - %s failed with omx_err(0x%x)\n",
-                      CLASSNAME, __func__, m_componentName.c_str(), omx_err);
+            CLOG(LOGERROR, "%s::%s - %s failed with omx_err(0x%x)\n",
+                 CLASSNAME, __func__, m_componentName.c_str(), omx_err);
             return omx_err;
         }
         return omx_err;
     }
 }
 
-void COMXCoreComponent::SetPrivateCallBack(enc_done_cbk cb)
+void COMXCoreComponent::SetPrivateCallBack(enc_done_cbk cb, void *opaque, int output)
 {
-    m_enc_private_cb = cb;
+    m_enc_private_cb     = cb;
+    m_enc_private_opaque = opaque;
+    m_enc_private_output = output;
 }
 
 
-bool COMXCoreComponent::Initialize( const std::string &component_name, OMX_INDEXTYPE index, OMX_CALLBACKTYPE *callbacks)
+bool COMXCoreComponent::Initialize( const std::string &component_name, OMX_INDEXTYPE index, OMX_CALLBACKTYPE *callbacks,
+                                    OMXCoreBackend backend)
 {
     OMX_ERRORTYPE omx_err;
 
@@ -1424,11 +1442,11 @@ bool COMXCoreComponent::Initialize( const std::string &component_name, OMX_INDEX
     // Get video component handle setting up callbacks, component is in loaded state on return.
     if(!m_handle)
     {
-        omx_err = OMX_GetHandle(&m_handle, (char*)component_name.c_str(), this, &m_callbacks);
+        omx_err = COMXCore::GetHandle(&m_handle, component_name, this, &m_callbacks, backend);
         if (!m_handle || omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, "COMXCoreComponent::Initialize - could not get component handle for %s omx_err(0x%08x)\n",
-                      component_name.c_str(), (int)omx_err);
+            CLOG(LOGERROR, "COMXCoreComponent::Initialize - could not get component handle for %s omx_err(0x%08x)\n",
+                 component_name.c_str(), (int)omx_err);
             Deinitialize();
             return false;
         }
@@ -1440,15 +1458,15 @@ bool COMXCoreComponent::Initialize( const std::string &component_name, OMX_INDEX
     omx_err = OMX_GetParameter(m_handle, index, &port_param);
     if (omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "COMXCoreComponent::Initialize - could not get port_param for component %s omx_err(0x%08x)\n", 
-                  component_name.c_str(), (int)omx_err);
+        CLOG(LOGERROR, "COMXCoreComponent::Initialize - could not get port_param for component %s omx_err(0x%08x)\n", 
+             component_name.c_str(), (int)omx_err);
     }
 
     omx_err = DisableAllPorts();
     if (omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "COMXCoreComponent::Initialize - error disable ports on component %s omx_err(0x%08x)\n",
-                  component_name.c_str(), (int)omx_err);
+        CLOG(LOGERROR, "COMXCoreComponent::Initialize - error disable ports on component %s omx_err(0x%08x)\n",
+             component_name.c_str(), (int)omx_err);
     }
 
     m_input_port  = port_param.nStartPortNumber;
@@ -1463,8 +1481,8 @@ bool COMXCoreComponent::Initialize( const std::string &component_name, OMX_INDEX
     if (m_output_port > port_param.nStartPortNumber+port_param.nPorts-1)
         m_output_port = port_param.nStartPortNumber+port_param.nPorts-1;
 
-    CLog::Log(LOGDEBUG, "COMXCoreComponent::Initialize %s input port %d output port %d m_handle %p\n",
-              m_componentName.c_str(), m_input_port, m_output_port, m_handle);
+    CLOG(LOGDEBUG, "COMXCoreComponent::Initialize %s input port %d output port %d m_handle %p\n",
+         m_componentName.c_str(), m_input_port, m_output_port, m_handle);
 
     m_exit = false;
     m_flush_input   = false;
@@ -1498,13 +1516,13 @@ bool COMXCoreComponent::Deinitialize()
 
         TransitionToStateLoaded();
 
-        CLog::Log(LOGDEBUG, "COMXCoreComponent::Deinitialize : %s handle %p\n",
-                  m_componentName.c_str(), m_handle);
-        omx_err = OMX_FreeHandle(m_handle);
+        CLOG(LOGDEBUG, "COMXCoreComponent::Deinitialize : %s handle %p\n",
+             m_componentName.c_str(), m_handle);
+        omx_err = COMXCore::FreeHandle(m_handle);
         if (omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, "COMXCoreComponent::Deinitialize - failed to free handle for component %s omx_err(0x%08x)",
-                      m_componentName.c_str(), omx_err);
+            CLOG(LOGERROR, "COMXCoreComponent::Deinitialize - failed to free handle for component %s omx_err(0x%08x)",
+                 m_componentName.c_str(), omx_err);
         }
         m_handle = NULL;
 
@@ -1566,17 +1584,25 @@ OMX_ERRORTYPE COMXCoreComponent::DecoderEmptyBufferDone(OMX_HANDLETYPE hComponen
         return OMX_ErrorNone;
 
 #if defined(OMX_DEBUG_EVENTHANDLER)
-    CLog::Log(LOGDEBUG, "COMXCoreComponent::DecoderEmptyBufferDone component(%s) %p %d/%d\n", m_componentName.c_str(), pBuffer, m_omx_input_avaliable.size(), m_input_buffer_count);
+    CLOG(LOGDEBUG, "COMXCoreComponent::DecoderEmptyBufferDone component(%s) %p %d/%d\n", m_componentName.c_str(), pBuffer, m_omx_input_avaliable.Size(), m_input_buffer_count);
 #endif
-    pthread_mutex_lock(&m_omx_input_mutex);
-    m_omx_input_avaliable.push(pBuffer);
+    // wakes the consumer only if it sleeps on an empty ring
+    if(!m_omx_input_avaliable.Push(pBuffer))
+        CLOG(LOGERROR, "COMXCoreComponent::DecoderEmptyBufferDone component(%s) %p returned twice\n", m_componentName.c_str(), pBuffer);
 
-    // this allows (all) blocked tasks to be awoken
-    pthread_cond_broadcast(&m_input_buffer_cond);
+    return OMX_ErrorNone;
+}
 
-    pthread_mutex_unlock(&m_omx_input_mutex);
+void COMXCoreComponent::ReturnInputBuffer(OMX_BUFFERHEADERTYPE *pBuffer)
+{
+    if(!m_exit && !m_omx_input_avaliable.Return(pBuffer))
+        CLOG(LOGERROR, "COMXCoreComponent::ReturnInputBuffer component(%s) %p returned twice\n", m_componentName.c_str(), pBuffer);
+}
 
-    return OMX_ErrorNone;
+void COMXCoreComponent::ReturnOutputBuffer(OMX_BUFFERHEADERTYPE *pBuffer)
+{
+    if(!m_exit && !m_omx_output_available.Return(pBuffer))
+        CLOG(LOGERROR, "COMXCoreComponent::ReturnOutputBuffer component(%s) %p returned twice\n", m_componentName.c_str(), pBuffer);
 }
 
 OMX_ERRORTYPE COMXCoreComponent::DecoderFillBufferDone(OMX_HANDLETYPE hComponent, OMX_BUFFERHEADERTYPE* pBuffer)
@@ -1586,23 +1612,20 @@ OMX_ERRORTYPE COMXCoreComponent::DecoderFillBufferDone(OMX_HANDLETYPE hComponent
 
     if (0 == strcmp(m_componentName.c_str(),"OMX.broadcom.video_encode"))
     {
-        if (NULL != m_enc_private_cb)
+        // empty buffers come back on flush/port disable, nothing to mux
+        if (NULL != m_enc_private_cb && pBuffer->nFilledLen > 0)
         {
-            m_enc_private_cb(pBuffer);
+            m_enc_private_cb(pBuffer, m_enc_private_opaque, m_enc_private_output);
         }
     
     }
   
 #if defined(OMX_DEBUG_EVENTHANDLER)
-    CLog::Log(LOGDEBUG, "COMXCoreComponent::DecoderFillBufferDone component(%s) %p %d/%d\n", m_componentName.c_str(), pBuffer, m_omx_output_available.size(), m_output_buffer_count);
+    CLOG(LOGDEBUG, "COMXCoreComponent::DecoderFillBufferDone component(%s) %p %d/%d\n", m_componentName.c_str(), pBuffer, m_omx_output_available.Size(), m_output_buffer_count);
 #endif
-    pthread_mutex_lock(&m_omx_output_mutex);
-    m_omx_output_available.push(pBuffer);
-
-    // this allows (all) blocked tasks to be awoken
-    pthread_cond_broadcast(&m_output_buffer_cond);
-
-    pthread_mutex_unlock(&m_omx_output_mutex);
+    // wakes the consumer only if it sleeps on an empty ring
+    if(!m_omx_output_available.Push(pBuffer))
+        CLOG(LOGERROR, "COMXCoreComponent::DecoderFillBufferDone component(%s) %p returned twice\n", m_componentName.c_str(), pBuffer);
 
     return OMX_ErrorNone;
 }
@@ -1618,17 +1641,17 @@ OMX_ERRORTYPE COMXCoreComponent::DecoderEventHandler(
     OMX_PTR pEventData)
 {
 #ifdef OMX_DEBUG_EVENTS
-    CLog::Log(LOGDEBUG,
-              "COMXCoreComponent::%s - %s eEvent(0x%x), nData1(0x%x), nData2(0x%x), pEventData(0x%p)\n",
-              __func__, GetName().c_str(), eEvent, nData1, nData2, pEventData);
+    CLOG(LOGDEBUG,
+         "COMXCoreComponent::%s - %s eEvent(0x%x), nData1(0x%x), nData2(0x%x), pEventData(0x%p)\n",
+         __func__, GetName().c_str(), eEvent, nData1, nData2, pEventData);
 #endif
 
     // if the error is expected, then we can skip it
     if (eEvent == OMX_EventError && (OMX_S32)nData1 == m_ignore_error)
     {
-        CLog::Log(LOGDEBUG,
-                  "COMXCoreComponent::%s - %s Ignoring expected event: eEvent(0x%x), nData1(0x%x), nData2(0x%x), pEventData(0x%p)\n",
-                  __func__, GetName().c_str(), eEvent, nData1, nData2, pEventData);
+        CLOG(LOGDEBUG,
+             "COMXCoreComponent::%s - %s Ignoring expected event: eEvent(0x%x), nData1(0x%x), nData2(0x%x), pEventData(0x%p)\n",
+             __func__, GetName().c_str(), eEvent, nData1, nData2, pEventData);
         m_ignore_error = OMX_ErrorNone;
         return OMX_ErrorNone;
     }
@@ -1645,67 +1668,67 @@ OMX_ERRORTYPE COMXCoreComponent::DecoderEventHandler(
             {
             case OMX_StateInvalid:
 #if defined(OMX_DEBUG_EVENTHANDLER)
-                CLog::Log(LOGDEBUG, "%s::%s %s - OMX_StateInvalid\n", CLASSNAME, __func__, GetName().c_str());
+                CLOG(LOGDEBUG, "%s::%s %s - OMX_StateInvalid\n", CLASSNAME, __func__, GetName().c_str());
 #endif
                 break;
             case OMX_StateLoaded:
 #if defined(OMX_DEBUG_EVENTHANDLER)
-                CLog::Log(LOGDEBUG, "%s::%s %s - OMX_StateLoaded\n", CLASSNAME, __func__, GetName().c_str());
+                CLOG(LOGDEBUG, "%s::%s %s - OMX_StateLoaded\n", CLASSNAME, __func__, GetName().c_str());
 #endif
                 break;
             case OMX_StateIdle:
 #if defined(OMX_DEBUG_EVENTHANDLER)
-                CLog::Log(LOGDEBUG, "%s::%s %s - OMX_StateIdle\n", CLASSNAME, __func__, GetName().c_str());
+                CLOG(LOGDEBUG, "%s::%s %s - OMX_StateIdle\n", CLASSNAME, __func__, GetName().c_str());
 #endif
                 break;
             case OMX_StateExecuting:
 #if defined(OMX_DEBUG_EVENTHANDLER)
-                CLog::Log(LOGDEBUG, "%s::%s %s - OMX_StateExecuting\n", CLASSNAME, __func__, GetName().c_str());
+                CLOG(LOGDEBUG, "%s::%s %s - OMX_StateExecuting\n", CLASSNAME, __func__, GetName().c_str());
 #endif
                 break;
             case OMX_StatePause:
 #if defined(OMX_DEBUG_EVENTHANDLER)
-                CLog::Log(LOGDEBUG, "%s::%s %s - OMX_StatePause\n", CLASSNAME, __func__, GetName().c_str());
+                CLOG(LOGDEBUG, "%s::%s %s - OMX_StatePause\n", CLASSNAME, __func__, GetName().c_str());
 #endif
                 break;
             case OMX_StateWaitForResources:
 #if defined(OMX_DEBUG_EVENTHANDLER)
-                CLog::Log(LOGDEBUG, "%s::%s %s - OMX_StateWaitForResources\n", CLASSNAME, __func__, GetName().c_str());
+                CLOG(LOGDEBUG, "%s::%s %s - OMX_StateWaitForResources\n", CLASSNAME, __func__, GetName().c_str());
 #endif
                 break;
             default:
 #if defined(OMX_DEBUG_EVENTHANDLER)
-                CLog::Log(LOGDEBUG,
-                          "%s::%s %s - Unknown OMX_Statexxxxx, state(%d)\n", CLASSNAME, __func__, GetName().c_str(), (int)nData2);
+                CLOG(LOGDEBUG,
+                     "%s::%s %s - Unknown OMX_Statexxxxx, state(%d)\n", CLASSNAME, __func__, GetName().c_str(), (int)nData2);
 #endif
                 break;
             }
             break;
         case OMX_CommandFlush:
 #if defined(OMX_DEBUG_EVENTHANDLER)
-            CLog::Log(LOGDEBUG, "%s::%s %s - OMX_CommandFlush, port %d\n", CLASSNAME, __func__, GetName().c_str(), (int)nData2);
+            CLOG(LOGDEBUG, "%s::%s %s - OMX_CommandFlush, port %d\n", CLASSNAME, __func__, GetName().c_str(), (int)nData2);
 #endif
             break;
         case OMX_CommandPortDisable:
 #if defined(OMX_DEBUG_EVENTHANDLER)
-            CLog::Log(LOGDEBUG, "%s::%s %s - OMX_CommandPortDisable, nData1(0x%x), port %d\n", CLASSNAME, __func__, GetName().c_str(), nData1, (int)nData2);
+            CLOG(LOGDEBUG, "%s::%s %s - OMX_CommandPortDisable, nData1(0x%x), port %d\n", CLASSNAME, __func__, GetName().c_str(), nData1, (int)nData2);
 #endif
             break;
         case OMX_CommandPortEnable:
 #if defined(OMX_DEBUG_EVENTHANDLER)
-            CLog::Log(LOGDEBUG, "%s::%s %s - OMX_CommandPortEnable, nData1(0x%x), port %d\n", CLASSNAME, __func__, GetName().c_str(), nData1, (int)nData2);
+            CLOG(LOGDEBUG, "%s::%s %s - OMX_CommandPortEnable, nData1(0x%x), port %d\n", CLASSNAME, __func__, GetName().c_str(), nData1, (int)nData2);
 #endif
             break;
 #if defined(OMX_DEBUG_EVENTHANDLER)
         case OMX_CommandMarkBuffer:
-            CLog::Log(LOGDEBUG, "%s::%s %s - OMX_CommandMarkBuffer, nData1(0x%x), port %d\n", CLASSNAME, __func__, GetName().c_str(), nData1, (int)nData2);
+            CLOG(LOGDEBUG, "%s::%s %s - OMX_CommandMarkBuffer, nData1(0x%x), port %d\n", CLASSNAME, __func__, GetName().c_str(), nData1, (int)nData2);
             break;
 #endif
         }
         break;
     case OMX_EventBufferFlag:
 #if defined(OMX_DEBUG_EVENTHANDLER)
-        CLog::Log(LOGDEBUG, "%s::%s %s - OMX_EventBufferFlag(input)\n", CLASSNAME, __func__, GetName().c_str());
+        CLOG(LOGDEBUG, "%s::%s %s - OMX_EventBufferFlag(input)\n", CLASSNAME, __func__, GetName().c_str());
 #endif
         if(nData2 & OMX_BUFFERFLAG_EOS)
         {
@@ -1716,20 +1739,20 @@ OMX_ERRORTYPE COMXCoreComponent::DecoderEventHandler(
         break;
     case OMX_EventPortSettingsChanged:
 #if defined(OMX_DEBUG_EVENTHANDLER)
-        CLog::Log(LOGDEBUG, "%s::%s %s - OMX_EventPortSettingsChanged(output)\n", CLASSNAME, __func__, GetName().c_str());
+        CLOG(LOGDEBUG, "%s::%s %s - OMX_EventPortSettingsChanged(output)\n", CLASSNAME, __func__, GetName().c_str());
 #endif
         break;
     case OMX_EventParamOrConfigChanged:
 #if defined(OMX_DEBUG_EVENTHANDLER)
-        CLog::Log(LOGDEBUG, "%s::%s %s - OMX_EventParamOrConfigChanged(output)\n", CLASSNAME, __func__, GetName().c_str());
+        CLOG(LOGDEBUG, "%s::%s %s - OMX_EventParamOrConfigChanged(output)\n", CLASSNAME, __func__, GetName().c_str());
 #endif
         break;
 #if defined(OMX_DEBUG_EVENTHANDLER)
     case OMX_EventMark:
-        CLog::Log(LOGDEBUG, "%s::%s %s - OMX_EventMark\n", CLASSNAME, __func__, GetName().c_str());
+        CLOG(LOGDEBUG, "%s::%s %s - OMX_EventMark\n", CLASSNAME, __func__, GetName().c_str());
         break;
     case OMX_EventResourcesAcquired:
-        CLog::Log(LOGDEBUG, "%s::%s %s- OMX_EventResourcesAcquired\n", CLASSNAME, __func__, GetName().c_str());
+        CLOG(LOGDEBUG, "%s::%s %s- OMX_EventResourcesAcquired\n", CLASSNAME, __func__, GetName().c_str());
         break;
 #endif
     case OMX_EventError:
@@ -1737,46 +1760,136 @@ OMX_ERRORTYPE COMXCoreComponent::DecoderEventHandler(
         {
         case OMX_ErrorSameState:
             //#if defined(OMX_DEBUG_EVENTHANDLER)
-            //CLog::Log(LOGERROR, "%s::%s %s - OMX_ErrorSameState, same state\n", CLASSNAME, __func__, GetName().c_str());
+            //CLOG(LOGERROR, "%s::%s %s - OMX_ErrorSameState, same state\n", CLASSNAME, __func__, GetName().c_str());
             //#endif
             break;
         case OMX_ErrorInsufficientResources:
-            CLog::Log(LOGERROR, "%s::%s %s - OMX_ErrorInsufficientResources, insufficient resources\n", CLASSNAME, __func__, GetName().c_str());
+            CLOG(LOGERROR, "%s::%s %s - OMX_ErrorInsufficientResources, insufficient resources\n", CLASSNAME, __func__, GetName().c_str());
             m_resource_error = true;
             break;
         case OMX_ErrorFormatNotDetected:
-            CLog::Log(LOGERROR, "%s::%s %s - OMX_ErrorFormatNotDetected, cannot parse input stream\n", CLASSNAME, __func__, GetName().c_str());
+            CLOG(LOGERROR, "%s::%s %s - OMX_ErrorFormatNotDetected, cannot parse input stream\n", CLASSNAME, __func__, GetName().c_str());
             break;
         case OMX_ErrorPortUnpopulated:
-            CLog::Log(LOGWARNING, "%s::%s %s - OMX_ErrorPortUnpopulated port %d\n", CLASSNAME, __func__, GetName().c_str(), (int)nData2);
+            CLOG(LOGWARNING, "%s::%s %s - OMX_ErrorPortUnpopulated port %d\n", CLASSNAME, __func__, GetName().c_str(), (int)nData2);
             break;
         case OMX_ErrorStreamCorrupt:
-            CLog::Log(LOGERROR, "%s::%s %s - OMX_ErrorStreamCorrupt, Bitstream corrupt\n", CLASSNAME, __func__, GetName().c_str());
+            CLOG(LOGERROR, "%s::%s %s - OMX_ErrorStreamCorrupt, Bitstream corrupt\n", CLASSNAME, __func__, GetName().c_str());
             m_resource_error = true;
             break;
         case OMX_ErrorUnsupportedSetting:
-            CLog::Log(LOGERROR, "%s::%s %s - OMX_ErrorUnsupportedSetting, unsupported setting\n", CLASSNAME, __func__, GetName().c_str());
+            CLOG(LOGERROR, "%s::%s %s - OMX_ErrorUnsupportedSetting, unsupported setting\n", CLASSNAME, __func__, GetName().c_str());
             break;
         default:
-            CLog::Log(LOGERROR, "%s::%s %s - OMX_EventError detected, nData1(0x%x), port %d\n",  CLASSNAME, __func__, GetName().c_str(), nData1, (int)nData2);
+            CLOG(LOGERROR, "%s::%s %s - OMX_EventError detected, nData1(0x%x), port %d\n",  CLASSNAME, __func__, GetName().c_str(), nData1, (int)nData2);
             break;
         }
         // wake things up
         if (m_resource_error)
         {
-            pthread_cond_broadcast(&m_output_buffer_cond);
-            pthread_cond_broadcast(&m_input_buffer_cond);
+            m_omx_output_available.WakeAll();
+            m_omx_input_avaliable.WakeAll();
             pthread_cond_broadcast(&m_omx_event_cond);
         }
         break;
     default:
-        CLog::Log(LOGWARNING, "%s::%s %s - Unknown eEvent(0x%x), nData1(0x%x), port %d\n", CLASSNAME, __func__, GetName().c_str(), eEvent, nData1, (int)nData2);
+        CLOG(LOGWARNING, "%s::%s %s - Unknown eEvent(0x%x), nData1(0x%x), port %d\n", CLASSNAME, __func__, GetName().c_str(), eEvent, nData1, (int)nData2);
         break;
     }
 
     return OMX_ErrorNone;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////
+#undef CLASSNAME
+#define CLASSNAME "COMXCore"
+
+OMXCoreBackend COMXCore::m_backend = OMX_CORE_BACKEND_DEFAULT;
+bool           COMXCore::m_is_open = false;
+
+bool COMXCore::Initialize(OMXCoreBackend backend)
+{
+    if(m_is_open)
+        return m_backend == backend;
+
+    if(backend == OMX_CORE_BACKEND_HW)
+    {
+#if defined(TARGET_RASPBERRY_PI)
+        OMX_ERRORTYPE omx_err = OMX_Init();
+        if(omx_err != OMX_ErrorNone)
+        {
+            CLOG(LOGERROR, "%s::%s - OMX_Init failed with omx_err(0x%08x)\n", CLASSNAME, __func__, omx_err);
+            return false;
+        }
+#else
+        CLOG(LOGERROR, "%s::%s - hardware OMX is only available on the Raspberry Pi\n", CLASSNAME, __func__);
+        return false;
+#endif
+    }
+
+    m_backend = backend;
+    m_is_open = true;
+    CLOG(LOGDEBUG, "%s::%s - using %s OMX components\n", CLASSNAME, __func__,
+         backend == OMX_CORE_BACKEND_HW ? "hardware" : "software");
+    return true;
+}
+
+void COMXCore::Deinitialize()
+{
+    if(!m_is_open)
+        return;
+
+#if defined(TARGET_RASPBERRY_PI)
+    if(m_backend == OMX_CORE_BACKEND_HW)
+        OMX_Deinit();
+#endif
+    m_is_open = false;
+}
+
+OMX_ERRORTYPE COMXCore::GetHandle(OMX_HANDLETYPE *handle, const std::string &component_name,
+                                  OMX_PTR app_data, OMX_CALLBACKTYPE *callbacks, OMXCoreBackend backend)
+{
+    if(backend == OMX_CORE_BACKEND_SOFT)
+        return COMXSoftComponent::GetHandle(handle, component_name, app_data, callbacks);
+
+#if defined(TARGET_RASPBERRY_PI)
+    return OMX_GetHandle(handle, (char*)component_name.c_str(), app_data, callbacks);
+#else
+    return OMX_ErrorComponentNotFound;
+#endif
+}
+
+OMX_ERRORTYPE COMXCore::FreeHandle(OMX_HANDLETYPE handle)
+{
+    if(COMXSoftComponent::IsSoftHandle(handle))
+        return COMXSoftComponent::FreeHandle(handle);
+
+#if defined(TARGET_RASPBERRY_PI)
+    return OMX_FreeHandle(handle);
+#else
+    return OMX_ErrorInvalidComponent;
+#endif
+}
+
+OMX_ERRORTYPE COMXCore::SetupTunnel(OMX_HANDLETYPE output, OMX_U32 output_port,
+                                    OMX_HANDLETYPE input, OMX_U32 input_port)
+{
+    if(COMXSoftComponent::IsSoftHandle(output) || COMXSoftComponent::IsSoftHandle(input))
+    {
+        // software components only exchange buffers through the client,
+        // tearing a tunnel down is a no-op
+        if(output && input)
+            return OMX_ErrorNotImplemented;
+        return OMX_ErrorNone;
+    }
+
+#if defined(TARGET_RASPBERRY_PI)
+    return OMX_SetupTunnel(output, output_port, input, input_port);
+#else
+    return OMX_ErrorNotImplemented;
+#endif
+}
+
 void OMXSleep(unsigned int dwMilliSeconds)
 {
   struct timespec req;
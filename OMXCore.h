@@ -23,6 +23,7 @@
 
 #include <string>
 #include <queue>
+#include <vector>
 #include <stdio.h>
 #include <string.h>
 #include <cassert>
@@ -42,6 +43,8 @@
 
 #include <semaphore.h>
 
+#include "OMXBufferRing.h"
+
 ////////////////////////////////////////////////////////////////////////////////////////////
 // debug spew defines
 #if 1
@@ -98,6 +101,40 @@ class COMXCoreComponent;
 class COMXCoreTunel;
 class COMXCoreClock;
 
+typedef enum OMXCoreBackend {
+    OMX_CORE_BACKEND_HW,    // VideoCore IL components (libopenmaxil)
+    OMX_CORE_BACKEND_SOFT   // libavcodec components, see OMXSoftCore.h
+} OMXCoreBackend;
+
+#if defined(TARGET_RASPBERRY_PI)
+#define OMX_CORE_BACKEND_DEFAULT OMX_CORE_BACKEND_HW
+#else
+#define OMX_CORE_BACKEND_DEFAULT OMX_CORE_BACKEND_SOFT
+#endif
+
+// Entry points of the IL core. Everything else goes through the
+// OMX_COMPONENTTYPE function table, so the components don't care which
+// backend created them. A component may come from the other backend than
+// the process one (a software decoder feeding the VideoCore encoder), the
+// handle tells FreeHandle/SetupTunnel which one it is.
+class COMXCore
+{
+public:
+    static bool           Initialize(OMXCoreBackend backend = OMX_CORE_BACKEND_DEFAULT);
+    static void           Deinitialize();
+    static OMXCoreBackend GetBackend() { return m_backend; }
+
+    static OMX_ERRORTYPE  GetHandle(OMX_HANDLETYPE *handle, const std::string &component_name,
+                                    OMX_PTR app_data, OMX_CALLBACKTYPE *callbacks,
+                                    OMXCoreBackend backend = GetBackend());
+    static OMX_ERRORTYPE  FreeHandle(OMX_HANDLETYPE handle);
+    static OMX_ERRORTYPE  SetupTunnel(OMX_HANDLETYPE output, OMX_U32 output_port,
+                                      OMX_HANDLETYPE input, OMX_U32 input_port);
+private:
+    static OMXCoreBackend m_backend;
+    static bool           m_is_open;
+};
+
 class COMXCoreTunel
 {
 public:
@@ -116,7 +153,9 @@ private:
     bool              m_tunnel_set;
 };
 
-typedef void (*enc_done_cbk) (OMX_BUFFERHEADERTYPE* pBuffer);
+// opaque: what the callback was set with, output: which of the encoders fed
+// from one decoder produced the buffer
+typedef void (*enc_done_cbk) (OMX_BUFFERHEADERTYPE* pBuffer, void *opaque, int output);
 
 class COMXCoreComponent
 {
@@ -144,9 +183,10 @@ public:
     OMX_ERRORTYPE EnablePort(unsigned int port, bool wait = true);
     OMX_ERRORTYPE DisablePort(unsigned int port, bool wait = true);
     OMX_ERRORTYPE UseEGLImage(OMX_BUFFERHEADERTYPE** ppBufferHdr, OMX_U32 nPortIndex, OMX_PTR pAppPrivate, void* eglImage);
-    void SetPrivateCallBack(enc_done_cbk cb);
+    void SetPrivateCallBack(enc_done_cbk cb, void *opaque = NULL, int output = 0);
 
-    bool          Initialize( const std::string &component_name, OMX_INDEXTYPE index, OMX_CALLBACKTYPE *callbacks = NULL);
+    bool          Initialize( const std::string &component_name, OMX_INDEXTYPE index, OMX_CALLBACKTYPE *callbacks = NULL,
+                              OMXCoreBackend backend = COMXCore::GetBackend());
     bool          IsInitialized() const { return m_handle != NULL; }
     bool          Deinitialize();
 
@@ -165,6 +205,11 @@ public:
         OMX_HANDLETYPE hComponent, OMX_BUFFERHEADERTYPE* pBuffer);
     OMX_ERRORTYPE DecoderFillBufferDone(
         OMX_HANDLETYPE hComponent, OMX_BUFFERHEADERTYPE* pBuffer);
+    // a buffer taken with GetInputBuffer/GetOutputBuffer that never reached
+    // the component (Empty/FillThisBuffer failed), from any thread but the
+    // IL callback one
+    void ReturnInputBuffer(OMX_BUFFERHEADERTYPE *pBuffer);
+    void ReturnOutputBuffer(OMX_BUFFERHEADERTYPE *pBuffer);
 
     void TransitionToStateLoaded();
 
@@ -175,22 +220,33 @@ public:
     unsigned int GetInputBufferSize() const { return m_input_buffer_count * m_input_buffer_size; }
     unsigned int GetOutputBufferSize() const { return m_output_buffer_count * m_output_buffer_size; }
 
-    unsigned int GetInputBufferSpace() const { return m_omx_input_avaliable.size() * m_input_buffer_size; }
-    unsigned int GetOutputBufferSpace() const { return m_omx_output_available.size() * m_output_buffer_size; }
+    unsigned int GetInputBufferSpace() const { return m_omx_input_avaliable.Size() * m_input_buffer_size; }
+    unsigned int GetOutputBufferSpace() const { return m_omx_output_available.Size() * m_output_buffer_size; }
 
     void FlushAll();
     void FlushInput();
     void FlushOutput();
 
-    OMX_BUFFERHEADERTYPE *GetInputBuffer(long timeout=200);
-    OMX_BUFFERHEADERTYPE *GetOutputBuffer(long timeout=200);
+    // log_timeout=false for callers that poll, where a timeout is not an error
+    OMX_BUFFERHEADERTYPE *GetInputBuffer(long timeout=200, bool log_timeout=true);
+    OMX_BUFFERHEADERTYPE *GetOutputBuffer(long timeout=200, bool log_timeout=true);
 
-    OMX_ERRORTYPE AllocInputBuffers(bool use_buffers = false);
+    // shared: OMX_UseBuffer on the memory of another port's buffers (same
+    // count and index), which stays owned by that port
+    OMX_ERRORTYPE AllocInputBuffers(bool use_buffers = false, const std::vector<OMX_BUFFERHEADERTYPE*> *shared = NULL);
     OMX_ERRORTYPE AllocOutputBuffers(bool use_buffers = false);
 
+    const std::vector<OMX_BUFFERHEADERTYPE*> &GetInputBuffers() const { return m_omx_input_buffers; }
+    const std::vector<OMX_BUFFERHEADERTYPE*> &GetOutputBuffers() const { return m_omx_output_buffers; }
+
     OMX_ERRORTYPE FreeInputBuffers();
     OMX_ERRORTYPE FreeOutputBuffers();
 
+    // Until bytes of input buffers are available, a timeout or any wake up
+    // (a returned buffer, WakeInputWaiters). true if the space is there.
+    bool WaitForInputSpace(unsigned int bytes, long timeout);
+    void WakeInputWaiters() { m_omx_input_avaliable.WakeAll(); }
+
     OMX_ERRORTYPE WaitForInputDone(long timeout=200);
     OMX_ERRORTYPE WaitForOutputDone(long timeout=200);
 
@@ -212,8 +268,7 @@ private:
     OMX_CALLBACKTYPE  m_callbacks;
 
     // OMXCore input buffers (demuxer packets)
-    pthread_mutex_t   m_omx_input_mutex;
-    std::queue<OMX_BUFFERHEADERTYPE*> m_omx_input_avaliable;
+    COMXBufferRing<OMX_BUFFERHEADERTYPE*> m_omx_input_avaliable;
     std::vector<OMX_BUFFERHEADERTYPE*> m_omx_input_buffers;
     unsigned int  m_input_alignment;
     unsigned int  m_input_buffer_size;
@@ -221,8 +276,7 @@ private:
     bool          m_omx_input_use_buffers;
 
     // OMXCore output buffers (video frames)
-    pthread_mutex_t   m_omx_output_mutex;
-    std::queue<OMX_BUFFERHEADERTYPE*> m_omx_output_available;
+    COMXBufferRing<OMX_BUFFERHEADERTYPE*> m_omx_output_available;
     std::vector<OMX_BUFFERHEADERTYPE*> m_omx_output_buffers;
     unsigned int  m_output_alignment;
     unsigned int  m_output_buffer_size;
@@ -230,15 +284,15 @@ private:
     bool          m_omx_output_use_buffers;
 
     bool          m_exit;
-    pthread_cond_t    m_input_buffer_cond;
-    pthread_cond_t    m_output_buffer_cond;
     pthread_cond_t    m_omx_event_cond;
     bool          m_eos;
-    bool          m_flush_input;
-    bool          m_flush_output;
-    bool          m_resource_error;
+    volatile bool m_flush_input;
+    volatile bool m_flush_output;
+    volatile bool m_resource_error;
     //Only for encoder
     enc_done_cbk m_enc_private_cb;  
+    void         *m_enc_private_opaque;
+    int          m_enc_private_output;
 };
 
 void OMXSleep(unsigned int dwMilliSeconds);
@@ -13,13 +13,19 @@
  */
 
 #include "OMXMuxer.h"
+#include "OMXPacketPool.h"
 
 #include <stdio.h>
 #include <unistd.h>
 #include <assert.h>
+#include <time.h>
 #include <sys/time.h>
 #include "linux/XMemUtils.h"
 
+extern "C" {
+#include <libavutil/opt.h>
+}
+
 // #define TEST_RAW_VIDEO
 // #define MUX_PRINT printf
 #define MUX_PRINT(...)
@@ -27,12 +33,38 @@
 
 OMXMuxer::OMXMuxer()
 {
+    o_context = NULL;
+    i_context = NULL;
+    is_ready_write = false;
+    passthrough = false;
+    format = MUX_FORMAT_TS;
+    m_keep_timestamps = false;
+    m_rebase = 0;
+    converter = NULL;
+    sps = pps = NULL;
+    m_parameter_sets_changed = false;
+    m_queue_bytes = 0;
+    m_closing = false;
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_depth_sum = 0;
+    m_write_sum = 0;
+    m_segment_duration = 0;
+    m_segment_list_size = 0;
+    m_segment_index = 0;
+    m_segment_start = m_segment_next = m_segment_last = AV_NOPTS_VALUE;
+    m_playlist_sequence = 0;
+    m_video_width = m_video_height = m_video_bitrate = m_video_max_bitrate = 0;
+    m_video_frame_rate = av_make_q(0, 1);
     pthread_mutex_init(&m_lock, NULL);
+    pthread_cond_init(&m_packet_cond, NULL);
+    pthread_cond_init(&m_space_cond, NULL);
 }
 
 OMXMuxer::~OMXMuxer()
 {
     Close();
+    pthread_cond_destroy(&m_packet_cond);
+    pthread_cond_destroy(&m_space_cond);
     pthread_mutex_destroy(&m_lock);
 }
 
@@ -46,7 +78,32 @@ void OMXMuxer::UnLock()
     pthread_mutex_unlock(&m_lock);
 }
 
-bool OMXMuxer::Open(AVFormatContext *input_ctx, char* file)
+const char *OMXMuxer::FormatName(EMUXFORMAT format)
+{
+    switch (format) {
+    case MUX_FORMAT_FMP4: return "fmp4";
+    case MUX_FORMAT_MP4:  return "mp4";
+    case MUX_FORMAT_TS:   return "mpegts";
+    default:              return "auto";
+    }
+}
+
+void OMXMuxer::SetSegmenting(double duration, int list_size)
+{
+    m_segment_duration  = duration > 0 ? (int64_t)(duration * AV_TIME_BASE) : 0;
+    m_segment_list_size = list_size;
+}
+
+void OMXMuxer::SetVideoOutput(int width, int height, int bitrate, int max_bitrate, AVRational frame_rate)
+{
+    m_video_width       = width;
+    m_video_height      = height;
+    m_video_bitrate     = bitrate;
+    m_video_max_bitrate = max_bitrate;
+    m_video_frame_rate  = frame_rate;
+}
+
+bool OMXMuxer::Open(AVFormatContext *input_ctx, char* file, bool passthrough, EMUXFORMAT format)
 {
 #ifdef TEST_RAW_VIDEO
     p_test_file = fopen ("test.264","wb");
@@ -60,8 +117,212 @@ bool OMXMuxer::Open(AVFormatContext *input_ctx, char* file)
 
     filename = file;
     printf("output file %s\n",  filename);
+    if (format == MUX_FORMAT_AUTO) {
+        AVOutputFormat *guess = av_guess_format(NULL, filename, NULL);
+        format = guess && (!strcmp(guess->name, "mp4") || !strcmp(guess->name, "mov")) ? MUX_FORMAT_MP4 : MUX_FORMAT_TS;
+    }
+    if (m_segment_duration) {
+        // segments are fragments of one mp4 stream, the moov goes in the init segment
+        if (format == MUX_FORMAT_MP4)
+            format = MUX_FORMAT_FMP4;
+        m_segment_base = filename;
+        size_t ext = m_segment_base.rfind('.');
+        if (ext != std::string::npos && m_segment_base.find('/', ext) == std::string::npos)
+            m_segment_base.erase(ext);
+        m_segment_index = 0;
+        m_segment_start = m_segment_next = m_segment_last = AV_NOPTS_VALUE;
+        m_playlist.clear();
+        m_playlist_sequence = 0;
+        m_segment_expired.clear();
+    }
+    this->format = format;
+    this->passthrough = passthrough;
+    i_context = input_ctx;
     o_context = CreatOutContext(input_ctx, filename, 0);
+    if (!o_context)
+        return false;
+    printf("output format %s\n", FormatName(format));
+
+    if (passthrough) {
+        // the encoder path starts once it has the SPS/PPS, here the input has them.
+        // mp4 takes avcC or Annex B as they are, mpegts needs Annex B with the
+        // SPS/PPS in-band, which the converter inserts itself
+        AVCodecContext *ic = input_ctx->streams[0]->codec;
+        if (format == MUX_FORMAT_TS) {
+            converter = new CBitstreamConverter();
+            if (!converter->Open(ic->codec_id, ic->extradata, ic->extradata_size, true)) {
+                delete converter;
+                converter = NULL;
+            } else {
+                AVCodecContext *oc = o_context->streams[stream_map[0]]->codec;
+                av_freep(&oc->extradata);
+                oc->extradata_size = 0;
+            }
+        }
+        if (!WriteHeader())
+            return false;
+    }
+
+    m_closing = false;
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_depth_sum = 0;
+    m_write_sum = 0;
+    Create();
+
+    return true;
+}
+
+bool OMXMuxer::WriteHeader()
+{
+    int ret;
+    if (m_segment_duration) {
+        // fmp4: the header (ftyp+moov) alone is the init segment
+        if (format == MUX_FORMAT_FMP4) {
+            m_segment_tmp = m_segment_base + "_init.mp4.tmp";
+            ret = avio_open(&o_context->pb, m_segment_tmp.c_str(), AVIO_FLAG_WRITE);
+        } else {
+            ret = OpenSegment() ? 0 : -1;
+        }
+    } else {
+        ret = avio_open(&o_context->pb, filename, AVIO_FLAG_WRITE);
+    }
+    if (ret < 0) {
+        MUX_PRINT("%s %d file %s avio_open error \n",__func__,__LINE__,filename);
+        return false;
+    }
+
+    // everything goes to the file as it is muxed: fragments are written per
+    // keyframe, faststart moves the moov up in one pass over the file at the end
+    AVDictionary *opts = NULL;
+    if (format == MUX_FORMAT_FMP4 && m_segment_duration)
+        av_dict_set(&opts, "movflags", "frag_custom+empty_moov+default_base_moof", 0);
+    else if (format == MUX_FORMAT_FMP4)
+        av_dict_set(&opts, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
+    else if (format == MUX_FORMAT_MP4)
+        av_dict_set(&opts, "movflags", "faststart", 0);
+    if (format == MUX_FORMAT_TS && m_keep_timestamps)
+        av_dict_set(&opts, "mpegts_copyts", "1", 0);
+
+    ret = avformat_write_header(o_context, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        MUX_PRINT("%s %d file Failed to write header \n",__func__,__LINE__);
+        return false;
+    }
+
+    if (m_segment_duration && format == MUX_FORMAT_FMP4) {
+        avio_closep(&o_context->pb);
+        std::string init = m_segment_base + "_init.mp4";
+        if (rename(m_segment_tmp.c_str(), init.c_str()) != 0 || !OpenSegment())
+            return false;
+    }
+    is_ready_write = true;
+    return true;
+}
+
+// the segment is written to a .tmp file, renamed when complete
+bool OMXMuxer::OpenSegment()
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%05u.%s", m_segment_index, format == MUX_FORMAT_TS ? "ts" : "m4s");
+    m_segment_tmp = m_segment_base + name + ".tmp";
+    if (avio_open(&o_context->pb, m_segment_tmp.c_str(), AVIO_FLAG_WRITE) < 0) {
+        CLOG(LOGERROR, "%s::%s - can't open %s\n", "OMXMuxer", __func__, m_segment_tmp.c_str());
+        return false;
+    }
+    // PAT/PMT at the start of each segment
+    if (format == MUX_FORMAT_TS && m_segment_index)
+        av_opt_set(o_context->priv_data, "mpegts_flags", "+resend_headers", 0);
+    return true;
+}
+
+// muxer thread: the current segment is complete up to end_ts
+bool OMXMuxer::CloseSegment(int64_t end_ts)
+{
+    avio_closep(&o_context->pb);
+
+    std::string name = m_segment_tmp.substr(0, m_segment_tmp.size() - 4);
+    if (rename(m_segment_tmp.c_str(), name.c_str()) != 0) {
+        CLOG(LOGERROR, "%s::%s - can't rename %s\n", "OMXMuxer", __func__, m_segment_tmp.c_str());
+        return false;
+    }
+
+    OMXMuxerSegment segment;
+    size_t slash = name.rfind('/');
+    segment.name     = slash == std::string::npos ? name : name.substr(slash + 1);
+    segment.duration = m_segment_start == AV_NOPTS_VALUE ? 0 : (double)(end_ts - m_segment_start) / AV_TIME_BASE;
+    m_playlist.push_back(segment);
+    m_segment_index++;
+    m_segment_start = end_ts;
+
+    // dropped segments stay on disk one more round for clients still behind
+    while (m_segment_list_size > 0 && (int)m_playlist.size() > m_segment_list_size) {
+        std::string dir = slash == std::string::npos ? "" : name.substr(0, slash + 1);
+        m_segment_expired.push_back(dir + m_playlist.front().name);
+        m_playlist.pop_front();
+        m_playlist_sequence++;
+    }
+    while (m_segment_expired.size() > 1) {
+        unlink(m_segment_expired.front().c_str());
+        m_segment_expired.pop_front();
+    }
+    return true;
+}
 
+// rewritten as a whole and renamed into place, players never see half of it
+void OMXMuxer::WritePlaylist(bool end)
+{
+    double target = 1;
+    for (size_t i = 0; i < m_playlist.size(); i++)
+        if (m_playlist[i].duration > target)
+            target = m_playlist[i].duration;
+
+    std::string tmp = std::string(filename) + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "w");
+    if (!f) {
+        CLOG(LOGERROR, "%s::%s - can't open %s\n", "OMXMuxer", __func__, tmp.c_str());
+        return;
+    }
+    fprintf(f, "#EXTM3U\n");
+    fprintf(f, "#EXT-X-VERSION:%d\n", format == MUX_FORMAT_TS ? 3 : 7);
+    fprintf(f, "#EXT-X-TARGETDURATION:%d\n", (int)(target + 0.999));
+    fprintf(f, "#EXT-X-MEDIA-SEQUENCE:%u\n", m_playlist_sequence);
+    if (format != MUX_FORMAT_TS) {
+        std::string init = m_segment_base + "_init.mp4";
+        size_t slash = init.rfind('/');
+        fprintf(f, "#EXT-X-MAP:URI=\"%s\"\n", slash == std::string::npos ? init.c_str() : init.c_str() + slash + 1);
+    }
+    for (size_t i = 0; i < m_playlist.size(); i++)
+        fprintf(f, "#EXTINF:%.3f,\n%s\n", m_playlist[i].duration, m_playlist[i].name.c_str());
+    if (end)
+        fprintf(f, "#EXT-X-ENDLIST\n");
+    fclose(f);
+
+    if (rename(tmp.c_str(), filename) != 0)
+        CLOG(LOGERROR, "%s::%s - can't rename %s\n", "OMXMuxer", __func__, tmp.c_str());
+}
+
+bool OMXMuxer::WriteMasterPlaylist(const char *file, const std::vector<OMXMuxerVariant> &variants)
+{
+    std::string tmp = std::string(file) + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "w");
+    if (!f) {
+        CLOG(LOGERROR, "%s::%s - can't open %s\n", "OMXMuxer", __func__, tmp.c_str());
+        return false;
+    }
+    fprintf(f, "#EXTM3U\n");
+    for (size_t i = 0; i < variants.size(); i++) {
+        fprintf(f, "#EXT-X-STREAM-INF:BANDWIDTH=%d", variants[i].bandwidth);
+        if (variants[i].width && variants[i].height)
+            fprintf(f, ",RESOLUTION=%dx%d", variants[i].width, variants[i].height);
+        fprintf(f, "\n%s\n", variants[i].uri.c_str());
+    }
+    fclose(f);
+
+    if (rename(tmp.c_str(), file) != 0) {
+        CLOG(LOGERROR, "%s::%s - can't rename %s\n", "OMXMuxer", __func__, tmp.c_str());
+        return false;
+    }
     return true;
 }
 
@@ -72,130 +333,583 @@ bool OMXMuxer::Reset()
 
 bool OMXMuxer::Close()
 {
+    if (Running()) {
+        Lock();
+        m_closing = true;
+        pthread_cond_broadcast(&m_packet_cond);
+        pthread_cond_broadcast(&m_space_cond);
+        UnLock();
+        StopThread();
+    }
+
 #ifdef TEST_RAW_VIDEO
-    fclose(p_test_file);
+    if (p_test_file) fclose(p_test_file);
+    p_test_file = NULL;
 #endif
 
+    for (int i = 0; i < MUX_QUEUES; i++) {
+        while (!m_queue[i].empty()) {
+            av_packet_free(&m_queue[i].front().pkt);
+            m_queue[i].pop_front();
+        }
+    }
+    m_queue_bytes = 0;
+
+    if (is_ready_write) {
+        av_write_trailer(o_context);
+        if (m_segment_duration) {
+            // the trailer went to the last segment
+            if (CloseSegment(m_segment_last != AV_NOPTS_VALUE ? m_segment_last : m_segment_start))
+                WritePlaylist(true);
+        } else {
+            avio_closep(&o_context->pb);
+        }
+        is_ready_write = false;
+    }
+    if (converter) {
+        converter->Close();
+        delete converter;
+        converter = NULL;
+    }
+    if (o_context) {
+        avformat_free_context(o_context);
+        o_context = NULL;
+    }
+    free(sps);
+    free(pps);
+    sps = pps = NULL;
+    sps_size = pps_size = 0;
+    m_parameter_sets_changed = false;
+
+    return true;
+}
+
+OMXMuxerStats OMXMuxer::GetStats()
+{
+    Lock();
+    OMXMuxerStats stats = m_stats;
+    if (stats.packets) {
+        stats.avg_depth    = m_depth_sum / stats.packets;
+        stats.avg_write_us = m_write_sum / stats.packets;
+    }
+    UnLock();
+    return stats;
+}
+
+bool OMXMuxer::Queue(int queue, AVPacket *pkt, int64_t ts, bool config)
+{
+    Lock();
+    // a packet bigger than the limit still goes through an empty queue
+    while (m_queue_bytes && m_queue_bytes + pkt->size > MUX_QUEUE_MAX_BYTES && !m_closing)
+        pthread_cond_wait(&m_space_cond, &m_lock);
+    if (m_closing) {
+        UnLock();
+        av_packet_free(&pkt);
+        return false;
+    }
+
+    OMXMuxerPacket entry;
+    entry.pkt    = pkt;
+    entry.ts     = ts;
+    entry.config = config;
+    m_queue[queue].push_back(entry);
+    m_queue_bytes += pkt->size;
+
+    unsigned int depth = m_queue[MUX_QUEUE_VIDEO].size() + m_queue[MUX_QUEUE_AUDIO].size();
+    if (depth > m_stats.max_depth)
+        m_stats.max_depth = depth;
+    m_depth_sum += depth;
+    UnLock();
+
+    pthread_cond_signal(&m_packet_cond);
     return true;
 }
 
 void OMXMuxer::Process()
 {
-    //TODO
+    while (true) {
+        Lock();
+        while (!(m_bStop || m_closing) && m_queue[MUX_QUEUE_VIDEO].empty() && m_queue[MUX_QUEUE_AUDIO].empty())
+            pthread_cond_wait(&m_packet_cond, &m_lock);
+        // on close, whatever is queued is written first
+        if (m_queue[MUX_QUEUE_VIDEO].empty() && m_queue[MUX_QUEUE_AUDIO].empty()) {
+            UnLock();
+            break;
+        }
+
+        int queue = MUX_QUEUE_VIDEO;
+        if (m_queue[MUX_QUEUE_VIDEO].empty() ||
+            (!m_queue[MUX_QUEUE_AUDIO].empty() && !m_queue[MUX_QUEUE_VIDEO].front().config &&
+             m_queue[MUX_QUEUE_AUDIO].front().ts < m_queue[MUX_QUEUE_VIDEO].front().ts))
+            queue = MUX_QUEUE_AUDIO;
+        // audio waits for the header (the encoder's first SPS/PPS) while it
+        // has room, the reader must not block on it before the video is in
+        if (queue == MUX_QUEUE_AUDIO && !is_ready_write && !(m_bStop || m_closing) &&
+            m_queue_bytes < MUX_QUEUE_MAX_BYTES / 2) {
+            pthread_cond_wait(&m_packet_cond, &m_lock);
+            UnLock();
+            continue;
+        }
+
+        OMXMuxerPacket entry = m_queue[queue].front();
+        m_queue[queue].pop_front();
+        m_queue_bytes -= entry.pkt->size;
+        pthread_cond_broadcast(&m_space_cond);
+        UnLock();
+
+        Write(queue, entry);
+        av_packet_free(&entry.pkt);
+    }
 }
 
-bool OMXMuxer::AddPacket(OMX_BUFFERHEADERTYPE* pBuffer)
+// muxer thread only, owns o_context while running
+void OMXMuxer::Write(int queue, OMXMuxerPacket &entry)
 {
-    CLog::Log(LOGDEBUG,"%s line %d pBuffer->nFilledLen %d\n",__func__,__LINE__,pBuffer->nFilledLen);
-#ifdef TEST_RAW_VIDEO
-    fwrite(static_cast<void*>(pBuffer->pBuffer) , sizeof(char), pBuffer->nFilledLen, p_test_file);
-#endif
+    if (entry.config) {
+        WriteParameterSet(entry.pkt);
+        return;
+    }
+    // audio the header came too late for is dropped
+    if (!is_ready_write)
+        return;
 
-    Lock();
-    if (pBuffer->nFlags & OMX_BUFFERFLAG_CODECCONFIG) {
-        WriteParameterSet(pBuffer);
+    AVPacket *pkt = entry.pkt;
+    if (queue == MUX_QUEUE_VIDEO && m_segment_duration) {
+        // cut at the first keyframe past each multiple of the duration
+        if (m_segment_next == AV_NOPTS_VALUE) {
+            m_segment_start = entry.ts;
+            m_segment_next  = entry.ts + m_segment_duration;
+        } else if ((pkt->flags & AV_PKT_FLAG_KEY) && entry.ts >= m_segment_next) {
+            // everything before goes to this segment, an mp4 fragment ends here
+            av_interleaved_write_frame(o_context, NULL);
+            av_write_frame(o_context, NULL);
+            if (CloseSegment(entry.ts))
+                WritePlaylist(false);
+            if (!OpenSegment()) {
+                is_ready_write = false;
+                return;
+            }
+            while (m_segment_next <= entry.ts)
+                m_segment_next += m_segment_duration;
+        }
+        m_segment_last = entry.ts;
+    }
+    if (queue == MUX_QUEUE_VIDEO) {
+        // AV_TIME_BASE from the input start, the stream time base is only
+        // known once the header is written
+        pkt->stream_index = stream_map[0];
+        AVRational tb = o_context->streams[pkt->stream_index]->time_base;
+        int64_t start_vpts = av_rescale_q(m_rebase > 0 ? -m_rebase : o_context->start_time, AV_TIME_BASE_Q, tb);
+        if (pkt->pts != AV_NOPTS_VALUE)
+            pkt->pts = av_rescale_q(pkt->pts, AV_TIME_BASE_Q, tb) + start_vpts;
+        if (pkt->dts != AV_NOPTS_VALUE)
+            pkt->dts = av_rescale_q(pkt->dts, AV_TIME_BASE_Q, tb) + start_vpts;
+        if (m_parameter_sets_changed && (pkt->flags & AV_PKT_FLAG_KEY) && !PrependParameterSets(pkt))
+            return;
+        // mp4 wants length prefixed NALs to go with the avcC
+        if (!passthrough && format != MUX_FORMAT_TS && !AnnexBToAvcc(pkt))
+            return;
     } else {
-        if (is_ready_write) OmxBuf2AvPkt(pBuffer);
+        int index = pkt->stream_index;
+        pkt->stream_index = stream_map[index];
+        AVRational tb = o_context->streams[pkt->stream_index]->time_base;
+        av_packet_rescale_ts(pkt, i_context->streams[index]->time_base, tb);
+        if (m_rebase > 0) {
+            // the input's start time and then the rebase, as the video
+            int64_t shift = m_rebase + (i_context->start_time != AV_NOPTS_VALUE ? i_context->start_time : 0);
+            shift = av_rescale_q(shift, AV_TIME_BASE_Q, tb);
+            if (pkt->pts != AV_NOPTS_VALUE)
+                pkt->pts -= shift;
+            if (pkt->dts != AV_NOPTS_VALUE)
+                pkt->dts -= shift;
+        }
     }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    av_interleaved_write_frame(o_context, pkt);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double us = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+    Lock();
+    m_stats.packets++;
+    m_write_sum += us;
+    if (us > m_stats.max_write_us)
+        m_stats.max_write_us = us;
     UnLock();
-    return true;
 }
 
-bool OMXMuxer::OmxBuf2AvPkt(OMX_BUFFERHEADERTYPE* pBuffer)
+static void FreePooledData(void *opaque, uint8_t *data)
 {
-    AVPacket pkt;
-    OMX_TICKS tick = pBuffer->nTimeStamp;
-    int outindex = 0; //TODO(truong): confirm getting video streaming index
-    int64_t start_vpts;
+    COMXPacketPool::PutData(data, (unsigned int)(uintptr_t)opaque);
+}
+
+static void FreeConverted(void *opaque, uint8_t *data)
+{
+    free(data);
+}
 
-    pkt.stream_index =  outindex;
-    av_init_packet(&pkt);
+// packet on a copy of data, from the packet pool
+static AVPacket *NewPacket(const uint8_t *data, int size)
+{
+    AVPacket *pkt = av_packet_alloc();
+    if (!pkt)
+        return NULL;
 
-    pkt.data = reinterpret_cast<uint8_t*>(malloc(pBuffer->nFilledLen));
-    memcpy(pkt.data, pBuffer->pBuffer + pBuffer->nOffset, pBuffer->nFilledLen);
-    pkt.size = pBuffer->nFilledLen;
+    unsigned int capacity;
+    uint8_t *buf = COMXPacketPool::GetData(size, capacity);
+    if (buf)
+        pkt->buf = av_buffer_create(buf, size + FF_INPUT_BUFFER_PADDING_SIZE, FreePooledData, (void *)(uintptr_t)capacity, 0);
+    if (!pkt->buf) {
+        if (buf)
+            COMXPacketPool::PutData(buf, capacity);
+        av_packet_free(&pkt);
+        return NULL;
+    }
+    memcpy(buf, data, size);
+    // the pool only clears the padding past capacity, lavf reads past size
+    memset(buf + size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+    pkt->data = buf;
+    pkt->size = size;
+    return pkt;
+}
+
+// called from the encoder FillBufferDone, only copies the payload out
+bool OMXMuxer::AddPacket(OMX_BUFFERHEADERTYPE* pBuffer)
+{
+    CLOG(LOGDEBUG,"%s line %d pBuffer->nFilledLen %d\n",__func__,__LINE__,pBuffer->nFilledLen);
+#ifdef TEST_RAW_VIDEO
+    fwrite(static_cast<void*>(pBuffer->pBuffer) , sizeof(char), pBuffer->nFilledLen, p_test_file);
+#endif
+
+    AVPacket *pkt = OmxBuf2AvPkt(pBuffer);
+    if (!pkt)
+        return false;
+
+    if (pBuffer->nFlags & OMX_BUFFERFLAG_CODECCONFIG)
+        return Queue(MUX_QUEUE_VIDEO, pkt, 0, true);
+    return Queue(MUX_QUEUE_VIDEO, pkt, pkt->pts);
+}
+
+AVPacket *OMXMuxer::OmxBuf2AvPkt(OMX_BUFFERHEADERTYPE* pBuffer)
+{
+    AVPacket *pkt = NewPacket(pBuffer->pBuffer + pBuffer->nOffset, pBuffer->nFilledLen);
+    if (!pkt)
+        return NULL;
+
+    int outindex = 0; //TODO(truong): confirm getting video streaming index
+    pkt->stream_index = outindex;
 
     if (pBuffer->nFlags & OMX_BUFFERFLAG_SYNCFRAME)
     {
-        pkt.flags |= AV_PKT_FLAG_KEY;
+        pkt->flags |= AV_PKT_FLAG_KEY;
     }
 
-    start_vpts = av_rescale_q(o_context->start_time, AV_TIME_BASE_Q, o_context->streams[outindex]->time_base);
-    pkt.pts = av_rescale_q(FromOMXTime(tick), AV_TIME_BASE_Q, o_context->streams[outindex]->time_base) + start_vpts;
-    pkt.dts = AV_NOPTS_VALUE;
+    // rescaled to the stream time base when written, no B frames from the encoder
+    pkt->pts = FromOMXTime(pBuffer->nTimeStamp);
+    pkt->dts = pkt->pts;
+    return pkt;
+}
 
-    int ret  = av_interleaved_write_frame(o_context, &pkt);
-    return (0 == ret);
+// start of the next start code from pos, len is 3 or 4 (size and 0 if none)
+static int FindStartCode(const uint8_t *data, int size, int pos, int *len)
+{
+    for (int i = pos; i + 2 < size; i++) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+            if (i > pos && data[i - 1] == 0) {
+                *len = 4;
+                return i - 1;
+            }
+            *len = 3;
+            return i;
+        }
+    }
+    *len = 0;
+    return size;
 }
 
-void OMXMuxer::WriteParameterSet(OMX_BUFFERHEADERTYPE* pBuffer)
+// Start codes to 4 byte NAL sizes. In place when they are all 4 bytes, which
+// is what the encoder emits, otherwise into a new buffer.
+bool OMXMuxer::AnnexBToAvcc(AVPacket *pkt)
 {
-    AVPacket pkt;
-    av_init_packet(&pkt);
-    int outindex = 0;
-    int ret = 0;
+    int len, next_len;
+    int pos = FindStartCode(pkt->data, pkt->size, 0, &len);
+    if (pos != 0)
+        return true;
 
-    pkt.data = reinterpret_cast<uint8_t*>(malloc(pBuffer->nFilledLen));
-    memcpy(pkt.data, pBuffer->pBuffer + pBuffer->nOffset, pBuffer->nFilledLen);
-    pkt.size = pBuffer->nFilledLen;
-  
-    int nal_type = pkt.data[4] & 0x1f;
+    int out_size = 0;
+    bool in_place = av_buffer_is_writable(pkt->buf);
+    while (pos < pkt->size) {
+        int next = FindStartCode(pkt->data, pkt->size, pos + len, &next_len);
+        out_size += 4 + next - (pos + len);
+        in_place = in_place && len == 4;
+        pos = next;
+        len = next_len;
+    }
+
+    AVBufferRef *buf = NULL;
+    uint8_t *out = pkt->data;
+    if (!in_place) {
+        buf = av_buffer_alloc(out_size + FF_INPUT_BUFFER_PADDING_SIZE);
+        if (!buf)
+            return false;
+        out = buf->data;
+    }
+
+    int out_pos = 0;
+    pos = FindStartCode(pkt->data, pkt->size, 0, &len);
+    while (pos < pkt->size) {
+        int next = FindStartCode(pkt->data, pkt->size, pos + len, &next_len);
+        int nal_size = next - (pos + len);
+        if (!in_place)
+            memcpy(out + out_pos + 4, pkt->data + pos + len, nal_size);
+        OMX_WB32(out + out_pos, nal_size);
+        out_pos += 4 + nal_size;
+        pos = next;
+        len = next_len;
+    }
+
+    if (buf) {
+        av_buffer_unref(&pkt->buf);
+        pkt->buf  = buf;
+        pkt->data = buf->data;
+    }
+    pkt->size = out_size;
+    return true;
+}
+
+// the current SPS/PPS (Annex B) in front of a keyframe
+bool OMXMuxer::PrependParameterSets(AVPacket *pkt)
+{
+    int size = sps_size + pps_size + pkt->size;
+    AVBufferRef *buf = av_buffer_alloc(size + FF_INPUT_BUFFER_PADDING_SIZE);
+    if (!buf)
+        return false;
+    memcpy(buf->data, sps, sps_size);
+    memcpy(buf->data + sps_size, pps, pps_size);
+    memcpy(buf->data + sps_size + pps_size, pkt->data, pkt->size);
+    memset(buf->data + size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+
+    av_buffer_unref(&pkt->buf);
+    pkt->buf  = buf;
+    pkt->data = buf->data;
+    pkt->size = size;
+    m_parameter_sets_changed = false;
+    MUX_PRINT("-------SPS/PPS in-band------------\n");
+    return true;
+}
+
+void OMXMuxer::WriteParameterSet(AVPacket *pkt)
+{
+    if (pkt->size < 5)
+        return;
+
+    int nal_type = pkt->data[4] & 0x1f;
+
+    // a new SPS/PPS mid-stream (the encoder was reconfigured) goes in-band
+    // with the next keyframe, the header keeps the first
+    if (is_ready_write && (7 == nal_type || 8 == nal_type)) {
+        uint8_t *old = 7 == nal_type ? sps : pps;
+        int old_size = 7 == nal_type ? sps_size : pps_size;
+        if (!old || old_size != pkt->size || memcmp(old, pkt->data, pkt->size))
+            m_parameter_sets_changed = true;
+    }
 
     if (7 == nal_type){
         MUX_PRINT("-------SPS------------\n");
         if (sps) free(sps);
-        sps = reinterpret_cast<uint8_t*>(malloc(pkt.size));
-        memcpy(sps, pkt.data, pkt.size);
-        sps_size = pkt.size;
+        sps = reinterpret_cast<uint8_t*>(malloc(pkt->size));
+        memcpy(sps, pkt->data, pkt->size);
+        sps_size = pkt->size;
     } else if (8 == nal_type) {
         MUX_PRINT("-------PPS------------\n");
         if (pps) free(pps);
-        pps = reinterpret_cast<uint8_t*>(malloc(pkt.size));
-        memcpy(pps, pkt.data, pkt.size);
-        pps_size = pkt.size;
+        pps = reinterpret_cast<uint8_t*>(malloc(pkt->size));
+        memcpy(pps, pkt->data, pkt->size);
+        pps_size = pkt->size;
     }
   
-    if (nal_type == 7 || nal_type == 8) {
-        AVCodecContext *c;
-        c = o_context->streams[0]->codec;
-        if (c->extradata) {
-            av_free(c->extradata);
-            c->extradata = NULL;
-            c->extradata_size = 0;
-        }
-    
-        if ((pps || sps) && !is_ready_write) {
-            c->extradata_size = pps_size + sps_size;
-            c->extradata = reinterpret_cast<uint8_t*>(malloc(pps_size+sps_size));
-            memcpy(c->extradata, sps, sps_size);
-            memcpy(&c->extradata[sps_size], pps, pps_size);
-
-            ret = avio_open(&o_context->pb, filename, AVIO_FLAG_WRITE);
-            if (ret < 0) {
-                MUX_PRINT("%s %d file %s avio_open error \n",__func__,__LINE__,filename);
-                return;
-            }
-      
-            ret = avformat_write_header(o_context, NULL);
-            if (ret < 0) {
-                MUX_PRINT("%s %d file Failed to write header \n",__func__,__LINE__);
-                return;
+    // the stream parameters are fixed once the header is out
+    if (is_ready_write || !sps || !pps)
+        return;
+
+    AVCodecContext *c = o_context->streams[stream_map[0]]->codec;
+    av_freep(&c->extradata);
+    c->extradata_size = 0;
+
+    // what the encoder actually produces
+    int sps_len;
+    int sps_start = FindStartCode(sps, sps_size, 0, &sps_len) + sps_len;
+    if (sps_size - sps_start >= 4) {
+        c->profile = sps[sps_start + 1];
+        c->level   = sps[sps_start + 3];
+    }
+
+    if (format == MUX_FORMAT_TS) {
+        // Annex B, the TS muxer repeats it in-band before keyframes
+        c->extradata = reinterpret_cast<uint8_t*>(av_mallocz(sps_size + pps_size + FF_INPUT_BUFFER_PADDING_SIZE));
+        if (!c->extradata)
+            return;
+        memcpy(c->extradata, sps, sps_size);
+        memcpy(&c->extradata[sps_size], pps, pps_size);
+        c->extradata_size = sps_size + pps_size;
+    } else {
+        // avcC, the frames are written with NAL sizes
+        int pps_len;
+        int sps_pos = sps_start;
+        int pps_pos = FindStartCode(pps, pps_size, 0, &pps_len) + pps_len;
+        int sps_nal = sps_size - sps_pos, pps_nal = pps_size - pps_pos;
+        if (sps_nal < 4 || pps_nal < 1)
+            return;
+
+        int size = 6 + 2 + sps_nal + 1 + 2 + pps_nal;
+        uint8_t *p = reinterpret_cast<uint8_t*>(av_mallocz(size + FF_INPUT_BUFFER_PADDING_SIZE));
+        if (!p)
+            return;
+        c->extradata = p;
+        c->extradata_size = size;
+        *p++ = 1;                  // version
+        *p++ = sps[sps_pos + 1];   // profile
+        *p++ = sps[sps_pos + 2];   // profile compatibility
+        *p++ = sps[sps_pos + 3];   // level
+        *p++ = 0xff;               // 4 byte NAL sizes
+        *p++ = 0xe1;               // one SPS
+        *p++ = sps_nal >> 8;
+        *p++ = sps_nal;
+        memcpy(p, sps + sps_pos, sps_nal);
+        p += sps_nal;
+        *p++ = 1;                  // one PPS
+        *p++ = pps_nal >> 8;
+        *p++ = pps_nal;
+        memcpy(p, pps + pps_pos, pps_nal);
+    }
+
+    WriteHeader();
+}
+
+bool OMXMuxer::AddPacket(AVPacket* pAvpkt)
+{
+    CLOG(LOGDEBUG,"%s line %d AUDIO pAvpkt->size %d pApkt->pts %lld\n",__func__,__LINE__,pAvpkt->size,(long long)pAvpkt->pts);
+    if (pAvpkt->stream_index < 0 || pAvpkt->stream_index >= (int)stream_map.size() ||
+        stream_map[pAvpkt->stream_index] < 0)
+        return false;
+    // a reference when the payload is refcounted, a copy otherwise
+    AVPacket *pkt = av_packet_alloc();
+    if (!pkt || av_packet_ref(pkt, pAvpkt) < 0) {
+        av_packet_free(&pkt);
+        return false;
+    }
+
+    int64_t ts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+    if (ts != AV_NOPTS_VALUE) {
+        ts = av_rescale_q(ts, i_context->streams[pkt->stream_index]->time_base, AV_TIME_BASE_Q);
+        if (i_context->start_time != AV_NOPTS_VALUE)
+            ts -= i_context->start_time;
+    } else {
+        ts = INT64_MIN;
+    }
+    return Queue(MUX_QUEUE_AUDIO, pkt, ts);
+}
+
+bool OMXMuxer::AddPacket(OMXPacket* pkt)
+{
+    if (!passthrough) return false;
+
+    AVPacket *avpkt = NULL;
+    if (converter && converter->Convert(pkt->data, pkt->size) && converter->GetConvertBuffer() != pkt->data) {
+        // the converter's output is taken over, not copied
+        int size = converter->GetConvertSize();
+        uint8_t *data = converter->DetachConvertBuffer();
+        if (data) {
+            avpkt = av_packet_alloc();
+            if (avpkt && (avpkt->buf = av_buffer_create(data, size, FreeConverted, NULL, 0)) != NULL) {
+                avpkt->data = data;
+                avpkt->size = size;
+            } else {
+                free(data);
+                av_packet_free(&avpkt);
             }
-            is_ready_write = true;	
+        } else {
+            avpkt = NewPacket(converter->GetConvertBuffer(), size);
         }
+    } else if (pkt->buf) {
+        // already Annex B, share the demuxer buffer
+        avpkt = av_packet_alloc();
+        if (avpkt && (avpkt->buf = av_buffer_ref(pkt->buf)) != NULL) {
+            avpkt->data = pkt->data;
+            avpkt->size = pkt->size;
+        } else {
+            av_packet_free(&avpkt);
+        }
+    } else {
+        avpkt = NewPacket(pkt->data, pkt->size);
     }
+    if (!avpkt)
+        return false;
+    avpkt->stream_index = 0;
+
+    // the demuxer's flag, else an IDR NAL when the data is Annex B (mp4/fmp4
+    // passthrough keeps avcC's length prefixes, which can't be scanned)
+    if (pkt->keyframe)
+        avpkt->flags |= AV_PKT_FLAG_KEY;
+    bool annexb = avpkt->size > 3 && avpkt->data[0] == 0 && avpkt->data[1] == 0 &&
+                  (avpkt->data[2] == 1 || (avpkt->data[2] == 0 && avpkt->data[3] == 1));
+    for (int i = 0; !pkt->keyframe && annexb && i + 3 < avpkt->size; i++) {
+        if (avpkt->data[i] == 0 && avpkt->data[i + 1] == 0 && avpkt->data[i + 2] == 1 &&
+            (avpkt->data[i + 3] & 0x1f) == 5) {
+            avpkt->flags |= AV_PKT_FLAG_KEY;
+            break;
+        }
+    }
+
+    // same as the encoder output, rescaled when written
+    avpkt->pts = pkt->pts == DVD_NOPTS_VALUE ? AV_NOPTS_VALUE : (int64_t)pkt->pts;
+    avpkt->dts = pkt->dts == DVD_NOPTS_VALUE ? AV_NOPTS_VALUE : (int64_t)pkt->dts;
+
+    CLOG(LOGDEBUG,"%s line %d VIDEO size %d pts %lld\n",__func__,__LINE__,avpkt->size,(long long)avpkt->pts);
+    return Queue(MUX_QUEUE_VIDEO, avpkt, avpkt->dts != AV_NOPTS_VALUE ? avpkt->dts : avpkt->pts);
 }
 
-bool OMXMuxer::AddPacket(AVPacket* pAvpkt)
+// SPS/PPS become config packets as they come from the encoder, the AUD the
+// first muxer added is dropped (mpegts adds its own)
+bool OMXMuxer::AddAnnexB(const uint8_t *data, int size, int64_t pts, int64_t dts, bool keyframe)
 {
-    if (is_ready_write == false) return true;
+    static const uint8_t start_code[4] = { 0, 0, 0, 1 };
+    if (passthrough) return false;
 
-    CLog::Log(LOGDEBUG,"%s line %d AUDIO pAvpkt->size %d pApkt->pts %lld\n",__func__,__LINE__,pAvpkt->size,pAvpkt->pts);
-    Lock();
-    int ret = av_interleaved_write_frame(o_context, pAvpkt);
-    av_packet_unref(pAvpkt);
-    UnLock();
-    return (0 == ret);
+    std::vector<uint8_t> frame;
+    int len, next_len;
+    int pos = FindStartCode(data, size, 0, &len);
+    while (pos < size) {
+        int next = FindStartCode(data, size, pos + len, &next_len);
+        const uint8_t *nal = data + pos + len;
+        int nal_size = next - (pos + len);
+        int nal_type = nal_size > 0 ? nal[0] & 0x1f : 0;
+        if (7 == nal_type || 8 == nal_type) {
+            std::vector<uint8_t> ps(start_code, start_code + 4);
+            ps.insert(ps.end(), nal, nal + nal_size);
+            AVPacket *config = NewPacket(&ps[0], ps.size());
+            if (!config || !Queue(MUX_QUEUE_VIDEO, config, 0, true))
+                return false;
+        } else if (nal_size > 0 && 9 != nal_type) {
+            frame.insert(frame.end(), start_code, start_code + 4);
+            frame.insert(frame.end(), nal, nal + nal_size);
+        }
+        pos = next;
+        len = next_len;
+    }
+    if (frame.empty())
+        return true;
+
+    AVPacket *pkt = NewPacket(&frame[0], frame.size());
+    if (!pkt)
+        return false;
+    pkt->stream_index = 0;
+    if (keyframe)
+        pkt->flags |= AV_PKT_FLAG_KEY;
+    pkt->pts = pts;
+    pkt->dts = dts;
+    return Queue(MUX_QUEUE_VIDEO, pkt, dts != AV_NOPTS_VALUE ? dts : pts);
 }
 
 AVFormatContext* OMXMuxer::CreatOutContext(AVFormatContext *i_context, const char *oname, int idx)
@@ -208,10 +922,10 @@ AVFormatContext* OMXMuxer::CreatOutContext(AVFormatContext *i_context, const cha
     AVCodecContext	*cc;
     int			streamindex = 0;
 
-    fmt = av_guess_format("mpegts", oname, NULL);
+    fmt = av_guess_format(format == MUX_FORMAT_TS ? "mpegts" : "mp4", NULL, NULL);
     if (!fmt) {
         MUX_PRINT("Can not guess format\n");
-        CLog::Log(LOGDEBUG, "Can not guess format\n");
+        CLOG(LOGDEBUG, "Can not guess format\n");
     }
 
     o_context = avformat_alloc_context();
@@ -226,30 +940,47 @@ AVFormatContext* OMXMuxer::CreatOutContext(AVFormatContext *i_context, const cha
     o_context->start_time_realtime = i_context->start_time_realtime;
     o_context->start_time = i_context->start_time;
     o_context->duration = i_context->duration;
-    o_context->bit_rate = i_context->bit_rate / 2;
 
     MUX_PRINT("INFO: %s %d i_context->nb_streams %d\n",__func__,__LINE__,i_context->nb_streams);
 
+    stream_map.assign(i_context->nb_streams, -1);
     for (i = 0; i < i_context->nb_streams; i++) {
         iflow = i_context->streams[i];
-        if (i == idx) { /* Creating codec context for Video */
+        if (i == idx && passthrough) { /* Copy video codec context, remuxed as is */
+            oflow = avformat_new_stream(o_context, iflow->codec->codec);
+            ASSERT(oflow != NULL);
+            avcodec_copy_context(oflow->codec, iflow->codec);
+            oflow->codec->codec_tag = 0;
+            oflow->time_base = iflow->time_base;
+            oflow->avg_frame_rate = iflow->avg_frame_rate;
+            oflow->r_frame_rate = iflow->r_frame_rate;
+            oflow->sample_aspect_ratio = iflow->sample_aspect_ratio;
+        } else if (i == idx) { /* Creating codec context for Video */
             oflow = avformat_new_stream(o_context, NULL);
             ASSERT(oflow != NULL);
             cc = oflow->codec;
-            cc->width = iflow->codec->width;
-            cc->height = iflow->codec->height;
+            cc->width = m_video_width ? m_video_width : iflow->codec->width;
+            cc->height = m_video_height ? m_video_height : iflow->codec->height;
             cc->codec_id = AV_CODEC_ID_H264;
             cc->codec_type = AVMEDIA_TYPE_VIDEO;
-            cc->bit_rate = iflow->codec->bit_rate / 2;
+            cc->bit_rate = m_video_bitrate;
+            cc->rc_max_rate = m_video_max_bitrate;
             cc->sample_aspect_ratio = iflow->codec->sample_aspect_ratio;
-            cc->profile = FF_PROFILE_H264_HIGH;
-            cc->level = 41;
+            if (cc->width != iflow->codec->width || cc->height != iflow->codec->height) {
+                // resized, the display aspect stays (as the encoder's pixel aspect does)
+                AVRational sar = cc->sample_aspect_ratio.num > 0 ? cc->sample_aspect_ratio : av_make_q(1, 1);
+                cc->sample_aspect_ratio = av_mul_q(sar, av_make_q(iflow->codec->width * cc->height,
+                                                                  iflow->codec->height * cc->width));
+            }
+            // from the SPS once it's out, WriteParameterSet
+            cc->profile = FF_PROFILE_UNKNOWN;
+            cc->level = FF_LEVEL_UNKNOWN;
             cc->time_base = iflow->codec->time_base;
 
-            oflow->avg_frame_rate = iflow->avg_frame_rate;
-            oflow->r_frame_rate = iflow->r_frame_rate;
+            oflow->avg_frame_rate = m_video_frame_rate.num ? m_video_frame_rate : iflow->avg_frame_rate;
+            oflow->r_frame_rate = m_video_frame_rate.num ? m_video_frame_rate : iflow->r_frame_rate;
             oflow->start_time = AV_NOPTS_VALUE;
-            oflow->sample_aspect_ratio = iflow->codec->sample_aspect_ratio;
+            oflow->sample_aspect_ratio = cc->sample_aspect_ratio;
 
             MUX_PRINT("resolution: %d/%d, bitrate %lld\n",
                       cc->width,
@@ -288,6 +1019,7 @@ AVFormatContext* OMXMuxer::CreatOutContext(AVFormatContext *i_context, const cha
             /* Reset the codec tag so as not to cause problems with output format */
             oflow->codec->codec_tag = 0; 
         }
+        stream_map[i] = oflow->index;
     }
 
     for (i = 0; i < o_context->nb_streams; i++) {
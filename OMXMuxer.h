@@ -19,6 +19,8 @@
 #include "OMXCore.h"
 #include "OMXStreamInfo.h"
 #include "OMXThread.h"
+#include "OMXReader.h"
+#include "BitstreamConverter.h"
 #include "utils/log.h"
 
 extern "C" {
@@ -34,46 +36,159 @@ extern "C" {
 #include <stdio.h>
 
 #include <string>
+#include <vector>
 #include <atomic>
 
 using namespace std;
 
-//Currently, processing muxer by using main loop.
-//TODO(truong): If having about performance pproblem, below solution will be confirmed,
-//OMXMuxer will inherit OMXThread.
-//Add packet --> add packet audio & video (convert from pBuffer) to queue.
-//Using thread context for getting result from queue for creating packet of http streaming?.
-//
+// output container
+enum EMUXFORMAT
+{
+  MUX_FORMAT_AUTO=0, // from the file name, mpegts unless it is .mp4/.mov
+  MUX_FORMAT_TS,     // mpegts, SPS/PPS in-band before keyframes
+  MUX_FORMAT_FMP4,   // fragmented mp4 (CMAF), a fragment per keyframe
+  MUX_FORMAT_MP4     // mp4 with the moov moved to the front at the end
+};
+
+// bytes queued for the muxer thread, producers block beyond this
+#define MUX_QUEUE_MAX_BYTES (8 * 1024 * 1024)
+
+enum
+{
+  MUX_QUEUE_VIDEO = 0,
+  MUX_QUEUE_AUDIO,
+  MUX_QUEUES
+};
+
+typedef struct OMXMuxerPacket
+{
+  AVPacket *pkt;
+  int64_t   ts;     // AV_TIME_BASE from the start of the input, to interleave
+  bool      config; // SPS/PPS from the encoder
+} OMXMuxerPacket;
 
-class OMXMuxer/* :  public OMXThread */
+typedef struct OMXMuxerSegment
+{
+  std::string name; // file name, relative to the playlist
+  double      duration;
+} OMXMuxerSegment;
+
+// one output of an ABR ladder, for the master playlist
+typedef struct OMXMuxerVariant
+{
+  std::string uri;  // media playlist, relative to the master one
+  int bandwidth;    // bits/s, peak
+  int width;
+  int height;
+} OMXMuxerVariant;
+
+typedef struct OMXMuxerStats
+{
+  unsigned int packets;
+  unsigned int max_depth;   // packets queued
+  double       avg_depth;
+  double       avg_write_us; // av_interleaved_write_frame
+  double       max_write_us;
+} OMXMuxerStats;
+
+// AddPacket only queues the packet, so the encoder callback and the reader
+// loop don't wait on disk. The muxer thread takes the earliest packet of the
+// video and audio queues and writes it.
+class OMXMuxer : public OMXThread
 {
 public:
   OMXMuxer();
   ~OMXMuxer();
-  bool Open(AVFormatContext *input_ctx, char* file);
+  // passthrough: the input video stream is remuxed, fed with AddPacket(OMXPacket*)
+  bool Open(AVFormatContext *input_ctx, char* file, bool passthrough = false, EMUXFORMAT format = MUX_FORMAT_AUTO);
+  // Before Open: file is then an HLS playlist, the output is cut at the first
+  // keyframe every duration seconds into <file without .m3u8>NNNNN.ts/.m4s.
+  // list_size > 0 keeps that many segments in the playlist and on disk.
+  void SetSegmenting(double duration, int list_size);
+  // Before Open: the encoded video stream as the encoder is set up, 0 keeps
+  // the input's size/frame rate. Profile and level are taken from the
+  // encoder's SPS.
+  void SetVideoOutput(int width, int height, int bitrate, int max_bitrate, AVRational frame_rate);
+  // Before Open: mpegts keeps the input's timestamps as they are (no mux
+  // delay added), for parts that are stitched together again
+  void SetKeepTimestamps(bool keep) { m_keep_timestamps = keep; }
+  // Before Open: the output's timestamps start from start (AV_TIME_BASE from
+  // the input start) at 0 instead of following the input's, 0 keeps them
+  void SetRebase(int64_t start) { m_rebase = start; }
+  // HLS master playlist over the media playlists of several muxers
+  static bool WriteMasterPlaylist(const char *file, const std::vector<OMXMuxerVariant> &variants);
+  // writes what is queued, then the trailer
   bool Close();
   bool Reset();
-  void Process();//TODO
+  void Process();
   bool AddPacket(OMX_BUFFERHEADERTYPE* pBuffer);//for video
-  bool AddPacket(AVPacket* pAvpkt);//for audio
+  bool AddPacket(AVPacket* pAvpkt);//for audio, the caller keeps pAvpkt
+  bool AddPacket(OMXPacket* pkt);//for passthrough video
+  // encoded video muxed once already (Annex B, pts/dts AV_TIME_BASE from the
+  // input start), goes the way the encoder's output does
+  bool AddAnnexB(const uint8_t *data, int size, int64_t pts, int64_t dts, bool keyframe);
+  OMXMuxerStats GetStats();
+  EMUXFORMAT GetFormat() { return format; }
+  static const char *FormatName(EMUXFORMAT format);
 
 private:
   AVFormatContext *CreatOutContext(AVFormatContext *i_context, const char *oname, int idx);
-  bool OmxBuf2AvPkt(OMX_BUFFERHEADERTYPE* pBuffer);
-  void WriteParameterSet(OMX_BUFFERHEADERTYPE* pBuffer);
-  int  httpStreaming(char*, char*);
+  AVPacket *OmxBuf2AvPkt(OMX_BUFFERHEADERTYPE* pBuffer);
+  bool Queue(int queue, AVPacket *pkt, int64_t ts, bool config = false);
+  void Write(int queue, OMXMuxerPacket &entry);
+  void WriteParameterSet(AVPacket *pkt);
+  bool PrependParameterSets(AVPacket *pkt);
+  bool WriteHeader();
+  bool AnnexBToAvcc(AVPacket *pkt);
+  bool OpenSegment();
+  bool CloseSegment(int64_t end_ts);
+  void WritePlaylist(bool end);
   FILE* p_test_file;
   char* filename;
   pthread_mutex_t m_lock;
+  pthread_cond_t m_packet_cond;
+  pthread_cond_t m_space_cond;
   void Lock();
   void UnLock();
 
+  std::deque<OMXMuxerPacket> m_queue[MUX_QUEUES];
+  unsigned int m_queue_bytes;
+  bool m_closing;
+  OMXMuxerStats m_stats;
+  double m_depth_sum;
+  double m_write_sum;
+
   AVOutputFormat *fmt;
   AVFormatContext *o_context;
   AVFormatContext *i_context;
   bool is_ready_write;
+  bool passthrough;
+  EMUXFORMAT format;
+  bool m_keep_timestamps;
+  int64_t m_rebase;
+  std::vector<int> stream_map; // input stream index to output, -1 if not muxed
+  int m_video_width;
+  int m_video_height;
+  int m_video_bitrate;
+  int m_video_max_bitrate;
+  AVRational m_video_frame_rate;
+
+  // segmenting, times are AV_TIME_BASE like OMXMuxerPacket::ts
+  int64_t m_segment_duration; // 0 when writing a single file
+  int m_segment_list_size;
+  std::string m_segment_base;
+  unsigned int m_segment_index;
+  int64_t m_segment_start;
+  int64_t m_segment_next;
+  int64_t m_segment_last; // last video packet
+  std::string m_segment_tmp;
+  std::deque<OMXMuxerSegment> m_playlist;
+  unsigned int m_playlist_sequence;
+  std::deque<std::string> m_segment_expired;
+  CBitstreamConverter *converter; // avcC to Annex B, NULL when already Annex B
   uint8_t *sps, *pps;
   int sps_size = 0, pps_size = 0;
+  bool m_parameter_sets_changed; // since the header, not yet in-band
   
 };
 #endif /*_OMX_MUXER_H_*/
@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2019/01 truong <truongptk30a3@gmail.com>
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ */
+
+#include "OMXPacketPool.h"
+#include "OMXReader.h"
+#include "utils/log.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#ifdef CLASSNAME
+#undef CLASSNAME
+#endif
+#define CLASSNAME "COMXPacketPool"
+
+// size classes 4 KiB .. 4 MiB
+#define PACKET_POOL_MIN_SHIFT   12
+#define PACKET_POOL_MAX_SHIFT   22
+#define PACKET_POOL_CLASSES     (PACKET_POOL_MAX_SHIFT - PACKET_POOL_MIN_SHIFT + 1)
+
+// spare entries kept around, beyond that memory goes back to the heap
+#define PACKET_POOL_MAX_PACKETS 256
+#define PACKET_POOL_MAX_DATA    32
+
+static pthread_mutex_t            g_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<OMXPacket*>    g_pool_packets;
+static std::vector<uint8_t*>      g_pool_data[PACKET_POOL_CLASSES];
+static OMXPacketPoolStats         g_pool_stats;
+
+static int SizeClass(unsigned int size)
+{
+    for (int i = 0; i < PACKET_POOL_CLASSES; i++)
+    {
+        if (size <= (1u << (PACKET_POOL_MIN_SHIFT + i)))
+            return i;
+    }
+    return -1;
+}
+
+OMXPacket *COMXPacketPool::GetPacket()
+{
+    OMXPacket *pkt = NULL;
+
+    pthread_mutex_lock(&g_pool_lock);
+    if (!g_pool_packets.empty())
+    {
+        pkt = g_pool_packets.back();
+        g_pool_packets.pop_back();
+        g_pool_stats.packet_hits++;
+    }
+    else
+    {
+        g_pool_stats.packet_misses++;
+    }
+    pthread_mutex_unlock(&g_pool_lock);
+
+    if (!pkt)
+        pkt = (OMXPacket *)malloc(sizeof(OMXPacket));
+    if (pkt)
+        memset(pkt, 0, sizeof(OMXPacket));
+    return pkt;
+}
+
+void COMXPacketPool::PutPacket(OMXPacket *pkt)
+{
+    if (!pkt)
+        return;
+
+    pthread_mutex_lock(&g_pool_lock);
+    if (g_pool_packets.size() < PACKET_POOL_MAX_PACKETS)
+    {
+        g_pool_packets.push_back(pkt);
+        pkt = NULL;
+    }
+    pthread_mutex_unlock(&g_pool_lock);
+
+    free(pkt);
+}
+
+uint8_t *COMXPacketPool::GetData(unsigned int size, unsigned int &capacity)
+{
+    uint8_t *data = NULL;
+    int size_class = SizeClass(size);
+
+    capacity = 0;
+
+    pthread_mutex_lock(&g_pool_lock);
+    if (size_class >= 0 && !g_pool_data[size_class].empty())
+    {
+        data = g_pool_data[size_class].back();
+        g_pool_data[size_class].pop_back();
+        g_pool_stats.data_hits++;
+    }
+    else
+    {
+        g_pool_stats.data_misses++;
+    }
+    pthread_mutex_unlock(&g_pool_lock);
+
+    if (size_class < 0)
+        return (uint8_t *)malloc(size + FF_INPUT_BUFFER_PADDING_SIZE);
+
+    capacity = 1u << (PACKET_POOL_MIN_SHIFT + size_class);
+    if (!data)
+    {
+        data = (uint8_t *)malloc(capacity + FF_INPUT_BUFFER_PADDING_SIZE);
+        if (!data)
+            capacity = 0;
+        else
+            memset(data + capacity, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+    }
+    return data;
+}
+
+void COMXPacketPool::PutData(uint8_t *data, unsigned int capacity)
+{
+    if (!data)
+        return;
+
+    int size_class = capacity ? SizeClass(capacity) : -1;
+
+    pthread_mutex_lock(&g_pool_lock);
+    if (size_class >= 0 && g_pool_data[size_class].size() < PACKET_POOL_MAX_DATA)
+    {
+        g_pool_data[size_class].push_back(data);
+        data = NULL;
+    }
+    pthread_mutex_unlock(&g_pool_lock);
+
+    free(data);
+}
+
+OMXPacketPoolStats COMXPacketPool::GetStats()
+{
+    pthread_mutex_lock(&g_pool_lock);
+    OMXPacketPoolStats stats = g_pool_stats;
+    pthread_mutex_unlock(&g_pool_lock);
+    return stats;
+}
+
+void COMXPacketPool::Clear()
+{
+    pthread_mutex_lock(&g_pool_lock);
+
+    CLOG(LOGINFO, "%s::%s - packets hit/miss %u/%u, payloads hit/miss %u/%u\n", CLASSNAME, __func__,
+         g_pool_stats.packet_hits, g_pool_stats.packet_misses, g_pool_stats.data_hits, g_pool_stats.data_misses);
+
+    for (size_t i = 0; i < g_pool_packets.size(); i++)
+        free(g_pool_packets[i]);
+    g_pool_packets.clear();
+
+    for (int c = 0; c < PACKET_POOL_CLASSES; c++)
+    {
+        for (size_t i = 0; i < g_pool_data[c].size(); i++)
+            free(g_pool_data[c][i]);
+        g_pool_data[c].clear();
+    }
+
+    memset(&g_pool_stats, 0, sizeof(g_pool_stats));
+    pthread_mutex_unlock(&g_pool_lock);
+}
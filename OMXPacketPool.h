@@ -0,0 +1,51 @@
+#pragma once
+/*
+ * Copyright (c) 2019/01 truong <truongptk30a3@gmail.com>
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ */
+
+// Recycles OMXPacket structs and payload buffers for the whole job, so the
+// reader -> OMXPlayerVideo -> decoder path doesn't malloc/free per packet.
+// Packets are freed by whichever thread is done with them, the free lists
+// are locked.
+//
+// Payloads come in power of two size classes, each buffer has
+// FF_INPUT_BUFFER_PADDING_SIZE spare bytes, zeroed when it is allocated.
+// Bigger payloads are plain mallocs (counted as misses).
+
+#include <stdint.h>
+
+struct OMXPacket;
+
+typedef struct OMXPacketPoolStats
+{
+    unsigned int packet_hits;
+    unsigned int packet_misses;
+    unsigned int data_hits;
+    unsigned int data_misses;
+} OMXPacketPoolStats;
+
+class COMXPacketPool
+{
+public:
+    // zeroed packet
+    static OMXPacket *GetPacket();
+    static void       PutPacket(OMXPacket *pkt);
+
+    // capacity is set to the pooled size, 0 for a plain malloc
+    static uint8_t   *GetData(unsigned int size, unsigned int &capacity);
+    static void       PutData(uint8_t *data, unsigned int capacity);
+
+    static OMXPacketPoolStats GetStats();
+    // frees the pooled memory and logs the counters
+    static void       Clear();
+};
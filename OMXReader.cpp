@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include "OMXReader.h"
+#include "OMXPacketPool.h"
 #include "linux/XMemUtils.h"
 
 #define MAX_DATA_SIZE_VIDEO    (8 * 1024 * 1024)
@@ -30,9 +31,11 @@
 
 static bool g_abort = false;
 
-static int64_t timeout_start;
+// the stall timer is per thread, each reader (and its prefetch thread) of
+// the jobs running side by side times its own reads
+static __thread int64_t timeout_start;
 static int64_t timeout_default_duration;
-static int64_t timeout_duration;
+static __thread int64_t timeout_duration;
 
 static int64_t CurrentHostCounter(void)
 {
@@ -47,7 +50,7 @@ static int64_t CurrentHostCounter(void)
     } while (0)
 
 
-OMXReader::OMXReader()
+OMXReader::OMXReader() : m_prefetch_thread(this)
 {
     m_open        = false;
     m_filename    = "";
@@ -67,6 +70,15 @@ OMXReader::OMXReader()
     ClearStreams();
 
     pthread_mutex_init(&m_lock, NULL);
+
+    m_prefetch_max_bytes = 0;
+    m_prefetch_max_time  = 0.0;
+    m_prefetch_stop      = false;
+    m_prefetch_eof       = false;
+    for(int i = 0; i < OMX_PREFETCH_QUEUES; i++)
+        m_prefetch[i].bytes = 0;
+    pthread_mutex_init(&m_prefetch_lock, NULL);
+    pthread_cond_init(&m_prefetch_cond, NULL);
 }
 
 OMXReader::~OMXReader()
@@ -74,6 +86,8 @@ OMXReader::~OMXReader()
     Close();
 
     pthread_mutex_destroy(&m_lock);
+    pthread_mutex_destroy(&m_prefetch_lock);
+    pthread_cond_destroy(&m_prefetch_cond);
 }
 
 void OMXReader::Lock()
@@ -91,12 +105,12 @@ static int interrupt_cb(void *unused)
     int ret = 0;
     if (g_abort)
     {
-        CLog::Log(LOGERROR, "COMXPlayer::interrupt_cb - Told to abort");
+        CLOG(LOGERROR, "COMXPlayer::interrupt_cb - Told to abort");
         ret = 1;
     }
     else if (timeout_duration && CurrentHostCounter() - timeout_start > timeout_duration)
     {
-        CLog::Log(LOGERROR, "COMXPlayer::interrupt_cb - Timed out");
+        CLOG(LOGERROR, "COMXPlayer::interrupt_cb - Timed out");
         ret = 1;
     }
     return ret;
@@ -153,7 +167,7 @@ bool OMXReader::Open(std::string filename, bool dump_format, bool live /* =false
 
     if (result < 0)
     {
-        CLog::Log(LOGERROR, "COMXPlayer::OpenFile - invalid lavfdopts %s ", lavfdopts.c_str());
+        CLOG(LOGERROR, "COMXPlayer::OpenFile - invalid lavfdopts %s ", lavfdopts.c_str());
         Close();
         return false;
     }
@@ -163,7 +177,7 @@ bool OMXReader::Open(std::string filename, bool dump_format, bool live /* =false
 
     if (result < 0)
     {
-        CLog::Log(LOGERROR, "COMXPlayer::OpenFile - invalid avdict %s ", avdict.c_str());
+        CLOG(LOGERROR, "COMXPlayer::OpenFile - invalid avdict %s ", avdict.c_str());
         Close();
         return false;
     }
@@ -212,18 +226,18 @@ bool OMXReader::Open(std::string filename, bool dump_format, bool live /* =false
                 av_dict_set(&d, "user_agent", user_agent.c_str(), 0);
             }
         }
-        CLog::Log(LOGDEBUG, "COMXPlayer::OpenFile - avformat_open_input %s ", m_filename.c_str());
+        CLOG(LOGDEBUG, "COMXPlayer::OpenFile - avformat_open_input %s ", m_filename.c_str());
         result = avformat_open_input(&m_pFormatContext, m_filename.c_str(), iformat, &d);
         if(av_dict_count(d) == 0)
         {
-            CLog::Log(LOGDEBUG, "COMXPlayer::OpenFile - avformat_open_input enabled SEEKING ");
+            CLOG(LOGDEBUG, "COMXPlayer::OpenFile - avformat_open_input enabled SEEKING ");
             if(m_filename.substr(0,7) == "http://")
                 m_pFormatContext->pb->seekable = AVIO_SEEKABLE_NORMAL;
         }
         av_dict_free(&d);
         if(result < 0)
         {
-            CLog::Log(LOGERROR, "COMXPlayer::OpenFile - avformat_open_input %s ", m_filename.c_str());
+            CLOG(LOGERROR, "COMXPlayer::OpenFile - avformat_open_input %s ", m_filename.c_str());
             Close();
             return false;
         }
@@ -234,7 +248,7 @@ bool OMXReader::Open(std::string filename, bool dump_format, bool live /* =false
 
         if (!m_pFile->Open(m_filename, flags))
         {
-            CLog::Log(LOGERROR, "COMXPlayer::OpenFile - %s ", m_filename.c_str());
+            CLOG(LOGERROR, "COMXPlayer::OpenFile - %s ", m_filename.c_str());
             Close();
             return false;
         }
@@ -252,7 +266,7 @@ bool OMXReader::Open(std::string filename, bool dump_format, bool live /* =false
 
         if(!iformat)
         {
-            CLog::Log(LOGERROR, "COMXPlayer::OpenFile - av_probe_input_buffer %s ", m_filename.c_str());
+            CLOG(LOGERROR, "COMXPlayer::OpenFile - av_probe_input_buffer %s ", m_filename.c_str());
             Close();
             return false;
         }
@@ -303,7 +317,7 @@ bool OMXReader::Open(std::string filename, bool dump_format, bool live /* =false
             unsigned rate = len * 1000 / tim;
             unsigned maxrate = rate + 1024 * 1024 / 8;
             if(m_pFile->IoControl(IOCTRL_CACHE_SETRATE, &maxrate) >= 0)
-                CLog::Log(LOGDEBUG, "COMXPlayer::OpenFile - set cache throttle rate to %u bytes per second", maxrate);
+                CLOG(LOGDEBUG, "COMXPlayer::OpenFile - set cache throttle rate to %u bytes per second", maxrate);
         }
     }
 
@@ -314,6 +328,13 @@ bool OMXReader::Open(std::string filename, bool dump_format, bool live /* =false
 
     UpdateCurrentPTS();
 
+    // local files only, the sidecar goes with the file
+    if(m_pFile && m_video_index >= 0)
+    {
+        int id = m_streams[m_video_index].id;
+        m_index.Open(m_filename, id, m_pFormatContext->streams[id]->time_base);
+    }
+
     m_open        = true;
     m_codec_type  = AVMEDIA_TYPE_UNKNOWN;
     return true;
@@ -350,11 +371,14 @@ void OMXReader::ClearStreams()
 
 bool OMXReader::Close()
 {
+    StopPrefetch();
+    m_index.Close();
+
     if (m_pFormatContext)
     {
         if (m_ioContext && m_pFormatContext->pb && m_pFormatContext->pb != m_ioContext)
         {
-            CLog::Log(LOGWARNING, "CDVDDemuxFFmpeg::Dispose - demuxer changed our byte context behind our back, possible memleak");
+            CLOG(LOGWARNING, "CDVDDemuxFFmpeg::Dispose - demuxer changed our byte context behind our back, possible memleak");
             m_ioContext = m_pFormatContext->pb;
         }
         avformat_close_input(&m_pFormatContext);
@@ -418,7 +442,7 @@ bool OMXReader::SeekTime(int time, bool backwords, double *startpts)
 
     if(m_pFile && !m_pFile->IoControl(IOCTRL_SEEK_POSSIBLE, NULL))
     {
-        CLog::Log(LOGDEBUG, "%s - input stream reports it is not seekable", __FUNCTION__);
+        CLOG(LOGDEBUG, "%s - input stream reports it is not seekable", __FUNCTION__);
         return false;
     }
 
@@ -433,8 +457,28 @@ bool OMXReader::SeekTime(int time, bool backwords, double *startpts)
     if (m_pFormatContext->start_time != (int64_t)AV_NOPTS_VALUE)
         seek_pts += m_pFormatContext->start_time;
 
+    // what is read from here on isn't the whole input in order
+    m_index.Abandon();
+
+    // formats that would bisect or scan the file for it (mpegts, mpeg ps)
+    // go straight to the indexed keyframe, the others have an index of their own
+    int entry = -1;
+    AVInputFormat *iformat = m_pFormatContext->iformat;
+    if (backwords && m_index.Loaded() && !iformat->read_seek && !iformat->read_seek2 &&
+        !(iformat->flags & (AVFMT_NO_BYTE_SEEK | AVFMT_NOTIMESTAMPS)))
+    {
+        AVStream *stream = m_pFormatContext->streams[m_index.Stream()];
+        entry = m_index.FindKeyframe(av_rescale_q(seek_pts, AV_TIME_BASE_Q, stream->time_base));
+        if (entry >= 0 && m_index.Entry(entry).pos < 0)
+            entry = -1;
+    }
+
     RESET_TIMEOUT(1);
-    int ret = av_seek_frame(m_pFormatContext, -1, seek_pts, backwords ? AVSEEK_FLAG_BACKWARD : 0);
+    int ret;
+    if (entry >= 0)
+        ret = av_seek_frame(m_pFormatContext, -1, m_index.Entry(entry).pos, AVSEEK_FLAG_BYTE);
+    else
+        ret = av_seek_frame(m_pFormatContext, -1, seek_pts, backwords ? AVSEEK_FLAG_BACKWARD : 0);
 
     if(ret >= 0)
         UpdateCurrentPTS();
@@ -451,7 +495,7 @@ bool OMXReader::SeekTime(int time, bool backwords, double *startpts)
         ret = 0;
     }
 
-    CLog::Log(LOGDEBUG, "OMXReader::SeekTime(%d) - seek ended up on time %d",time,(int)(m_iCurrentPts / DVD_TIME_BASE * 1000));
+    CLOG(LOGDEBUG, "OMXReader::SeekTime(%d) - seek ended up on time %d",time,(int)(m_iCurrentPts / DVD_TIME_BASE * 1000));
 
     UnLock();
 
@@ -488,6 +532,8 @@ OMXPacket *OMXReader::Read()
     result = av_read_frame(m_pFormatContext, &m_av_pkt);
     if (result < 0)
     {
+        if (result == AVERROR_EOF)
+            m_index.Finish();
         m_eof = true;
         //FlushRead();
         //av_free_packet(&m_av_pkt);
@@ -500,7 +546,7 @@ OMXPacket *OMXReader::Read()
         // XXX, in some cases ffmpeg returns a negative packet size
         if(m_pFormatContext->pb && !m_pFormatContext->pb->eof_reached)
         {
-            CLog::Log(LOGERROR, "OMXReader::Read no valid packet");
+            CLOG(LOGERROR, "OMXReader::Read no valid packet");
             //FlushRead();
         }
 
@@ -561,7 +607,11 @@ OMXPacket *OMXReader::Read()
         m_av_pkt.pts = AV_NOPTS_VALUE;
     }
 
-    m_omx_pkt = AllocPacket(m_av_pkt.size);
+    // with the timestamps as they are used
+    m_index.Add(m_av_pkt);
+
+    // takes over the demuxer buffer, freeing m_av_pkt leaves it alone
+    m_omx_pkt = AllocPacket(&m_av_pkt);
     /* oom error allocation av packet */
     if(!m_omx_pkt)
     {
@@ -573,20 +623,14 @@ OMXPacket *OMXReader::Read()
 
     m_omx_pkt->codec_type = pStream->codec->codec_type;
 
-    /* copy content into our own packet */
-    m_omx_pkt->size = m_av_pkt.size;
-
-
     if (m_streams[m_video_index].id == m_av_pkt.stream_index) {
-        CLog::Log(LOGDEBUG, "COMXReader::Read %s VIDEO FRAME %d\n",__func__,m_av_pkt.size);
+        CLOG(LOGDEBUG, "COMXReader::Read %s VIDEO FRAME %d\n",__func__,m_av_pkt.size);
     } else if (m_streams[m_audio_index].id == m_av_pkt.stream_index) {
-        CLog::Log(LOGDEBUG, "COMXReader::Read %s AUDIO FRAME %d\n",__func__,m_av_pkt.size);    
+        CLOG(LOGDEBUG, "COMXReader::Read %s AUDIO FRAME %d\n",__func__,m_av_pkt.size);    
     }
 
-    if (m_av_pkt.data)
-        memcpy(m_omx_pkt->data, m_av_pkt.data, m_omx_pkt->size);
-
     m_omx_pkt->stream_index = m_av_pkt.stream_index;
+    m_omx_pkt->keyframe = (m_av_pkt.flags & AV_PKT_FLAG_KEY) != 0;
     GetHints(pStream, &m_omx_pkt->hints);
 
     m_omx_pkt->dts = ConvertTimestamp(m_av_pkt.dts, pStream->time_base.den, pStream->time_base.num);
@@ -633,6 +677,226 @@ bool OMXReader::FreePacket()
     return true;
 }
 
+void OMXReaderPrefetch::Process()
+{
+    while(!m_bStop && !m_reader->m_prefetch_stop)
+        m_reader->Prefetch();
+}
+
+static void prefetch_endtime(struct timespec &endtime, long timeout)
+{
+    clock_gettime(CLOCK_REALTIME, &endtime);
+    long long nsec = endtime.tv_nsec + (long long)timeout * 1000000;
+    endtime.tv_sec += nsec / 1000000000;
+    endtime.tv_nsec = nsec % 1000000000;
+}
+
+bool OMXReader::StartPrefetch(unsigned int max_bytes, double max_time)
+{
+    if(!m_pFormatContext || IsPrefetching())
+        return false;
+
+    m_prefetch_max_bytes = max_bytes;
+    m_prefetch_max_time  = max_time;
+    m_prefetch_stop      = false;
+    m_prefetch_eof       = m_eof;
+
+    CLOG(LOGDEBUG, "OMXReader::StartPrefetch %u bytes %.1fs per stream type\n", max_bytes, max_time);
+
+    return m_prefetch_thread.Create();
+}
+
+void OMXReader::StopPrefetch()
+{
+    if(m_prefetch_thread.Running())
+    {
+        pthread_mutex_lock(&m_prefetch_lock);
+        m_prefetch_stop = true;
+        pthread_cond_broadcast(&m_prefetch_cond);
+        pthread_mutex_unlock(&m_prefetch_lock);
+
+        m_prefetch_thread.StopThread();
+    }
+    ClearPrefetch();
+}
+
+void OMXReader::ClearPrefetch()
+{
+    pthread_mutex_lock(&m_prefetch_lock);
+    for(int i = 0; i < OMX_PREFETCH_QUEUES; i++)
+    {
+        while(!m_prefetch[i].entries.empty())
+        {
+            OMXPrefetchEntry &entry = m_prefetch[i].entries.front();
+            if(entry.omx_pkt)
+                FreePacket(entry.omx_pkt);
+            if(entry.av_pkt)
+                av_packet_free(&entry.av_pkt);
+            m_prefetch[i].entries.pop_front();
+        }
+        m_prefetch[i].bytes = 0;
+    }
+    m_prefetch_eof = false;
+    pthread_mutex_unlock(&m_prefetch_lock);
+}
+
+// a queue always takes one packet, so a huge one can't stall the reader
+bool OMXReader::PrefetchFull(const OMXPrefetchQueue &queue)
+{
+    if(queue.entries.empty())
+        return false;
+    if(queue.bytes >= m_prefetch_max_bytes)
+        return true;
+
+    double first = queue.entries.front().ts;
+    double last  = queue.entries.back().ts;
+    return first != DVD_NOPTS_VALUE && last != DVD_NOPTS_VALUE &&
+           last - first >= m_prefetch_max_time * DVD_TIME_BASE;
+}
+
+// one packet from the demuxer into its queue, waits while that queue is full
+void OMXReader::Prefetch()
+{
+    OMXPrefetchEntry entry;
+    int queue = OMX_PREFETCH_VIDEO;
+
+    memset(&entry, 0, sizeof(entry));
+
+    if(m_prefetch_eof)
+    {
+        pthread_mutex_lock(&m_prefetch_lock);
+        while(!m_prefetch_stop)
+            pthread_cond_wait(&m_prefetch_cond, &m_prefetch_lock);
+        pthread_mutex_unlock(&m_prefetch_lock);
+        return;
+    }
+
+    OMXPacket *pkt = Read();
+    if(pkt)
+    {
+        if(pkt->codec_type != AVMEDIA_TYPE_VIDEO)
+        {
+            FreePacket(pkt);
+            return;
+        }
+        entry.omx_pkt = pkt;
+        entry.size    = pkt->size;
+        entry.ts      = pkt->dts != DVD_NOPTS_VALUE ? pkt->dts : pkt->pts;
+    }
+    else if(!m_eof && m_codec_type == AVMEDIA_TYPE_AUDIO)
+    {
+        // Read() left the packet in m_av_pkt, as for GetPacket()
+        entry.av_pkt = av_packet_alloc();
+        if(!entry.av_pkt)
+        {
+            av_free_packet(&m_av_pkt);
+            return;
+        }
+        av_packet_move_ref(entry.av_pkt, &m_av_pkt);
+
+        AVStream *stream = m_pFormatContext->streams[entry.av_pkt->stream_index];
+        int64_t ts = entry.av_pkt->dts != (int64_t)AV_NOPTS_VALUE ? entry.av_pkt->dts : entry.av_pkt->pts;
+        entry.size = entry.av_pkt->size;
+        entry.ts   = ConvertTimestamp(ts, stream->time_base.den, stream->time_base.num);
+        queue      = OMX_PREFETCH_AUDIO;
+    }
+    else
+    {
+        pthread_mutex_lock(&m_prefetch_lock);
+        m_prefetch_eof = m_eof;
+        pthread_cond_broadcast(&m_prefetch_cond);
+        pthread_mutex_unlock(&m_prefetch_lock);
+        return;
+    }
+
+    pthread_mutex_lock(&m_prefetch_lock);
+    while(PrefetchFull(m_prefetch[queue]) && !m_prefetch_stop)
+        pthread_cond_wait(&m_prefetch_cond, &m_prefetch_lock);
+
+    if(!m_prefetch_stop)
+    {
+        m_prefetch[queue].entries.push_back(entry);
+        m_prefetch[queue].bytes += entry.size;
+        pthread_cond_broadcast(&m_prefetch_cond);
+        entry.omx_pkt = NULL;
+        entry.av_pkt  = NULL;
+    }
+    pthread_mutex_unlock(&m_prefetch_lock);
+
+    if(entry.omx_pkt)
+        FreePacket(entry.omx_pkt);
+    if(entry.av_pkt)
+        av_packet_free(&entry.av_pkt);
+}
+
+bool OMXReader::PopPrefetch(int queue, long timeout, OMXPrefetchEntry &entry)
+{
+    bool ret = false;
+    struct timespec endtime;
+    prefetch_endtime(endtime, timeout);
+
+    pthread_mutex_lock(&m_prefetch_lock);
+    while(m_prefetch[queue].entries.empty() && !m_prefetch_eof && !m_prefetch_stop && timeout != 0)
+    {
+        if(pthread_cond_timedwait(&m_prefetch_cond, &m_prefetch_lock, &endtime) != 0)
+            break;
+    }
+    if(!m_prefetch[queue].entries.empty())
+    {
+        entry = m_prefetch[queue].entries.front();
+        m_prefetch[queue].entries.pop_front();
+        m_prefetch[queue].bytes -= entry.size;
+        // room for the reader
+        pthread_cond_broadcast(&m_prefetch_cond);
+        ret = true;
+    }
+    pthread_mutex_unlock(&m_prefetch_lock);
+
+    return ret;
+}
+
+OMXPacket *OMXReader::ReadVideo(long timeout)
+{
+    OMXPrefetchEntry entry;
+    if(!PopPrefetch(OMX_PREFETCH_VIDEO, timeout, entry))
+        return NULL;
+    return entry.omx_pkt;
+}
+
+AVPacket *OMXReader::ReadAudio(long timeout)
+{
+    OMXPrefetchEntry entry;
+    if(!PopPrefetch(OMX_PREFETCH_AUDIO, timeout, entry))
+        return NULL;
+    return entry.av_pkt;
+}
+
+bool OMXReader::WaitForPacket(long timeout)
+{
+    struct timespec endtime;
+    prefetch_endtime(endtime, timeout);
+
+    pthread_mutex_lock(&m_prefetch_lock);
+    while(m_prefetch[OMX_PREFETCH_VIDEO].entries.empty() && m_prefetch[OMX_PREFETCH_AUDIO].entries.empty() &&
+          !m_prefetch_eof && !m_prefetch_stop)
+    {
+        if(pthread_cond_timedwait(&m_prefetch_cond, &m_prefetch_lock, &endtime) != 0)
+            break;
+    }
+    bool ret = !m_prefetch[OMX_PREFETCH_VIDEO].entries.empty() || !m_prefetch[OMX_PREFETCH_AUDIO].entries.empty();
+    pthread_mutex_unlock(&m_prefetch_lock);
+
+    return ret;
+}
+
+bool OMXReader::PrefetchDone()
+{
+    pthread_mutex_lock(&m_prefetch_lock);
+    bool ret = m_prefetch_eof && m_prefetch[OMX_PREFETCH_VIDEO].entries.empty() && m_prefetch[OMX_PREFETCH_AUDIO].entries.empty();
+    pthread_mutex_unlock(&m_prefetch_lock);
+    return ret;
+}
+
 
 bool OMXReader::GetStreams()
 {
@@ -1020,38 +1284,73 @@ void OMXReader::FreePacket(OMXPacket *pkt)
 {
     if(pkt)
     {
-        if(pkt->data)
-            free(pkt->data);
-        free(pkt);
+        if(pkt->buf)
+            av_buffer_unref(&pkt->buf);
+        else
+            COMXPacketPool::PutData(pkt->data, pkt->data_capacity);
+        COMXPacketPool::PutPacket(pkt);
     }
 }
 
-OMXPacket *OMXReader::AllocPacket(int size)
+static OMXPacket *NewPacket()
 {
-    OMXPacket *pkt = (OMXPacket *)malloc(sizeof(OMXPacket));
+    OMXPacket *pkt = COMXPacketPool::GetPacket();
     if(pkt)
     {
-        memset(pkt, 0, sizeof(OMXPacket));
+        pkt->dts  = DVD_NOPTS_VALUE;
+        pkt->pts  = DVD_NOPTS_VALUE;
+        pkt->now  = DVD_NOPTS_VALUE;
+        pkt->duration = DVD_NOPTS_VALUE;
+        pkt->keyframe = false;
+    }
+    return pkt;
+}
 
-        pkt->data = (uint8_t*) malloc(size + FF_INPUT_BUFFER_PADDING_SIZE);
+OMXPacket *OMXReader::AllocPacket(int size)
+{
+    OMXPacket *pkt = NewPacket();
+    if(pkt)
+    {
+        pkt->data = COMXPacketPool::GetData(size, pkt->data_capacity);
         if(!pkt->data)
         {
-            free(pkt);
+            COMXPacketPool::PutPacket(pkt);
             pkt = NULL;
         }
         else
         {
             memset(pkt->data + size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
             pkt->size = size;
-            pkt->dts  = DVD_NOPTS_VALUE;
-            pkt->pts  = DVD_NOPTS_VALUE;
-            pkt->now  = DVD_NOPTS_VALUE;
-            pkt->duration = DVD_NOPTS_VALUE;
         }
     }
     return pkt;
 }
 
+// Packet on the payload of av_pkt. A refcounted payload (what av_read_frame
+// returns) is moved, not copied: the packet holds the reference and
+// av_pkt->buf is cleared. Other payloads are copied.
+OMXPacket *OMXReader::AllocPacket(AVPacket *av_pkt)
+{
+    if(!av_pkt->buf)
+    {
+        OMXPacket *pkt = AllocPacket(av_pkt->size);
+        if(pkt && av_pkt->data)
+            memcpy(pkt->data, av_pkt->data, av_pkt->size);
+        return pkt;
+    }
+
+    OMXPacket *pkt = NewPacket();
+    if(pkt)
+    {
+        // lavf buffers come with AV_INPUT_BUFFER_PADDING_SIZE zeroed bytes
+        pkt->buf  = av_pkt->buf;
+        pkt->data = av_pkt->data;
+        pkt->size = av_pkt->size;
+        av_pkt->buf  = NULL;
+    }
+    return pkt;
+}
+
 bool OMXReader::SetActiveStream(OMXStreamType type, unsigned int index)
 {
     bool ret = false;
@@ -1193,6 +1492,42 @@ void OMXReader::SetSpeed(int iSpeed)
     }
 }
 
+bool OMXReader::ScanKeyframes(std::vector<double> &keyframes)
+{
+    keyframes.clear();
+    if(!m_pFormatContext || m_video_index < 0)
+        return false;
+
+    if(m_index.Loaded())
+    {
+        AVStream *stream = m_pFormatContext->streams[m_index.Stream()];
+        const std::vector<unsigned int> &entries = m_index.Keyframes();
+        for(size_t i = 0; i < entries.size(); i++)
+        {
+            int64_t ts = COMXReaderIndex::KeyTime(m_index.Entry(entries[i]));
+            if(ts != (int64_t)AV_NOPTS_VALUE)
+                keyframes.push_back(ConvertTimestamp(ts, stream->time_base.den, stream->time_base.num));
+        }
+        return !keyframes.empty();
+    }
+
+    while(!m_eof)
+    {
+        OMXPacket *pkt = Read();
+        if(!pkt)
+        {
+            // the audio is left in m_av_pkt
+            if(!m_eof && m_codec_type == AVMEDIA_TYPE_AUDIO)
+                av_free_packet(&m_av_pkt);
+            continue;
+        }
+        if(pkt->keyframe && IsActive(OMXSTREAM_VIDEO, pkt->stream_index))
+            keyframes.push_back(pkt->pts != DVD_NOPTS_VALUE ? pkt->pts : pkt->dts);
+        FreePacket(pkt);
+    }
+    return !keyframes.empty();
+}
+
 int OMXReader::GetStreamLength()
 {
     if (!m_pFormatContext)
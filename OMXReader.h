@@ -37,8 +37,11 @@ extern "C" {
 #include "OMXStreamInfo.h"
 #include "OMXThread.h"
 #include "OMXCore.h"
+#include "OMXReaderIndex.h"
 
 #include <queue>
+#include <deque>
+#include <vector>
 
 #include "OMXStreamInfo.h"
 
@@ -78,7 +81,10 @@ typedef struct OMXPacket
   double    duration; // duration in DVD_TIME_BASE if available
   int       size;
   uint8_t   *data;
+  AVBufferRef *buf; // demuxer buffer data points into, NULL when data is ours
+  unsigned int data_capacity; // COMXPacketPool size class of data, 0 if malloc'ed
   int       stream_index;
+  bool      keyframe;
   COMXStreamInfo hints;
   enum AVMediaType codec_type;
 } OMXPacket;
@@ -105,8 +111,35 @@ typedef struct OMXStream
   COMXStreamInfo hints;
 } OMXStream;
 
+// Thread demuxing ahead of the consumers, see OMXReader::StartPrefetch.
+class OMXReaderPrefetch : public OMXThread
+{
+public:
+  OMXReaderPrefetch(OMXReader *reader) : m_reader(reader) {}
+  void Process();
+private:
+  OMXReader *m_reader;
+};
+
+typedef struct OMXPrefetchEntry
+{
+  OMXPacket *omx_pkt; // video
+  AVPacket  *av_pkt;  // audio, untouched for the muxer
+  int       size;
+  double    ts;       // dts, else pts, in DVD_TIME_BASE
+} OMXPrefetchEntry;
+
+typedef struct OMXPrefetchQueue
+{
+  std::deque<OMXPrefetchEntry> entries;
+  unsigned int bytes;
+} OMXPrefetchQueue;
+
+enum { OMX_PREFETCH_VIDEO = 0, OMX_PREFETCH_AUDIO, OMX_PREFETCH_QUEUES };
+
 class OMXReader
 {
+  friend class OMXReaderPrefetch;
 protected:
   int                       m_video_index;
   int                       m_audio_index;
@@ -138,6 +171,21 @@ protected:
   void UnLock();
   bool SetActiveStreamInternal(OMXStreamType type, unsigned int index);
   bool                      m_seek;
+  COMXReaderIndex           m_index;
+
+  // read-ahead
+  OMXReaderPrefetch         m_prefetch_thread;
+  pthread_mutex_t           m_prefetch_lock;
+  pthread_cond_t            m_prefetch_cond;
+  OMXPrefetchQueue          m_prefetch[OMX_PREFETCH_QUEUES];
+  unsigned int              m_prefetch_max_bytes;
+  double                    m_prefetch_max_time;
+  volatile bool             m_prefetch_stop;
+  bool                      m_prefetch_eof;
+  void Prefetch();
+  bool PrefetchFull(const OMXPrefetchQueue &queue);
+  bool PopPrefetch(int queue, long timeout, OMXPrefetchEntry &entry);
+  void ClearPrefetch();
 private:
 public:
   OMXReader();
@@ -152,6 +200,20 @@ public:
   AVPacket *GetPacket();
   bool FreePacket();
 
+  // Read-ahead: av_read_frame runs on its own thread and fills a video and
+  // an audio queue, each bounded in bytes and in duration (seconds). Read()
+  // must not be used meanwhile.
+  bool StartPrefetch(unsigned int max_bytes, double max_time);
+  void StopPrefetch();
+  bool IsPrefetching() { return m_prefetch_thread.Running(); }
+  // timeout in ms, NULL if nothing is queued in time
+  OMXPacket *ReadVideo(long timeout);
+  AVPacket  *ReadAudio(long timeout); // free with av_packet_free
+  // until some packet is queued, false on timeout or once PrefetchDone
+  bool WaitForPacket(long timeout);
+  // end of input and every queued packet consumed
+  bool PrefetchDone();
+
   void Process();
   bool GetStreams();
   void AddStream(int id);
@@ -173,6 +235,7 @@ public:
   OMXChapter GetChapter(unsigned int chapter) { return m_chapters[(chapter > MAX_OMX_CHAPTERS) ? MAX_OMX_CHAPTERS : chapter]; };
   static void FreePacket(OMXPacket *pkt);
   static OMXPacket *AllocPacket(int size);
+  static OMXPacket *AllocPacket(AVPacket *av_pkt);
   void SetSpeed(int iSpeed);
   void UpdateCurrentPTS();
   double ConvertTimestamp(int64_t pts, int den, int num);
@@ -193,6 +256,10 @@ public:
   }
 
   int GetStreamLength();
+  // Video keyframe times (DVD_TIME_BASE, pts or else dts as Read() gives
+  // them), from the index when there is one. Otherwise from a pass over the
+  // whole input, which builds it, and the reader is at its end after.
+  bool ScanKeyframes(std::vector<double> &keyframes);
   static double NormalizeFrameduration(double frameduration);
   bool IsMatroska() { return m_bMatroska; };
   std::string GetCodecName(OMXStreamType type);
@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2019/01 truong <truongptk30a3@gmail.com>
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ */
+
+#include "OMXReaderIndex.h"
+#include "utils/log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifdef CLASSNAME
+#undef CLASSNAME
+#endif
+#define CLASSNAME "COMXReaderIndex"
+
+COMXReaderIndex::COMXReaderIndex()
+{
+    m_stream     = -1;
+    m_time_base  = av_make_q(0, 1);
+    m_file_size  = 0;
+    m_mtime_sec  = 0;
+    m_mtime_nsec = 0;
+    m_map        = NULL;
+    m_map_size   = 0;
+    m_entries    = NULL;
+    m_count      = 0;
+    m_building   = false;
+    m_finished   = false;
+}
+
+COMXReaderIndex::~COMXReaderIndex()
+{
+    Close();
+}
+
+// $XDG_CACHE_HOME/omxtranscoder/<absolute path, / as %>.omxidx
+std::string COMXReaderIndex::CachePath(const std::string &file, bool create)
+{
+    char real[PATH_MAX];
+    if (!realpath(file.c_str(), real))
+        return "";
+
+    std::string dir;
+    const char *cache = getenv("XDG_CACHE_HOME");
+    const char *home  = getenv("HOME");
+    if (cache && *cache)
+        dir = cache;
+    else if (home && *home)
+        dir = std::string(home) + "/.cache";
+    else
+        return "";
+    if (create)
+        mkdir(dir.c_str(), 0755);
+    dir += "/omxtranscoder";
+    if (create)
+        mkdir(dir.c_str(), 0755);
+
+    std::string name = real;
+    for (size_t i = 0; i < name.size(); i++)
+    {
+        if (name[i] == '/')
+            name[i] = '%';
+    }
+    return dir + "/" + name + OMX_INDEX_SUFFIX;
+}
+
+bool COMXReaderIndex::Open(const std::string &file, int stream, AVRational time_base)
+{
+    Close();
+
+    struct stat input;
+    if (stat(file.c_str(), &input) != 0 || !S_ISREG(input.st_mode))
+        return false;
+
+    m_file       = file;
+    m_stream     = stream;
+    m_time_base  = time_base;
+    m_file_size  = input.st_size;
+    m_mtime_sec  = input.st_mtim.tv_sec;
+    m_mtime_nsec = input.st_mtim.tv_nsec;
+
+    if (Map(file + OMX_INDEX_SUFFIX, input) || Map(CachePath(file, false), input))
+    {
+        for (unsigned int i = 0; i < m_count; i++)
+        {
+            if (m_entries[i].flags & AV_PKT_FLAG_KEY)
+                m_keyframes.push_back(i);
+        }
+        CLOG(LOGDEBUG, "%s::%s - %s: %u packets, %u keyframes\n", CLASSNAME, __func__,
+             file.c_str(), m_count, (unsigned int)m_keyframes.size());
+        return true;
+    }
+
+    m_building = true;
+    m_finished = false;
+    m_build.clear();
+    return true;
+}
+
+// a sidecar of the same input as it is now, for the same stream
+bool COMXReaderIndex::Map(const std::string &path, const struct stat &input)
+{
+    if (path.empty())
+        return false;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(OMXIndexHeader))
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    const OMXIndexHeader *header = (const OMXIndexHeader *)map;
+    if (memcmp(header->magic, OMX_INDEX_MAGIC, sizeof(header->magic)) ||
+        header->file_size != m_file_size || header->mtime_sec != m_mtime_sec || header->mtime_nsec != m_mtime_nsec ||
+        header->stream != m_stream || header->time_base_num != m_time_base.num ||
+        header->time_base_den != m_time_base.den ||
+        (uint64_t)st.st_size != sizeof(OMXIndexHeader) + (uint64_t)header->count * sizeof(OMXIndexEntry))
+    {
+        CLOG(LOGDEBUG, "%s::%s - %s is stale\n", CLASSNAME, __func__, path.c_str());
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    m_map      = map;
+    m_map_size = st.st_size;
+    m_entries  = (const OMXIndexEntry *)((const uint8_t *)map + sizeof(OMXIndexHeader));
+    m_count    = header->count;
+    return true;
+}
+
+void COMXReaderIndex::Close()
+{
+    // next to the input, or in the cache when that directory isn't ours
+    if (m_finished && !m_build.empty() && !Save(m_file + OMX_INDEX_SUFFIX))
+        Save(CachePath(m_file, true));
+
+    if (m_map)
+        munmap(m_map, m_map_size);
+    m_map      = NULL;
+    m_map_size = 0;
+    m_entries  = NULL;
+    m_count    = 0;
+    m_keyframes.clear();
+    m_building = false;
+    m_finished = false;
+    m_build.clear();
+    m_stream   = -1;
+    m_file.clear();
+}
+
+// to a temporary file renamed into place, jobs of the same input may race
+bool COMXReaderIndex::Save(const std::string &path)
+{
+    if (path.empty())
+        return false;
+    std::string tmp = path + ".XXXXXX";
+    int fd = mkstemp(&tmp[0]);
+    if (fd < 0)
+        return false;
+
+    OMXIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, OMX_INDEX_MAGIC, sizeof(header.magic));
+    header.file_size     = m_file_size;
+    header.mtime_sec     = m_mtime_sec;
+    header.mtime_nsec    = m_mtime_nsec;
+    header.stream        = m_stream;
+    header.time_base_num = m_time_base.num;
+    header.time_base_den = m_time_base.den;
+    header.count         = m_build.size();
+
+    size_t size = m_build.size() * sizeof(OMXIndexEntry);
+    bool ok = write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+              write(fd, &m_build[0], size) == (ssize_t)size;
+    fchmod(fd, 0644);
+    ok = close(fd) == 0 && ok && rename(tmp.c_str(), path.c_str()) == 0;
+    if (!ok)
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+    CLOG(LOGDEBUG, "%s::%s - %s: %u packets\n", CLASSNAME, __func__, path.c_str(), header.count);
+    return true;
+}
+
+void COMXReaderIndex::Add(const AVPacket &pkt)
+{
+    if (!m_building || pkt.stream_index != m_stream)
+        return;
+
+    OMXIndexEntry entry;
+    entry.pos   = pkt.pos;
+    entry.pts   = pkt.pts;
+    entry.dts   = pkt.dts;
+    entry.size  = pkt.size;
+    entry.flags = pkt.flags & AV_PKT_FLAG_KEY;
+    m_build.push_back(entry);
+}
+
+void COMXReaderIndex::Abandon()
+{
+    m_building = false;
+    m_finished = false;
+    m_build.clear();
+}
+
+int64_t COMXReaderIndex::KeyTime(const OMXIndexEntry &entry)
+{
+    return entry.pts != (int64_t)AV_NOPTS_VALUE ? entry.pts : entry.dts;
+}
+
+// keyframes are in presentation order, whatever the frames between them do
+int COMXReaderIndex::FindKeyframe(int64_t ts) const
+{
+    int lo = 0, hi = (int)m_keyframes.size() - 1, found = -1;
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        int64_t key = KeyTime(m_entries[m_keyframes[mid]]);
+        if (key != (int64_t)AV_NOPTS_VALUE && key <= ts)
+            found = mid, lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return found < 0 ? -1 : (int)m_keyframes[found];
+}
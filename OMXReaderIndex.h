@@ -0,0 +1,108 @@
+#pragma once
+/*
+ * Copyright (c) 2019/01 truong <truongptk30a3@gmail.com>
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ */
+
+// Packet index of a local input's video stream, kept in a sidecar file:
+// <file>.omxidx next to it, else under $XDG_CACHE_HOME (~/.cache)/omxtranscoder.
+//
+// The first read of a file from its start to its end builds it (Add, one
+// entry per video packet), Close then writes it. Later opens map it, as long
+// as the size and mtime of the file match, and the reader seeks and plans
+// from it without reading the file. Host byte order, it is only a cache.
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#define OMX_INDEX_MAGIC   "OMXIDX1"
+#define OMX_INDEX_SUFFIX  ".omxidx"
+
+typedef struct OMXIndexHeader
+{
+  char     magic[8];    // OMX_INDEX_MAGIC
+  uint64_t file_size;   // of the input when indexed
+  int64_t  mtime_sec;
+  int64_t  mtime_nsec;
+  int32_t  stream;      // AVStream index of the video
+  int32_t  time_base_num;
+  int32_t  time_base_den;
+  uint32_t count;       // entries that follow
+} OMXIndexHeader;
+
+typedef struct OMXIndexEntry
+{
+  int64_t  pos;         // byte offset in the input, -1 if unknown
+  int64_t  pts;         // stream time base as OMXReader::Read() takes them,
+  int64_t  dts;         // AV_NOPTS_VALUE if none
+  uint32_t size;
+  uint32_t flags;       // AV_PKT_FLAG_KEY
+} OMXIndexEntry;
+
+class COMXReaderIndex
+{
+public:
+  COMXReaderIndex();
+  ~COMXReaderIndex();
+
+  // The index of file's video stream, mapped when there is a valid one,
+  // otherwise Add() builds it. false for no local file.
+  bool Open(const std::string &file, int stream, AVRational time_base);
+  // writes the built index when the input was read to its end
+  void Close();
+
+  bool Loaded() const { return m_entries != NULL; }
+  int Stream() const { return m_stream; }
+  unsigned int Count() const { return m_count; }
+  const OMXIndexEntry &Entry(unsigned int i) const { return m_entries[i]; }
+  // entry numbers of the keyframes, in order
+  const std::vector<unsigned int> &Keyframes() const { return m_keyframes; }
+  // the last keyframe with pts (else dts) at or before ts, stream time
+  // base, -1 if none
+  int FindKeyframe(int64_t ts) const;
+  static int64_t KeyTime(const OMXIndexEntry &entry);
+
+  // building: a packet of the stream, read in order from the start
+  void Add(const AVPacket &pkt);
+  // the end of the input was read
+  void Finish() { m_finished = m_building; }
+  // the reader moved, what is built can't be complete
+  void Abandon();
+
+private:
+  bool Map(const std::string &path, const struct stat &input);
+  bool Save(const std::string &path);
+  static std::string CachePath(const std::string &file, bool create);
+
+  std::string                 m_file;
+  int                         m_stream;
+  AVRational                  m_time_base;
+  uint64_t                    m_file_size;
+  int64_t                     m_mtime_sec;
+  int64_t                     m_mtime_nsec;
+  // a mapped index
+  void                        *m_map;
+  size_t                      m_map_size;
+  const OMXIndexEntry         *m_entries;
+  unsigned int                m_count;
+  std::vector<unsigned int>   m_keyframes;
+  // one being built
+  bool                        m_building;
+  bool                        m_finished;
+  std::vector<OMXIndexEntry>  m_build;
+};
@@ -0,0 +1,1858 @@
+/*
+ * Copyright (c) 2019/01 truong <truongptk30a3@gmail.com>
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ */
+
+#if defined(HAVE_OMXLIB)
+#include "OMXSoftCore.h"
+#include "utils/log.h"
+#include "linux/XMemUtils.h"
+
+#include <algorithm>
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+}
+
+#ifdef CLASSNAME
+#undef CLASSNAME
+#endif
+#define CLASSNAME "COMXSoftComponent"
+
+#define OMX_SOFT_VIDEO_DECODER      "OMX.broadcom.video_decode"
+#define OMX_SOFT_VIDEO_ENCODER      "OMX.broadcom.video_encode"
+
+// same port numbering as the VideoCore components
+#define OMX_SOFT_DECODER_PORT       130
+#define OMX_SOFT_ENCODER_PORT       200
+
+// decoded frames / encoded packets held before input is back-pressured
+#define OMX_SOFT_MAX_FRAMES         2
+#define OMX_SOFT_MAX_PACKETS        4
+
+#define OMX_SOFT_ENC_INTRA_PERIOD   60
+
+enum
+{
+    SOFT_CB_EVENT,
+    SOFT_CB_EMPTY_DONE,
+    SOFT_CB_FILL_DONE
+};
+
+COMXSoftPort::COMXSoftPort()
+{
+    OMX_INIT_STRUCTURE(def);
+    def.bEnabled         = OMX_TRUE;
+    def.bPopulated       = OMX_FALSE;
+    def.eDomain          = OMX_PortDomainVideo;
+    def.nBufferAlignment = 16;
+    def.nBufferCountMin  = 1;
+    def.nBufferCountActual = 1;
+    enable_pending       = false;
+    disable_pending      = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+
+COMXSoftComponent::COMXSoftComponent(const std::string &component_name, OMX_U32 start_port)
+{
+    m_componentName = component_name;
+    m_app_data      = NULL;
+    m_state         = OMX_StateLoaded;
+    m_target_state  = OMX_StateLoaded;
+    m_busy          = NULL;
+    m_busy_freed    = false;
+    m_output_reconfig = false;
+
+    memset(&m_callbacks, 0, sizeof(m_callbacks));
+    memset(&m_handle, 0, sizeof(m_handle));
+    m_handle.nSize              = sizeof(m_handle);
+    m_handle.nVersion.nVersion  = OMX_VERSION;
+    m_handle.pComponentPrivate  = this;
+    m_handle.SendCommand        = &COMXSoftComponent::SendCommandCallback;
+    m_handle.GetParameter       = &COMXSoftComponent::GetParameterCallback;
+    m_handle.SetParameter       = &COMXSoftComponent::SetParameterCallback;
+    m_handle.GetConfig          = &COMXSoftComponent::GetConfigCallback;
+    m_handle.SetConfig          = &COMXSoftComponent::SetConfigCallback;
+    m_handle.GetState           = &COMXSoftComponent::GetStateCallback;
+    m_handle.UseBuffer          = &COMXSoftComponent::UseBufferCallback;
+    m_handle.AllocateBuffer     = &COMXSoftComponent::AllocateBufferCallback;
+    m_handle.FreeBuffer         = &COMXSoftComponent::FreeBufferCallback;
+    m_handle.EmptyThisBuffer    = &COMXSoftComponent::EmptyThisBufferCallback;
+    m_handle.FillThisBuffer     = &COMXSoftComponent::FillThisBufferCallback;
+    m_handle.UseEGLImage        = &COMXSoftComponent::UseEGLImageCallback;
+
+    InputPort().def.nPortIndex  = start_port;
+    InputPort().def.eDir        = OMX_DirInput;
+    OutputPort().def.nPortIndex = start_port + 1;
+    OutputPort().def.eDir       = OMX_DirOutput;
+
+    pthread_mutex_init(&m_soft_lock, NULL);
+    pthread_cond_init(&m_soft_cond, NULL);
+}
+
+COMXSoftComponent::~COMXSoftComponent()
+{
+    for(int i = 0; i < OMX_SOFT_PORTS; i++)
+    {
+        for(size_t j = 0; j < m_ports[i].buffers.size(); j++)
+            FreeHeader(m_ports[i].buffers[j]);
+        m_ports[i].buffers.clear();
+        m_ports[i].queue.clear();
+    }
+
+    pthread_mutex_destroy(&m_soft_lock);
+    pthread_cond_destroy(&m_soft_cond);
+}
+
+bool COMXSoftComponent::IsSoftComponent(const std::string &component_name)
+{
+    return component_name == OMX_SOFT_VIDEO_DECODER || component_name == OMX_SOFT_VIDEO_ENCODER;
+}
+
+OMX_ERRORTYPE COMXSoftComponent::GetHandle(OMX_HANDLETYPE *handle, const std::string &component_name,
+                                           OMX_PTR app_data, OMX_CALLBACKTYPE *callbacks)
+{
+    COMXSoftComponent *component = NULL;
+
+    if(!handle || !callbacks)
+        return OMX_ErrorBadParameter;
+
+    if(component_name == OMX_SOFT_VIDEO_DECODER)
+        component = new COMXSoftVideoDecoder(component_name);
+    else if(component_name == OMX_SOFT_VIDEO_ENCODER)
+        component = new COMXSoftVideoEncoder(component_name);
+
+    if(!component)
+    {
+        CLOG(LOGERROR, "%s::%s - no software component for %s\n", CLASSNAME, __func__, component_name.c_str());
+        *handle = NULL;
+        return OMX_ErrorComponentNotFound;
+    }
+
+    component->m_callbacks = *callbacks;
+    component->m_app_data  = app_data;
+    component->Create();
+
+    *handle = &component->m_handle;
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE COMXSoftComponent::FreeHandle(OMX_HANDLETYPE handle)
+{
+    COMXSoftComponent *component = FromHandle(handle);
+    if(!component)
+        return OMX_ErrorBadParameter;
+
+    component->LockComponent();
+    component->m_bStop = true;
+    pthread_cond_broadcast(&component->m_soft_cond);
+    component->UnLockComponent();
+    component->StopThread();
+
+    delete component;
+    return OMX_ErrorNone;
+}
+
+bool COMXSoftComponent::IsSoftHandle(OMX_HANDLETYPE handle)
+{
+    return handle && ((OMX_COMPONENTTYPE*)handle)->SendCommand == &COMXSoftComponent::SendCommandCallback;
+}
+
+COMXSoftComponent *COMXSoftComponent::FromHandle(OMX_HANDLETYPE handle)
+{
+    if(!handle)
+        return NULL;
+    return static_cast<COMXSoftComponent*>(((OMX_COMPONENTTYPE*)handle)->pComponentPrivate);
+}
+
+COMXSoftPort *COMXSoftComponent::GetPort(OMX_U32 port)
+{
+    for(int i = 0; i < OMX_SOFT_PORTS; i++)
+    {
+        if(m_ports[i].def.nPortIndex == port)
+            return &m_ports[i];
+    }
+    return NULL;
+}
+
+bool COMXSoftComponent::OutputReady()
+{
+    return OutputPort().def.bEnabled && !OutputPort().disable_pending && !m_output_reconfig;
+}
+
+void COMXSoftComponent::FreeHeader(OMX_BUFFERHEADERTYPE *header)
+{
+    if(header->pPlatformPrivate)
+        _aligned_free(header->pPlatformPrivate);
+    delete header;
+}
+
+void COMXSoftComponent::QueueCallback(int type, OMX_BUFFERHEADERTYPE *buffer,
+                                      OMX_EVENTTYPE eEvent, OMX_U32 nData1, OMX_U32 nData2)
+{
+    omx_soft_callback callback;
+
+    callback.type   = type;
+    callback.buffer = buffer;
+    callback.eEvent = eEvent;
+    callback.nData1 = nData1;
+    callback.nData2 = nData2;
+    m_pending_callbacks.push_back(callback);
+    pthread_cond_broadcast(&m_soft_cond);
+}
+
+void COMXSoftComponent::PostEvent(OMX_EVENTTYPE eEvent, OMX_U32 nData1, OMX_U32 nData2)
+{
+    LockComponent();
+    QueueCallback(SOFT_CB_EVENT, NULL, eEvent, nData1, nData2);
+    UnLockComponent();
+}
+
+void COMXSoftComponent::PortSettingsChanged(const OMX_PARAM_PORTDEFINITIONTYPE &def)
+{
+    LockComponent();
+    COMXSoftPort &port = OutputPort();
+
+    port.def.format           = def.format;
+    port.def.nBufferSize      = def.nBufferSize;
+    port.def.nBufferCountMin  = def.nBufferCountMin;
+    if(port.def.nBufferCountActual < port.def.nBufferCountMin)
+        port.def.nBufferCountActual = port.def.nBufferCountMin;
+    if(!port.def.format.video.xFramerate)
+        port.def.format.video.xFramerate = InputPort().def.format.video.xFramerate;
+
+    m_output_reconfig = true;
+    QueueCallback(SOFT_CB_EVENT, NULL, OMX_EventPortSettingsChanged, port.def.nPortIndex, 0);
+    UnLockComponent();
+}
+
+// callbacks are raised one at a time without the component lock, like the
+// VideoCore host thread does, so the client may call back into the component
+void COMXSoftComponent::DispatchCallbacks()
+{
+    while(!m_pending_callbacks.empty())
+    {
+        omx_soft_callback callback = m_pending_callbacks.front();
+        m_pending_callbacks.pop_front();
+
+        m_busy = callback.buffer;
+        UnLockComponent();
+
+        switch(callback.type)
+        {
+        case SOFT_CB_EVENT:
+            if(m_callbacks.EventHandler)
+                m_callbacks.EventHandler(&m_handle, m_app_data, callback.eEvent, callback.nData1, callback.nData2, NULL);
+            break;
+        case SOFT_CB_EMPTY_DONE:
+            if(m_callbacks.EmptyBufferDone)
+                m_callbacks.EmptyBufferDone(&m_handle, m_app_data, callback.buffer);
+            break;
+        case SOFT_CB_FILL_DONE:
+            if(m_callbacks.FillBufferDone)
+                m_callbacks.FillBufferDone(&m_handle, m_app_data, callback.buffer);
+            break;
+        }
+
+        LockComponent();
+        if(m_busy_freed)
+            FreeHeader(m_busy);
+        m_busy       = NULL;
+        m_busy_freed = false;
+    }
+}
+
+void COMXSoftComponent::ReturnBuffers(COMXSoftPort &port)
+{
+    while(!port.queue.empty())
+    {
+        OMX_BUFFERHEADERTYPE *buffer = port.queue.front();
+        port.queue.pop_front();
+
+        if(port.def.eDir == OMX_DirInput)
+        {
+            QueueCallback(SOFT_CB_EMPTY_DONE, buffer);
+        }
+        else
+        {
+            buffer->nFilledLen = 0;
+            buffer->nOffset    = 0;
+            buffer->nFlags     = 0;
+            QueueCallback(SOFT_CB_FILL_DONE, buffer);
+        }
+    }
+}
+
+void COMXSoftComponent::HandleStateSet(OMX_STATETYPE state)
+{
+    if(state == m_state)
+    {
+        QueueCallback(SOFT_CB_EVENT, NULL, OMX_EventError, (OMX_U32)OMX_ErrorSameState, 1);
+        return;
+    }
+
+    switch(state)
+    {
+    case OMX_StateIdle:
+        if(m_state == OMX_StateExecuting || m_state == OMX_StatePause)
+        {
+            ReturnBuffers(InputPort());
+            ReturnBuffers(OutputPort());
+            FlushCodec();
+            m_state = OMX_StateIdle;
+            QueueCallback(SOFT_CB_EVENT, NULL, OMX_EventCmdComplete, OMX_CommandStateSet, OMX_StateIdle);
+            return;
+        }
+        if(m_state == OMX_StateLoaded)
+        {
+            // completes once every enabled port is populated
+            m_target_state = OMX_StateIdle;
+            return;
+        }
+        break;
+    case OMX_StateLoaded:
+        if(m_state == OMX_StateIdle)
+        {
+            // completes once every buffer has been freed
+            m_target_state = OMX_StateLoaded;
+            return;
+        }
+        break;
+    case OMX_StateExecuting:
+    case OMX_StatePause:
+        if(m_state == OMX_StateIdle || m_state == OMX_StateExecuting || m_state == OMX_StatePause)
+        {
+            m_state        = state;
+            m_target_state = state;
+            QueueCallback(SOFT_CB_EVENT, NULL, OMX_EventCmdComplete, OMX_CommandStateSet, state);
+            return;
+        }
+        break;
+    default:
+        break;
+    }
+
+    CLOG(LOGERROR, "%s::%s - %s incorrect state transition %d -> %d\n", CLASSNAME, __func__,
+         m_componentName.c_str(), (int)m_state, (int)state);
+    QueueCallback(SOFT_CB_EVENT, NULL, OMX_EventError, (OMX_U32)OMX_ErrorIncorrectStateTransition, 0);
+}
+
+void COMXSoftComponent::HandleFlush(OMX_U32 port)
+{
+    for(int i = 0; i < OMX_SOFT_PORTS; i++)
+    {
+        if(port != OMX_ALL && port != m_ports[i].def.nPortIndex)
+            continue;
+
+        ReturnBuffers(m_ports[i]);
+        QueueCallback(SOFT_CB_EVENT, NULL, OMX_EventCmdComplete, OMX_CommandFlush, m_ports[i].def.nPortIndex);
+    }
+    // any data held between the ports belongs to the flushed stream
+    FlushCodec();
+}
+
+void COMXSoftComponent::HandleCommand(const omx_soft_command &command)
+{
+    switch(command.cmd)
+    {
+    case OMX_CommandStateSet:
+        HandleStateSet((OMX_STATETYPE)command.nParam);
+        break;
+    case OMX_CommandFlush:
+        HandleFlush(command.nParam);
+        break;
+    case OMX_CommandPortDisable:
+    case OMX_CommandPortEnable:
+        for(int i = 0; i < OMX_SOFT_PORTS; i++)
+        {
+            COMXSoftPort &port = m_ports[i];
+            if(command.nParam != OMX_ALL && command.nParam != port.def.nPortIndex)
+                continue;
+
+            if(command.cmd == OMX_CommandPortDisable)
+            {
+                port.def.bEnabled    = OMX_FALSE;
+                port.enable_pending  = false;
+                port.disable_pending = true;
+                ReturnBuffers(port);
+            }
+            else
+            {
+                port.def.bEnabled    = OMX_TRUE;
+                port.disable_pending = false;
+                port.enable_pending  = true;
+            }
+        }
+        break;
+    default:
+        QueueCallback(SOFT_CB_EVENT, NULL, OMX_EventError, (OMX_U32)OMX_ErrorNotImplemented, 0);
+        break;
+    }
+}
+
+void COMXSoftComponent::CheckTransitions()
+{
+    bool populated = true;
+    bool empty     = true;
+
+    for(int i = 0; i < OMX_SOFT_PORTS; i++)
+    {
+        COMXSoftPort &port = m_ports[i];
+
+        port.def.bPopulated = (!port.buffers.empty() && port.buffers.size() >= port.def.nBufferCountActual) ? OMX_TRUE : OMX_FALSE;
+
+        if(port.disable_pending && port.buffers.empty())
+        {
+            port.disable_pending = false;
+            QueueCallback(SOFT_CB_EVENT, NULL, OMX_EventCmdComplete, OMX_CommandPortDisable, port.def.nPortIndex);
+        }
+
+        if(port.enable_pending && (port.def.bPopulated || (m_state == OMX_StateLoaded && m_target_state == OMX_StateLoaded)))
+        {
+            port.enable_pending = false;
+            if(port.def.eDir == OMX_DirOutput)
+                m_output_reconfig = false;
+            QueueCallback(SOFT_CB_EVENT, NULL, OMX_EventCmdComplete, OMX_CommandPortEnable, port.def.nPortIndex);
+        }
+
+        if(port.def.bEnabled && !port.def.bPopulated)
+            populated = false;
+        if(!port.buffers.empty())
+            empty = false;
+    }
+
+    if(m_state == OMX_StateLoaded && m_target_state == OMX_StateIdle && populated)
+    {
+        m_state = OMX_StateIdle;
+        QueueCallback(SOFT_CB_EVENT, NULL, OMX_EventCmdComplete, OMX_CommandStateSet, OMX_StateIdle);
+    }
+    else if(m_state == OMX_StateIdle && m_target_state == OMX_StateLoaded && empty)
+    {
+        CloseCodec();
+        m_state = OMX_StateLoaded;
+        QueueCallback(SOFT_CB_EVENT, NULL, OMX_EventCmdComplete, OMX_CommandStateSet, OMX_StateLoaded);
+    }
+}
+
+void COMXSoftComponent::Process()
+{
+    LockComponent();
+    while(!m_bStop)
+    {
+        bool progress = false;
+
+        if(!m_commands.empty())
+        {
+            omx_soft_command command = m_commands.front();
+            m_commands.pop_front();
+            HandleCommand(command);
+            progress = true;
+        }
+
+        CheckTransitions();
+
+        if(m_state == OMX_StateExecuting && m_commands.empty())
+        {
+            if(OutputReady() && !OutputPort().queue.empty() && HasOutput())
+            {
+                OMX_BUFFERHEADERTYPE *buffer = OutputPort().queue.front();
+                OutputPort().queue.pop_front();
+
+                m_busy = buffer;
+                UnLockComponent();
+                ProcessOutput(buffer);
+                LockComponent();
+
+                if(m_busy_freed)
+                {
+                    FreeHeader(buffer);
+                }
+                else
+                {
+                    QueueCallback(SOFT_CB_FILL_DONE, buffer);
+                    if(buffer->nFlags & OMX_BUFFERFLAG_EOS)
+                        QueueCallback(SOFT_CB_EVENT, NULL, OMX_EventBufferFlag, OutputPort().def.nPortIndex, buffer->nFlags);
+                }
+                m_busy       = NULL;
+                m_busy_freed = false;
+                progress     = true;
+            }
+
+            if(InputPort().def.bEnabled && !InputPort().queue.empty() && CanAcceptInput())
+            {
+                OMX_BUFFERHEADERTYPE *buffer = InputPort().queue.front();
+                InputPort().queue.pop_front();
+
+                m_busy = buffer;
+                UnLockComponent();
+                ProcessInput(buffer);
+                LockComponent();
+
+                if(m_busy_freed)
+                {
+                    FreeHeader(buffer);
+                }
+                else
+                {
+                    buffer->nFilledLen = 0;
+                    buffer->nOffset    = 0;
+                    QueueCallback(SOFT_CB_EMPTY_DONE, buffer);
+                }
+                m_busy       = NULL;
+                m_busy_freed = false;
+                progress     = true;
+            }
+        }
+
+        if(!m_pending_callbacks.empty())
+        {
+            DispatchCallbacks();
+            progress = true;
+        }
+
+        if(!progress)
+            pthread_cond_wait(&m_soft_cond, &m_soft_lock);
+    }
+    UnLockComponent();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+// client side, called through the OMX_COMPONENTTYPE function table
+
+OMX_ERRORTYPE COMXSoftComponent::DoSendCommand(OMX_COMMANDTYPE cmd, OMX_U32 nParam)
+{
+    if(cmd != OMX_CommandStateSet && cmd != OMX_CommandFlush && nParam != OMX_ALL && !GetPort(nParam))
+        return OMX_ErrorBadPortIndex;
+
+    omx_soft_command command;
+    command.cmd    = cmd;
+    command.nParam = nParam;
+
+    LockComponent();
+    m_commands.push_back(command);
+    pthread_cond_broadcast(&m_soft_cond);
+    UnLockComponent();
+
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE COMXSoftComponent::DoGetParameter(OMX_INDEXTYPE index, OMX_PTR param)
+{
+    OMX_ERRORTYPE omx_err = OMX_ErrorNone;
+
+    if(!param)
+        return OMX_ErrorBadParameter;
+
+    LockComponent();
+    switch(index)
+    {
+    case OMX_IndexParamAudioInit:
+    case OMX_IndexParamImageInit:
+    case OMX_IndexParamOtherInit:
+    case OMX_IndexParamVideoInit:
+    {
+        OMX_PORT_PARAM_TYPE *ports = (OMX_PORT_PARAM_TYPE *)param;
+        ports->nPorts           = index == OMX_IndexParamVideoInit ? OMX_SOFT_PORTS : 0;
+        ports->nStartPortNumber = index == OMX_IndexParamVideoInit ? InputPort().def.nPortIndex : 0;
+        break;
+    }
+    case OMX_IndexParamPortDefinition:
+    {
+        OMX_PARAM_PORTDEFINITIONTYPE *def = (OMX_PARAM_PORTDEFINITIONTYPE *)param;
+        COMXSoftPort *port = GetPort(def->nPortIndex);
+        if(!port)
+        {
+            omx_err = OMX_ErrorBadPortIndex;
+            break;
+        }
+        *def = port->def;
+        break;
+    }
+    default:
+        omx_err = GetComponentParameter(index, param);
+        break;
+    }
+    UnLockComponent();
+
+    return omx_err;
+}
+
+OMX_ERRORTYPE COMXSoftComponent::DoSetParameter(OMX_INDEXTYPE index, OMX_PTR param)
+{
+    OMX_ERRORTYPE omx_err = OMX_ErrorNone;
+
+    if(!param)
+        return OMX_ErrorBadParameter;
+
+    LockComponent();
+    switch(index)
+    {
+    case OMX_IndexParamPortDefinition:
+    {
+        OMX_PARAM_PORTDEFINITIONTYPE *def = (OMX_PARAM_PORTDEFINITIONTYPE *)param;
+        COMXSoftPort *port = GetPort(def->nPortIndex);
+        if(!port)
+        {
+            omx_err = OMX_ErrorBadPortIndex;
+            break;
+        }
+        if(def->nBufferCountActual < port->def.nBufferCountMin)
+        {
+            omx_err = OMX_ErrorBadParameter;
+            break;
+        }
+        SetPortDefinition(*port, *def);
+        break;
+    }
+    default:
+        omx_err = SetComponentParameter(index, param);
+        break;
+    }
+    UnLockComponent();
+
+    return omx_err;
+}
+
+OMX_ERRORTYPE COMXSoftComponent::DoSetConfig(OMX_INDEXTYPE index, OMX_PTR config)
+{
+    if(!config)
+        return OMX_ErrorBadParameter;
+
+    LockComponent();
+    OMX_ERRORTYPE omx_err = SetComponentConfig(index, config);
+    UnLockComponent();
+
+    return omx_err;
+}
+
+OMX_ERRORTYPE COMXSoftComponent::DoGetState(OMX_STATETYPE *state)
+{
+    if(!state)
+        return OMX_ErrorBadParameter;
+
+    LockComponent();
+    *state = m_state;
+    UnLockComponent();
+
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE COMXSoftComponent::DoUseBuffer(OMX_BUFFERHEADERTYPE **header, OMX_U32 port_index, OMX_PTR app_private,
+                                             OMX_U32 size, OMX_U8 *data)
+{
+    if(!header)
+        return OMX_ErrorBadParameter;
+
+    LockComponent();
+    COMXSoftPort *port = GetPort(port_index);
+    if(!port)
+    {
+        UnLockComponent();
+        return OMX_ErrorBadPortIndex;
+    }
+    if(size < port->def.nBufferSize)
+    {
+        UnLockComponent();
+        return OMX_ErrorBadParameter;
+    }
+
+    OMX_BUFFERHEADERTYPE *buffer = new OMX_BUFFERHEADERTYPE;
+    OMX_INIT_STRUCTURE(*buffer);
+    buffer->nAllocLen   = size;
+    buffer->pAppPrivate = app_private;
+    if(data)
+    {
+        buffer->pBuffer = data;
+    }
+    else
+    {
+        // OMX_AllocateBuffer, the component owns the memory
+        buffer->pBuffer          = (OMX_U8 *)_aligned_malloc(size, port->def.nBufferAlignment);
+        buffer->pPlatformPrivate = buffer->pBuffer;
+    }
+    if(port->def.eDir == OMX_DirInput)
+        buffer->nInputPortIndex  = port->def.nPortIndex;
+    else
+        buffer->nOutputPortIndex = port->def.nPortIndex;
+
+    port->buffers.push_back(buffer);
+    pthread_cond_broadcast(&m_soft_cond);
+    UnLockComponent();
+
+    *header = buffer;
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE COMXSoftComponent::DoFreeBuffer(OMX_U32 port_index, OMX_BUFFERHEADERTYPE *header)
+{
+    LockComponent();
+    COMXSoftPort *port = GetPort(port_index);
+    if(!port)
+    {
+        UnLockComponent();
+        return OMX_ErrorBadPortIndex;
+    }
+
+    std::vector<OMX_BUFFERHEADERTYPE*>::iterator it = std::find(port->buffers.begin(), port->buffers.end(), header);
+    if(it == port->buffers.end())
+    {
+        UnLockComponent();
+        return OMX_ErrorBadParameter;
+    }
+    port->buffers.erase(it);
+
+    std::deque<OMX_BUFFERHEADERTYPE*>::iterator queued = std::find(port->queue.begin(), port->queue.end(), header);
+    if(queued != port->queue.end())
+        port->queue.erase(queued);
+
+    for(std::deque<omx_soft_callback>::iterator cb = m_pending_callbacks.begin(); cb != m_pending_callbacks.end(); )
+    {
+        if(cb->buffer == header)
+            cb = m_pending_callbacks.erase(cb);
+        else
+            ++cb;
+    }
+
+    if(header == m_busy)
+        m_busy_freed = true;
+    else
+        FreeHeader(header);
+
+    pthread_cond_broadcast(&m_soft_cond);
+    UnLockComponent();
+
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE COMXSoftComponent::DoQueueBuffer(OMX_U32 port_index, OMX_BUFFERHEADERTYPE *header)
+{
+    if(!header)
+        return OMX_ErrorBadParameter;
+
+    LockComponent();
+    COMXSoftPort *port = GetPort(port_index);
+    if(!port)
+    {
+        UnLockComponent();
+        return OMX_ErrorBadPortIndex;
+    }
+    if(m_state != OMX_StateExecuting && m_state != OMX_StatePause && m_state != OMX_StateIdle)
+    {
+        UnLockComponent();
+        return OMX_ErrorIncorrectStateOperation;
+    }
+    if(!port->def.bEnabled)
+    {
+        UnLockComponent();
+        return OMX_ErrorIncorrectStateOperation;
+    }
+
+    port->queue.push_back(header);
+    pthread_cond_broadcast(&m_soft_cond);
+    UnLockComponent();
+
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE COMXSoftComponent::GetComponentParameter(OMX_INDEXTYPE index, OMX_PTR param)
+{
+    return OMX_ErrorUnsupportedIndex;
+}
+
+OMX_ERRORTYPE COMXSoftComponent::SetComponentParameter(OMX_INDEXTYPE index, OMX_PTR param)
+{
+    return OMX_ErrorUnsupportedIndex;
+}
+
+OMX_ERRORTYPE COMXSoftComponent::SetComponentConfig(OMX_INDEXTYPE index, OMX_PTR config)
+{
+    // VideoCore accepts most config indices through either call
+    return SetComponentParameter(index, config);
+}
+
+OMX_ERRORTYPE COMXSoftComponent::SendCommandCallback(OMX_HANDLETYPE handle, OMX_COMMANDTYPE cmd, OMX_U32 nParam, OMX_PTR data)
+{
+    return FromHandle(handle)->DoSendCommand(cmd, nParam);
+}
+
+OMX_ERRORTYPE COMXSoftComponent::GetParameterCallback(OMX_HANDLETYPE handle, OMX_INDEXTYPE index, OMX_PTR param)
+{
+    return FromHandle(handle)->DoGetParameter(index, param);
+}
+
+OMX_ERRORTYPE COMXSoftComponent::SetParameterCallback(OMX_HANDLETYPE handle, OMX_INDEXTYPE index, OMX_PTR param)
+{
+    return FromHandle(handle)->DoSetParameter(index, param);
+}
+
+OMX_ERRORTYPE COMXSoftComponent::GetConfigCallback(OMX_HANDLETYPE handle, OMX_INDEXTYPE index, OMX_PTR config)
+{
+    return FromHandle(handle)->DoGetParameter(index, config);
+}
+
+OMX_ERRORTYPE COMXSoftComponent::SetConfigCallback(OMX_HANDLETYPE handle, OMX_INDEXTYPE index, OMX_PTR config)
+{
+    return FromHandle(handle)->DoSetConfig(index, config);
+}
+
+OMX_ERRORTYPE COMXSoftComponent::GetStateCallback(OMX_HANDLETYPE handle, OMX_STATETYPE *state)
+{
+    return FromHandle(handle)->DoGetState(state);
+}
+
+OMX_ERRORTYPE COMXSoftComponent::UseBufferCallback(OMX_HANDLETYPE handle, OMX_BUFFERHEADERTYPE **header, OMX_U32 port,
+                                                   OMX_PTR app_private, OMX_U32 size, OMX_U8 *data)
+{
+    if(!data)
+        return OMX_ErrorBadParameter;
+    return FromHandle(handle)->DoUseBuffer(header, port, app_private, size, data);
+}
+
+OMX_ERRORTYPE COMXSoftComponent::AllocateBufferCallback(OMX_HANDLETYPE handle, OMX_BUFFERHEADERTYPE **header, OMX_U32 port,
+                                                        OMX_PTR app_private, OMX_U32 size)
+{
+    return FromHandle(handle)->DoUseBuffer(header, port, app_private, size, NULL);
+}
+
+OMX_ERRORTYPE COMXSoftComponent::FreeBufferCallback(OMX_HANDLETYPE handle, OMX_U32 port, OMX_BUFFERHEADERTYPE *header)
+{
+    return FromHandle(handle)->DoFreeBuffer(port, header);
+}
+
+OMX_ERRORTYPE COMXSoftComponent::EmptyThisBufferCallback(OMX_HANDLETYPE handle, OMX_BUFFERHEADERTYPE *header)
+{
+    if(!header)
+        return OMX_ErrorBadParameter;
+    return FromHandle(handle)->DoQueueBuffer(header->nInputPortIndex, header);
+}
+
+OMX_ERRORTYPE COMXSoftComponent::FillThisBufferCallback(OMX_HANDLETYPE handle, OMX_BUFFERHEADERTYPE *header)
+{
+    if(!header)
+        return OMX_ErrorBadParameter;
+    return FromHandle(handle)->DoQueueBuffer(header->nOutputPortIndex, header);
+}
+
+OMX_ERRORTYPE COMXSoftComponent::UseEGLImageCallback(OMX_HANDLETYPE handle, OMX_BUFFERHEADERTYPE **header, OMX_U32 port,
+                                                     OMX_PTR app_private, void *egl_image)
+{
+    return OMX_ErrorNotImplemented;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+#undef CLASSNAME
+#define CLASSNAME "COMXSoftVideoDecoder"
+
+static enum AVCodecID SoftCodecId(OMX_VIDEO_CODINGTYPE coding, const std::vector<uint8_t> &extradata)
+{
+    switch((int)coding)
+    {
+    case OMX_VIDEO_CodingAVC:    return AV_CODEC_ID_H264;
+    case OMX_VIDEO_CodingMPEG4:  return AV_CODEC_ID_MPEG4;
+    case OMX_VIDEO_CodingMPEG2:  return AV_CODEC_ID_MPEG2VIDEO;
+    case OMX_VIDEO_CodingH263:   return AV_CODEC_ID_H263;
+    case OMX_VIDEO_CodingVP6:    return AV_CODEC_ID_VP6F;
+    case OMX_VIDEO_CodingVP8:    return AV_CODEC_ID_VP8;
+    case OMX_VIDEO_CodingTheora: return AV_CODEC_ID_THEORA;
+    case OMX_VIDEO_CodingMJPEG:  return AV_CODEC_ID_MJPEG;
+    case OMX_VIDEO_CodingWMV:
+        // advanced profile sequence headers carry start codes, simple/main don't
+        if(extradata.size() > 4 && extradata[0] == 0 && extradata[1] == 0 && extradata[2] == 1)
+            return AV_CODEC_ID_VC1;
+        return AV_CODEC_ID_WMV3;
+    default:
+        if((int)coding > OMX_SOFT_CODING_AVCODEC && (int)coding < OMX_SOFT_CODING_AVCODEC + 0x10000)
+            return (enum AVCodecID)((int)coding - OMX_SOFT_CODING_AVCODEC);
+        return AV_CODEC_ID_NONE;
+    }
+}
+
+COMXSoftVideoDecoder::COMXSoftVideoDecoder(const std::string &component_name)
+    : COMXSoftComponent(component_name, OMX_SOFT_DECODER_PORT)
+{
+    m_codec_ctx     = NULL;
+    m_sws_ctx       = NULL;
+    m_packet_pts    = AV_NOPTS_VALUE;
+    m_packet_dts    = AV_NOPTS_VALUE;
+    m_eos           = false;
+    m_configured    = false;
+    m_width         = 0;
+    m_height        = 0;
+    m_pixel_aspect.num = 0;
+    m_pixel_aspect.den = 0;
+
+    // VideoCore defaults: 20 x 80kB compressed input, one frame out
+    OMX_PARAM_PORTDEFINITIONTYPE &in = InputPort().def;
+    in.nBufferCountActual = 20;
+    in.nBufferSize        = 80 * 1024;
+    in.format.video.eCompressionFormat = OMX_VIDEO_CodingAVC;
+    in.format.video.eColorFormat       = OMX_COLOR_FormatUnused;
+
+    OMX_PARAM_PORTDEFINITIONTYPE &out = OutputPort().def;
+    out.format.video.nFrameWidth   = 160;
+    out.format.video.nFrameHeight  = 64;
+    out.format.video.nStride       = 160;
+    out.format.video.nSliceHeight  = 64;
+    out.format.video.eCompressionFormat = OMX_VIDEO_CodingUnused;
+    out.format.video.eColorFormat  = OMX_COLOR_FormatYUV420PackedPlanar;
+    out.nBufferSize = out.format.video.nStride * out.format.video.nSliceHeight * 3 / 2;
+}
+
+COMXSoftVideoDecoder::~COMXSoftVideoDecoder()
+{
+    CloseCodec();
+}
+
+bool COMXSoftVideoDecoder::OpenCodec()
+{
+    LockComponent();
+    OMX_VIDEO_PORTDEFINITIONTYPE video = InputPort().def.format.video;
+    UnLockComponent();
+
+    enum AVCodecID codec_id = SoftCodecId(video.eCompressionFormat, m_extradata);
+    AVCodec *codec = avcodec_find_decoder(codec_id);
+    if(!codec)
+    {
+        CLOG(LOGERROR, "%s::%s - no decoder for coding %d\n", CLASSNAME, __func__, (int)video.eCompressionFormat);
+        PostEvent(OMX_EventError, (OMX_U32)OMX_ErrorFormatNotDetected, 0);
+        return false;
+    }
+
+    m_codec_ctx = avcodec_alloc_context3(codec);
+    m_codec_ctx->width             = video.nFrameWidth;
+    m_codec_ctx->height            = video.nFrameHeight;
+    m_codec_ctx->refcounted_frames = 1;
+    // a thread per core, frame threading where the codec has it
+    m_codec_ctx->thread_count      = 0;
+    m_codec_ctx->thread_type       = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    if(!m_extradata.empty())
+    {
+        m_codec_ctx->extradata = (uint8_t *)av_mallocz(m_extradata.size() + FF_INPUT_BUFFER_PADDING_SIZE);
+        m_codec_ctx->extradata_size = m_extradata.size();
+        memcpy(m_codec_ctx->extradata, &m_extradata[0], m_extradata.size());
+    }
+
+    if(avcodec_open2(m_codec_ctx, codec, NULL) < 0)
+    {
+        CLOG(LOGERROR, "%s::%s - could not open %s\n", CLASSNAME, __func__, codec->name);
+        avcodec_free_context(&m_codec_ctx);
+        PostEvent(OMX_EventError, (OMX_U32)OMX_ErrorFormatNotDetected, 0);
+        return false;
+    }
+
+    CLOG(LOGDEBUG, "%s::%s - %s %dx%d extradata %d threads %d\n", CLASSNAME, __func__, codec->name,
+         m_codec_ctx->width, m_codec_ctx->height, m_codec_ctx->extradata_size, m_codec_ctx->thread_count);
+    return true;
+}
+
+void COMXSoftVideoDecoder::FlushCodec()
+{
+    m_packet.clear();
+    while(!m_frames.empty())
+    {
+        av_frame_free(&m_frames.front());
+        m_frames.pop_front();
+    }
+    m_eos = false;
+
+    if(m_codec_ctx)
+        avcodec_flush_buffers(m_codec_ctx);
+}
+
+void COMXSoftVideoDecoder::CloseCodec()
+{
+    FlushCodec();
+
+    if(m_codec_ctx)
+        avcodec_free_context(&m_codec_ctx);
+    if(m_sws_ctx)
+        sws_freeContext(m_sws_ctx);
+    m_sws_ctx    = NULL;
+    m_configured = false;
+    m_extradata.clear();
+}
+
+bool COMXSoftVideoDecoder::CanAcceptInput()
+{
+    return !m_eos && m_frames.size() < OMX_SOFT_MAX_FRAMES;
+}
+
+bool COMXSoftVideoDecoder::HasOutput()
+{
+    return !m_frames.empty() || m_eos;
+}
+
+void COMXSoftVideoDecoder::CheckFrameFormat(AVFrame *frame)
+{
+    if(m_configured && frame->width == m_width && frame->height == m_height)
+        return;
+
+    m_configured = true;
+    m_width      = frame->width;
+    m_height     = frame->height;
+
+    LockComponent();
+    m_pixel_aspect = frame->sample_aspect_ratio;
+    UnLockComponent();
+
+    OMX_PARAM_PORTDEFINITIONTYPE def;
+    OMX_INIT_STRUCTURE(def);
+    def.format.video.nFrameWidth        = m_width;
+    def.format.video.nFrameHeight       = m_height;
+    def.format.video.nStride            = FFALIGN(m_width, 32);
+    def.format.video.nSliceHeight       = FFALIGN(m_height, 16);
+    def.format.video.eCompressionFormat = OMX_VIDEO_CodingUnused;
+    def.format.video.eColorFormat       = OMX_COLOR_FormatYUV420PackedPlanar;
+    def.nBufferSize     = def.format.video.nStride * def.format.video.nSliceHeight * 3 / 2;
+    def.nBufferCountMin = 1;
+
+    CLOG(LOGDEBUG, "%s::%s - %dx%d stride %d slice %d\n", CLASSNAME, __func__,
+         m_width, m_height, (int)def.format.video.nStride, (int)def.format.video.nSliceHeight);
+
+    PortSettingsChanged(def);
+}
+
+void COMXSoftVideoDecoder::DecodePacket(uint8_t *data, int size)
+{
+    AVPacket pkt;
+    av_init_packet(&pkt);
+    pkt.data = data;
+    pkt.size = size;
+    pkt.pts  = m_packet_pts;
+    pkt.dts  = m_packet_dts;
+
+    AVFrame *frame = av_frame_alloc();
+    while(true)
+    {
+        int got_picture = 0;
+        int ret = avcodec_decode_video2(m_codec_ctx, frame, &got_picture, &pkt);
+        if(ret < 0)
+        {
+            // VideoCore drops corrupt data silently as well
+            CLOG(LOGWARNING, "%s::%s - decode error %d size %d\n", CLASSNAME, __func__, ret, size);
+            break;
+        }
+
+        if(got_picture)
+        {
+            CheckFrameFormat(frame);
+            m_frames.push_back(frame);
+            frame = av_frame_alloc();
+        }
+
+        if(!data)
+        {
+            // draining, until the decoder has nothing left
+            if(!got_picture)
+                break;
+            continue;
+        }
+
+        // nothing taken and nothing out, the rest of the packet would loop
+        if(ret == 0 && !got_picture)
+            break;
+        pkt.data += ret;
+        pkt.size -= ret;
+        if(pkt.size <= 0)
+            break;
+    }
+    av_frame_free(&frame);
+}
+
+void COMXSoftVideoDecoder::ProcessInput(OMX_BUFFERHEADERTYPE *buffer)
+{
+    uint8_t *data = buffer->pBuffer + buffer->nOffset;
+
+    if(buffer->nFlags & OMX_BUFFERFLAG_CODECCONFIG)
+    {
+        // in-band once running, the parsers pick the new parameter sets up
+        if(m_codec_ctx)
+            m_packet.insert(m_packet.end(), data, data + buffer->nFilledLen);
+        else
+            m_extradata.insert(m_extradata.end(), data, data + buffer->nFilledLen);
+        return;
+    }
+
+    if(buffer->nFilledLen > 0)
+    {
+        if(!m_codec_ctx && !OpenCodec())
+            return;
+
+        if(m_packet.empty())
+        {
+            int64_t ts = FromOMXTime(buffer->nTimeStamp);
+            m_packet_pts = AV_NOPTS_VALUE;
+            m_packet_dts = AV_NOPTS_VALUE;
+            if(buffer->nFlags & OMX_BUFFERFLAG_TIME_IS_DTS)
+                m_packet_dts = ts;
+            else if(!(buffer->nFlags & OMX_BUFFERFLAG_TIME_UNKNOWN))
+                m_packet_pts = ts;
+        }
+        m_packet.insert(m_packet.end(), data, data + buffer->nFilledLen);
+    }
+
+    if((buffer->nFlags & (OMX_BUFFERFLAG_ENDOFFRAME | OMX_BUFFERFLAG_EOS)) && !m_packet.empty() && m_codec_ctx)
+    {
+        int size = m_packet.size();
+        m_packet.resize(size + FF_INPUT_BUFFER_PADDING_SIZE, 0);
+        DecodePacket(&m_packet[0], size);
+        m_packet.clear();
+    }
+
+    if(buffer->nFlags & OMX_BUFFERFLAG_EOS)
+    {
+        if(m_codec_ctx)
+        {
+            DecodePacket(NULL, 0);
+            avcodec_flush_buffers(m_codec_ctx);
+        }
+        m_eos = true;
+    }
+}
+
+void COMXSoftVideoDecoder::ProcessOutput(OMX_BUFFERHEADERTYPE *buffer)
+{
+    buffer->nOffset    = 0;
+    buffer->nFilledLen = 0;
+    buffer->nFlags     = 0;
+
+    if(m_frames.empty())
+    {
+        // nothing left to return but the end of stream
+        buffer->nTimeStamp = ToOMXTime(0LL);
+        buffer->nFlags     = OMX_BUFFERFLAG_EOS | OMX_BUFFERFLAG_TIME_UNKNOWN;
+        m_eos = false;
+        return;
+    }
+
+    AVFrame *frame = m_frames.front();
+    m_frames.pop_front();
+
+    LockComponent();
+    OMX_VIDEO_PORTDEFINITIONTYPE video = OutputPort().def.format.video;
+    UnLockComponent();
+
+    int stride = video.nStride;
+    int slice  = video.nSliceHeight;
+    int width  = FFMIN(frame->width, stride);
+    int height = FFMIN(frame->height, slice);
+    OMX_U32 size = stride * slice * 3 / 2;
+
+    if(size > buffer->nAllocLen)
+    {
+        CLOG(LOGERROR, "%s::%s - output buffer too small %u < %u\n", CLASSNAME, __func__, buffer->nAllocLen, size);
+    }
+    else
+    {
+        uint8_t *dst[4];
+        int      dst_stride[4];
+
+        dst[0] = buffer->pBuffer;
+        dst[1] = dst[0] + stride * slice;
+        dst[2] = dst[1] + (stride / 2) * (slice / 2);
+        dst[3] = NULL;
+        dst_stride[0] = stride;
+        dst_stride[1] = stride / 2;
+        dst_stride[2] = stride / 2;
+        dst_stride[3] = 0;
+
+        if(frame->format == AV_PIX_FMT_YUV420P || frame->format == AV_PIX_FMT_YUVJ420P)
+        {
+            av_image_copy_plane(dst[0], dst_stride[0], frame->data[0], frame->linesize[0], width, height);
+            av_image_copy_plane(dst[1], dst_stride[1], frame->data[1], frame->linesize[1], (width + 1) / 2, (height + 1) / 2);
+            av_image_copy_plane(dst[2], dst_stride[2], frame->data[2], frame->linesize[2], (width + 1) / 2, (height + 1) / 2);
+        }
+        else
+        {
+            m_sws_ctx = sws_getCachedContext(m_sws_ctx, frame->width, frame->height, (enum AVPixelFormat)frame->format,
+                                             width, height, AV_PIX_FMT_YUV420P, SWS_BICUBIC, NULL, NULL, NULL);
+            if(m_sws_ctx)
+                sws_scale(m_sws_ctx, frame->data, frame->linesize, 0, frame->height, dst, dst_stride);
+        }
+        buffer->nFilledLen = size;
+    }
+
+    int64_t pts = av_frame_get_best_effort_timestamp(frame);
+    if(pts == AV_NOPTS_VALUE)
+    {
+        buffer->nTimeStamp = ToOMXTime(0LL);
+        buffer->nFlags    |= OMX_BUFFERFLAG_TIME_UNKNOWN;
+    }
+    else
+    {
+        buffer->nTimeStamp = ToOMXTime(pts);
+    }
+    buffer->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
+
+    if(m_frames.empty() && m_eos)
+    {
+        buffer->nFlags |= OMX_BUFFERFLAG_EOS;
+        m_eos = false;
+    }
+
+    av_frame_free(&frame);
+}
+
+void COMXSoftVideoDecoder::SetPortDefinition(COMXSoftPort &port, const OMX_PARAM_PORTDEFINITIONTYPE &def)
+{
+    port.def.nBufferCountActual = def.nBufferCountActual;
+
+    if(port.def.eDir == OMX_DirInput)
+    {
+        if(def.nBufferSize > port.def.nBufferSize)
+            port.def.nBufferSize = def.nBufferSize;
+        port.def.format.video.nFrameWidth        = def.format.video.nFrameWidth;
+        port.def.format.video.nFrameHeight       = def.format.video.nFrameHeight;
+        port.def.format.video.eCompressionFormat = def.format.video.eCompressionFormat;
+        if(def.format.video.xFramerate)
+            port.def.format.video.xFramerate     = def.format.video.xFramerate;
+    }
+}
+
+OMX_ERRORTYPE COMXSoftVideoDecoder::GetComponentParameter(OMX_INDEXTYPE index, OMX_PTR param)
+{
+    switch((int)index)
+    {
+    case OMX_IndexParamVideoPortFormat:
+    {
+        OMX_VIDEO_PARAM_PORTFORMATTYPE *format = (OMX_VIDEO_PARAM_PORTFORMATTYPE *)param;
+        COMXSoftPort &port = format->nPortIndex == InputPort().def.nPortIndex ? InputPort() : OutputPort();
+        format->eCompressionFormat = port.def.format.video.eCompressionFormat;
+        format->eColorFormat       = port.def.format.video.eColorFormat;
+        format->xFramerate         = port.def.format.video.xFramerate;
+        return OMX_ErrorNone;
+    }
+    case OMX_IndexParamBrcmPixelAspectRatio:
+    {
+        OMX_CONFIG_POINTTYPE *aspect = (OMX_CONFIG_POINTTYPE *)param;
+        aspect->nX = m_pixel_aspect.num;
+        aspect->nY = m_pixel_aspect.den;
+        return OMX_ErrorNone;
+    }
+    case OMX_IndexParamBrcmInterlaceType:
+    {
+        OMX_CONFIG_INTERLACETYPE *interlace = (OMX_CONFIG_INTERLACETYPE *)param;
+        interlace->eMode             = OMX_InterlaceProgressive;
+        interlace->bRepeatFirstField = OMX_FALSE;
+        return OMX_ErrorNone;
+    }
+    default:
+        return OMX_ErrorUnsupportedIndex;
+    }
+}
+
+OMX_ERRORTYPE COMXSoftVideoDecoder::SetComponentParameter(OMX_INDEXTYPE index, OMX_PTR param)
+{
+    switch((int)index)
+    {
+    case OMX_IndexParamVideoPortFormat:
+    {
+        OMX_VIDEO_PARAM_PORTFORMATTYPE *format = (OMX_VIDEO_PARAM_PORTFORMATTYPE *)param;
+        if(format->nPortIndex != InputPort().def.nPortIndex)
+            return OMX_ErrorUnsupportedSetting;
+        InputPort().def.format.video.eCompressionFormat = format->eCompressionFormat;
+        if(format->xFramerate)
+            InputPort().def.format.video.xFramerate = format->xFramerate;
+        return OMX_ErrorNone;
+    }
+    case OMX_IndexConfigRequestCallback:
+        // settings changes are always reported
+        return OMX_ErrorNone;
+    default:
+        return OMX_ErrorUnsupportedIndex;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+#undef CLASSNAME
+#define CLASSNAME "COMXSoftVideoEncoder"
+
+static int SoftAvcLevel(OMX_U32 level)
+{
+    switch(level)
+    {
+    case OMX_VIDEO_AVCLevel1:  return 10;
+    case OMX_VIDEO_AVCLevel1b: return 9;
+    case OMX_VIDEO_AVCLevel11: return 11;
+    case OMX_VIDEO_AVCLevel12: return 12;
+    case OMX_VIDEO_AVCLevel13: return 13;
+    case OMX_VIDEO_AVCLevel2:  return 20;
+    case OMX_VIDEO_AVCLevel21: return 21;
+    case OMX_VIDEO_AVCLevel22: return 22;
+    case OMX_VIDEO_AVCLevel3:  return 30;
+    case OMX_VIDEO_AVCLevel31: return 31;
+    case OMX_VIDEO_AVCLevel32: return 32;
+    case OMX_VIDEO_AVCLevel4:  return 40;
+    case OMX_VIDEO_AVCLevel41: return 41;
+    case OMX_VIDEO_AVCLevel42: return 42;
+    case OMX_VIDEO_AVCLevel5:  return 50;
+    case OMX_VIDEO_AVCLevel51: return 51;
+    default:                   return FF_LEVEL_UNKNOWN;
+    }
+}
+
+COMXSoftVideoEncoder::COMXSoftVideoEncoder(const std::string &component_name)
+    : COMXSoftComponent(component_name, OMX_SOFT_ENCODER_PORT)
+{
+    m_codec_ctx      = NULL;
+    m_frame          = NULL;
+    m_eos            = false;
+    m_last_pts       = AV_NOPTS_VALUE;
+    m_control_rate   = OMX_Video_ControlRateVariable;
+    m_bitrate        = 0;
+    m_profile        = OMX_VIDEO_AVCProfileHigh;
+    m_level          = OMX_VIDEO_AVCLevel4;
+    m_p_frames       = OMX_SOFT_ENC_INTRA_PERIOD - 1;
+    m_min_quant      = 0;
+    m_max_quant      = 0;
+    m_aspect_x       = 0;
+    m_aspect_y       = 0;
+    m_request_iframe = false;
+
+    OMX_PARAM_PORTDEFINITIONTYPE &in = InputPort().def;
+    in.nBufferCountActual = 3;
+    in.format.video.nFrameWidth   = 160;
+    in.format.video.nFrameHeight  = 64;
+    in.format.video.nStride       = 160;
+    in.format.video.nSliceHeight  = 64;
+    in.format.video.xFramerate    = 25 << 16;
+    in.format.video.eCompressionFormat = OMX_VIDEO_CodingUnused;
+    in.format.video.eColorFormat  = OMX_COLOR_FormatYUV420PackedPlanar;
+    in.nBufferSize = in.format.video.nStride * in.format.video.nSliceHeight * 3 / 2;
+
+    OMX_PARAM_PORTDEFINITIONTYPE &out = OutputPort().def;
+    out.format.video = in.format.video;
+    out.format.video.eCompressionFormat = OMX_VIDEO_CodingAVC;
+    out.format.video.eColorFormat       = OMX_COLOR_FormatUnused;
+    out.nBufferSize = 64 * 1024;
+}
+
+COMXSoftVideoEncoder::~COMXSoftVideoEncoder()
+{
+    CloseCodec();
+}
+
+bool COMXSoftVideoEncoder::OpenCodec()
+{
+    LockComponent();
+    OMX_VIDEO_PORTDEFINITIONTYPE video = InputPort().def.format.video;
+    OMX_VIDEO_CONTROLRATETYPE control_rate = m_control_rate;
+    OMX_U32 bitrate = m_bitrate ? m_bitrate : OutputPort().def.format.video.nBitrate;
+    OMX_U32 profile = m_profile;
+    OMX_U32 level   = m_level;
+    OMX_U32 p_frames  = m_p_frames;
+    OMX_U32 min_quant = m_min_quant;
+    OMX_U32 max_quant = m_max_quant;
+    AVRational aspect = av_make_q(m_aspect_x, m_aspect_y);
+    std::string codec_name = m_codec_name;
+    if(OutputPort().def.format.video.xFramerate)
+        video.xFramerate = OutputPort().def.format.video.xFramerate;
+    UnLockComponent();
+
+    AVCodec *codec = NULL;
+    if(!codec_name.empty())
+        codec = avcodec_find_encoder_by_name(codec_name.c_str());
+    else
+    {
+        codec = avcodec_find_encoder_by_name("libx264");
+        if(!codec)
+            codec = avcodec_find_encoder_by_name("libopenh264");
+        if(!codec)
+            codec = avcodec_find_encoder(AV_CODEC_ID_H264);
+    }
+    if(!codec || codec->id != AV_CODEC_ID_H264)
+    {
+        CLOG(LOGERROR, "%s::%s - no H.264 encoder %s in libavcodec\n", CLASSNAME, __func__, codec_name.c_str());
+        PostEvent(OMX_EventError, (OMX_U32)OMX_ErrorInsufficientResources, 0);
+        return false;
+    }
+
+    double fps = video.xFramerate ? (double)video.xFramerate / (1 << 16) : 25.0;
+
+    m_codec_ctx = avcodec_alloc_context3(codec);
+    m_codec_ctx->width        = video.nFrameWidth;
+    m_codec_ctx->height       = video.nFrameHeight;
+    m_codec_ctx->pix_fmt      = AV_PIX_FMT_YUV420P;
+    // OMX ticks are microseconds
+    m_codec_ctx->time_base    = av_make_q(1, DVD_TIME_BASE);
+    m_codec_ctx->framerate    = av_d2q(fps, 1 << 16);
+    m_codec_ctx->gop_size     = p_frames + 1;
+    m_codec_ctx->max_b_frames = 0;
+    m_codec_ctx->bit_rate     = bitrate;
+    // a thread per core, there may be cores the VideoCore encoders leave idle
+    m_codec_ctx->thread_count = 0;
+    m_codec_ctx->flags       |= CODEC_FLAG_GLOBAL_HEADER;
+    m_codec_ctx->level        = SoftAvcLevel(level);
+    if(min_quant)
+        m_codec_ctx->qmin = min_quant;
+    if(max_quant)
+        m_codec_ctx->qmax = max_quant;
+    if(aspect.num > 0 && aspect.den > 0)
+        m_codec_ctx->sample_aspect_ratio = aspect;
+    if(control_rate == OMX_Video_ControlRateConstant && bitrate)
+    {
+        m_codec_ctx->rc_max_rate    = bitrate;
+        m_codec_ctx->rc_buffer_size = bitrate;
+    }
+
+    AVDictionary *opts = NULL;
+    // the VideoCore encoder has a single frame of latency and no B frames
+    av_dict_set(&opts, "preset", "veryfast", 0);
+    av_dict_set(&opts, "tune", "zerolatency", 0);
+    switch(profile)
+    {
+    case OMX_VIDEO_AVCProfileBaseline:
+    case OMX_VIDEO_AVCProfileConstrainedBaseline:
+        m_codec_ctx->profile = FF_PROFILE_H264_BASELINE;
+        av_dict_set(&opts, "profile", "baseline", 0);
+        break;
+    case OMX_VIDEO_AVCProfileMain:
+        m_codec_ctx->profile = FF_PROFILE_H264_MAIN;
+        av_dict_set(&opts, "profile", "main", 0);
+        break;
+    default:
+        m_codec_ctx->profile = FF_PROFILE_H264_HIGH;
+        av_dict_set(&opts, "profile", "high", 0);
+        break;
+    }
+
+    int ret = avcodec_open2(m_codec_ctx, codec, &opts);
+    av_dict_free(&opts);
+    if(ret < 0)
+    {
+        CLOG(LOGERROR, "%s::%s - could not open %s %dx%d\n", CLASSNAME, __func__, codec->name,
+             (int)video.nFrameWidth, (int)video.nFrameHeight);
+        avcodec_free_context(&m_codec_ctx);
+        PostEvent(OMX_EventError, (OMX_U32)OMX_ErrorInsufficientResources, 0);
+        return false;
+    }
+
+    m_frame    = av_frame_alloc();
+    m_last_pts = AV_NOPTS_VALUE;
+
+    CLOG(LOGDEBUG, "%s::%s - %s %dx%d %.2ffps %ubps\n", CLASSNAME, __func__, codec->name,
+         m_codec_ctx->width, m_codec_ctx->height, fps, (unsigned int)bitrate);
+
+    SendCodecConfig();
+    return true;
+}
+
+// Like VideoCore, SPS and PPS go out first as separate codec config buffers,
+// each one NAL with a four byte start code.
+void COMXSoftVideoEncoder::SendCodecConfig()
+{
+    const uint8_t *p   = m_codec_ctx->extradata;
+    const uint8_t *end = p + m_codec_ctx->extradata_size;
+
+    while(p && p + 3 < end)
+    {
+        if(p[0] != 0 || p[1] != 0 || p[2] != 1)
+        {
+            p++;
+            continue;
+        }
+        p += 3;
+
+        const uint8_t *nal_end = p;
+        while(nal_end + 3 <= end && !(nal_end[0] == 0 && nal_end[1] == 0 && (nal_end[2] == 1 || (nal_end[2] == 0 && nal_end + 3 < end && nal_end[3] == 1))))
+            nal_end++;
+        if(nal_end + 3 > end)
+            nal_end = end;
+
+        int nal_type = p[0] & 0x1f;
+        if(nal_type == 7 || nal_type == 8)
+        {
+            AVPacket pkt;
+            av_init_packet(&pkt);
+            if(av_new_packet(&pkt, 4 + (nal_end - p)) == 0)
+            {
+                pkt.data[0] = 0;
+                pkt.data[1] = 0;
+                pkt.data[2] = 0;
+                pkt.data[3] = 1;
+                memcpy(pkt.data + 4, p, nal_end - p);
+                pkt.pts = AV_NOPTS_VALUE;
+                QueuePacket(&pkt, OMX_BUFFERFLAG_CODECCONFIG);
+            }
+        }
+        p = nal_end;
+    }
+}
+
+void COMXSoftVideoEncoder::QueuePacket(AVPacket *pkt, OMX_U32 flags)
+{
+    omx_soft_packet packet;
+
+    packet.pkt    = *pkt;
+    packet.flags  = flags;
+    packet.offset = 0;
+    if(pkt->flags & AV_PKT_FLAG_KEY)
+        packet.flags |= OMX_BUFFERFLAG_SYNCFRAME;
+    m_packets.push_back(packet);
+}
+
+void COMXSoftVideoEncoder::EncodeFrame(AVFrame *frame)
+{
+    while(true)
+    {
+        AVPacket pkt;
+        av_init_packet(&pkt);
+        pkt.data = NULL;
+        pkt.size = 0;
+
+        int got_packet = 0;
+        int ret = avcodec_encode_video2(m_codec_ctx, &pkt, frame, &got_packet);
+        if(ret < 0)
+        {
+            CLOG(LOGERROR, "%s::%s - encode error %d\n", CLASSNAME, __func__, ret);
+            return;
+        }
+
+        if(got_packet)
+            QueuePacket(&pkt, 0);
+
+        // a frame gives at most one packet, draining gives all that is left
+        if(frame || !got_packet)
+            return;
+    }
+}
+
+void COMXSoftVideoEncoder::FlushCodec()
+{
+    while(!m_packets.empty())
+    {
+        av_packet_unref(&m_packets.front().pkt);
+        m_packets.pop_front();
+    }
+    m_eos = false;
+}
+
+void COMXSoftVideoEncoder::CloseCodec()
+{
+    FlushCodec();
+
+    if(m_codec_ctx)
+        avcodec_free_context(&m_codec_ctx);
+    if(m_frame)
+        av_frame_free(&m_frame);
+}
+
+bool COMXSoftVideoEncoder::CanAcceptInput()
+{
+    return !m_eos && m_packets.size() < OMX_SOFT_MAX_PACKETS;
+}
+
+bool COMXSoftVideoEncoder::HasOutput()
+{
+    return !m_packets.empty() || m_eos;
+}
+
+void COMXSoftVideoEncoder::ProcessInput(OMX_BUFFERHEADERTYPE *buffer)
+{
+    if(buffer->nFilledLen > 0)
+    {
+        LockComponent();
+        OMX_VIDEO_PORTDEFINITIONTYPE video = InputPort().def.format.video;
+        OMX_U32 bitrate     = m_bitrate;
+        bool request_iframe = m_request_iframe;
+        m_request_iframe    = false;
+        UnLockComponent();
+
+        // a new input format starts a new stream, with new parameter sets
+        if(m_codec_ctx && (m_codec_ctx->width != (int)video.nFrameWidth || m_codec_ctx->height != (int)video.nFrameHeight))
+        {
+            EncodeFrame(NULL);
+            avcodec_free_context(&m_codec_ctx);
+            av_frame_free(&m_frame);
+        }
+
+        if(!m_codec_ctx && !OpenCodec())
+            return;
+
+        int stride = video.nStride;
+        int slice  = video.nSliceHeight;
+
+        m_frame->format      = AV_PIX_FMT_YUV420P;
+        m_frame->width       = video.nFrameWidth;
+        m_frame->height      = video.nFrameHeight;
+        m_frame->data[0]     = buffer->pBuffer + buffer->nOffset;
+        m_frame->data[1]     = m_frame->data[0] + stride * slice;
+        m_frame->data[2]     = m_frame->data[1] + (stride / 2) * (slice / 2);
+        m_frame->linesize[0] = stride;
+        m_frame->linesize[1] = stride / 2;
+        m_frame->linesize[2] = stride / 2;
+        m_frame->pict_type   = request_iframe ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+        m_frame->key_frame   = request_iframe ? 1 : 0;
+
+        // the encoder needs strictly increasing timestamps
+        int64_t pts = FromOMXTime(buffer->nTimeStamp);
+        int64_t duration = av_rescale_q(1, av_inv_q(m_codec_ctx->framerate), m_codec_ctx->time_base);
+        if(buffer->nFlags & OMX_BUFFERFLAG_TIME_UNKNOWN)
+            pts = m_last_pts == AV_NOPTS_VALUE ? 0 : m_last_pts + duration;
+        if(m_last_pts != AV_NOPTS_VALUE && pts <= m_last_pts)
+            pts = m_last_pts + 1;
+        m_frame->pts = pts;
+        m_last_pts   = pts;
+
+        if(bitrate && bitrate != (OMX_U32)m_codec_ctx->bit_rate)
+            m_codec_ctx->bit_rate = bitrate;
+
+        EncodeFrame(m_frame);
+    }
+
+    if(buffer->nFlags & OMX_BUFFERFLAG_EOS)
+    {
+        if(m_codec_ctx)
+        {
+            EncodeFrame(NULL);
+            // start over with fresh parameter sets for whatever follows
+            avcodec_free_context(&m_codec_ctx);
+            av_frame_free(&m_frame);
+        }
+        m_eos = true;
+    }
+}
+
+void COMXSoftVideoEncoder::ProcessOutput(OMX_BUFFERHEADERTYPE *buffer)
+{
+    buffer->nOffset    = 0;
+    buffer->nFilledLen = 0;
+    buffer->nFlags     = 0;
+
+    if(m_packets.empty())
+    {
+        buffer->nTimeStamp = ToOMXTime(0LL);
+        buffer->nFlags     = OMX_BUFFERFLAG_EOS | OMX_BUFFERFLAG_ENDOFFRAME | OMX_BUFFERFLAG_TIME_UNKNOWN;
+        m_eos = false;
+        return;
+    }
+
+    // frames bigger than the buffer are split, ENDOFFRAME marks the last part
+    omx_soft_packet &packet = m_packets.front();
+    int len = FFMIN((OMX_U32)(packet.pkt.size - packet.offset), buffer->nAllocLen);
+
+    memcpy(buffer->pBuffer, packet.pkt.data + packet.offset, len);
+    buffer->nFilledLen = len;
+    buffer->nFlags     = packet.flags;
+    buffer->nTimeStamp = ToOMXTime(packet.pkt.pts != AV_NOPTS_VALUE ? packet.pkt.pts : 0);
+    packet.offset     += len;
+
+    if(packet.offset >= packet.pkt.size)
+    {
+        buffer->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
+        av_packet_unref(&packet.pkt);
+        m_packets.pop_front();
+
+        if(m_packets.empty() && m_eos)
+        {
+            buffer->nFlags |= OMX_BUFFERFLAG_EOS;
+            m_eos = false;
+        }
+    }
+}
+
+void COMXSoftVideoEncoder::SetPortDefinition(COMXSoftPort &port, const OMX_PARAM_PORTDEFINITIONTYPE &def)
+{
+    const OMX_VIDEO_PORTDEFINITIONTYPE &video = def.format.video;
+
+    port.def.nBufferCountActual = def.nBufferCountActual;
+
+    if(port.def.eDir == OMX_DirInput)
+    {
+        OMX_VIDEO_PORTDEFINITIONTYPE &in = port.def.format.video;
+        in.nFrameWidth  = video.nFrameWidth;
+        in.nFrameHeight = video.nFrameHeight;
+        in.nStride      = (OMX_S32)video.nFrameWidth > video.nStride ? video.nFrameWidth : video.nStride;
+        in.nSliceHeight = video.nFrameHeight > video.nSliceHeight ? video.nFrameHeight : video.nSliceHeight;
+        in.eColorFormat = video.eColorFormat;
+        if(video.xFramerate)
+            in.xFramerate = video.xFramerate;
+        port.def.nBufferSize = FFMAX(def.nBufferSize, (OMX_U32)(in.nStride * in.nSliceHeight * 3 / 2));
+
+        // the output follows the input format
+        OMX_VIDEO_PORTDEFINITIONTYPE &out = OutputPort().def.format.video;
+        out.nFrameWidth  = in.nFrameWidth;
+        out.nFrameHeight = in.nFrameHeight;
+        out.nStride      = in.nStride;
+        out.nSliceHeight = in.nSliceHeight;
+        if(!out.xFramerate)
+            out.xFramerate = in.xFramerate;
+    }
+    else
+    {
+        OMX_VIDEO_PORTDEFINITIONTYPE &out = port.def.format.video;
+        if(def.nBufferSize > port.def.nBufferSize)
+            port.def.nBufferSize = def.nBufferSize;
+        if(video.nBitrate)
+        {
+            out.nBitrate = video.nBitrate;
+            m_bitrate    = video.nBitrate;
+        }
+        if(video.xFramerate)
+            out.xFramerate = video.xFramerate;
+    }
+}
+
+OMX_ERRORTYPE COMXSoftVideoEncoder::GetComponentParameter(OMX_INDEXTYPE index, OMX_PTR param)
+{
+    switch((int)index)
+    {
+    case OMX_IndexParamVideoPortFormat:
+    {
+        OMX_VIDEO_PARAM_PORTFORMATTYPE *format = (OMX_VIDEO_PARAM_PORTFORMATTYPE *)param;
+        COMXSoftPort &port = format->nPortIndex == InputPort().def.nPortIndex ? InputPort() : OutputPort();
+        format->eCompressionFormat = port.def.format.video.eCompressionFormat;
+        format->eColorFormat       = port.def.format.video.eColorFormat;
+        format->xFramerate         = port.def.format.video.xFramerate;
+        return OMX_ErrorNone;
+    }
+    case OMX_IndexParamVideoBitrate:
+    {
+        OMX_VIDEO_PARAM_BITRATETYPE *bitrate = (OMX_VIDEO_PARAM_BITRATETYPE *)param;
+        bitrate->eControlRate   = m_control_rate;
+        bitrate->nTargetBitrate = m_bitrate;
+        return OMX_ErrorNone;
+    }
+    case OMX_IndexParamVideoProfileLevelCurrent:
+    {
+        OMX_VIDEO_PARAM_PROFILELEVELTYPE *profile_level = (OMX_VIDEO_PARAM_PROFILELEVELTYPE *)param;
+        profile_level->eProfile = m_profile;
+        profile_level->eLevel   = m_level;
+        return OMX_ErrorNone;
+    }
+    case OMX_IndexParamVideoAvc:
+    {
+        OMX_VIDEO_PARAM_AVCTYPE *avc = (OMX_VIDEO_PARAM_AVCTYPE *)param;
+        avc->nPFrames = m_p_frames;
+        avc->nBFrames = 0;
+        avc->eProfile = (OMX_VIDEO_AVCPROFILETYPE)m_profile;
+        avc->eLevel   = (OMX_VIDEO_AVCLEVELTYPE)m_level;
+        return OMX_ErrorNone;
+    }
+    case OMX_IndexParamBrcmVideoEncodeMinQuant:
+    case OMX_IndexParamBrcmVideoEncodeMaxQuant:
+    {
+        OMX_PARAM_U32TYPE *quant = (OMX_PARAM_U32TYPE *)param;
+        quant->nU32 = (int)index == OMX_IndexParamBrcmVideoEncodeMinQuant ? m_min_quant : m_max_quant;
+        return OMX_ErrorNone;
+    }
+    case OMX_IndexParamBrcmPixelAspectRatio:
+    {
+        OMX_CONFIG_POINTTYPE *aspect = (OMX_CONFIG_POINTTYPE *)param;
+        aspect->nX = m_aspect_x;
+        aspect->nY = m_aspect_y;
+        return OMX_ErrorNone;
+    }
+    default:
+        return OMX_ErrorUnsupportedIndex;
+    }
+}
+
+OMX_ERRORTYPE COMXSoftVideoEncoder::SetComponentParameter(OMX_INDEXTYPE index, OMX_PTR param)
+{
+    switch((int)index)
+    {
+    case OMX_IndexParamVideoPortFormat:
+    {
+        OMX_VIDEO_PARAM_PORTFORMATTYPE *format = (OMX_VIDEO_PARAM_PORTFORMATTYPE *)param;
+        if(format->nPortIndex == OutputPort().def.nPortIndex && format->eCompressionFormat != OMX_VIDEO_CodingAVC)
+            return OMX_ErrorUnsupportedSetting;
+        return OMX_ErrorNone;
+    }
+    case OMX_IndexParamVideoBitrate:
+    {
+        OMX_VIDEO_PARAM_BITRATETYPE *bitrate = (OMX_VIDEO_PARAM_BITRATETYPE *)param;
+        m_control_rate = bitrate->eControlRate;
+        m_bitrate      = bitrate->nTargetBitrate;
+        return OMX_ErrorNone;
+    }
+    case OMX_IndexParamVideoProfileLevelCurrent:
+    {
+        OMX_VIDEO_PARAM_PROFILELEVELTYPE *profile_level = (OMX_VIDEO_PARAM_PROFILELEVELTYPE *)param;
+        m_profile = profile_level->eProfile;
+        m_level   = profile_level->eLevel;
+        return OMX_ErrorNone;
+    }
+    case OMX_IndexParamVideoAvc:
+    {
+        OMX_VIDEO_PARAM_AVCTYPE *avc = (OMX_VIDEO_PARAM_AVCTYPE *)param;
+        if(avc->nBFrames)
+            return OMX_ErrorUnsupportedSetting;
+        m_p_frames = avc->nPFrames;
+        m_profile  = avc->eProfile;
+        m_level    = avc->eLevel;
+        return OMX_ErrorNone;
+    }
+    case OMX_IndexParamBrcmVideoEncodeMinQuant:
+    {
+        m_min_quant = ((OMX_PARAM_U32TYPE *)param)->nU32;
+        return OMX_ErrorNone;
+    }
+    case OMX_IndexParamBrcmVideoEncodeMaxQuant:
+    {
+        m_max_quant = ((OMX_PARAM_U32TYPE *)param)->nU32;
+        return OMX_ErrorNone;
+    }
+    case OMX_IndexParamBrcmPixelAspectRatio:
+    {
+        OMX_CONFIG_POINTTYPE *aspect = (OMX_CONFIG_POINTTYPE *)param;
+        m_aspect_x = aspect->nX;
+        m_aspect_y = aspect->nY;
+        return OMX_ErrorNone;
+    }
+    case OMX_IndexParamSoftEncoderName:
+    {
+        OMX_PARAM_COMPONENTROLETYPE *name = (OMX_PARAM_COMPONENTROLETYPE *)param;
+        m_codec_name.assign((const char *)name->cRole, strnlen((const char *)name->cRole, OMX_MAX_STRINGNAME_SIZE));
+        return OMX_ErrorNone;
+    }
+    case OMX_IndexConfigRequestCallback:
+        return OMX_ErrorNone;
+    default:
+        return OMX_ErrorUnsupportedIndex;
+    }
+}
+
+OMX_ERRORTYPE COMXSoftVideoEncoder::SetComponentConfig(OMX_INDEXTYPE index, OMX_PTR config)
+{
+    switch((int)index)
+    {
+    case OMX_IndexConfigBrcmVideoRequestIFrame:
+    {
+        OMX_CONFIG_PORTBOOLEANTYPE *request = (OMX_CONFIG_PORTBOOLEANTYPE *)config;
+        m_request_iframe = request->bEnabled == OMX_TRUE;
+        return OMX_ErrorNone;
+    }
+    case OMX_IndexConfigVideoBitrate:
+    {
+        OMX_VIDEO_CONFIG_BITRATETYPE *bitrate = (OMX_VIDEO_CONFIG_BITRATETYPE *)config;
+        m_bitrate = bitrate->nEncodeBitrate;
+        return OMX_ErrorNone;
+    }
+    case OMX_IndexConfigVideoAVCIntraPeriod:
+    {
+        // libavcodec's gop is the IDR interval, there are no I frames in between
+        OMX_VIDEO_CONFIG_AVCINTRAPERIOD *period = (OMX_VIDEO_CONFIG_AVCINTRAPERIOD *)config;
+        if(period->nIDRPeriod > 1)
+            CLOG(LOGINFO, "%s::%s - IDR period %u ignored, every I frame is an IDR\n", CLASSNAME, __func__,
+                 (unsigned int)period->nIDRPeriod);
+        m_p_frames = period->nPFrames;
+        return OMX_ErrorNone;
+    }
+    default:
+        return SetComponentParameter(index, config);
+    }
+}
+
+#endif
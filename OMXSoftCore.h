@@ -0,0 +1,277 @@
+#pragma once
+/*
+ * Copyright (c) 2019/01 truong <truongptk30a3@gmail.com>
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ */
+
+#if defined(HAVE_OMXLIB)
+
+// Software stand-in for the Broadcom OMX IL components.
+//
+// Each component implements the OMX_COMPONENTTYPE function table (the OMX_xxx
+// macros of OMX_Core.h dispatch through it) on top of libavcodec, so
+// COMXCoreComponent can drive it exactly like the VideoCore one:
+// - commands (state set, port enable/disable, flush) complete asynchronously
+//   with OMX_EventCmdComplete from the component thread,
+// - EmptyBufferDone/FillBufferDone are raised from the component thread,
+// - the decoder raises OMX_EventPortSettingsChanged on its first frame (and on
+//   every format change) and holds output until the port is (re)enabled,
+// - EOS on the input port is propagated to the output buffer and reported
+//   with OMX_EventBufferFlag, as the hardware does.
+//
+// Only OMX_GetHandle/OMX_FreeHandle have to be replaced, see COMXCore.
+
+#include "OMXCore.h"
+#include "OMXThread.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/avutil.h>
+}
+
+struct SwsContext;
+
+#include <deque>
+#include <vector>
+#include <string>
+
+#define OMX_SOFT_PORTS 2
+
+// Codings without an OMX_VIDEO_CODINGTYPE (HEVC, VP9, ...): the software
+// decoder takes the AVCodecID above OMX_SOFT_CODING_AVCODEC.
+#define OMX_SOFT_CODING_AVCODEC 0x7F100000
+#define OMX_SOFT_CODING(codec_id) ((OMX_VIDEO_CODINGTYPE)(OMX_SOFT_CODING_AVCODEC + (int)(codec_id)))
+
+// Software encoder only: OMX_PARAM_COMPONENTROLETYPE with the libavcodec
+// encoder name in cRole, an empty one picks libx264, libopenh264 or any H.264.
+#define OMX_IndexParamSoftEncoderName ((OMX_INDEXTYPE)0x7F100001)
+
+typedef struct omx_soft_command {
+    OMX_COMMANDTYPE cmd;
+    OMX_U32         nParam;
+} omx_soft_command;
+
+typedef struct omx_soft_callback {
+    int                   type;
+    OMX_BUFFERHEADERTYPE *buffer;
+    OMX_EVENTTYPE         eEvent;
+    OMX_U32               nData1;
+    OMX_U32               nData2;
+} omx_soft_callback;
+
+class COMXSoftPort
+{
+public:
+    COMXSoftPort();
+
+    OMX_PARAM_PORTDEFINITIONTYPE        def;
+    // every header allocated on this port
+    std::vector<OMX_BUFFERHEADERTYPE*>  buffers;
+    // headers currently owned by the component
+    std::deque<OMX_BUFFERHEADERTYPE*>   queue;
+    bool                                enable_pending;
+    bool                                disable_pending;
+};
+
+class COMXSoftComponent : public OMXThread
+{
+public:
+    virtual ~COMXSoftComponent();
+
+    static bool          IsSoftComponent(const std::string &component_name);
+    static OMX_ERRORTYPE GetHandle(OMX_HANDLETYPE *handle, const std::string &component_name,
+                                   OMX_PTR app_data, OMX_CALLBACKTYPE *callbacks);
+    static OMX_ERRORTYPE FreeHandle(OMX_HANDLETYPE handle);
+    // whether handle was made by GetHandle above
+    static bool          IsSoftHandle(OMX_HANDLETYPE handle);
+
+    void Process();
+
+protected:
+    COMXSoftComponent(const std::string &component_name, OMX_U32 start_port);
+
+    // Called on the component thread without the component lock held.
+    virtual bool CanAcceptInput() = 0;
+    virtual void ProcessInput(OMX_BUFFERHEADERTYPE *buffer) = 0;
+    virtual bool HasOutput() = 0;
+    virtual void ProcessOutput(OMX_BUFFERHEADERTYPE *buffer) = 0;
+    virtual void FlushCodec() = 0;
+    virtual void CloseCodec() = 0;
+
+    // Called from the client thread with the component lock held.
+    virtual OMX_ERRORTYPE GetComponentParameter(OMX_INDEXTYPE index, OMX_PTR param);
+    virtual OMX_ERRORTYPE SetComponentParameter(OMX_INDEXTYPE index, OMX_PTR param);
+    virtual OMX_ERRORTYPE SetComponentConfig(OMX_INDEXTYPE index, OMX_PTR config);
+    virtual void          SetPortDefinition(COMXSoftPort &port, const OMX_PARAM_PORTDEFINITIONTYPE &def) = 0;
+
+    void LockComponent()   { pthread_mutex_lock(&m_soft_lock); }
+    void UnLockComponent() { pthread_mutex_unlock(&m_soft_lock); }
+
+    COMXSoftPort &InputPort()  { return m_ports[0]; }
+    COMXSoftPort &OutputPort() { return m_ports[1]; }
+    bool          OutputReady();
+    void          PostEvent(OMX_EVENTTYPE eEvent, OMX_U32 nData1, OMX_U32 nData2);
+    void          PortSettingsChanged(const OMX_PARAM_PORTDEFINITIONTYPE &def);
+
+    std::string   m_componentName;
+
+private:
+    COMXSoftPort *GetPort(OMX_U32 port);
+    void          QueueCallback(int type, OMX_BUFFERHEADERTYPE *buffer,
+                                OMX_EVENTTYPE eEvent = OMX_EventMax, OMX_U32 nData1 = 0, OMX_U32 nData2 = 0);
+    void          DispatchCallbacks();
+    void          ReturnBuffers(COMXSoftPort &port);
+    void          FreeHeader(OMX_BUFFERHEADERTYPE *header);
+    void          HandleCommand(const omx_soft_command &command);
+    void          HandleStateSet(OMX_STATETYPE state);
+    void          HandleFlush(OMX_U32 port);
+    void          CheckTransitions();
+
+    OMX_ERRORTYPE DoSendCommand(OMX_COMMANDTYPE cmd, OMX_U32 nParam);
+    OMX_ERRORTYPE DoGetParameter(OMX_INDEXTYPE index, OMX_PTR param);
+    OMX_ERRORTYPE DoSetParameter(OMX_INDEXTYPE index, OMX_PTR param);
+    OMX_ERRORTYPE DoSetConfig(OMX_INDEXTYPE index, OMX_PTR config);
+    OMX_ERRORTYPE DoGetState(OMX_STATETYPE *state);
+    OMX_ERRORTYPE DoUseBuffer(OMX_BUFFERHEADERTYPE **header, OMX_U32 port, OMX_PTR app_private,
+                              OMX_U32 size, OMX_U8 *data);
+    OMX_ERRORTYPE DoFreeBuffer(OMX_U32 port, OMX_BUFFERHEADERTYPE *header);
+    OMX_ERRORTYPE DoQueueBuffer(OMX_U32 port, OMX_BUFFERHEADERTYPE *header);
+
+    // OMX_COMPONENTTYPE entry points
+    static COMXSoftComponent *FromHandle(OMX_HANDLETYPE handle);
+    static OMX_ERRORTYPE SendCommandCallback(OMX_HANDLETYPE handle, OMX_COMMANDTYPE cmd, OMX_U32 nParam, OMX_PTR data);
+    static OMX_ERRORTYPE GetParameterCallback(OMX_HANDLETYPE handle, OMX_INDEXTYPE index, OMX_PTR param);
+    static OMX_ERRORTYPE SetParameterCallback(OMX_HANDLETYPE handle, OMX_INDEXTYPE index, OMX_PTR param);
+    static OMX_ERRORTYPE GetConfigCallback(OMX_HANDLETYPE handle, OMX_INDEXTYPE index, OMX_PTR config);
+    static OMX_ERRORTYPE SetConfigCallback(OMX_HANDLETYPE handle, OMX_INDEXTYPE index, OMX_PTR config);
+    static OMX_ERRORTYPE GetStateCallback(OMX_HANDLETYPE handle, OMX_STATETYPE *state);
+    static OMX_ERRORTYPE UseBufferCallback(OMX_HANDLETYPE handle, OMX_BUFFERHEADERTYPE **header, OMX_U32 port,
+                                           OMX_PTR app_private, OMX_U32 size, OMX_U8 *data);
+    static OMX_ERRORTYPE AllocateBufferCallback(OMX_HANDLETYPE handle, OMX_BUFFERHEADERTYPE **header, OMX_U32 port,
+                                                OMX_PTR app_private, OMX_U32 size);
+    static OMX_ERRORTYPE FreeBufferCallback(OMX_HANDLETYPE handle, OMX_U32 port, OMX_BUFFERHEADERTYPE *header);
+    static OMX_ERRORTYPE EmptyThisBufferCallback(OMX_HANDLETYPE handle, OMX_BUFFERHEADERTYPE *header);
+    static OMX_ERRORTYPE FillThisBufferCallback(OMX_HANDLETYPE handle, OMX_BUFFERHEADERTYPE *header);
+    static OMX_ERRORTYPE UseEGLImageCallback(OMX_HANDLETYPE handle, OMX_BUFFERHEADERTYPE **header, OMX_U32 port,
+                                             OMX_PTR app_private, void *egl_image);
+
+    OMX_COMPONENTTYPE              m_handle;
+    OMX_CALLBACKTYPE               m_callbacks;
+    OMX_PTR                        m_app_data;
+
+    pthread_mutex_t                m_soft_lock;
+    pthread_cond_t                 m_soft_cond;
+    OMX_STATETYPE                  m_state;
+    OMX_STATETYPE                  m_target_state;
+    COMXSoftPort                   m_ports[OMX_SOFT_PORTS];
+    std::deque<omx_soft_command>   m_commands;
+    std::deque<omx_soft_callback>  m_pending_callbacks;
+    // header the component thread is working on or dispatching, freed late
+    OMX_BUFFERHEADERTYPE          *m_busy;
+    bool                           m_busy_freed;
+    // output is held back after a settings change until the port is re-enabled
+    bool                           m_output_reconfig;
+};
+
+// libavcodec backed "OMX.broadcom.video_decode" (ports 130/131), outputs
+// OMX_COLOR_FormatYUV420PackedPlanar with the VideoCore stride/slice alignment.
+class COMXSoftVideoDecoder : public COMXSoftComponent
+{
+public:
+    COMXSoftVideoDecoder(const std::string &component_name);
+    ~COMXSoftVideoDecoder();
+
+protected:
+    bool CanAcceptInput();
+    void ProcessInput(OMX_BUFFERHEADERTYPE *buffer);
+    bool HasOutput();
+    void ProcessOutput(OMX_BUFFERHEADERTYPE *buffer);
+    void FlushCodec();
+    void CloseCodec();
+
+    OMX_ERRORTYPE GetComponentParameter(OMX_INDEXTYPE index, OMX_PTR param);
+    OMX_ERRORTYPE SetComponentParameter(OMX_INDEXTYPE index, OMX_PTR param);
+    void          SetPortDefinition(COMXSoftPort &port, const OMX_PARAM_PORTDEFINITIONTYPE &def);
+
+private:
+    bool OpenCodec();
+    void DecodePacket(uint8_t *data, int size);
+    void CheckFrameFormat(AVFrame *frame);
+
+    AVCodecContext         *m_codec_ctx;
+    struct SwsContext      *m_sws_ctx;
+    std::vector<uint8_t>    m_extradata;
+    std::vector<uint8_t>    m_packet;
+    int64_t                 m_packet_pts;
+    int64_t                 m_packet_dts;
+    std::deque<AVFrame*>    m_frames;
+    bool                    m_eos;
+    bool                    m_configured;
+    int                     m_width;
+    int                     m_height;
+    AVRational              m_pixel_aspect;
+};
+
+typedef struct omx_soft_packet {
+    AVPacket pkt;
+    OMX_U32  flags;
+    int      offset;
+} omx_soft_packet;
+
+// libavcodec backed "OMX.broadcom.video_encode" (ports 200/201), takes
+// OMX_COLOR_FormatYUV420PackedPlanar and produces H.264 with the parameter
+// sets sent first as separate OMX_BUFFERFLAG_CODECCONFIG buffers.
+class COMXSoftVideoEncoder : public COMXSoftComponent
+{
+public:
+    COMXSoftVideoEncoder(const std::string &component_name);
+    ~COMXSoftVideoEncoder();
+
+protected:
+    bool CanAcceptInput();
+    void ProcessInput(OMX_BUFFERHEADERTYPE *buffer);
+    bool HasOutput();
+    void ProcessOutput(OMX_BUFFERHEADERTYPE *buffer);
+    void FlushCodec();
+    void CloseCodec();
+
+    OMX_ERRORTYPE GetComponentParameter(OMX_INDEXTYPE index, OMX_PTR param);
+    OMX_ERRORTYPE SetComponentParameter(OMX_INDEXTYPE index, OMX_PTR param);
+    OMX_ERRORTYPE SetComponentConfig(OMX_INDEXTYPE index, OMX_PTR config);
+    void          SetPortDefinition(COMXSoftPort &port, const OMX_PARAM_PORTDEFINITIONTYPE &def);
+
+private:
+    bool OpenCodec();
+    void SendCodecConfig();
+    void QueuePacket(AVPacket *pkt, OMX_U32 flags);
+    void EncodeFrame(AVFrame *frame);
+
+    AVCodecContext              *m_codec_ctx;
+    AVFrame                     *m_frame;
+    std::deque<omx_soft_packet>  m_packets;
+    bool                         m_eos;
+    int64_t                      m_last_pts;
+    // settings, written by the client under the component lock
+    OMX_VIDEO_CONTROLRATETYPE    m_control_rate;
+    OMX_U32                      m_bitrate;
+    OMX_U32                      m_profile;
+    OMX_U32                      m_level;
+    OMX_U32                      m_p_frames;  // between I frames, each one is an IDR
+    OMX_U32                      m_min_quant; // 0: libavcodec's default
+    OMX_U32                      m_max_quant;
+    std::string                  m_codec_name;
+    OMX_S32                      m_aspect_x;
+    OMX_S32                      m_aspect_y;
+    bool                         m_request_iframe;
+};
+
+#endif
@@ -22,7 +22,9 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <algorithm>
 #include "OMXTranscoderVideo.h"
+#include "BitstreamConverter.h"
 #include "linux/XMemUtils.h"
 
 // #define DBG_PRINT printf
@@ -37,12 +39,14 @@ OMXPlayerVideo::OMXPlayerVideo()
     m_fps           = 25.0f;
     m_flush         = false;
     m_flush_requested = false;
+    m_submit_eos    = false;
     m_cached_size   = 0;
     m_iVideoDelay   = 0;
     m_iCurrentPts   = 0;
 
     pthread_cond_init(&m_packet_cond, NULL);
     pthread_cond_init(&m_picture_cond, NULL);
+    pthread_cond_init(&m_space_cond, NULL);
     pthread_mutex_init(&m_lock, NULL);
     pthread_mutex_init(&m_lock_decoder, NULL);
 }
@@ -53,6 +57,7 @@ OMXPlayerVideo::~OMXPlayerVideo()
 
     pthread_cond_destroy(&m_packet_cond);
     pthread_cond_destroy(&m_picture_cond);
+    pthread_cond_destroy(&m_space_cond);
     pthread_mutex_destroy(&m_lock);
     pthread_mutex_destroy(&m_lock_decoder);
 }
@@ -95,6 +100,7 @@ bool OMXPlayerVideo::Open(const OMXVideoConfig &config)
     m_iCurrentPts = DVD_NOPTS_VALUE;
     m_bAbort      = false;
     m_flush       = false;
+    m_submit_eos  = false;
     m_cached_size = 0;
     m_iVideoDelay = 0;
 
@@ -146,6 +152,7 @@ bool OMXPlayerVideo::Close()
     {
         Lock();
         pthread_cond_broadcast(&m_packet_cond);
+        pthread_cond_broadcast(&m_space_cond);
         UnLock();
 
         StopThread();
@@ -178,13 +185,15 @@ bool OMXPlayerVideo::Decode(OMXPacket *pkt)
     if(pts != DVD_NOPTS_VALUE)
         m_iCurrentPts = pts;
 
-    while((int) m_decoder->GetFreeSpace() < pkt->size)
+    // woken up as the decoder returns input buffers, or by Flush()
+    unsigned int needed = std::min((unsigned int)pkt->size, m_decoder->GetSize());
+    while(m_decoder->GetFreeSpace() < needed)
     {
-        OMXSleep(10);
         if(m_flush_requested) return true;
+        m_decoder->WaitForFreeSpace(needed, 100);
     }
 
-    CLog::Log(LOGINFO, "CDVDPlayerVideo::Decode dts:%.0f pts:%.0f cur:%.0f, size:%d", pkt->dts, pkt->pts, m_iCurrentPts, pkt->size);
+    CLOG(LOGINFO, "CDVDPlayerVideo::Decode dts:%.0f pts:%.0f cur:%.0f, size:%d", pkt->dts, pkt->pts, m_iCurrentPts, pkt->size);
     m_decoder->Decode(pkt->data, pkt->size, dts, pts);
     return true;
 }
@@ -195,9 +204,11 @@ void OMXPlayerVideo::Process()
 
     while(true)
     {
+        bool submit_eos = false;
+
         Lock();
         DBG_PRINT("%s %d\n",__func__,__LINE__);
-        if(!(m_bStop || m_bAbort) && m_packets.empty())
+        if(!(m_bStop || m_bAbort) && m_packets.empty() && !m_submit_eos)
             pthread_cond_wait(&m_packet_cond, &m_lock);
         DBG_PRINT("%s %d\n",__func__,__LINE__);
         if (m_bStop || m_bAbort)
@@ -218,10 +229,19 @@ void OMXPlayerVideo::Process()
             omx_pkt = m_packets.front();
             m_cached_size -= omx_pkt->size;
             m_packets.pop_front();
+            pthread_cond_broadcast(&m_space_cond);
+        }
+        else if(!omx_pkt && m_submit_eos)
+        {
+            // everything queued before it has been decoded
+            m_submit_eos = false;
+            submit_eos   = true;
         }
         UnLock();
 
         LockDecoder();
+        if(submit_eos && m_decoder)
+            m_decoder->SubmitEOS();
         if(m_flush && omx_pkt)
         {
             OMXReader::FreePacket(omx_pkt);
@@ -243,10 +263,13 @@ void OMXPlayerVideo::Process()
 void OMXPlayerVideo::Flush()
 {
     m_flush_requested = true;
+    if(m_decoder)
+        m_decoder->WakeWaiters();
     Lock();
     LockDecoder();
     m_flush_requested = false;
     m_flush = true;
+    m_submit_eos = false;
     while (!m_packets.empty())
     {
         OMXPacket *pkt = m_packets.front(); 
@@ -255,13 +278,14 @@ void OMXPlayerVideo::Flush()
     }
     m_iCurrentPts = DVD_NOPTS_VALUE;
     m_cached_size = 0;
+    pthread_cond_broadcast(&m_space_cond);
     if(m_decoder)
         m_decoder->Reset();
     UnLockDecoder();
     UnLock();
 }
 
-bool OMXPlayerVideo::AddPacket(OMXPacket *pkt)
+bool OMXPlayerVideo::AddPacket(OMXPacket *pkt, long timeout /* = 0 */)
 {
     bool ret = false;
 
@@ -271,22 +295,149 @@ bool OMXPlayerVideo::AddPacket(OMXPacket *pkt)
     if(m_bStop || m_bAbort)
         return ret;
 
+    struct timespec endtime;
+    clock_gettime(CLOCK_REALTIME, &endtime);
+    long long nsec = endtime.tv_nsec + (long long)timeout * 1000000;
+    endtime.tv_sec += nsec / 1000000000;
+    endtime.tv_nsec = nsec % 1000000000;
+
+    Lock();
+    // the decoder thread signals m_space_cond as it takes packets
+    while((m_cached_size + pkt->size) >= m_config.queue_size * 1024 * 1024 &&
+          timeout > 0 && m_config.use_thread && !(m_bStop || m_bAbort))
+    {
+        if(pthread_cond_timedwait(&m_space_cond, &m_lock, &endtime) != 0)
+            break;
+    }
     if((m_cached_size + pkt->size) < m_config.queue_size * 1024 * 1024)
     {
-        Lock();
         m_cached_size += pkt->size;
         m_packets.push_back(pkt);
-        UnLock();
         ret = true;
-        pthread_cond_broadcast(&m_packet_cond);
     }
+    UnLock();
+
+    if(ret)
+        pthread_cond_broadcast(&m_packet_cond);
 
     return ret;
 }
 
-void OMXPlayerVideo::SetCallBack(enc_done_cbk cb)
+// first SPS of avcC or Annex B extradata, without the NAL header byte
+static bool FindH264SPS(uint8_t *extra, unsigned int size, uint8_t **sps, unsigned int *sps_size)
+{
+    if(!extra || size < 8)
+        return false;
+
+    if(extra[0] == 1)
+    {
+        if((extra[5] & 0x1f) == 0)
+            return false;
+        unsigned int len = (extra[6] << 8) | extra[7];
+        if(len < 2 || 8 + len > size)
+            return false;
+        *sps      = extra + 9;
+        *sps_size = len - 1;
+        return true;
+    }
+
+    for(unsigned int i = 0; i + 3 < size; i++)
+    {
+        if(extra[i] != 0 || extra[i + 1] != 0 || extra[i + 2] != 1 || (extra[i + 3] & 0x1f) != 7)
+            continue;
+        unsigned int end = i + 4;
+        while(end + 2 < size && !(extra[end] == 0 && extra[end + 1] == 0 && extra[end + 2] <= 1))
+            end++;
+        if(end + 2 >= size)
+            end = size;
+        *sps      = extra + i + 4;
+        *sps_size = end - (i + 4);
+        return *sps_size > 0;
+    }
+    return false;
+}
+
+// profile_idc ordered by what a player has to support
+static int AvcProfileRank(int profile_idc)
+{
+    switch(profile_idc)
+    {
+    case 66:  return 0; // Baseline
+    case 77:  return 1; // Main
+    case 100: return 2; // High
+    default:  return -1;
+    }
+}
+
+bool OMXPlayerVideo::CanPassthrough(const COMXStreamInfo &hints, int64_t bitrate, const OMXVideoEncoderConfig &encoder,
+                                    const char **reason)
+{
+    const char *dummy;
+    if(!reason)
+        reason = &dummy;
+
+    if(hints.codec != AV_CODEC_ID_H264)
+    {
+        *reason = "not H.264";
+        return false;
+    }
+    if(hints.width > VIDEO_ENCODER_MAX_WIDTH || hints.height > VIDEO_ENCODER_MAX_HEIGHT)
+    {
+        *reason = "resolution above the encoder's";
+        return false;
+    }
+    // unknown counts as too high, the container rate includes audio so errs the same way
+    if(bitrate <= 0 || bitrate > encoder.MaxBitrate())
+    {
+        *reason = "bitrate unknown or above the target";
+        return false;
+    }
+
+    uint8_t *sps;
+    unsigned int sps_size;
+    sps_info_struct info;
+    CBitstreamConverter converter;
+    if(!FindH264SPS((uint8_t *)hints.extradata, hints.extrasize, &sps, &sps_size) ||
+       !converter.parseh264_sps(sps, sps_size, &info))
+    {
+        *reason = "no usable SPS";
+        return false;
+    }
+
+    CLOG(LOGINFO, "%s::%s - profile %d level %d chroma %d depth %d progressive %d", "OMXPlayerVideo", __func__,
+         info.profile_idc, info.level_idc, info.chroma_format_idc, info.bit_depth_luma_minus8 + 8, info.frame_mbs_only_flag);
+
+    // Baseline, Main and High: what players take wherever the encoder's output goes
+    int max_rank = encoder.profile == OMX_VIDEO_AVCProfileBaseline ? 0 : encoder.profile == OMX_VIDEO_AVCProfileMain ? 1 : 2;
+    int rank = AvcProfileRank(info.profile_idc);
+    if(rank < 0 || rank > max_rank)
+    {
+        *reason = "profile above the target";
+        return false;
+    }
+    if(info.level_idc > encoder.level)
+    {
+        *reason = "level above the target";
+        return false;
+    }
+    if(info.chroma_format_idc != 1 || info.bit_depth_luma_minus8 || info.bit_depth_chroma_minus8)
+    {
+        *reason = "not 8 bit 4:2:0";
+        return false;
+    }
+    if(!info.frame_mbs_only_flag)
+    {
+        *reason = "interlaced";
+        return false;
+    }
+
+    *reason = "compliant H.264";
+    return true;
+}
+
+void OMXPlayerVideo::SetCallBack(enc_done_cbk cb, void *opaque)
 {
-    m_decoder->SetCallBack(cb);
+    m_decoder->SetCallBack(cb, opaque);
 }
 
 bool OMXPlayerVideo::OpenDecoder()
@@ -319,6 +470,16 @@ bool OMXPlayerVideo::OpenDecoder()
     return true;
 }
 
+bool OMXPlayerVideo::GetTransferStats(OMXVideoTransferStats &stats)
+{
+    LockDecoder();
+    bool open = m_decoder != NULL;
+    if(open)
+        stats = m_decoder->GetTransferStats();
+    UnLockDecoder();
+    return open;
+}
+
 bool OMXPlayerVideo::CloseDecoder()
 {
     if(m_decoder)
@@ -343,16 +504,29 @@ int  OMXPlayerVideo::GetDecoderFreeSpace()
         return 0;
 }
 
+// after the packets already queued, on the decoder thread
 void OMXPlayerVideo::SubmitEOS()
 {
-    if(m_decoder)
-        m_decoder->SubmitEOS();
+    if(!m_config.use_thread)
+    {
+        if(m_decoder)
+            m_decoder->SubmitEOS();
+        return;
+    }
+
+    Lock();
+    m_submit_eos = true;
+    UnLock();
+    pthread_cond_broadcast(&m_packet_cond);
 }
 
 bool OMXPlayerVideo::IsEOS()
 {
     if(!m_decoder)
         return false;
-    return m_packets.empty() && (!m_decoder || m_decoder->IsEOS());
+    Lock();
+    bool queued = !m_packets.empty() || m_submit_eos;
+    UnLock();
+    return !queued && m_decoder->IsEOS();
 }
 
@@ -55,6 +55,7 @@ protected:
     double                    m_iCurrentPts;
     pthread_cond_t            m_packet_cond;
     pthread_cond_t            m_picture_cond;
+    pthread_cond_t            m_space_cond;
     pthread_mutex_t           m_lock;
     pthread_mutex_t           m_lock_decoder;
     COMXVideo                 *m_decoder;
@@ -64,6 +65,7 @@ protected:
     bool                      m_bAbort;
     bool                      m_flush;
     std::atomic<bool>         m_flush_requested;
+    bool                      m_submit_eos; // SubmitEOS once m_packets is empty
     unsigned int              m_cached_size;
     double                    m_iVideoDelay;
     OMXVideoConfig            m_config;
@@ -81,8 +83,13 @@ public:
     bool Decode(OMXPacket *pkt);
     void Process();
     void Flush();
-    bool AddPacket(OMXPacket *pkt);
-    void SetCallBack(enc_done_cbk cb);
+    // timeout in ms: how long to wait for room in the queue
+    bool AddPacket(OMXPacket *pkt, long timeout = 0);
+    void SetCallBack(enc_done_cbk cb, void *opaque = NULL);
+    // true when the stream already fits what encoder would produce and can
+    // be remuxed as is, reason tells why (not)
+    static bool CanPassthrough(const COMXStreamInfo &hints, int64_t bitrate, const OMXVideoEncoderConfig &encoder,
+                               const char **reason = NULL);
     bool OpenDecoder();
     bool CloseDecoder();
     int  GetDecoderBufferSize();
@@ -90,6 +97,8 @@ public:
     double GetCurrentPTS() { return m_iCurrentPts; };
     double GetFPS() { return m_fps; };
     unsigned int GetCached() { return m_cached_size; };
+    // false when no decoder is open
+    bool GetTransferStats(OMXVideoTransferStats &stats);
     unsigned int GetMaxCached() { return m_config.queue_size * 1024 * 1024; };
     unsigned int GetLevel() { return m_config.queue_size ? 100.0f * m_cached_size / (m_config.queue_size * 1024.0f * 1024.0f) : 0; };
     void SubmitEOS();
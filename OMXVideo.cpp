@@ -27,9 +27,14 @@
 
 #include "OMXVideo.h"
 #include "OMXStreamInfo.h"
+#include "OMXSoftCore.h"
 #include "utils/log.h"
 #include "linux/XMemUtils.h"
 
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
 #ifdef CLASSNAME
 #undef CLASSNAME
 #endif
@@ -37,6 +42,8 @@
 
 #define OMX_VIDEO_ENCODER       "OMX.broadcom.video_encode"
 #define OMX_VIDEO_DECODER       "OMX.broadcom.video_decode"
+#define OMX_VIDEO_SPLITTER      "OMX.broadcom.video_splitter"
+#define OMX_VIDEO_RESIZE        "OMX.broadcom.resize"
 
 #define OMX_H264BASE_DECODER    OMX_VIDEO_DECODER
 #define OMX_H264MAIN_DECODER    OMX_VIDEO_DECODER
@@ -57,13 +64,31 @@
 // #define PORT_PRINT printf
 // #define COMP_PRINT printf
 
-//TODO(truong): Currently, tentative using non-tunnel, for tunnel is used later.
-#define NON_TUNNEL
 #define PORT_PRINT(...)
 #define COMP_PRINT(...)
 
+// pumps poll their stop flag at this interval (ms)
+#define VIDEO_PUMP_TIMEOUT 100
+// ms for the encoders to finish the frames in flight on a format change
+#define VIDEO_DRAIN_TIMEOUT 1000
+
+void COMXVideoPump::Process()
+{
+    while(!m_bStop)
+        (m_video->*m_pump)(m_output);
+}
+
+COMXVideoOutput::COMXVideoOutput(COMXVideo *video, unsigned int index, const OMXVideoRendition &rendition,
+                                 const OMXVideoEncoderConfig &settings)
+    : index(index), rendition(rendition), settings(settings), pixel_aspect(av_make_q(1, 1)), scaled(false),
+      pump(video, &COMXVideo::PumpEncoderOutput, index),
+      stride(0), slice_height(0), sws(NULL), next_keyframe(AV_NOPTS_VALUE)
+{
+}
 
-COMXVideo::COMXVideo() : m_video_codec_name("")
+COMXVideo::COMXVideo() : m_video_codec_name(""),
+                         m_frame_pump(this, &COMXVideo::PumpFrames),
+                         m_return_pump(this, &COMXVideo::PumpSharedReturns)
 {
     m_is_open           = false;
     m_drop_state        = false;
@@ -71,6 +96,17 @@ COMXVideo::COMXVideo() : m_video_codec_name("")
     m_failed_eos        = false;
     m_settings_changed  = false;
     m_setStartTime      = false;
+    m_pumps_stop        = false;
+    m_enc_done_cb       = NULL;
+    m_enc_done_opaque   = NULL;
+    m_transfer_mode     = VIDEO_TRANSFER_AUTO;
+    m_transfer_copied   = 0;
+    m_transfer_frames   = 0;
+    m_transfer_dropped  = 0;
+    m_decimate_start    = AV_NOPTS_VALUE;
+    m_decimate_slot     = -1;
+    memset(&m_decoded_format, 0, sizeof(m_decoded_format));
+    m_decoded_aspect    = av_make_q(1, 1);
 }
 
 COMXVideo::~COMXVideo()
@@ -78,9 +114,10 @@ COMXVideo::~COMXVideo()
     Close();
 }
 
-void COMXVideo::SetCallBack(enc_done_cbk cb)
+void COMXVideo::SetCallBack(enc_done_cbk cb, void *opaque)
 {
-    m_enc_done_cb = cb;
+    m_enc_done_cb     = cb;
+    m_enc_done_opaque = opaque;
 }
 
 void COMXVideo::DumpCompState(COMXCoreComponent* comp)
@@ -193,7 +230,7 @@ bool COMXVideo::SendDecoderConfig()
 
         if(omx_buffer == NULL)
         {
-            CLog::Log(LOGERROR, "%s::%s - buffer error 0x%08x", CLASSNAME, __func__, omx_err);
+            CLOG(LOGERROR, "%s::%s - buffer error 0x%08x", CLASSNAME, __func__, omx_err);
             return false;
         }
 
@@ -207,279 +244,1191 @@ bool COMXVideo::SendDecoderConfig()
         omx_err = m_omx_decoder.EmptyThisBuffer(omx_buffer);
         if (omx_err != OMX_ErrorNone)
         {
-            CLog::Log(LOGERROR, "%s::%s - OMX_EmptyThisBuffer() failed with result(0x%x)\n", CLASSNAME, __func__, omx_err);
-            m_omx_decoder.DecoderEmptyBufferDone(m_omx_decoder.GetComponent(), omx_buffer);
-            return false;
+            CLOG(LOGERROR, "%s::%s - OMX_EmptyThisBuffer() failed with result(0x%x)\n", CLASSNAME, __func__, omx_err);
+            m_omx_decoder.ReturnInputBuffer(omx_buffer);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool COMXVideo::NaluFormatStartCodes(enum AVCodecID codec, uint8_t *in_extradata, int in_extrasize)
+{
+    switch(codec)
+    {
+    case AV_CODEC_ID_H264:
+        if (in_extrasize < 7 || in_extradata == NULL)
+            return true;
+        // valid avcC atom data always starts with the value 1 (version), otherwise annexb
+        else if ( *in_extradata != 1 )
+            return true;
+    default: break;
+    }
+    return false;    
+}
+
+// splitter/resize: tunneled ports only, no buffers to wait for
+static bool StartTunnelComponent(COMXCoreComponent &component)
+{
+    if(!component.IsInitialized())
+        return true;
+
+    OMX_ERRORTYPE omx_err = component.SetStateForComponent(OMX_StateIdle);
+    if(omx_err == OMX_ErrorNone)
+        omx_err = component.SetStateForComponent(OMX_StateExecuting);
+    if(omx_err != OMX_ErrorNone)
+    {
+        CLOG(LOGERROR, "%s::%s - %s omx_err(0x%08x)\n", CLASSNAME, __func__, component.GetName().c_str(), omx_err);
+        return false;
+    }
+    return true;
+}
+
+bool COMXVideo::PortSettingsChanged()
+{
+    CSingleLock lock (m_critSection);
+    OMX_ERRORTYPE omx_err   = OMX_ErrorNone;
+
+    if(m_settings_changed)
+        return ReconfigureInput();
+
+    CLOG(LOGDEBUG,"%s line %d start\n",__func__,__LINE__);
+
+    OMX_PARAM_PORTDEFINITIONTYPE in_port_enc_prm;
+    if(!ReadDecodedFormat(in_port_enc_prm))
+        return false;
+    OMX_U32 framerate = EncoderFramerate(in_port_enc_prm);
+
+    for(size_t i = 0; i < m_outputs.size(); i++)
+    {
+        COMXVideoOutput *output = m_outputs[i];
+
+        ResolveOutput(output, false);
+
+        //ADD(truong): create Encoder component
+        if(!output->encoder.Initialize(OMX_VIDEO_ENCODER, OMX_IndexParamVideoInit, NULL, output->settings.Backend()))
+        {
+            CLOG(LOGERROR,"%s line %d encoder is initialized fail\n",__func__,__LINE__);
+            return false;
+        }
+
+        if(output->settings.Backend() == OMX_CORE_BACKEND_SOFT && !output->settings.soft_name.empty())
+        {
+            OMX_PARAM_COMPONENTROLETYPE name;
+            OMX_INIT_STRUCTURE(name);
+            strncpy((char *)name.cRole, output->settings.soft_name.c_str(), OMX_MAX_STRINGNAME_SIZE - 1);
+            omx_err = output->encoder.SetParameter(OMX_IndexParamSoftEncoderName, &name);
+            if(omx_err != OMX_ErrorNone)
+            {
+                CLOG(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
+                return false;
+            }
+        }
+
+        output->encoder.SetPrivateCallBack(m_enc_done_cb, m_enc_done_opaque, i);
+
+        if(!ConfigureEncoderInput(output, in_port_enc_prm, framerate))
+            return false;
+
+        omx_err = output->encoder.SetStateForComponent(OMX_StateIdle);
+        if (omx_err != OMX_ErrorNone)
+        {
+            CLOG(LOGERROR, "COMXVideo::Open error encoder.SetStateForComponent\n");
+            return false;
+        }
+    }
+
+    // the frame grid, keyframe grid and counters run across later changes
+    m_transfer_copied  = 0;
+    m_transfer_frames  = 0;
+    m_transfer_dropped = 0;
+    m_decimate_start   = AV_NOPTS_VALUE;
+    for(size_t i = 0; i < m_outputs.size(); i++)
+        m_outputs[i]->next_keyframe = AV_NOPTS_VALUE;
+
+    if(!SetupTransfer())
+        return false;
+
+    for(size_t i = 0; i < m_outputs.size(); i++)
+    {
+        if(!ConfigureEncoder(m_outputs[i], framerate))
+            return false;
+    }
+
+    if(!StartTransfer())
+        return false;
+
+    m_settings_changed = true;
+    return true;
+}
+
+// A PortSettingsChanged after the first: the decoded frames changed size or
+// aspect mid-stream. The decoder and the encoders stay up and keep their
+// output size; what is in flight is encoded, then the transfer between them
+// is rebuilt around the new frames. An encoder whose pixel aspect changes
+// cycles its output port, the SPS it sends next goes to the muxer.
+bool COMXVideo::ReconfigureInput()
+{
+    CLOG(LOGINFO, "%s::%s - decoded format changed from %ux%u\n", CLASSNAME, __func__,
+         (unsigned int)m_decoded_format.nFrameWidth, (unsigned int)m_decoded_format.nFrameHeight);
+
+    DrainTransfer();
+    StopPumps();
+
+    if(m_transfer_mode == VIDEO_TRANSFER_TUNNEL)
+    {
+        CloseTunnels();
+    }
+    else
+    {
+        // the encoder side first, its buffers may be the decoder's
+        for(size_t i = 0; i < m_outputs.size(); i++)
+            m_outputs[i]->encoder.FreeInputBuffers();
+        m_omx_decoder.FreeOutputBuffers();
+    }
+
+    OMX_PARAM_PORTDEFINITIONTYPE in_port_enc_prm;
+    if(!ReadDecodedFormat(in_port_enc_prm))
+        return false;
+    OMX_U32 framerate = EncoderFramerate(in_port_enc_prm);
+
+    for(size_t i = 0; i < m_outputs.size(); i++)
+    {
+        COMXVideoOutput *output = m_outputs[i];
+        AVRational pixel_aspect = output->pixel_aspect;
+
+        ResolveOutput(output, true);
+        if(!ConfigureEncoderInput(output, in_port_enc_prm, framerate))
+            return false;
+        if(av_cmp_q(pixel_aspect, output->pixel_aspect) && !SetEncoderAspect(output, true))
+            return false;
+    }
+
+    if(!SetupTransfer())
+        return false;
+    return StartTransfer();
+}
+
+// The decoder output port as it is now (not populated): buffer count,
+// m_decoded_format and m_decoded_aspect.
+bool COMXVideo::ReadDecodedFormat(OMX_PARAM_PORTDEFINITIONTYPE &in_port_enc_prm)
+{
+    OMX_ERRORTYPE omx_err;
+
+    // get output param of decoder -> set to encoder
+    OMX_INIT_STRUCTURE(in_port_enc_prm);
+    in_port_enc_prm.nPortIndex = m_omx_decoder.GetOutputPort();
+
+    omx_err = m_omx_decoder.GetParameter(OMX_IndexParamPortDefinition, &in_port_enc_prm);
+    if(omx_err != OMX_ErrorNone)
+    {
+        CLOG(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
+        return false;
+    }
+    DumpPort(in_port_enc_prm);
+
+    // keep several frames in flight between the decoder and the encoder
+    in_port_enc_prm.nBufferCountActual = std::max((OMX_U32)VIDEO_FRAME_BUFFERS, in_port_enc_prm.nBufferCountMin);
+    omx_err = m_omx_decoder.SetParameter(OMX_IndexParamPortDefinition, &in_port_enc_prm);
+    if(omx_err != OMX_ErrorNone)
+    {
+        CLOG(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
+        return false;
+    }
+    m_decoded_format = in_port_enc_prm.format.video;
+
+    // the stream's pixel aspect as the decoder parsed it, else the container's
+    OMX_CONFIG_POINTTYPE pixel_aspect;
+    OMX_INIT_STRUCTURE(pixel_aspect);
+    pixel_aspect.nPortIndex = m_omx_decoder.GetOutputPort();
+    if(m_omx_decoder.GetParameter(OMX_IndexParamBrcmPixelAspectRatio, &pixel_aspect) == OMX_ErrorNone &&
+       pixel_aspect.nX > 0 && pixel_aspect.nY > 0)
+        m_decoded_aspect = av_make_q(pixel_aspect.nX, pixel_aspect.nY);
+    else if(m_config.hints.aspect > 0.0f)
+        m_decoded_aspect = av_d2q((double)m_config.hints.aspect * m_config.hints.height / m_config.hints.width, 1000);
+    else
+        m_decoded_aspect = av_make_q(1, 1);
+
+    return true;
+}
+
+// the encoders run at output_fps when frames are dropped
+OMX_U32 COMXVideo::EncoderFramerate(const OMX_PARAM_PORTDEFINITIONTYPE &decoded)
+{
+    if(m_config.output_fps > 0.0f)
+        return (OMX_U32)(m_config.output_fps * (1 << 16));
+    return decoded.format.video.xFramerate;
+}
+
+// Size, scaling and pixel aspect of output for m_decoded_format. keep_size:
+// the size is already settled (mid-stream change), the frames are scaled to it.
+void COMXVideo::ResolveOutput(COMXVideoOutput *output, bool keep_size)
+{
+    int width  = m_decoded_format.nFrameWidth;
+    int height = m_decoded_format.nFrameHeight;
+
+    if(!keep_size)
+        m_config.OutputSize(output->index, width, height, m_decoded_aspect.num, m_decoded_aspect.den,
+                            output->rendition.width, output->rendition.height);
+    output->scaled = output->rendition.width != width || output->rendition.height != height;
+    // a size off the display aspect is fixed up by the pixel aspect
+    output->pixel_aspect = av_mul_q(m_decoded_aspect, av_make_q(width * output->rendition.height,
+                                                                height * output->rendition.width));
+}
+
+// Encoder input port of output: the decoded frames, or frames of the
+// rendition size. The port is disabled or the encoder not running yet.
+bool COMXVideo::ConfigureEncoderInput(COMXVideoOutput *output, const OMX_PARAM_PORTDEFINITIONTYPE &decoded, OMX_U32 framerate)
+{
+    OMX_ERRORTYPE omx_err;
+
+    OMX_PARAM_PORTDEFINITIONTYPE enc_in = decoded;
+    enc_in.nPortIndex = output->encoder.GetInputPort();
+    enc_in.format.video.xFramerate = framerate;
+    if(output->scaled)
+    {
+        enc_in.format.video.nFrameWidth  = output->rendition.width;
+        enc_in.format.video.nFrameHeight = output->rendition.height;
+        enc_in.format.video.nStride      = FFALIGN(output->rendition.width, 32);
+        enc_in.format.video.nSliceHeight = FFALIGN(output->rendition.height, 16);
+        enc_in.nBufferSize = enc_in.format.video.nStride * enc_in.format.video.nSliceHeight * 3 / 2;
+    }
+    omx_err = output->encoder.SetParameter(OMX_IndexParamPortDefinition, &enc_in);
+    if(omx_err != OMX_ErrorNone)
+    {
+        CLOG(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
+        return false;
+    }
+
+    // the layout the encoder settled on, frames are copied/scaled into it
+    omx_err = output->encoder.GetParameter(OMX_IndexParamPortDefinition, &enc_in);
+    if(omx_err != OMX_ErrorNone)
+    {
+        CLOG(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
+        return false;
+    }
+    output->stride       = enc_in.format.video.nStride;
+    output->slice_height = enc_in.format.video.nSliceHeight;
+    return true;
+}
+
+// Buffers for the chosen transfer, ports enabled and the pumps started. The
+// encoders have their output port set up.
+bool COMXVideo::StartTransfer()
+{
+    OMX_ERRORTYPE omx_err;
+
+    if(m_transfer_mode == VIDEO_TRANSFER_SHARED)
+    {
+        // one output at the decoded size
+        COMXCoreComponent &encoder = m_outputs[0]->encoder;
+
+        // decoder output buffers first, the encoder input port uses their memory
+        omx_err = m_omx_decoder.AllocOutputBuffers();
+        if (omx_err != OMX_ErrorNone)
+        {
+            CLOG(LOGERROR, "COMXVideo::Open AllocOutputBuffers error (0%08x)\n", omx_err);
+            return false;
+        }
+
+        omx_err = encoder.AllocInputBuffers(false, &m_omx_decoder.GetOutputBuffers());
+        if (omx_err != OMX_ErrorNone && m_config.transfer_mode == VIDEO_TRANSFER_AUTO)
+        {
+            // port buffer sizes/counts don't line up, copy instead
+            CLOG(LOGINFO, "%s::%s - can't share decoder buffers (0x%08x), copying frames\n", CLASSNAME, __func__, omx_err);
+            m_transfer_mode = VIDEO_TRANSFER_COPY;
+            omx_err = encoder.AllocInputBuffers();
+        }
+        if (omx_err != OMX_ErrorNone)
+        {
+            CLOG(LOGERROR, "COMXVideo::Open AllocInputBuffers error (0%08x)\n", omx_err);
+            return false;
+        }
+    }
+    else if(m_transfer_mode == VIDEO_TRANSFER_COPY)
+    {
+        // Alloc buffers for input port of encoder
+        for(size_t i = 0; i < m_outputs.size(); i++)
+        {
+            omx_err = m_outputs[i]->encoder.AllocInputBuffers();
+            if (omx_err != OMX_ErrorNone)
+            {
+                CLOG(LOGERROR, "COMXVideo::Open AllocInputBuffers error (0%08x)\n", omx_err);
+                return false;
+            }
+        }
+    }
+
+    for(size_t i = 0; i < m_outputs.size(); i++)
+    {
+        if(m_outputs[i]->encoder.GetState() == OMX_StateExecuting)
+            continue;
+        omx_err = m_outputs[i]->encoder.SetStateForComponent(OMX_StateExecuting);
+        if (omx_err != OMX_ErrorNone)
+        {
+            CLOG(LOGERROR, "COMXVideo::Open error encoder.SetStateForComponent\n");
+            return false;
+        }
+    }
+
+    if(m_transfer_mode == VIDEO_TRANSFER_TUNNEL)
+    {
+        if(!StartTunnelComponent(m_omx_splitter))
+            return false;
+        for(size_t i = 0; i < m_outputs.size(); i++)
+        {
+            if(!StartTunnelComponent(m_outputs[i]->resize))
+                return false;
+        }
+    }
+
+    for(size_t i = 0; i < m_outputs.size(); i++)
+    {
+        COMXVideoOutput *output = m_outputs[i];
+        output->encoder.EnablePort(output->encoder.GetInputPort(), false);
+        if(output->resize.IsInitialized())
+        {
+            output->resize.EnablePort(output->resize.GetInputPort(), false);
+            output->resize.EnablePort(output->resize.GetOutputPort(), false);
+        }
+        if(m_omx_splitter.IsInitialized())
+            m_omx_splitter.EnablePort(m_omx_splitter.GetOutputPort() + i, false);
+    }
+    if(m_omx_splitter.IsInitialized())
+        m_omx_splitter.EnablePort(m_omx_splitter.GetInputPort(), false);
+    m_omx_decoder.EnablePort(m_omx_decoder.GetOutputPort(), false);    
+
+    if(m_transfer_mode == VIDEO_TRANSFER_COPY && m_omx_decoder.GetOutputBuffers().empty())
+    {
+        // Alloc buffers for output port of decoder
+        omx_err = m_omx_decoder.AllocOutputBuffers();
+        if (omx_err != OMX_ErrorNone)
+        {
+            CLOG(LOGERROR, "COMXVideo::Open AllocOutputBuffers error (0%08x)\n", omx_err);
+            return false;
+        }
+    }
+
+    if(m_transfer_mode == VIDEO_TRANSFER_SHARED)
+    {
+        // every encoder input header belongs to the pump until its frame is
+        // decoded, only headers the encoder is done with are "available"
+        COMXCoreComponent &encoder = m_outputs[0]->encoder;
+        while(encoder.GetInputBuffer(0) != NULL)
+            ;
+        m_shared_in_encoder.assign(encoder.GetInputBuffers().size(), 0);
+    }
+
+    if(m_transfer_mode != VIDEO_TRANSFER_TUNNEL)
+    {
+        // hand every decoder output buffer over, the frame pump recycles them
+        OMX_BUFFERHEADERTYPE *omx_buffer = NULL;
+        while((omx_buffer = m_omx_decoder.GetOutputBuffer(0)) != NULL)
+        {
+            omx_buffer->nOffset     = 0;
+            omx_buffer->nFilledLen  = 0;
+            omx_err = m_omx_decoder.FillThisBuffer(omx_buffer);
+            if (omx_err != OMX_ErrorNone)
+            {
+                CLOG(LOGERROR, "%s::%s - OMX_FillThisBuffer() failed with result(0x%x)\n", CLASSNAME, __func__, omx_err);
+                m_omx_decoder.ReturnOutputBuffer(omx_buffer);
+                return false;
+            }
+        }
+    }
+
+    //DEBUG(truong): confirm state of port & component
+    DumpCompState(&m_omx_decoder);
+    for(size_t i = 0; i < m_outputs.size(); i++)
+        DumpCompState(&m_outputs[i]->encoder);
+
+    OMX_PARAM_PORTDEFINITIONTYPE port_state;
+    OMX_INIT_STRUCTURE(port_state);
+
+    port_state.nPortIndex = m_omx_decoder.GetInputPort();
+    omx_err = m_omx_decoder.GetParameter(OMX_IndexParamPortDefinition, &port_state);
+    if(omx_err != OMX_ErrorNone)
+    {
+        CLOG(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
+        return false;
+    }
+    DumpPort(port_state);
+
+    port_state.nPortIndex = m_omx_decoder.GetOutputPort();
+    omx_err = m_omx_decoder.GetParameter(OMX_IndexParamPortDefinition, &port_state);
+    if(omx_err != OMX_ErrorNone)
+    {
+        CLOG(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
+        return false;
+    }
+    DumpPort(port_state);
+
+    for(size_t i = 0; i < m_outputs.size(); i++)
+    {
+        COMXCoreComponent &encoder = m_outputs[i]->encoder;
+
+        port_state.nPortIndex = encoder.GetInputPort();
+        omx_err = encoder.GetParameter(OMX_IndexParamPortDefinition, &port_state);
+        if(omx_err != OMX_ErrorNone)
+        {
+            CLOG(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
+            return false;
+        }
+        DumpPort(port_state);
+
+        port_state.nPortIndex = encoder.GetOutputPort();
+        omx_err = encoder.GetParameter(OMX_IndexParamPortDefinition, &port_state);
+        if(omx_err != OMX_ErrorNone)
+        {
+            CLOG(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
+            return false;
+        }
+        DumpPort(port_state);
+    }
+    //end DEBUG
+
+    StartPumps();
+    return true;
+}
+
+// Stops the frame pump and waits until the encoders are done with the
+// frames they were given. A tunnel can't be watched, disabling its ports
+// hands back what an encoder hasn't taken yet.
+void COMXVideo::DrainTransfer()
+{
+    m_pumps_stop = true;
+    if(m_frame_pump.Running())
+        m_frame_pump.StopThread();
+
+    if(m_transfer_mode == VIDEO_TRANSFER_COPY)
+    {
+        for(size_t i = 0; i < m_outputs.size(); i++)
+            m_outputs[i]->encoder.WaitForInputDone(VIDEO_DRAIN_TIMEOUT);
+    }
+    else if(m_transfer_mode == VIDEO_TRANSFER_SHARED)
+    {
+        // m_return_pump refills the decoder as the encoder lets go
+        for(int waited = 0; waited < VIDEO_DRAIN_TIMEOUT; waited += 10)
+        {
+            if(std::count(m_shared_in_encoder.begin(), m_shared_in_encoder.end(), 1) == 0)
+                break;
+            OMXSleep(10);
+        }
+    }
+}
+
+static const struct { int idc; OMX_VIDEO_AVCLEVELTYPE level; } avc_levels[] = {
+    { 10, OMX_VIDEO_AVCLevel1 },  { 11, OMX_VIDEO_AVCLevel11 }, { 12, OMX_VIDEO_AVCLevel12 },
+    { 13, OMX_VIDEO_AVCLevel13 }, { 20, OMX_VIDEO_AVCLevel2 },  { 21, OMX_VIDEO_AVCLevel21 },
+    { 22, OMX_VIDEO_AVCLevel22 }, { 30, OMX_VIDEO_AVCLevel3 },  { 31, OMX_VIDEO_AVCLevel31 },
+    { 32, OMX_VIDEO_AVCLevel32 }, { 40, OMX_VIDEO_AVCLevel4 },  { 41, OMX_VIDEO_AVCLevel41 },
+    { 42, OMX_VIDEO_AVCLevel42 }, { 50, OMX_VIDEO_AVCLevel5 },  { 51, OMX_VIDEO_AVCLevel51 },
+};
+
+// level_idc (41) to OMX, the nearest level above for unknown values
+static OMX_VIDEO_AVCLEVELTYPE AvcLevel(int idc)
+{
+    for(size_t i = 0; i < sizeof(avc_levels) / sizeof(avc_levels[0]); i++)
+    {
+        if(avc_levels[i].idc >= idc)
+            return avc_levels[i].level;
+    }
+    return OMX_VIDEO_AVCLevel51;
+}
+
+static int AvcLevelIdc(OMX_U32 level)
+{
+    for(size_t i = 0; i < sizeof(avc_levels) / sizeof(avc_levels[0]); i++)
+    {
+        if(avc_levels[i].level == level)
+            return avc_levels[i].idc;
+    }
+    return 0;
+}
+
+// Encoder output port of one rendition, and its output buffers.
+bool COMXVideo::ConfigureEncoder(COMXVideoOutput *output, OMX_U32 framerate)
+{
+    COMXCoreComponent &encoder = output->encoder;
+    OMXVideoEncoderConfig &settings = output->settings;
+    OMX_ERRORTYPE omx_err;
+
+    SetEncoderAspect(output, false);
+  
+    // Setting output port of encoder component
+    OMX_PARAM_PORTDEFINITIONTYPE enc_param;
+    OMX_INIT_STRUCTURE(enc_param);
+    enc_param.nPortIndex = encoder.GetOutputPort();
+
+    omx_err = encoder.GetParameter(OMX_IndexParamPortDefinition, &enc_param);
+    if(omx_err != OMX_ErrorNone)
+    {
+        CLOG(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
+        return false;
+    }
+
+    enc_param.bEnabled   = OMX_TRUE;
+    enc_param.bPopulated = OMX_FALSE;
+    enc_param.eDomain    = OMX_PortDomainVideo;
+    enc_param.format.video.pNativeRender = NULL;
+    enc_param.format.video.nFrameWidth   = output->rendition.width;
+    enc_param.format.video.nFrameHeight  = output->rendition.height;
+    enc_param.format.video.nStride       = 0;
+    enc_param.format.video.nSliceHeight  = 0;
+    enc_param.format.video.nBitrate      = settings.bitrate;
+    enc_param.format.video.xFramerate    = framerate;
+    enc_param.format.video.bFlagErrorConcealment  = OMX_FALSE;
+    enc_param.format.video.eCompressionFormat = OMX_VIDEO_CodingAVC;
+  
+    enc_param.nPortIndex = encoder.GetOutputPort();
+    enc_param.nBufferCountActual = std::max((OMX_U32)settings.buffers, enc_param.nBufferCountMin);
+
+    omx_err = encoder.SetParameter(OMX_IndexParamPortDefinition, &enc_param);
+    if(omx_err != OMX_ErrorNone)
+    {
+        CLOG(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
+        return false;
+    }
+  
+    OMX_VIDEO_PARAM_PORTFORMATTYPE format;
+    OMX_INIT_STRUCTURE(format);
+    format.nPortIndex = encoder.GetOutputPort();
+    format.eCompressionFormat = OMX_VIDEO_CodingAVC;
+
+    omx_err = encoder.SetParameter(OMX_IndexParamVideoPortFormat, &format);
+    if(omx_err != OMX_ErrorNone)
+    {
+        CLOG(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
+        return false;
+    }
+
+    OMX_VIDEO_PARAM_BITRATETYPE bitrate;
+    OMX_INIT_STRUCTURE(bitrate);
+    bitrate.eControlRate = settings.rate_control == VIDEO_RATE_CBR ? OMX_Video_ControlRateConstant : OMX_Video_ControlRateVariable;
+    bitrate.nTargetBitrate = settings.bitrate;
+    bitrate.nPortIndex = encoder.GetOutputPort();
+
+    omx_err = encoder.SetParameter(OMX_IndexParamVideoBitrate, &bitrate);
+    if(omx_err != OMX_ErrorNone)
+    {
+        CLOG(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
+        return false;
+    }
+
+    // GOP, profile and level in one go, no B frames either way
+    OMX_VIDEO_PARAM_AVCTYPE avc;
+    OMX_INIT_STRUCTURE(avc);
+    avc.nPortIndex = encoder.GetOutputPort();
+    omx_err = encoder.GetParameter(OMX_IndexParamVideoAvc, &avc);
+    if(omx_err != OMX_ErrorNone)
+    {
+        CLOG(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
+        return false;
+    }
+    if(settings.gop > 0)
+        avc.nPFrames = settings.gop - 1;
+    avc.nBFrames = 0;
+    avc.eProfile = settings.profile;
+    avc.eLevel   = AvcLevel(settings.level);
+    omx_err = encoder.SetParameter(OMX_IndexParamVideoAvc, &avc);
+    if(omx_err != OMX_ErrorNone)
+    {
+        CLOG(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
+        return false;
+    }
+
+    OMX_VIDEO_PARAM_PROFILELEVELTYPE profile_level;
+    OMX_INIT_STRUCTURE(profile_level);
+    profile_level.nPortIndex = encoder.GetOutputPort();
+    profile_level.eProfile   = settings.profile;
+    profile_level.eLevel     = AvcLevel(settings.level);
+    omx_err = encoder.SetParameter(OMX_IndexParamVideoProfileLevelCurrent, &profile_level);
+    if(omx_err != OMX_ErrorNone)
+    {
+        CLOG(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
+        return false;
+    }
+
+    if(settings.idr_period > 0)
+    {
+        OMX_VIDEO_CONFIG_AVCINTRAPERIOD period;
+        OMX_INIT_STRUCTURE(period);
+        period.nPortIndex = encoder.GetOutputPort();
+        period.nIDRPeriod = settings.idr_period;
+        period.nPFrames   = avc.nPFrames;
+        omx_err = encoder.SetConfig(OMX_IndexConfigVideoAVCIntraPeriod, &period);
+        if(omx_err != OMX_ErrorNone)
+            CLOG(LOGERROR, "%s::%s - IDR period %d not supported omx_err(0x%08x)\n", CLASSNAME, __func__, settings.idr_period, omx_err);
+    }
+
+    // quantiser bounds, 0 leaves the encoder's
+    const struct { int qp; OMX_INDEXTYPE index; } quants[] = {
+        { settings.qp_min, OMX_IndexParamBrcmVideoEncodeMinQuant },
+        { settings.qp_max, OMX_IndexParamBrcmVideoEncodeMaxQuant },
+    };
+    for(size_t i = 0; i < sizeof(quants) / sizeof(quants[0]); i++)
+    {
+        if(quants[i].qp <= 0)
+            continue;
+        OMX_PARAM_U32TYPE quant;
+        OMX_INIT_STRUCTURE(quant);
+        quant.nPortIndex = encoder.GetOutputPort();
+        quant.nU32       = quants[i].qp;
+        omx_err = encoder.SetParameter(quants[i].index, &quant);
+        if(omx_err != OMX_ErrorNone)
+            CLOG(LOGERROR, "%s::%s - QP bound %d not supported omx_err(0x%08x)\n", CLASSNAME, __func__, quants[i].qp, omx_err);
+    }
+
+    // what the encoder settled on, the settings may have been clamped
+    if(encoder.GetParameter(OMX_IndexParamVideoBitrate, &bitrate) == OMX_ErrorNone)
+    {
+        settings.bitrate      = bitrate.nTargetBitrate;
+        settings.rate_control = bitrate.eControlRate == OMX_Video_ControlRateConstant ? VIDEO_RATE_CBR : VIDEO_RATE_VBR;
+    }
+    if(encoder.GetParameter(OMX_IndexParamVideoAvc, &avc) == OMX_ErrorNone)
+        settings.gop = avc.nPFrames + 1;
+    if(encoder.GetParameter(OMX_IndexParamVideoProfileLevelCurrent, &profile_level) == OMX_ErrorNone)
+    {
+        settings.profile = (OMX_VIDEO_AVCPROFILETYPE)profile_level.eProfile;
+        settings.level   = AvcLevelIdc(profile_level.eLevel);
+    }
+    if(encoder.GetParameter(OMX_IndexParamPortDefinition, &enc_param) == OMX_ErrorNone)
+        settings.buffers = enc_param.nBufferCountActual;
+
+    // Alloc buffers for the omx output port.
+    omx_err = encoder.AllocOutputBuffers();
+    if (omx_err != OMX_ErrorNone)
+    {
+        CLOG(LOGERROR, "COMXVideo::Open AllocOutputBuffers error (0%08x)\n", omx_err);
+        return false;
+    }
+
+    CLOG(LOGINFO, "%s::%s - output %u: %dx%d (%d:%d) %s %d bps (peak %d), gop %d, profile 0x%x level %d, %d buffers%s\n",
+         CLASSNAME, __func__, output->index, output->rendition.width, output->rendition.height,
+         output->pixel_aspect.num, output->pixel_aspect.den,
+         settings.rate_control == VIDEO_RATE_CBR ? "CBR" : "VBR", settings.bitrate, settings.MaxBitrate(),
+         settings.gop, settings.profile, settings.level, settings.buffers, output->scaled ? ", scaled" : "");
+    return true;
+}
+
+// Pixel aspect written to the SPS. A running encoder only takes it with its
+// output port disabled, the buffers are reallocated and the pump queues them.
+bool COMXVideo::SetEncoderAspect(COMXVideoOutput *output, bool running)
+{
+    COMXCoreComponent &encoder = output->encoder;
+    OMX_ERRORTYPE omx_err;
+
+    if(running)
+        encoder.FreeOutputBuffers();
+
+    OMX_CONFIG_POINTTYPE pixel_aspect;
+    OMX_INIT_STRUCTURE(pixel_aspect);
+    pixel_aspect.nPortIndex = encoder.GetOutputPort();
+    pixel_aspect.nX = output->pixel_aspect.num;
+    pixel_aspect.nY = output->pixel_aspect.den;
+    omx_err = encoder.SetParameter(OMX_IndexParamBrcmPixelAspectRatio, &pixel_aspect);
+    if(omx_err != OMX_ErrorNone)
+    {
+        CLOG(LOGERROR, "%s::%s - error encoder.SetParameter(OMX_IndexParamBrcmPixelAspectRatio) omx_err(0x%08x)", CLASSNAME, __func__, omx_err);
+    }
+
+    if(running)
+    {
+        omx_err = encoder.AllocOutputBuffers();
+        if (omx_err != OMX_ErrorNone)
+        {
+            CLOG(LOGERROR, "%s::%s - AllocOutputBuffers error (0%08x)\n", CLASSNAME, __func__, omx_err);
+            return false;
+        }
+        CLOG(LOGINFO, "%s::%s - output %u: pixel aspect %d:%d\n", CLASSNAME, __func__, output->index,
+             output->pixel_aspect.num, output->pixel_aspect.den);
+    }
+    return true;
+}
+
+const char *COMXVideo::TransferModeName(EVIDEOTRANSFERMODE mode)
+{
+    switch(mode)
+    {
+    case VIDEO_TRANSFER_TUNNEL: return "tunnel";
+    case VIDEO_TRANSFER_SHARED: return "shared";
+    case VIDEO_TRANSFER_COPY:   return "copy";
+    default:                    return "auto";
+    }
+}
+
+// Tunnel when asked to or in auto mode; auto falls back to sharing the
+// decoder output buffers with the encoder when the backend can't tunnel,
+// or to copying when they would have to feed several/resized outputs.
+bool COMXVideo::SetupTransfer()
+{
+    m_transfer_mode   = m_config.transfer_mode;
+
+    bool can_share = m_outputs.size() == 1 && !m_outputs[0]->scaled;
+
+    if(m_config.DropsFrames())
+    {
+        // frames are only dropped on their way through PumpFrames
+        if(m_transfer_mode == VIDEO_TRANSFER_TUNNEL)
+        {
+            CLOG(LOGERROR, "%s::%s - a tunnel can't drop frames (%.3f fps, %.3f-%.3fs)\n", CLASSNAME, __func__,
+                 m_config.output_fps, m_config.trim_start, m_config.trim_end);
+            return false;
+        }
+        if(m_transfer_mode == VIDEO_TRANSFER_AUTO)
+            m_transfer_mode = can_share ? VIDEO_TRANSFER_SHARED : VIDEO_TRANSFER_COPY;
+    }
+
+    if(m_transfer_mode == VIDEO_TRANSFER_AUTO || m_transfer_mode == VIDEO_TRANSFER_TUNNEL)
+    {
+        OMX_ERRORTYPE omx_err = SetupTunnels();
+        if (omx_err == OMX_ErrorNone)
+        {
+            m_transfer_mode = VIDEO_TRANSFER_TUNNEL;
+        }
+        else if (m_transfer_mode == VIDEO_TRANSFER_TUNNEL)
+        {
+            CLOG(LOGERROR, "%s::%s - SetupTunnels omx_err(0x%08x)", CLASSNAME, __func__, omx_err);
+            return false;
+        }
+        else
+        {
+            CloseTunnels();
+            m_transfer_mode = can_share ? VIDEO_TRANSFER_SHARED : VIDEO_TRANSFER_COPY;
+            CLOG(LOGINFO, "%s::%s - no tunnel (0x%08x), %s\n", CLASSNAME, __func__, omx_err,
+                 can_share ? "sharing decoder buffers with the encoder" : "copying frames to the encoders");
+        }
+    }
+    else if(m_transfer_mode == VIDEO_TRANSFER_SHARED && !can_share)
+    {
+        CLOG(LOGINFO, "%s::%s - decoder buffers can't back %u/resized outputs, copying frames\n", CLASSNAME, __func__,
+             (unsigned int)m_outputs.size());
+        m_transfer_mode = VIDEO_TRANSFER_COPY;
+    }
+
+    CLOG(LOGINFO, "%s::%s - decoder -> encoder transfer: %s, %u outputs\n", CLASSNAME, __func__,
+         TransferModeName(m_transfer_mode), (unsigned int)m_outputs.size());
+    return true;
+}
+
+// decoder -> [video_splitter ->] [resize ->] encoder for each output. The
+// ports stay disabled until the encoders have their buffers.
+OMX_ERRORTYPE COMXVideo::SetupTunnels()
+{
+    OMX_ERRORTYPE omx_err;
+    COMXCoreComponent *source = &m_omx_decoder;
+
+    if(m_outputs.size() > 1)
+    {
+        if(!m_omx_splitter.Initialize(OMX_VIDEO_SPLITTER, OMX_IndexParamVideoInit))
+            return OMX_ErrorComponentNotFound;
+        m_omx_tunnel_splitter.Initialize(&m_omx_decoder, m_omx_decoder.GetOutputPort(), &m_omx_splitter, m_omx_splitter.GetInputPort());
+        omx_err = m_omx_tunnel_splitter.Establish(false, false);
+        if(omx_err != OMX_ErrorNone)
+            return omx_err;
+        source = &m_omx_splitter;
+    }
+
+    for(size_t i = 0; i < m_outputs.size(); i++)
+    {
+        COMXVideoOutput *output = m_outputs[i];
+        // the splitter outputs are consecutive ports
+        unsigned int source_port = source->GetOutputPort() + (source == &m_omx_splitter ? i : 0);
+
+        if(!output->scaled)
+        {
+            output->tunnel_source.Initialize(source, source_port, &output->encoder, output->encoder.GetInputPort());
+            omx_err = output->tunnel_source.Establish(false, false);
+            if(omx_err != OMX_ErrorNone)
+                return omx_err;
+            continue;
+        }
+
+        if(!output->resize.Initialize(OMX_VIDEO_RESIZE, OMX_IndexParamImageInit))
+            return OMX_ErrorComponentNotFound;
+        output->tunnel_source.Initialize(source, source_port, &output->resize, output->resize.GetInputPort());
+        omx_err = output->tunnel_source.Establish(false, false);
+        if(omx_err != OMX_ErrorNone)
+            return omx_err;
+
+        // resized to the encoder input format
+        OMX_PARAM_PORTDEFINITIONTYPE resize_out;
+        OMX_INIT_STRUCTURE(resize_out);
+        resize_out.nPortIndex = output->resize.GetOutputPort();
+        omx_err = output->resize.GetParameter(OMX_IndexParamPortDefinition, &resize_out);
+        if(omx_err != OMX_ErrorNone)
+            return omx_err;
+        resize_out.format.image.nFrameWidth        = output->rendition.width;
+        resize_out.format.image.nFrameHeight       = output->rendition.height;
+        resize_out.format.image.nStride            = output->stride;
+        resize_out.format.image.nSliceHeight       = output->slice_height;
+        resize_out.format.image.eCompressionFormat = OMX_IMAGE_CodingUnused;
+        resize_out.format.image.eColorFormat       = m_decoded_format.eColorFormat;
+        omx_err = output->resize.SetParameter(OMX_IndexParamPortDefinition, &resize_out);
+        if(omx_err != OMX_ErrorNone)
+        {
+            CLOG(LOGERROR, "%s::%s - resize to %dx%d omx_err(0x%08x)\n", CLASSNAME, __func__,
+                 output->rendition.width, output->rendition.height, omx_err);
+            return omx_err;
         }
+
+        output->tunnel_resize.Initialize(&output->resize, output->resize.GetOutputPort(), &output->encoder, output->encoder.GetInputPort());
+        omx_err = output->tunnel_resize.Establish(false, false);
+        if(omx_err != OMX_ErrorNone)
+            return omx_err;
     }
-    return true;
+    return OMX_ErrorNone;
 }
 
-bool COMXVideo::NaluFormatStartCodes(enum AVCodecID codec, uint8_t *in_extradata, int in_extrasize)
+// the components between the decoder and the encoders go with their tunnels
+void COMXVideo::CloseTunnels()
 {
-    switch(codec)
+    m_omx_tunnel_splitter.Deestablish();
+    for(size_t i = 0; i < m_outputs.size(); i++)
     {
-    case AV_CODEC_ID_H264:
-        if (in_extrasize < 7 || in_extradata == NULL)
-            return true;
-        // valid avcC atom data always starts with the value 1 (version), otherwise annexb
-        else if ( *in_extradata != 1 )
-            return true;
-    default: break;
+        m_outputs[i]->tunnel_source.Deestablish();
+        m_outputs[i]->tunnel_resize.Deestablish();
+        m_outputs[i]->resize.Deinitialize();
     }
-    return false;    
+    m_omx_splitter.Deinitialize();
 }
 
-bool COMXVideo::PortSettingsChanged()
+void COMXVideo::StartPumps()
 {
-    CSingleLock lock (m_critSection);
-    OMX_ERRORTYPE omx_err   = OMX_ErrorNone;
+    m_pumps_stop = false;
+    if(m_transfer_mode != VIDEO_TRANSFER_TUNNEL)
+        m_frame_pump.Create();
+    if(m_transfer_mode == VIDEO_TRANSFER_SHARED)
+        m_return_pump.Create();
+    for(size_t i = 0; i < m_outputs.size(); i++)
+        m_outputs[i]->pump.Create();
+}
 
-    CLog::Log(LOGDEBUG,"%s line %d start\n",__func__,__LINE__);
-  
-    //ADD(truong): create Encoder component
-    if(!m_omx_encoder.Initialize(OMX_VIDEO_ENCODER, OMX_IndexParamVideoInit))
+void COMXVideo::StopPumps()
+{
+    m_pumps_stop = true;
+    if(m_frame_pump.Running())
+        m_frame_pump.StopThread();
+    if(m_return_pump.Running())
+        m_return_pump.StopThread();
+    for(size_t i = 0; i < m_outputs.size(); i++)
     {
-        CLog::Log(LOGERROR,"%s line %d encoder is initialized fail\n",__func__,__LINE__);
-        return false;
+        if(m_outputs[i]->pump.Running())
+            m_outputs[i]->pump.StopThread();
     }
 
-    m_omx_encoder.SetPrivateCallBack(m_enc_done_cb);
-  
-    // get output param of decoder -> set to encoder
-    OMX_PARAM_PORTDEFINITIONTYPE in_port_enc_prm;
-    OMX_INIT_STRUCTURE(in_port_enc_prm);
-    in_port_enc_prm.nPortIndex = m_omx_decoder.GetOutputPort();
+    if(m_transfer_mode == VIDEO_TRANSFER_SHARED)
+        ReleaseSharedBuffers();
+}
 
-    omx_err = m_omx_decoder.GetParameter(OMX_IndexParamPortDefinition, &in_port_enc_prm);
-    if(omx_err != OMX_ErrorNone)
-    {
-        CLog::Log(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
-        return false;
-    }
-    DumpPort(in_port_enc_prm);
+// With the pumps stopped, give each shared buffer pair back to the side
+// that frees it: headers the encoder still holds come back on its flush,
+// their decoder twins and every other encoder header are returned here.
+void COMXVideo::ReleaseSharedBuffers()
+{
+    if(m_outputs.empty())
+        return;
 
-    in_port_enc_prm.nPortIndex = m_omx_encoder.GetInputPort();
-    omx_err = m_omx_encoder.SetParameter(OMX_IndexParamPortDefinition, &in_port_enc_prm);
-    if(omx_err != OMX_ErrorNone)
-    {
-        CLog::Log(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
-        return false;
-    }
+    COMXCoreComponent &encoder = m_outputs[0]->encoder;
+    const std::vector<OMX_BUFFERHEADERTYPE*> &dec_buffers = m_omx_decoder.GetOutputBuffers();
+    const std::vector<OMX_BUFFERHEADERTYPE*> &enc_buffers = encoder.GetInputBuffers();
 
-    omx_err = m_omx_encoder.SetStateForComponent(OMX_StateIdle);
-    if (omx_err != OMX_ErrorNone)
+    for(size_t i = 0; i < m_shared_in_encoder.size() && i < dec_buffers.size() && i < enc_buffers.size(); i++)
     {
-        CLog::Log(LOGERROR, "COMXVideo::Open error m_omx_encoder.SetStateForComponent\n");
-        return false;
+        if(m_shared_in_encoder[i])
+            m_omx_decoder.ReturnOutputBuffer(dec_buffers[i]);
+        else
+            encoder.ReturnInputBuffer(enc_buffers[i]);
     }
+    m_shared_in_encoder.clear();
+}
 
-#ifndef NON_TUNNEL
-    //ADD(truong): settup tunnel decoder comp - encoder comp
-    m_omx_tunnel_decoder.Initialize(&m_omx_decoder, m_omx_decoder.GetOutputPort(), &m_omx_encoder, m_omx_encoder.GetInputPort());
-    omx_err = m_omx_tunnel_decoder.Establish(false,false);
-    if (omx_err != OMX_ErrorNone)
-    {
-        CLog::Log(LOGERROR, "%s::%s - m_omx_tunnel_decoder.Establish omx_err(0x%08x)", CLASSNAME, __func__, omx_err);
-        return false;
-    }
-#endif
-    // Setting aspect ratio (64:45)
-    // TODO(truong): It must be consider get from input stream
-    OMX_CONFIG_POINTTYPE pixel_aspect;
-    OMX_INIT_STRUCTURE(pixel_aspect);
-    pixel_aspect.nPortIndex = m_omx_encoder.GetOutputPort();
-    pixel_aspect.nX = 64;
-    pixel_aspect.nY = 45;
-    omx_err = m_omx_encoder.SetParameter(OMX_IndexParamBrcmPixelAspectRatio, &pixel_aspect);
-    if(omx_err != OMX_ErrorNone)
+// Decoded frame -> encoder input(s). The decoder buffer is owned by this
+// thread until it is refilled, so it is given back if the pump is stopped.
+void COMXVideo::PumpFrames(unsigned int)
+{
+    OMX_ERRORTYPE omx_err;
+
+    OMX_BUFFERHEADERTYPE *dec_buffer = m_omx_decoder.GetOutputBuffer(VIDEO_PUMP_TIMEOUT, false);
+    if(dec_buffer == NULL)
     {
-        CLog::Log(LOGERROR, "%s::%s - error m_omx_encoder.SetParameter(OMX_IndexParamBrcmPixelAspectRatio) omx_err(0x%08x)", CLASSNAME, __func__, omx_err);
+        if(m_omx_decoder.BadState())
+            OMXSleep(VIDEO_PUMP_TIMEOUT);
+        return;
     }
-  
-    // Setting output port of encoder component
-    OMX_PARAM_PORTDEFINITIONTYPE enc_param;
-    OMX_INIT_STRUCTURE(enc_param);
-    enc_param.nPortIndex = m_omx_encoder.GetOutputPort();
 
-    omx_err = m_omx_encoder.GetParameter(OMX_IndexParamPortDefinition, &enc_param);
-    if(omx_err != OMX_ErrorNone)
+    if(DropFrame(dec_buffer))
     {
-        CLog::Log(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
-        return false;
+        m_transfer_dropped++;
+        RefillDecoderBuffer(dec_buffer);
+        return;
     }
 
-    enc_param.bEnabled   = OMX_TRUE;
-    enc_param.bPopulated = OMX_FALSE;
-    enc_param.eDomain    = OMX_PortDomainVideo;
-    enc_param.format.video.pNativeRender = NULL;
-    enc_param.format.video.nFrameWidth   = m_config.hints.width;
-    enc_param.format.video.nFrameHeight  = m_config.hints.height;
-    enc_param.format.video.nStride       = 0;
-    enc_param.format.video.nSliceHeight  = 0;
-    enc_param.format.video.nBitrate      = 2*1000*1000; //TODO(truong): tentative 2Mbps
-    enc_param.format.video.xFramerate    = in_port_enc_prm.format.video.xFramerate;
-    enc_param.format.video.bFlagErrorConcealment  = OMX_FALSE;
-    enc_param.format.video.eCompressionFormat = OMX_VIDEO_CodingAVC;
-  
-    enc_param.nPortIndex = m_omx_encoder.GetOutputPort();
-    enc_param.nBufferCountActual = 10; //TOD(truong): consider later
+    if(dec_buffer->nFilledLen)
+        m_transfer_frames++;
 
-    omx_err = m_omx_encoder.SetParameter(OMX_IndexParamPortDefinition, &enc_param);
-    if(omx_err != OMX_ErrorNone)
+    if(m_transfer_mode == VIDEO_TRANSFER_SHARED)
     {
-        CLog::Log(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
-        return false;
+        // the twin encoder header points at the same memory, only the
+        // metadata moves; m_return_pump refills the decoder buffer
+        COMXVideoOutput *output = m_outputs[0];
+        size_t index = (size_t)dec_buffer->pAppPrivate;
+        OMX_BUFFERHEADERTYPE *enc_buffer = output->encoder.GetInputBuffers()[index];
+
+        enc_buffer->nOffset    = dec_buffer->nOffset;
+        enc_buffer->nFilledLen = dec_buffer->nFilledLen;
+        enc_buffer->nTimeStamp = dec_buffer->nTimeStamp;
+        enc_buffer->nFlags     = dec_buffer->nFlags & (OMX_BUFFERFLAG_EOS | OMX_BUFFERFLAG_ENDOFFRAME | OMX_BUFFERFLAG_TIME_UNKNOWN);
+
+        if(enc_buffer->nFilledLen || (enc_buffer->nFlags & OMX_BUFFERFLAG_EOS))
+        {
+            if(enc_buffer->nFilledLen)
+                CheckKeyFrame(output, enc_buffer->nTimeStamp);
+            m_shared_in_encoder[index] = 1;
+            omx_err = output->encoder.EmptyThisBuffer(enc_buffer);
+            if (omx_err == OMX_ErrorNone)
+                return;
+
+            CLOG(LOGERROR, "%s::%s - OMX_EmptyThisBuffer() failed with result(0x%x)\n", CLASSNAME, __func__, omx_err);
+            m_shared_in_encoder[index] = 0;
+        }
+
+        RefillDecoderBuffer(dec_buffer);
+        return;
     }
-  
-    OMX_VIDEO_PARAM_PORTFORMATTYPE format;
-    OMX_INIT_STRUCTURE(format);
-    format.nPortIndex = m_omx_encoder.GetOutputPort();
-    format.eCompressionFormat = OMX_VIDEO_CodingAVC;
 
-    omx_err = m_omx_encoder.SetParameter(OMX_IndexParamVideoPortFormat, &format);
-    if(omx_err != OMX_ErrorNone)
+    // decoded once, copied to every output
+    for(size_t i = 0; i < m_outputs.size(); i++)
     {
-        CLog::Log(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
-        return false;
+        if(!CopyFrame(m_outputs[i], dec_buffer))
+        {
+            m_omx_decoder.ReturnOutputBuffer(dec_buffer);
+            return;
+        }
     }
 
-    OMX_VIDEO_PARAM_BITRATETYPE bitrate;
-    OMX_INIT_STRUCTURE(bitrate);
-    // set current bitrate to 2Mbit
-    bitrate.nSize = sizeof(OMX_VIDEO_PARAM_BITRATETYPE);
-    bitrate.nVersion.nVersion = OMX_VERSION;
-    bitrate.eControlRate = OMX_Video_ControlRateVariable;
-    bitrate.nTargetBitrate = 2000000;
-    bitrate.nPortIndex = m_omx_encoder.GetOutputPort();
-
-    omx_err = m_omx_encoder.SetParameter(OMX_IndexParamVideoBitrate, &bitrate);
-    if(omx_err != OMX_ErrorNone)
-    {
-        CLog::Log(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
+    RefillDecoderBuffer(dec_buffer);
+}
+
+// True for a frame outside trim_start/trim_end (decoded from the keyframe
+// before the start, or reordered past the end). output_fps: also when the
+// frame falls in an output slot already filled, otherwise it is kept and
+// retimed onto the output frame grid
+bool COMXVideo::DropFrame(OMX_BUFFERHEADERTYPE *dec_buffer)
+{
+    if(!m_config.DropsFrames() || !dec_buffer->nFilledLen ||
+       (dec_buffer->nFlags & (OMX_BUFFERFLAG_EOS | OMX_BUFFERFLAG_TIME_UNKNOWN)))
         return false;
-    }
-  
-    OMX_VIDEO_PARAM_PROFILELEVELTYPE profile_level;
-    OMX_INIT_STRUCTURE(profile_level);
-    profile_level.nPortIndex = m_omx_encoder.GetOutputPort();
-    omx_err = m_omx_encoder.GetParameter(OMX_IndexParamVideoProfileLevelCurrent,&profile_level);
-    if(omx_err != OMX_ErrorNone)
-    {
-        CLog::Log(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
+
+    int64_t ts = FromOMXTime(dec_buffer->nTimeStamp);
+    if((m_config.trim_start > 0.0 && ts < (int64_t)(m_config.trim_start * AV_TIME_BASE + 0.5)) ||
+       (m_config.trim_end > 0.0 && ts >= (int64_t)(m_config.trim_end * AV_TIME_BASE + 0.5)))
+        return true;
+    if(m_config.output_fps <= 0.0f)
         return false;
-    }
-  
-    //TODO(truong): Depend on player application, consider suitable profile&level
-    profile_level.nPortIndex = m_omx_encoder.GetOutputPort();
-    omx_err = m_omx_encoder.SetParameter(OMX_IndexParamVideoProfileLevelCurrent,&profile_level);  
-    if(omx_err != OMX_ErrorNone)
+
+    if(m_decimate_start == AV_NOPTS_VALUE || ts < m_decimate_start)
     {
-        CLog::Log(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
-        return false;
+        // first frame, or a discontinuity: a new grid from here
+        m_decimate_start = ts;
+        m_decimate_slot  = -1;
     }
 
-    // Alloc buffers for the omx output port.
-    omx_err = m_omx_encoder.AllocOutputBuffers();
+    // a tenth of a slot of slack for timestamps rounded by the container
+    int64_t slot = (int64_t)((double)(ts - m_decimate_start) * m_config.output_fps / AV_TIME_BASE + 0.1);
+    if(slot <= m_decimate_slot)
+        return true;
+
+    m_decimate_slot = slot;
+    dec_buffer->nTimeStamp = ToOMXTime(m_decimate_start + (int64_t)(slot * AV_TIME_BASE / m_config.output_fps));
+    return false;
+}
+
+// Reset output buffer before request fill buffer
+void COMXVideo::RefillDecoderBuffer(OMX_BUFFERHEADERTYPE *dec_buffer)
+{
+    dec_buffer->nOffset     = 0;
+    dec_buffer->nFilledLen  = 0;
+    dec_buffer->nFlags      = 0;
+    OMX_ERRORTYPE omx_err = m_omx_decoder.FillThisBuffer(dec_buffer);
     if (omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "COMXVideo::Open AllocOutputBuffers error (0%08x)\n", omx_err);
-        return false;
+        CLOG(LOGERROR, "%s::%s - OMX_FillThisBuffer() failed with result(0x%x)\n", CLASSNAME, __func__, omx_err);
+        m_omx_decoder.ReturnOutputBuffer(dec_buffer);
+        OMXSleep(VIDEO_PUMP_TIMEOUT);
     }
+}
 
-#ifdef NON_TUNNEL
-    // Alloc buffers for input port of encoder
-    omx_err = m_omx_encoder.AllocInputBuffers();
-    if (omx_err != OMX_ErrorNone)
-    {
-        CLog::Log(LOGERROR, "COMXVideo::Open AllocInputBuffers error (0%08x)\n", omx_err);
+// VIDEO_TRANSFER_COPY: the decoded frame into an encoder input buffer of
+// output, scaled to its size. false when stopped waiting for the buffer.
+bool COMXVideo::CopyFrame(COMXVideoOutput *output, OMX_BUFFERHEADERTYPE *dec_buffer)
+{
+    OMX_BUFFERHEADERTYPE *in_enc_buffer = NULL;
+    while(!in_enc_buffer && !m_pumps_stop && !output->encoder.BadState())
+        in_enc_buffer = output->encoder.GetInputBuffer(VIDEO_PUMP_TIMEOUT, false);
+
+    if(in_enc_buffer == NULL)
         return false;
+
+    in_enc_buffer->nOffset    = 0;
+    in_enc_buffer->nTimeStamp = dec_buffer->nTimeStamp;
+    in_enc_buffer->nFlags     = dec_buffer->nFlags & (OMX_BUFFERFLAG_EOS | OMX_BUFFERFLAG_ENDOFFRAME | OMX_BUFFERFLAG_TIME_UNKNOWN);
+    if(output->scaled && dec_buffer->nFilledLen)
+    {
+        in_enc_buffer->nFilledLen = ScaleFrame(output, dec_buffer, in_enc_buffer);
     }
-#endif
-  
-    omx_err = m_omx_encoder.SetStateForComponent(OMX_StateExecuting);
-    if (omx_err != OMX_ErrorNone)
+    else
     {
-        CLog::Log(LOGERROR, "COMXVideo::Open error m_omx_encoder.SetStateForComponent\n");
-        return false;
+        in_enc_buffer->nFilledLen = std::min(dec_buffer->nFilledLen, in_enc_buffer->nAllocLen);
+        memcpy(in_enc_buffer->pBuffer, dec_buffer->pBuffer + dec_buffer->nOffset, in_enc_buffer->nFilledLen);
     }
-  
-    m_omx_encoder.EnablePort(m_omx_encoder.GetInputPort(), false);
-    m_omx_decoder.EnablePort(m_omx_decoder.GetOutputPort(), false);    
+    m_transfer_copied += in_enc_buffer->nFilledLen;
 
-#ifdef NON_TUNNEL  
-    // Alloc buffers for output port of decoder
-    omx_err = m_omx_decoder.AllocOutputBuffers();
-    if (omx_err != OMX_ErrorNone)
+    if(in_enc_buffer->nFilledLen || (in_enc_buffer->nFlags & OMX_BUFFERFLAG_EOS))
     {
-        CLog::Log(LOGERROR, "COMXVideo::Open AllocOutputBuffers error (0%08x)\n", omx_err);
-        return false;
+        if(in_enc_buffer->nFilledLen)
+            CheckKeyFrame(output, in_enc_buffer->nTimeStamp);
+        OMX_ERRORTYPE omx_err = output->encoder.EmptyThisBuffer(in_enc_buffer);
+        if (omx_err != OMX_ErrorNone)
+        {
+            CLOG(LOGERROR, "%s::%s - OMX_EmptyThisBuffer() failed with result(0x%x)\n", CLASSNAME, __func__, omx_err);
+            output->encoder.ReturnInputBuffer(in_enc_buffer);
+        }
     }
-
-    OMX_BUFFERHEADERTYPE *omx_buffer = m_omx_decoder.GetOutputBuffer();
-    if(omx_buffer == NULL)
+    else
     {
-        CLog::Log(LOGERROR, "%s::%s - buffer error 0x%08x", CLASSNAME, __func__, omx_err);
-        return false;
+        output->encoder.ReturnInputBuffer(in_enc_buffer);
     }
+    return true;
+}
 
-    omx_buffer->nOffset     = 0;
-    omx_buffer->nFilledLen  = 0;  
-    omx_err = m_omx_decoder.FillThisBuffer(omx_buffer);
-    if (omx_err != OMX_ErrorNone)
+// I420 as the ports lay it out: each plane stride x slice height
+static void FramePlanes(uint8_t *data, int stride, int slice_height, uint8_t *planes[3], int strides[3])
+{
+    planes[0]  = data;
+    planes[1]  = planes[0] + stride * slice_height;
+    planes[2]  = planes[1] + (stride / 2) * (slice_height / 2);
+    strides[0] = stride;
+    strides[1] = stride / 2;
+    strides[2] = stride / 2;
+}
+
+// swscale into the encoder buffer, the bytes written (0 on error)
+unsigned int COMXVideo::ScaleFrame(COMXVideoOutput *output, OMX_BUFFERHEADERTYPE *dec_buffer, OMX_BUFFERHEADERTYPE *enc_buffer)
+{
+    int width  = m_decoded_format.nFrameWidth;
+    int height = m_decoded_format.nFrameHeight;
+    int stride = m_decoded_format.nStride ? m_decoded_format.nStride : FFALIGN(width, 32);
+    int slice  = m_decoded_format.nSliceHeight ? m_decoded_format.nSliceHeight : FFALIGN(height, 16);
+
+    unsigned int size = output->stride * output->slice_height * 3 / 2;
+    if(size > enc_buffer->nAllocLen || (unsigned int)(stride * slice * 3 / 2) > dec_buffer->nFilledLen)
     {
-        CLog::Log(LOGERROR, "%s::%s - OMX_EmptyThisBuffer() failed with result(0x%x)\n", CLASSNAME, __func__, omx_err);
-        m_omx_decoder.DecoderFillBufferDone(m_omx_decoder.GetComponent(), omx_buffer);
-        return false;
+        CLOG(LOGERROR, "%s::%s - output %u: frame doesn't fit %u/%u\n", CLASSNAME, __func__,
+             output->index, (unsigned int)dec_buffer->nFilledLen, (unsigned int)enc_buffer->nAllocLen);
+        return 0;
     }
-#endif
 
-    //DEBUG(truong): confirm state of port & component
-    DumpCompState(&m_omx_decoder);
-    DumpCompState(&m_omx_encoder);
+    output->sws = sws_getCachedContext(output->sws, width, height, AV_PIX_FMT_YUV420P,
+                                       output->rendition.width, output->rendition.height, AV_PIX_FMT_YUV420P,
+                                       SWS_BILINEAR, NULL, NULL, NULL);
+    if(!output->sws)
+        return 0;
+
+    uint8_t *src[3], *dst[3];
+    int src_stride[3], dst_stride[3];
+    FramePlanes(dec_buffer->pBuffer + dec_buffer->nOffset, stride, slice, src, src_stride);
+    FramePlanes(enc_buffer->pBuffer, output->stride, output->slice_height, dst, dst_stride);
+    sws_scale(output->sws, src, src_stride, 0, height, dst, dst_stride);
+    return size;
+}
 
-    OMX_PARAM_PORTDEFINITIONTYPE port_state;
-    OMX_INIT_STRUCTURE(port_state);
+// VIDEO_TRANSFER_SHARED: the encoder is done with a frame, its memory can be
+// decoded into again.
+void COMXVideo::PumpSharedReturns(unsigned int)
+{
+    COMXCoreComponent &encoder = m_outputs[0]->encoder;
+    OMX_BUFFERHEADERTYPE *enc_buffer = encoder.GetInputBuffer(VIDEO_PUMP_TIMEOUT, false);
+    if(enc_buffer == NULL)
+    {
+        if(encoder.BadState())
+            OMXSleep(VIDEO_PUMP_TIMEOUT);
+        return;
+    }
 
-    port_state.nPortIndex = m_omx_decoder.GetInputPort();
-    omx_err = m_omx_decoder.GetParameter(OMX_IndexParamPortDefinition, &port_state);
-    if(omx_err != OMX_ErrorNone)
+    size_t index = (size_t)enc_buffer->pAppPrivate;
+    OMX_BUFFERHEADERTYPE *dec_buffer = m_omx_decoder.GetOutputBuffers()[index];
+    m_shared_in_encoder[index] = 0;
+
+    dec_buffer->nOffset     = 0;
+    dec_buffer->nFilledLen  = 0;
+    dec_buffer->nFlags      = 0;
+    OMX_ERRORTYPE omx_err = m_omx_decoder.FillThisBuffer(dec_buffer);
+    if (omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
-        return false;
+        CLOG(LOGERROR, "%s::%s - OMX_FillThisBuffer() failed with result(0x%x)\n", CLASSNAME, __func__, omx_err);
+        m_omx_decoder.ReturnOutputBuffer(dec_buffer);
+        OMXSleep(VIDEO_PUMP_TIMEOUT);
     }
-    DumpPort(port_state);
+}
 
-    port_state.nPortIndex = m_omx_decoder.GetOutputPort();
-    omx_err = m_omx_decoder.GetParameter(OMX_IndexParamPortDefinition, &port_state);
-    if(omx_err != OMX_ErrorNone)
+// keyframe_interval: asks for an IDR on the frame crossing each multiple of
+// the interval, the muxer cuts its segments at those frames
+void COMXVideo::CheckKeyFrame(COMXVideoOutput *output, OMX_TICKS timestamp)
+{
+    if(m_config.keyframe_interval <= 0.0f)
+        return;
+
+    int64_t ts       = FromOMXTime(timestamp);
+    int64_t interval = (int64_t)(m_config.keyframe_interval * AV_TIME_BASE);
+    if(output->next_keyframe == AV_NOPTS_VALUE)
     {
-        CLog::Log(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
-        return false;
+        output->next_keyframe = ts + interval;
+        return;
     }
-    DumpPort(port_state);
-  
-    port_state.nPortIndex = m_omx_encoder.GetInputPort();
-    omx_err = m_omx_encoder.GetParameter(OMX_IndexParamPortDefinition, &port_state);
+    if(ts < output->next_keyframe)
+        return;
+    while(output->next_keyframe <= ts)
+        output->next_keyframe += interval;
+
+    OMX_CONFIG_PORTBOOLEANTYPE idr;
+    OMX_INIT_STRUCTURE(idr);
+    idr.nPortIndex = output->encoder.GetOutputPort();
+    idr.bEnabled   = OMX_TRUE;
+    OMX_ERRORTYPE omx_err = output->encoder.SetConfig(OMX_IndexConfigBrcmVideoRequestIFrame, &idr);
     if(omx_err != OMX_ErrorNone)
+        CLOG(LOGERROR, "%s::%s - request IDR omx_err(0x%08x)\n", CLASSNAME, __func__, omx_err);
+}
+
+// Encoder output buffers come back through the FillBufferDone callback
+// (already muxed by then), queue them again straight away.
+void COMXVideo::PumpEncoderOutput(unsigned int index)
+{
+    COMXVideoOutput *output = m_outputs[index];
+    OMX_BUFFERHEADERTYPE *enc_buffer = output->encoder.GetOutputBuffer(VIDEO_PUMP_TIMEOUT, false);
+    if(enc_buffer == NULL)
     {
-        CLog::Log(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
-        return false;
+        if(output->encoder.BadState())
+            OMXSleep(VIDEO_PUMP_TIMEOUT);
+        return;
     }
-    DumpPort(port_state);
 
-    port_state.nPortIndex = m_omx_encoder.GetOutputPort();
-    omx_err = m_omx_encoder.GetParameter(OMX_IndexParamPortDefinition, &port_state);
-    if(omx_err != OMX_ErrorNone)
+    // tunneled frames never pass through here on the way in, the encoder
+    // output is the closest: the IDR lands a few frames past the boundary
+    if(m_transfer_mode == VIDEO_TRANSFER_TUNNEL && enc_buffer->nFilledLen &&
+       !(enc_buffer->nFlags & OMX_BUFFERFLAG_CODECCONFIG))
+        CheckKeyFrame(output, enc_buffer->nTimeStamp);
+
+    enc_buffer->nOffset     = 0;
+    enc_buffer->nFilledLen  = 0;
+    enc_buffer->nFlags      = 0;
+    OMX_ERRORTYPE omx_err = output->encoder.FillThisBuffer(enc_buffer);
+    if (omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "ENC (%d) omx_err(0x%08x)\n",__LINE__ ,omx_err);
-        return false;
+        CLOG(LOGERROR, "%s::%s - OMX_FillThisBuffer() failed with result(0x%x)\n", CLASSNAME, __func__, omx_err);
+        output->encoder.ReturnOutputBuffer(enc_buffer);
+        OMXSleep(VIDEO_PUMP_TIMEOUT);
     }
-    DumpPort(port_state);
-    //end DEBUG
-  
-    m_settings_changed = true;
-    return true;
 }
 
 bool COMXVideo::Open(const OMXVideoConfig &config)
@@ -489,6 +1438,7 @@ bool COMXVideo::Open(const OMXVideoConfig &config)
     Close();
     OMX_ERRORTYPE omx_err   = OMX_ErrorNone;
     std::string decoder_name;
+    OMXCoreBackend decoder_backend = COMXCore::GetBackend();
     m_settings_changed = false;
     m_setStartTime = true;
 
@@ -504,6 +1454,24 @@ bool COMXVideo::Open(const OMXVideoConfig &config)
     if(!m_config.hints.width || !m_config.hints.height)
         return false;
 
+    if(m_config.renditions.size() > VIDEO_MAX_RENDITIONS)
+    {
+        CLOG(LOGERROR, "%s::%s - %u renditions, at most %d\n", CLASSNAME, __func__,
+             (unsigned int)m_config.renditions.size(), VIDEO_MAX_RENDITIONS);
+        return false;
+    }
+    for(size_t i = 0; i < std::max(m_config.renditions.size(), (size_t)1); i++)
+    {
+        m_outputs.push_back(new COMXVideoOutput(this, i, i < m_config.renditions.size() ? m_config.renditions[i] : OMXVideoRendition(),
+                                                m_config.EncoderFor(i)));
+        if(m_outputs[i]->settings.Backend() == OMX_CORE_BACKEND_HW && COMXCore::GetBackend() != OMX_CORE_BACKEND_HW)
+        {
+            CLOG(LOGERROR, "%s::%s - output %u: no VideoCore encoder with the software backend\n", CLASSNAME, __func__,
+                 (unsigned int)i);
+            return false;
+        }
+    }
+
   
     switch (m_config.hints.codec)
     {
@@ -610,18 +1578,34 @@ bool COMXVideo::Open(const OMXVideoConfig &config)
         m_video_codec_name = "omx-vc1";
         break;    
     default:
-        printf("Vcodec id unknown: %x\n", m_config.hints.codec);
-        return false;
-        break;
+    {
+        // HEVC, VP9, ...: decoded by libavcodec threads on the CPU, the
+        // frames still go to the VideoCore encoder (copied or shared)
+        AVCodec *codec = avcodec_find_decoder(m_config.hints.codec);
+        if(!codec)
+        {
+            printf("Vcodec id unknown: %x\n", m_config.hints.codec);
+            return false;
+        }
+        decoder_name = OMX_VIDEO_DECODER;
+        decoder_backend = OMX_CORE_BACKEND_SOFT;
+        m_codingType = OMX_SOFT_CODING(m_config.hints.codec);
+        m_video_codec_name = std::string("sw-") + codec->name;
+    }
+    break;
     }
 
-    if(!m_omx_decoder.Initialize(decoder_name, OMX_IndexParamVideoInit))
+    if(decoder_backend != COMXCore::GetBackend())
+        CLOG(LOGINFO, "%s::%s - no hardware decoder for %s, decoding in software\n", CLASSNAME, __func__,
+             m_video_codec_name.c_str() + 3);
+
+    if(!m_omx_decoder.Initialize(decoder_name, OMX_IndexParamVideoInit, NULL, decoder_backend))
         return false;
 
     omx_err = m_omx_decoder.SetStateForComponent(OMX_StateIdle);
     if (omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "COMXVideo::Open m_omx_decoder.SetStateForComponent\n");
+        CLOG(LOGERROR, "COMXVideo::Open m_omx_decoder.SetStateForComponent\n");
         return false;
     }
 
@@ -650,7 +1634,7 @@ bool COMXVideo::Open(const OMXVideoConfig &config)
     omx_err = m_omx_decoder.GetParameter(OMX_IndexParamPortDefinition, &portParam);
     if(omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "COMXVideo::Open error OMX_IndexParamPortDefinition omx_err(0x%08x)\n", omx_err);
+        CLOG(LOGERROR, "COMXVideo::Open error OMX_IndexParamPortDefinition omx_err(0x%08x)\n", omx_err);
         return false;
     }
 
@@ -665,7 +1649,7 @@ bool COMXVideo::Open(const OMXVideoConfig &config)
     omx_err = m_omx_decoder.SetParameter(OMX_IndexParamPortDefinition, &portParam);
     if(omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "COMXVideo::Open error OMX_IndexParamPortDefinition omx_err(0x%08x)\n", omx_err);
+        CLOG(LOGERROR, "COMXVideo::Open error OMX_IndexParamPortDefinition omx_err(0x%08x)\n", omx_err);
         return false;
     }
 
@@ -675,7 +1659,7 @@ bool COMXVideo::Open(const OMXVideoConfig &config)
     omx_err = m_omx_decoder.SetParameter(OMX_IndexParamPortDefinition, &portParam);
     if(omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "COMXVideo::Open error OMX_IndexParamPortDefinition omx_err(0x%08x)\n", omx_err);
+        CLOG(LOGERROR, "COMXVideo::Open error OMX_IndexParamPortDefinition omx_err(0x%08x)\n", omx_err);
         return false;
     }
   
@@ -689,7 +1673,7 @@ bool COMXVideo::Open(const OMXVideoConfig &config)
     omx_err = m_omx_decoder.SetParameter((OMX_INDEXTYPE)OMX_IndexConfigRequestCallback, &notifications);
     if (omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "COMXVideo::Open OMX_IndexConfigRequestCallback error (0%08x)\n", omx_err);
+        CLOG(LOGERROR, "COMXVideo::Open OMX_IndexConfigRequestCallback error (0%08x)\n", omx_err);
         return false;
     }
 
@@ -697,14 +1681,14 @@ bool COMXVideo::Open(const OMXVideoConfig &config)
     omx_err = m_omx_decoder.AllocInputBuffers();
     if (omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "COMXVideo::Open AllocOMXInputBuffers error (0%08x)\n", omx_err);
+        CLOG(LOGERROR, "COMXVideo::Open AllocOMXInputBuffers error (0%08x)\n", omx_err);
         return false;
     }
 
     omx_err = m_omx_decoder.SetStateForComponent(OMX_StateExecuting);
     if (omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "COMXVideo::Open error m_omx_decoder.SetStateForComponent\n");
+        CLOG(LOGERROR, "COMXVideo::Open error m_omx_decoder.SetStateForComponent\n");
         return false;
     }
 
@@ -720,12 +1704,45 @@ bool COMXVideo::Open(const OMXVideoConfig &config)
     return true;
 }
 
+OMXVideoTransferStats COMXVideo::GetTransferStats() const
+{
+    OMXVideoTransferStats stats;
+    stats.mode             = m_transfer_mode;
+    stats.frames           = m_transfer_frames;
+    stats.outputs          = m_outputs.size();
+    stats.dropped          = m_transfer_dropped;
+    stats.copied_per_frame = GetCopiedBytesPerFrame();
+    return stats;
+}
+
 void COMXVideo::Close()
 {
 
     CSingleLock lock (m_critSection);
 
-    m_omx_tunnel_decoder.Deestablish();
+    StopPumps();
+
+    if(m_transfer_frames)
+    {
+        CLOG(LOGINFO, "%s::%s - %s transfer: %u frames to %u outputs (%u dropped), %.0f bytes copied per frame\n",
+             CLASSNAME, __func__, TransferModeName(m_transfer_mode), m_transfer_frames, (unsigned int)m_outputs.size(),
+             m_transfer_dropped, GetCopiedBytesPerFrame());
+        m_transfer_frames  = 0;
+        m_transfer_dropped = 0;
+        m_transfer_copied  = 0;
+    }
+
+    CloseTunnels();
+
+    // before the decoder, its buffers may back an encoder input port
+    for(size_t i = 0; i < m_outputs.size(); i++)
+    {
+        m_outputs[i]->encoder.Deinitialize();
+        if(m_outputs[i]->sws)
+            sws_freeContext(m_outputs[i]->sws);
+        delete m_outputs[i];
+    }
+    m_outputs.clear();
 
     m_omx_decoder.FlushInput();
 
@@ -755,11 +1772,22 @@ unsigned int COMXVideo::GetSize()
     return m_omx_decoder.GetInputBufferSize();
 }
 
+// no m_critSection, Decode/PortSettingsChanged must not wait for it
+bool COMXVideo::WaitForFreeSpace(unsigned int bytes, long timeout)
+{
+    return m_omx_decoder.WaitForInputSpace(bytes, timeout);
+}
+
+void COMXVideo::WakeWaiters()
+{
+    m_omx_decoder.WakeInputWaiters();
+}
+
 int COMXVideo::Decode(uint8_t *pData, int iSize, double dts, double pts)
 {
     CSingleLock lock (m_critSection);
     OMX_ERRORTYPE omx_err;
-    CLog::Log(LOGDEBUG, "OMXVideo::Decode  %s %d\n",__func__,__LINE__);
+    CLOG(LOGDEBUG, "OMXVideo::Decode  %s %d\n",__func__,__LINE__);
     if( m_drop_state || !m_is_open )
         return true;
 
@@ -773,7 +1801,7 @@ int COMXVideo::Decode(uint8_t *pData, int iSize, double dts, double pts)
         if(m_setStartTime)
         {
             nFlags |= OMX_BUFFERFLAG_STARTTIME;
-            CLog::Log(LOGDEBUG, "OMXVideo::Decode VDec : setStartTime %f\n", (pts == DVD_NOPTS_VALUE ? 0.0 : pts) / DVD_TIME_BASE);
+            CLOG(LOGDEBUG, "OMXVideo::Decode VDec : setStartTime %f\n", (pts == DVD_NOPTS_VALUE ? 0.0 : pts) / DVD_TIME_BASE);
             m_setStartTime = false;
         }
         if (pts == DVD_NOPTS_VALUE && dts == DVD_NOPTS_VALUE)
@@ -787,7 +1815,7 @@ int COMXVideo::Decode(uint8_t *pData, int iSize, double dts, double pts)
             OMX_BUFFERHEADERTYPE *omx_buffer = m_omx_decoder.GetInputBuffer(500);
             if(omx_buffer == NULL)
             {
-                CLog::Log(LOGERROR," %s %d timeout\n",__func__,__LINE__);
+                CLOG(LOGERROR," %s %d timeout\n",__func__,__LINE__);
                 return false;
             }
 
@@ -806,85 +1834,23 @@ int COMXVideo::Decode(uint8_t *pData, int iSize, double dts, double pts)
             omx_err = m_omx_decoder.EmptyThisBuffer(omx_buffer);
             if (omx_err != OMX_ErrorNone)
             {
-                CLog::Log(LOGERROR, "%s::%s - OMX_EmptyThisBuffer() failed with result(0x%x)\n", CLASSNAME, __func__, omx_err);
-                m_omx_decoder.DecoderEmptyBufferDone(m_omx_decoder.GetComponent(), omx_buffer);
+                CLOG(LOGERROR, "%s::%s - OMX_EmptyThisBuffer() failed with result(0x%x)\n", CLASSNAME, __func__, omx_err);
+                m_omx_decoder.ReturnInputBuffer(omx_buffer);
                 return false;
             }
-            CLog::Log(LOGINFO, "VideD: dts:%.0f pts:%.0f size:%d)\n", dts, pts, iSize);
-
-            //TODO(truong): tentative request encode here ( will make other thread)
-            if (m_settings_changed) {
-
-                OMX_BUFFERHEADERTYPE *enc_buffer = m_omx_encoder.GetOutputBuffer(500);
-                if(enc_buffer == NULL)
-                {
-                    CLog::Log(LOGERROR," %s %d timeout\n",__func__,__LINE__);
-                    m_omx_encoder.FlushOutput();
-                    // m_omx_encoder.FlushAll();
-                    return false;
-                }
-
-                omx_err = m_omx_encoder.FillThisBuffer(enc_buffer);
-                if (omx_err != OMX_ErrorNone)
-                {
-                    CLog::Log(LOGERROR, "%s::%s - OMX_EmptyThisBuffer() failed with result(0x%x)\n", CLASSNAME, __func__, omx_err);
-                    m_omx_encoder.DecoderFillBufferDone(m_omx_encoder.GetComponent(), enc_buffer);
-                    return false;
-                }
-
-                //Get output buffer of decoder
-                OMX_BUFFERHEADERTYPE *dec_buffer = m_omx_decoder.GetOutputBuffer(500);
-                if(dec_buffer == NULL)
-                {
-                    CLog::Log(LOGERROR," %s %d timeout\n",__func__,__LINE__);
-                    return false;
-                }
-
-                //TODO(truong) non-tunnel by getting output buffer of decoder.
-                OMX_BUFFERHEADERTYPE *in_enc_buffer = m_omx_encoder.GetInputBuffer(500);
-                if(in_enc_buffer == NULL)
-                {
-                    CLog::Log(LOGERROR," %s %d timeout\n",__func__,__LINE__);
-                    return false;
-                }
-
-                in_enc_buffer->nOffset = 0;
-                in_enc_buffer->nFilledLen = dec_buffer->nFilledLen;
-                in_enc_buffer->nTimeStamp = dec_buffer->nTimeStamp;
-                memcpy(in_enc_buffer->pBuffer, dec_buffer->pBuffer, in_enc_buffer->nFilledLen);
+            CLOG(LOGINFO, "VideD: dts:%.0f pts:%.0f size:%d)\n", dts, pts, iSize);
 
-                omx_err = m_omx_encoder.EmptyThisBuffer(in_enc_buffer);
-                if (omx_err != OMX_ErrorNone)
-                {
-                    CLog::Log(LOGERROR, "%s::%s - OMX_EmptyThisBuffer() failed with result(0x%x)\n", CLASSNAME, __func__, omx_err);
-                    m_omx_encoder.DecoderEmptyBufferDone(m_omx_encoder.GetComponent(), in_enc_buffer);
-                    return false;
-                }
-
-                //Reset output buffer before request fill buffer
-                dec_buffer->nOffset     = 0;
-                dec_buffer->nFilledLen  = 0;
-                omx_err = m_omx_decoder.FillThisBuffer(dec_buffer);
-                if (omx_err != OMX_ErrorNone)
+            // decoded frames are moved to the encoder by m_frame_pump, the
+            // first event sets that up and later ones (size/aspect changes
+            // mid-stream) rebuild it
+            omx_err = m_omx_decoder.WaitForEvent(OMX_EventPortSettingsChanged, 0);
+            if (omx_err == OMX_ErrorNone)
+            {
+                if(!PortSettingsChanged())
                 {
-                    CLog::Log(LOGERROR, "%s::%s - OMX_EmptyThisBuffer() failed with result(0x%x)\n", CLASSNAME, __func__, omx_err);
-                    printf("%s::%s - OMX_EmptyThisBuffer() failed with result(0x%x)\n", CLASSNAME, __func__, omx_err);
-                    m_omx_decoder.DecoderFillBufferDone(m_omx_decoder.GetComponent(), dec_buffer);
+                    CLOG(LOGERROR, "%s::%s - error PortSettingsChanged omx_err(0x%08x)\n", CLASSNAME, __func__, omx_err);
                     return false;
                 }
-	
-            }
-            //end TODO
-            if (!m_settings_changed) {      
-                omx_err = m_omx_decoder.WaitForEvent(OMX_EventPortSettingsChanged, 0);
-                if (omx_err == OMX_ErrorNone)
-                {
-                    if(!PortSettingsChanged())
-                    {
-                        CLog::Log(LOGERROR, "%s::%s - error PortSettingsChanged omx_err(0x%08x)\n", CLASSNAME, __func__, omx_err);
-                        return false;
-                    }
-                }
             }
       
         }
@@ -925,7 +1891,7 @@ void COMXVideo::SubmitEOS()
   
     if(omx_buffer == NULL)
     {
-        CLog::Log(LOGERROR, "%s::%s - buffer error 0x%08x", CLASSNAME, __func__, omx_err);
+        CLOG(LOGERROR, "%s::%s - buffer error 0x%08x", CLASSNAME, __func__, omx_err);
         m_failed_eos = true;
         return;
     }
@@ -939,23 +1905,35 @@ void COMXVideo::SubmitEOS()
     omx_err = m_omx_decoder.EmptyThisBuffer(omx_buffer);
     if (omx_err != OMX_ErrorNone)
     {
-        CLog::Log(LOGERROR, "%s::%s - OMX_EmptyThisBuffer() failed with result(0x%x)\n", CLASSNAME, __func__, omx_err);
-        m_omx_decoder.DecoderEmptyBufferDone(m_omx_decoder.GetComponent(), omx_buffer);
+        CLOG(LOGERROR, "%s::%s - OMX_EmptyThisBuffer() failed with result(0x%x)\n", CLASSNAME, __func__, omx_err);
+        m_omx_decoder.ReturnInputBuffer(omx_buffer);
         return;
     }
-    CLog::Log(LOGINFO, "%s::%s", CLASSNAME, __func__);
+    CLOG(LOGINFO, "%s::%s", CLASSNAME, __func__);
 }
 
+// the EOS came out of every encoder, so their last frames were muxed
 bool COMXVideo::IsEOS()
 {
     CSingleLock lock (m_critSection);
     if(!m_is_open)
         return true;
-    if (!m_failed_eos)
+    if (!m_submitted_eos)
         return false;
+    if (!m_failed_eos)
+    {
+        // nothing was decoded: no encoder, the decoder's EOS is the end
+        if (!m_settings_changed && !m_omx_decoder.IsEOS())
+            return false;
+        for (size_t i = 0; m_settings_changed && i < m_outputs.size(); i++)
+        {
+            if (!m_outputs[i]->encoder.IsEOS())
+                return false;
+        }
+    }
     if (m_submitted_eos)
     {
-        CLog::Log(LOGINFO, "%s::%s", CLASSNAME, __func__);
+        CLOG(LOGINFO, "%s::%s", CLASSNAME, __func__);
         m_submitted_eos = false;
     }
     return true;
@@ -25,12 +25,27 @@
 #include "OMXCore.h"
 #include "OMXStreamInfo.h"
 #include "OMXReader.h"
+#include "OMXThread.h"
 
 #include <IL/OMX_Video.h>
 #include "utils/SingleLock.h"
 
 #define VIDEO_BUFFERS 60
 
+// decoded frames in flight between decoder and encoder, each side keeps
+// working on one while the other is handed over
+#define VIDEO_FRAME_BUFFERS 3
+
+// what the encoder produces by default, streams within these are remuxed as they are
+#define VIDEO_ENCODER_BITRATE    (2*1000*1000)
+#define VIDEO_ENCODER_MAX_LEVEL  41
+#define VIDEO_ENCODER_BUFFERS    10
+#define VIDEO_ENCODER_MAX_WIDTH  1920
+#define VIDEO_ENCODER_MAX_HEIGHT 1080
+
+// encoders fed from one decoder, one per video_splitter output
+#define VIDEO_MAX_RENDITIONS 4
+
 enum EDEINTERLACEMODE
 {
   VS_DEINTERLACEMODE_OFF=0,
@@ -38,8 +53,88 @@ enum EDEINTERLACEMODE
   VS_DEINTERLACEMODE_FORCE=2
 };
 
+// how decoded frames reach the encoder
+enum EVIDEOTRANSFERMODE
+{
+  VIDEO_TRANSFER_AUTO=0,    // tunnel, shared if the backend can't tunnel
+  VIDEO_TRANSFER_TUNNEL,    // decoder output port tunneled to encoder input
+  VIDEO_TRANSFER_SHARED,    // encoder input uses the decoder output buffers
+  VIDEO_TRANSFER_COPY       // frames are copied between the two ports
+};
+
 #define CLASSNAME "COMXVideo"
 
+// how the encoder spends its bits
+enum EVIDEORATECONTROL
+{
+  VIDEO_RATE_VBR=0,
+  VIDEO_RATE_CBR
+};
+
+// which OMX.broadcom.video_encode an output gets
+enum EVIDEOENCODER
+{
+  VIDEO_ENCODER_DEFAULT=0,  // the process backend's (--soft-omx)
+  VIDEO_ENCODER_HW,         // VideoCore
+  VIDEO_ENCODER_SOFT        // libavcodec on the CPU, alongside the VideoCore ones
+};
+
+// H.264 encoder settings shared by the renditions, 0 leaves the encoder's default
+class OMXVideoEncoderConfig
+{
+public:
+  int bitrate;      // target bits/s
+  int peak_bitrate; // bits/s, signalled in the output (VideoCore has no such cap), 0: the target
+  EVIDEORATECONTROL rate_control;
+  int gop;          // frames from an I frame to the next
+  int idr_period;   // every idr_period-th I frame is an IDR
+  OMX_VIDEO_AVCPROFILETYPE profile;
+  int level;        // level_idc, 41 for 4.1
+  int qp_min;
+  int qp_max;
+  int buffers;      // encoder output buffers
+  EVIDEOENCODER backend;
+  std::string soft_name; // libavcodec encoder, "": libx264, else libopenh264, else any H.264 one
+
+  OMXVideoEncoderConfig()
+  {
+    bitrate      = VIDEO_ENCODER_BITRATE;
+    peak_bitrate = 0;
+    rate_control = VIDEO_RATE_VBR;
+    gop          = 0;
+    idr_period   = 0;
+    profile      = OMX_VIDEO_AVCProfileHigh;
+    level        = VIDEO_ENCODER_MAX_LEVEL;
+    qp_min       = 0;
+    qp_max       = 0;
+    buffers      = VIDEO_ENCODER_BUFFERS;
+    backend      = VIDEO_ENCODER_DEFAULT;
+  }
+
+  OMXCoreBackend Backend() const
+  {
+    if(backend == VIDEO_ENCODER_DEFAULT)
+      return COMXCore::GetBackend();
+    return backend == VIDEO_ENCODER_HW ? OMX_CORE_BACKEND_HW : OMX_CORE_BACKEND_SOFT;
+  }
+
+  // what the stream promises a player, the peak for VBR
+  int MaxBitrate() const { return rate_control == VIDEO_RATE_CBR || peak_bitrate < bitrate ? bitrate : peak_bitrate; }
+};
+
+// one encoded output of the decoded stream
+class OMXVideoRendition
+{
+public:
+  int width;   // 0x0: OMXVideoConfig width/height, 0 for one keeps the display aspect
+  int height;
+  int bitrate; // bits/s, 0: OMXVideoEncoderConfig::bitrate
+  EVIDEOENCODER encoder;  // VIDEO_ENCODER_DEFAULT: OMXVideoEncoderConfig::backend
+  std::string soft_name;
+
+  OMXVideoRendition() : width(0), height(0), bitrate(0), encoder(VIDEO_ENCODER_DEFAULT) {}
+};
+
 class OMXVideoConfig
 {
 public:
@@ -57,6 +152,22 @@ public:
   int layer;
   float queue_size;
   float fifo_size;
+  EVIDEOTRANSFERMODE transfer_mode;
+  float keyframe_interval; // seconds, an IDR is requested on this grid (segmenting), 0 off
+  // frames/s the encoders get, decoded frames between the output slots are
+  // dropped (not tunneled then), 0 keeps them all
+  float output_fps;
+  // seconds from the input start, decoded frames before trim_start or from
+  // trim_end on are dropped (not tunneled then), 0 for either keeps them
+  double trim_start;
+  double trim_end;
+  // up to VIDEO_MAX_RENDITIONS, output i goes to the callback with output=i.
+  // Empty: one output at the decoded size and encoder.bitrate.
+  std::vector<OMXVideoRendition> renditions;
+  OMXVideoEncoderConfig encoder;
+  // output size of the renditions without one, 0x0: the decoded size
+  int width;
+  int height;
 
   OMXVideoConfig()
   {
@@ -72,13 +183,124 @@ public:
     layer = 0;
     queue_size = 10.0f;
     fifo_size = (float)80*1024*60 / (1024*1024);
+    transfer_mode = VIDEO_TRANSFER_AUTO;
+    keyframe_interval = 0.0f;
+    output_fps = 0.0f;
+    trim_start = 0.0;
+    trim_end = 0.0;
+    width = 0;
+    height = 0;
+  }
+
+  // frames are dropped between the decoder and the encoders
+  bool DropsFrames() const { return output_fps > 0.0f || trim_start > 0.0 || trim_end > 0.0; }
+
+  // Size of output i for w x h frames with a sar_num:sar_den pixel aspect.
+  // A 0 dimension follows the display aspect, rounded to even.
+  void OutputSize(unsigned int output, int w, int h, int sar_num, int sar_den, int &out_w, int &out_h) const
+  {
+    out_w = width;
+    out_h = height;
+    if(output < renditions.size() && (renditions[output].width || renditions[output].height))
+    {
+      out_w = renditions[output].width;
+      out_h = renditions[output].height;
+    }
+    if((!out_w && !out_h) || w <= 0 || h <= 0)
+    {
+      out_w = w;
+      out_h = h;
+      return;
+    }
+    double display_aspect = (double)w * (sar_num > 0 && sar_den > 0 ? (double)sar_num / sar_den : 1.0) / h;
+    if(!out_h)
+      out_h = (int)(out_w / display_aspect / 2 + 0.5) * 2;
+    else if(!out_w)
+      out_w = (int)(out_h * display_aspect / 2 + 0.5) * 2;
+  }
+
+  // the encoder settings of output i, its bitrate is the rendition's and the
+  // peak scales along with it
+  OMXVideoEncoderConfig EncoderFor(unsigned int output) const
+  {
+    OMXVideoEncoderConfig config = encoder;
+    if(output < renditions.size() && renditions[output].bitrate)
+    {
+      config.bitrate = renditions[output].bitrate;
+      if(encoder.peak_bitrate > encoder.bitrate)
+        config.peak_bitrate = (int)((int64_t)encoder.peak_bitrate * config.bitrate / encoder.bitrate);
+      else
+        config.peak_bitrate = 0;
+    }
+    if(output < renditions.size() && renditions[output].encoder != VIDEO_ENCODER_DEFAULT)
+    {
+      config.backend   = renditions[output].encoder;
+      config.soft_name = renditions[output].soft_name;
+    }
+    return config;
   }
 };
 
+// decoded frames on their way to the encoders, for the caller's summary
+typedef struct OMXVideoTransferStats
+{
+  EVIDEOTRANSFERMODE mode;
+  unsigned int       frames;
+  unsigned int       outputs;
+  unsigned int       dropped;         // output_fps/trim
+  double             copied_per_frame; // bytes memcpy'd
+} OMXVideoTransferStats;
+
 class DllAvUtil;
 class DllAvFormat;
+class COMXVideo;
+struct SwsContext;
+
+// Thread running one stage of COMXVideo until stopped, output is the
+// rendition it serves.
+class COMXVideoPump : public OMXThread
+{
+public:
+  typedef void (COMXVideo::*PumpFunc)(unsigned int output);
+
+  COMXVideoPump(COMXVideo *video, PumpFunc pump, unsigned int output = 0) : m_video(video), m_pump(pump), m_output(output) {}
+  void Process();
+private:
+  COMXVideo   *m_video;
+  PumpFunc     m_pump;
+  unsigned int m_output;
+};
+
+// One rendition: its encoder, a resize in front of it when the size differs
+// from the decoded frames, and the thread recycling its output buffers.
+class COMXVideoOutput
+{
+public:
+  COMXVideoOutput(COMXVideo *video, unsigned int index, const OMXVideoRendition &rendition,
+                  const OMXVideoEncoderConfig &settings);
+
+  unsigned int       index;
+  OMXVideoRendition  rendition;     // size resolved once the decoder has one
+  OMXVideoEncoderConfig settings;   // read back from the encoder once configured
+  AVRational         pixel_aspect;  // keeps the display aspect of the decoded frames
+  bool               scaled;
+  COMXCoreComponent  resize;        // tunnel transfer, scaled
+  COMXCoreComponent  encoder;
+  COMXCoreTunel      tunnel_source; // decoder or splitter -> resize or encoder
+  COMXCoreTunel      tunnel_resize; // resize -> encoder
+  COMXVideoPump      pump;          // COMXVideo::PumpEncoderOutput
+  // copy transfer: encoder input layout, and the scaler when scaled
+  int                stride;
+  int                slice_height;
+  struct SwsContext *sws;
+  // keyframe_interval: next IDR time, AV_TIME_BASE as the frame timestamps
+  int64_t            next_keyframe;
+};
+
 class COMXVideo
 {
+  friend class COMXVideoPump;
+  friend class COMXVideoOutput;
 public:
   COMXVideo();
   ~COMXVideo();
@@ -92,6 +314,9 @@ public:
   void Close(void);
   unsigned int GetFreeSpace();
   unsigned int GetSize();
+  // see COMXCoreComponent::WaitForInputSpace
+  bool WaitForFreeSpace(unsigned int bytes, long timeout);
+  void WakeWaiters();
   int  Decode(uint8_t *pData, int iSize, double dts, double pts);
   void Reset(void);
   void SetDropState(bool bDrop);
@@ -101,17 +326,57 @@ public:
   bool IsEOS();
   bool SubmittedEOS() { return m_submitted_eos; }
   bool BadState() { return m_omx_decoder.BadState(); };
-  void SetCallBack(enc_done_cbk cb);
+  void SetCallBack(enc_done_cbk cb, void *opaque = NULL);
+  EVIDEOTRANSFERMODE GetTransferMode() const { return m_transfer_mode; }
+  unsigned int GetOutputCount() const { return m_outputs.size(); }
+  // memcpy'd between decoder and encoder, 0 on the tunnel/shared paths
+  double GetCopiedBytesPerFrame() const { return m_transfer_frames ? (double)m_transfer_copied / m_transfer_frames : 0.0; }
+  // up to now, Close() resets them
+  OMXVideoTransferStats GetTransferStats() const;
+  static const char *TransferModeName(EVIDEOTRANSFERMODE mode);
 
   void DumpPort(OMX_PARAM_PORTDEFINITIONTYPE& port_def);
   void DumpPort(OMX_PARAM_BUFFERSUPPLIERTYPE& port_def);
   void DumpCompState(COMXCoreComponent* comp);
 protected:
+  // decoder output -> encoder input, and encoder output recycling, each on
+  // their own thread so demux, decode and encode overlap
+  void StartPumps();
+  void StopPumps();
+  bool SetupTransfer();
+  OMX_ERRORTYPE SetupTunnels();
+  void CloseTunnels();
+  bool ConfigureEncoder(COMXVideoOutput *output, OMX_U32 framerate);
+  bool SetEncoderAspect(COMXVideoOutput *output, bool running);
+  // PortSettingsChanged, in pieces shared with a mid-stream change
+  bool ReconfigureInput();
+  bool ReadDecodedFormat(OMX_PARAM_PORTDEFINITIONTYPE &decoded);
+  OMX_U32 EncoderFramerate(const OMX_PARAM_PORTDEFINITIONTYPE &decoded);
+  void ResolveOutput(COMXVideoOutput *output, bool keep_size);
+  bool ConfigureEncoderInput(COMXVideoOutput *output, const OMX_PARAM_PORTDEFINITIONTYPE &decoded, OMX_U32 framerate);
+  bool StartTransfer();
+  void DrainTransfer();
+  void PumpFrames(unsigned int output);
+  bool DropFrame(OMX_BUFFERHEADERTYPE *dec_buffer);
+  void RefillDecoderBuffer(OMX_BUFFERHEADERTYPE *dec_buffer);
+  bool CopyFrame(COMXVideoOutput *output, OMX_BUFFERHEADERTYPE *dec_buffer);
+  unsigned int ScaleFrame(COMXVideoOutput *output, OMX_BUFFERHEADERTYPE *dec_buffer, OMX_BUFFERHEADERTYPE *enc_buffer);
+  void PumpSharedReturns(unsigned int output);
+  void PumpEncoderOutput(unsigned int output);
+  void ReleaseSharedBuffers();
+  void CheckKeyFrame(COMXVideoOutput *output, OMX_TICKS timestamp);
+
   OMX_VIDEO_CODINGTYPE m_codingType;
   COMXCoreComponent m_omx_decoder;
-  COMXCoreComponent m_omx_encoder;
-  COMXCoreTunel     m_omx_tunnel_decoder;
+  // tunnel transfer with more than one output
+  COMXCoreComponent m_omx_splitter;
+  COMXCoreTunel     m_omx_tunnel_splitter;
+  std::vector<COMXVideoOutput*> m_outputs;
+  // decoder output port, what the frame pump reads
+  OMX_VIDEO_PORTDEFINITIONTYPE m_decoded_format;
+  AVRational        m_decoded_aspect; // pixel aspect, the decoder's else the container's
   enc_done_cbk m_enc_done_cb;
+  void         *m_enc_done_opaque;
   
   bool              m_drop_state;
   bool              m_is_open;
@@ -122,6 +387,18 @@ protected:
   bool              m_failed_eos;
   bool              m_settings_changed;
   CCriticalSection  m_critSection;
+  COMXVideoPump     m_frame_pump;
+  COMXVideoPump     m_return_pump;
+  volatile bool     m_pumps_stop;
+  EVIDEOTRANSFERMODE m_transfer_mode;
+  // VIDEO_TRANSFER_SHARED (one output): frame i is with the encoder, not the decoder
+  std::vector<int>  m_shared_in_encoder;
+  uint64_t          m_transfer_copied;
+  unsigned int      m_transfer_frames;
+  unsigned int      m_transfer_dropped;
+  // output_fps: the output frame grid, AV_TIME_BASE, and the last slot filled
+  int64_t           m_decimate_start;
+  int64_t           m_decimate_slot;
 };
 
 #endif
@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2019/01 truong <truongptk30a3@gmail.com>
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ */
+
+// GetInputBuffer/GetOutputBuffer round trips: a port thread takes a buffer
+// as COMXCoreComponent does and hands it to a "component" thread, which
+// gives it back the way the IL callback thread does. COMXBufferRing against
+// the mutex/condition queue the ports used before.
+//
+// make bench_bufferring && ./bench_bufferring [round trips] [buffers]
+
+#include "OMXBufferRing.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <deque>
+
+#define BENCH_TIMEOUT_MS  1000
+
+static double Now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void EndTime(struct timespec &endtime)
+{
+    clock_gettime(CLOCK_MONOTONIC, &endtime);
+    endtime.tv_sec += BENCH_TIMEOUT_MS / 1000;
+}
+
+// as COMXCoreComponent::GetInputBuffer, NULL on a timeout
+static void *RingGet(COMXBufferRing<void*> &ring)
+{
+    struct timespec endtime;
+    EndTime(endtime);
+    void *buffer = NULL;
+    while (true)
+    {
+        int token = ring.WaitToken();
+        if (ring.Pop(buffer) || !ring.Wait(token, endtime))
+            break;
+    }
+    return buffer;
+}
+
+// the old ports: a queue under a mutex, signalled on every push
+class CLockedQueue
+{
+public:
+    CLockedQueue()
+    {
+        pthread_mutex_init(&m_lock, NULL);
+        pthread_cond_init(&m_cond, NULL);
+    }
+    ~CLockedQueue()
+    {
+        pthread_cond_destroy(&m_cond);
+        pthread_mutex_destroy(&m_lock);
+    }
+    void Push(void *buffer)
+    {
+        pthread_mutex_lock(&m_lock);
+        m_queue.push_back(buffer);
+        pthread_cond_broadcast(&m_cond);
+        pthread_mutex_unlock(&m_lock);
+    }
+    void *Get()
+    {
+        struct timespec endtime;
+        clock_gettime(CLOCK_REALTIME, &endtime);
+        endtime.tv_sec += BENCH_TIMEOUT_MS / 1000;
+        void *buffer = NULL;
+        pthread_mutex_lock(&m_lock);
+        while (m_queue.empty())
+        {
+            if (pthread_cond_timedwait(&m_cond, &m_lock, &endtime) != 0)
+                break;
+        }
+        if (!m_queue.empty())
+        {
+            buffer = m_queue.front();
+            m_queue.pop_front();
+        }
+        pthread_mutex_unlock(&m_lock);
+        return buffer;
+    }
+private:
+    pthread_mutex_t     m_lock;
+    pthread_cond_t      m_cond;
+    std::deque<void*>   m_queue;
+};
+
+struct BenchRings
+{
+    COMXBufferRing<void*> available;   // port side, pushed by the "callback"
+    COMXBufferRing<void*> submitted;   // component side
+    unsigned long         count;
+};
+
+struct BenchQueues
+{
+    CLockedQueue          available;
+    CLockedQueue          submitted;
+    unsigned long         count;
+};
+
+static void *RingComponent(void *arg)
+{
+    BenchRings *rings = (BenchRings *)arg;
+    for (unsigned long i = 0; i < rings->count; i++)
+    {
+        void *buffer = RingGet(rings->submitted);
+        if (!buffer || !rings->available.Push(buffer))
+            abort();
+    }
+    return NULL;
+}
+
+static void *QueueComponent(void *arg)
+{
+    BenchQueues *queues = (BenchQueues *)arg;
+    for (unsigned long i = 0; i < queues->count; i++)
+    {
+        void *buffer = queues->submitted.Get();
+        if (!buffer)
+            abort();
+        queues->available.Push(buffer);
+    }
+    return NULL;
+}
+
+static double BenchRing(unsigned long count, unsigned int buffers)
+{
+    BenchRings rings;
+    rings.count = count;
+    rings.available.Reset(buffers);
+    rings.submitted.Reset(buffers);
+    for (unsigned int i = 0; i < buffers; i++)
+        rings.available.Push((void *)(uintptr_t)(i + 1));
+
+    pthread_t component;
+    double start = Now();
+    pthread_create(&component, NULL, RingComponent, &rings);
+    for (unsigned long i = 0; i < count; i++)
+    {
+        void *buffer = RingGet(rings.available);
+        if (!buffer || !rings.submitted.Push(buffer))
+            abort();
+    }
+    pthread_join(component, NULL);
+    return Now() - start;
+}
+
+static double BenchQueue(unsigned long count, unsigned int buffers)
+{
+    BenchQueues queues;
+    queues.count = count;
+    for (unsigned int i = 0; i < buffers; i++)
+        queues.available.Push((void *)(uintptr_t)(i + 1));
+
+    pthread_t component;
+    double start = Now();
+    pthread_create(&component, NULL, QueueComponent, &queues);
+    for (unsigned long i = 0; i < count; i++)
+    {
+        void *buffer = queues.available.Get();
+        if (!buffer)
+            abort();
+        queues.submitted.Push(buffer);
+    }
+    pthread_join(component, NULL);
+    return Now() - start;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long count   = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    unsigned int  buffers = argc > 2 ? strtoul(argv[2], NULL, 10) : 8;
+    if (!count || !buffers)
+    {
+        printf("Usage: %s [round trips] [buffers]\n", argv[0]);
+        return 1;
+    }
+
+    double ring  = BenchRing(count, buffers);
+    double queue = BenchQueue(count, buffers);
+    printf("%lu round trips, %u buffers\n", count, buffers);
+    printf("COMXBufferRing:  %.3f s, %.0f ns per round trip\n", ring, ring * 1e9 / count);
+    printf("mutex/condition: %.3f s, %.0f ns per round trip\n", queue, queue * 1e9 / count);
+    return 0;
+}
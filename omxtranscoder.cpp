@@ -21,6 +21,7 @@
 #include <signal.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <limits.h>
 #include <termios.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
@@ -29,6 +30,13 @@
 #include <string>
 #include <vector>
 #include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <time.h>
+#include <deque>
+#include <algorithm>
 
 #define AV_NOWARN_DEPRECATED
 
@@ -46,13 +54,17 @@ extern "C" {
 #include <libavutil/avutil.h>
 #include <libavutil/crc.h>
 #include <libavutil/fifo.h>
+#include <libavutil/intreadwrite.h>
+#if defined(TARGET_RASPBERRY_PI)
 #include <bcm_host.h>
+#endif
 }
 
 #include "OMXVideo.h"
 #include "OMXReader.h"
 #include "OMXTranscoderVideo.h"
 #include "OMXMuxer.h"
+#include "OMXPacketPool.h"
 #include "utils/Strprintf.h"
 
 #include <string>
@@ -61,18 +73,21 @@ extern "C" {
 
 #define MAIN_PRINT printf
 
-OMXReader         m_omx_reader;
-int               m_audio_index_use     = 0;
-OMXVideoConfig    m_config_video;
-OMXPacket         *m_omx_pkt            = NULL;
+// --prefetch queue bounds, for each of the video and audio queues
+#define PREFETCH_MAX_BYTES    (16 * 1024 * 1024)
+#define PREFETCH_MAX_TIME     2.0
+
+// a job is done once its encoders flagged EOS, or this long (s) after the
+// last packet went to the decoder
+#define JOB_EOS_TIMEOUT       10.0
+
 bool              m_no_hdmi_clock_sync  = false;
 int               m_subtitle_index      = -1;
-OMXPlayerVideo    m_transcoder_video;
-OMXMuxer          m_muxer;
-bool              m_has_video           = false;
-bool              m_has_audio           = false;
 bool              m_gen_log             = true;
 
+// SIGINT/SIGTERM in --batch/--listen: no new jobs, the running ones finish
+static volatile sig_atomic_t g_stop     = 0;
+
 enum{ERROR=-1,SUCCESS,ONEBYTE};
 
 bool Exists(const std::string& path)
@@ -104,91 +119,630 @@ bool IsPipe(const std::string& str)
 }
 
 
-static void enc_done_callback(OMX_BUFFERHEADERTYPE* pBuffer)
+// bits/s, with an optional k or M, 0 when not a positive rate
+static int ParseBitrate(const char *arg, char **end)
 {
-    m_muxer.AddPacket(pBuffer);
+    double bitrate = strtod(arg, end);
+    if(**end == 'k')
+        bitrate *= 1000, (*end)++;
+    else if(**end == 'M')
+        bitrate *= 1000 * 1000, (*end)++;
+    return bitrate > 0 && bitrate < INT_MAX ? (int)bitrate : 0;
 }
 
-int main(int argc, char *argv[])
+// WxH, even and within the encoder's, 0 for one keeps the display aspect
+static bool ParseSize(const char *arg, char **end, int &width, int &height)
 {
-  
-    std::string           m_filename;
-    char*                 m_out_filename;
-    bool                  m_dump_format         = false;
-
-    float m_timeout        = 10.0f; // amount of time file/network operation can stall for before timing out
-    float m_fps            = 0.0f; // unset
+    width = strtol(arg, end, 10);
+    if(**end != 'x')
+        return false;
+    height = strtol(*end + 1, end, 10);
+    return width >= 0 && height >= 0 && !((width | height) & 1) &&
+           width <= VIDEO_ENCODER_MAX_WIDTH && height <= VIDEO_ENCODER_MAX_HEIGHT;
+}
 
-    std::string            m_cookie              = "";
-    std::string            m_user_agent          = "";
-    std::string            m_lavfdopts           = "";
-    std::string            m_avdict              = "";
+// hw, sw or a libavcodec H.264 encoder name (software)
+static bool ParseEncoder(const char *arg, EVIDEOENCODER &encoder, std::string &soft_name)
+{
+    soft_name.clear();
+    if(!strcmp(arg, "hw"))
+        encoder = VIDEO_ENCODER_HW;
+    else if(!strcmp(arg, "sw"))
+        encoder = VIDEO_ENCODER_SOFT;
+    else if(*arg && strlen(arg) < OMX_MAX_STRINGNAME_SIZE)
+        encoder = VIDEO_ENCODER_SOFT, soft_name = arg;
+    else
+        return false;
+    return true;
+}
 
-    m_filename = argv[optind];
-    m_out_filename = argv[optind + 1];
+// WxH[:bitrate[k|M]][:encoder], 0x0 for --size or the input size
+static bool ParseRendition(const char *arg, OMXVideoRendition &rendition)
+{
+    char *end;
+    if(!ParseSize(arg, &end, rendition.width, rendition.height))
+        return false;
+    if(*end == ':' && isdigit((unsigned char)end[1]) && !(rendition.bitrate = ParseBitrate(end + 1, &end)))
+        return false;
+    if(*end == ':')
+        return ParseEncoder(end + 1, rendition.encoder, rendition.soft_name);
+    return !*end;
+}
 
-    bool filename_is_URL = IsURL(m_filename);
+// the encoder settings options, false on a bad value
+static const int bitrate_opt = 0x108;
+static const int peak_bitrate_opt = 0x109;
+static const int rate_control_opt = 0x10a;
+static const int gop_opt = 0x10b;
+static const int idr_period_opt = 0x10c;
+static const int profile_opt = 0x10d;
+static const int level_opt = 0x10e;
+static const int qp_opt = 0x10f;
+static const int encoder_buffers_opt = 0x110;
+static const int encoder_opt = 0x116;
 
-    if(!filename_is_URL && !IsPipe(m_filename) && !Exists(m_filename))
+static bool ParseEncoderOption(int opt, const char *arg, OMXVideoEncoderConfig &encoder)
+{
+    char *end = NULL;
+    switch(opt)
     {
-        return EXIT_FAILURE;
+    case bitrate_opt:
+        encoder.bitrate = ParseBitrate(arg, &end);
+        return !*end && encoder.bitrate;
+    case peak_bitrate_opt:
+        encoder.peak_bitrate = ParseBitrate(arg, &end);
+        return !*end && encoder.peak_bitrate;
+    case rate_control_opt:
+        if(!strcmp(arg, "vbr"))
+            encoder.rate_control = VIDEO_RATE_VBR;
+        else if(!strcmp(arg, "cbr"))
+            encoder.rate_control = VIDEO_RATE_CBR;
+        else
+            return false;
+        return true;
+    case gop_opt:
+        encoder.gop = strtol(arg, &end, 10);
+        return !*end && encoder.gop > 0;
+    case idr_period_opt:
+        encoder.idr_period = strtol(arg, &end, 10);
+        return !*end && encoder.idr_period > 0;
+    case profile_opt:
+        if(!strcmp(arg, "baseline"))
+            encoder.profile = OMX_VIDEO_AVCProfileBaseline;
+        else if(!strcmp(arg, "main"))
+            encoder.profile = OMX_VIDEO_AVCProfileMain;
+        else if(!strcmp(arg, "high"))
+            encoder.profile = OMX_VIDEO_AVCProfileHigh;
+        else
+            return false;
+        return true;
+    case level_opt:
+        // 4.1 or 41
+        encoder.level = (int)(strtod(arg, &end) * (strchr(arg, '.') ? 10 : 1) + 0.5);
+        return !*end && encoder.level >= 10 && encoder.level <= 51;
+    case qp_opt:
+        encoder.qp_min = strtol(arg, &end, 10);
+        if(*end != ':')
+            return false;
+        encoder.qp_max = strtol(end + 1, &end, 10);
+        return !*end && encoder.qp_min >= 0 && encoder.qp_max <= 51 &&
+               (!encoder.qp_max || encoder.qp_min <= encoder.qp_max);
+    case encoder_buffers_opt:
+        encoder.buffers = strtol(arg, &end, 10);
+        return !*end && encoder.buffers > 0;
+    case encoder_opt:
+        return ParseEncoder(arg, encoder.backend, encoder.soft_name);
+    default:
+        return false;
     }
+}
 
-    if(m_gen_log)
+// what one transcode is given, from the command line or a job line
+struct TranscodeJob
+{
+    std::string     filename;
+    std::string     out_filename;
+    OMXVideoConfig  config_video;
+    bool            dump_format;
+    float           timeout;        // amount of time file/network operation can stall for before timing out
+    float           fps;            // 0: the stream's
+    std::string     cookie;
+    std::string     user_agent;
+    std::string     lavfdopts;
+    std::string     avdict;
+    int             audio_index_use;
+    bool            prefetch;
+    bool            allow_passthrough;
+    EMUXFORMAT      mux_format;
+    float           segment;
+    int             segment_list;
+    double          start;          // --start, seconds of the input
+    double          duration;       // --duration, 0: to the end
+    // The input from range_start to range_end (DVD_TIME_BASE from the input
+    // start, DVD_NOPTS_VALUE for its end): --start/--duration, cut at those
+    // frames with the output starting at 0, or a --parallel part, from the
+    // keyframe at range_start to the one at range_end, to mpegts with the
+    // input's timestamps
+    bool            part;
+    double          range_start;
+    double          range_end;
+
+    TranscodeJob() : dump_format(false), timeout(10.0f), fps(0.0f), audio_index_use(0), prefetch(false),
+                     allow_passthrough(true), mux_format(MUX_FORMAT_AUTO), segment(0.0f), segment_list(0),
+                     start(0.0), duration(0.0), part(false), range_start(0.0), range_end(DVD_NOPTS_VALUE) {}
+};
+
+// how long a job took over how much input
+struct TranscodeResult
+{
+    bool          ok;
+    double        seconds;        // wall clock, open to close
+    double        media_seconds;  // input duration, 0 when unknown
+    unsigned int  frames;         // video packets read
+    uint64_t      bytes;          // audio and video packets read
+
+    TranscodeResult() : ok(false), seconds(0.0), media_seconds(0.0), frames(0), bytes(0) {}
+};
+
+// only from the command line, they hold for the whole process
+struct TranscodeProcess
+{
+    OMXCoreBackend  omx_backend;
+    std::string     batch;          // job lines from this file, - for stdin
+    std::string     listen;         // or from connections to this UNIX socket
+    int             jobs;           // run side by side
+    int             parallel;       // parts of a single file transcoded side by side
+    bool            help;
+
+    TranscodeProcess() : omx_backend(OMX_CORE_BACKEND_DEFAULT), jobs(1), parallel(1), help(false) {}
+};
+
+static double MonotonicSeconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// One job: an input to its outputs. The reader, decoder/encoders and muxers
+// are closed at the end of a job and opened again by the next one on the
+// same objects; the OMX core, FFmpeg and the packet pool stay up.
+class COMXTranscoder
+{
+public:
+    COMXTranscoder() : m_omx_pkt(NULL), m_muxer_count(1), m_has_video(false), m_has_audio(false),
+                       m_passthrough(false), m_eos_start(0.0), m_ranged(false), m_range_start(0.0),
+                       m_range_end(DVD_NOPTS_VALUE), m_range_trim(false), m_range_video_started(false),
+                       m_range_video_done(false), m_range_audio_done(false) {}
+    bool Run(const TranscodeJob &job, TranscodeResult &result);
+    // --parallel: where each of up to parts parts of the input starts (at
+    // keyframes), none when the job is better run as a whole. false when the
+    // input can't be read.
+    bool Plan(const TranscodeJob &job, unsigned int parts, std::vector<double> &starts);
+    // the outputs of job from the file_out of each of its parts, in order
+    bool Stitch(const TranscodeJob &job, const std::vector<std::string> &parts);
+
+private:
+    static void EncodeDone(OMX_BUFFERHEADERTYPE* pBuffer, void *opaque, int output);
+    bool OpenInput(const TranscodeJob &job);
+    void ChooseVideo(const TranscodeJob &job);
+    bool OpenMuxers(const TranscodeJob &job);
+    bool Open(const TranscodeJob &job);
+    bool Transcode(TranscodeResult &result);
+    bool VideoInRange(const OMXPacket *pkt);
+    bool AudioInRange(double ts);
+    bool RangeDone();
+    double AudioTime(AVPacket *pkt);
+    bool StitchPart(const std::string &file, OMXMuxer &muxer, const std::vector<int> &audio_streams);
+    bool Drained();
+    void Close(const TranscodeJob &job);
+    void VideoOutputSize(unsigned int output, int &width, int &height);
+
+    OMXReader         m_omx_reader;
+    OMXVideoConfig    m_config_video;
+    OMXPacket         *m_omx_pkt;
+    OMXPlayerVideo    m_transcoder_video;
+    // one per rendition
+    OMXMuxer          m_muxers[VIDEO_MAX_RENDITIONS];
+    unsigned int      m_muxer_count;
+    std::vector<std::string> m_out_files;
+    bool              m_has_video;
+    bool              m_has_audio;
+    bool              m_passthrough;
+    double            m_eos_start;  // when the decoder got its EOS, 0 before
+    // the part of the input the job covers, TranscodeJob::range_start/end
+    bool              m_ranged;
+    double            m_range_start;
+    double            m_range_end;
+    bool              m_range_trim;     // --start/--duration rather than a part
+    bool              m_range_video_started;
+    bool              m_range_video_done;
+    bool              m_range_audio_done;
+};
+
+void COMXTranscoder::EncodeDone(OMX_BUFFERHEADERTYPE* pBuffer, void *opaque, int output)
+{
+    static_cast<COMXTranscoder *>(opaque)->m_muxers[output].AddPacket(pBuffer);
+}
+
+// size of video output i, as COMXVideo works it out from the decoded frames
+void COMXTranscoder::VideoOutputSize(unsigned int output, int &width, int &height)
+{
+    const COMXStreamInfo &hints = m_config_video.hints;
+    AVRational sar = av_make_q(1, 1);
+    if(hints.aspect > 0.0f && hints.width > 0)
+        sar = av_d2q((double)hints.aspect * hints.height / hints.width, 1000);
+    m_config_video.OutputSize(output, hints.width, hints.height, sar.num, sar.den, width, height);
+}
+
+// file_out of output i when there are several: out.ts -> out_1.ts
+static std::string OutputName(const std::string &file, unsigned int output)
+{
+    size_t ext = file.rfind('.');
+    if(ext == std::string::npos || file.find('/', ext) != std::string::npos)
+        ext = file.size();
+    return file.substr(0, ext) + strprintf("_%u", output) + file.substr(ext);
+}
+
+bool COMXTranscoder::Run(const TranscodeJob &job, TranscodeResult &result)
+{
+    double start = MonotonicSeconds();
+
+    result = TranscodeResult();
+    result.ok = Open(job) && Transcode(result);
+    int length = m_omx_reader.GetStreamLength();
+    result.media_seconds = length > 0 ? length / 1000.0 : 0.0;
+    if(job.range_end != DVD_NOPTS_VALUE && job.range_end / DVD_TIME_BASE < result.media_seconds)
+        result.media_seconds = job.range_end / DVD_TIME_BASE;
+    result.media_seconds = std::max(result.media_seconds - job.range_start / DVD_TIME_BASE, 0.0);
+
+    Close(job);
+    result.seconds = MonotonicSeconds() - start;
+    return result.ok;
+}
+
+// the reader on the job's input, at the start of its range
+bool COMXTranscoder::OpenInput(const TranscodeJob &job)
+{
+    m_config_video = job.config_video;
+    m_omx_pkt      = NULL;
+    m_muxer_count  = 1;
+    m_passthrough  = false;
+    m_eos_start    = 0.0;
+    m_out_files.clear();
+    m_ranged              = job.range_start > 0.0 || job.range_end != DVD_NOPTS_VALUE;
+    m_range_start         = job.range_start;
+    m_range_end           = job.range_end;
+    m_range_trim          = m_ranged && !job.part;
+    m_range_video_started = job.range_start <= 0.0;
+    m_range_video_done    = false;
+    m_range_audio_done    = false;
+
+    bool filename_is_URL = IsURL(job.filename);
+
+    if(!filename_is_URL && !IsPipe(job.filename) && !Exists(job.filename))
     {
-        CLog::SetLogLevel(LOG_LEVEL_DEBUG);
-        CLog::Init("./");
+        CLOG(LOGERROR, "%s - %s not found\n", __func__, job.filename.c_str());
+        return false;
     }
-    else
+
+    if(!m_omx_reader.Open(job.filename.c_str(), job.dump_format, /*m_config_audio.is_live*/false, job.timeout, job.cookie.c_str(), job.user_agent.c_str(), job.lavfdopts.c_str(), job.avdict.c_str()))
+        return false;
+
+    m_has_video     = m_omx_reader.VideoStreamCount();
+    m_has_audio     = job.audio_index_use < 0 ? false : m_omx_reader.AudioStreamCount();
+
+    m_omx_reader.GetHints(OMXSTREAM_VIDEO, m_config_video.hints);
+
+    if (job.fps > 0.0f)
+        m_config_video.hints.fpsrate = job.fps * DVD_TIME_BASE, m_config_video.hints.fpsscale = DVD_TIME_BASE;
+
+    // --target-fps is a ceiling, slower input keeps its own rate
+    if (m_config_video.output_fps > 0.0f && m_config_video.hints.fpsrate && m_config_video.hints.fpsscale &&
+        m_config_video.output_fps >= (float)m_config_video.hints.fpsrate / m_config_video.hints.fpsscale)
+        m_config_video.output_fps = 0.0f;
+
+    if(job.audio_index_use > 0)
+        m_omx_reader.SetActiveStream(OMXSTREAM_AUDIO, job.audio_index_use-1);
+
+    // the decoder drops the frames of a trim outside it
+    if(m_range_trim)
     {
-        CLog::SetLogLevel(LOG_LEVEL_NONE);
+        m_config_video.trim_start = job.range_start / DVD_TIME_BASE;
+        m_config_video.trim_end   = job.range_end != DVD_NOPTS_VALUE ? job.range_end / DVD_TIME_BASE : 0.0;
     }
 
-	bcm_host_init();
-	OMX_Init();
+    // to the keyframe at or before the start, the range filter drops what is before
+    if(job.range_start > 0.0 && !m_omx_reader.SeekTime((int)(job.range_start / 1000), true, NULL))
+    {
+        CLOG(LOGERROR, "%s - can't seek %s to %.3fs\n", __func__, job.filename.c_str(), job.range_start / DVD_TIME_BASE);
+        return false;
+    }
+    return true;
+}
 
-  
-    if(!m_omx_reader.Open(m_filename.c_str(), m_dump_format, /*m_config_audio.is_live*/false, m_timeout, m_cookie.c_str(), m_user_agent.c_str(), m_lavfdopts.c_str(), m_avdict.c_str()))
-        goto do_exit;
+// how many outputs, and whether the video is remuxed rather than encoded
+void COMXTranscoder::ChooseVideo(const TranscodeJob &job)
+{
+    if(m_has_video && !m_config_video.renditions.empty())
+    {
+        // the renditions are encoded, even one that matches the input
+        m_muxer_count = m_config_video.renditions.size();
+        printf("Video re-encoded: %u renditions\n", m_muxer_count);
+    }
+    else if(m_has_video && (m_config_video.width || m_config_video.height || m_config_video.DropsFrames()))
+    {
+        // a trim starts and ends at frames that need not be keyframes
+        printf("Video re-encoded: %s\n", m_config_video.output_fps > 0.0f ? "frame rate changed" :
+                                         m_range_trim ? "trimmed" : "resized");
+    }
+    else if(m_has_video && job.allow_passthrough)
+    {
+        // the stream's own rate, or the whole file's when the container has none
+        int64_t bitrate = m_config_video.hints.bitrate;
+        if(bitrate <= 0)
+            bitrate = m_omx_reader.GetFormatCxt()->bit_rate;
+        const char *reason;
+        m_passthrough = OMXPlayerVideo::CanPassthrough(m_config_video.hints, bitrate, m_config_video.encoder, &reason);
+        printf("Video %s: %s\n", m_passthrough ? "remuxed" : "re-encoded", reason);
+    }
+}
 
-    m_has_video     = m_omx_reader.VideoStreamCount();
-    m_has_audio     = m_audio_index_use < 0 ? false : m_omx_reader.AudioStreamCount();
+bool COMXTranscoder::Open(const TranscodeJob &job)
+{
+    if(!OpenInput(job))
+        return false;
+    ChooseVideo(job);
 
-    m_omx_reader.GetHints(OMXSTREAM_VIDEO, m_config_video.hints);
+    // the encoder puts an IDR on the segment grid, passthrough cuts at the
+    // input's own keyframes
+    m_config_video.keyframe_interval = job.segment;
 
-    if (m_fps > 0.0f)
-        m_config_video.hints.fpsrate = m_fps * DVD_TIME_BASE, m_config_video.hints.fpsscale = DVD_TIME_BASE;
+    if(m_has_video && !m_passthrough)
+    {
+        if(!m_transcoder_video.Open(m_config_video))
+            return false;
+        m_transcoder_video.SetCallBack(&EncodeDone, this);
+    }
 
-    if(m_audio_index_use > 0)
-        m_omx_reader.SetActiveStream(OMXSTREAM_AUDIO, m_audio_index_use-1);
+    if(!OpenMuxers(job))
+        return false;
 
-    if(m_has_video && !m_transcoder_video.Open(m_config_video))
-        goto do_exit;
+    if(job.prefetch && !m_omx_reader.StartPrefetch(PREFETCH_MAX_BYTES, PREFETCH_MAX_TIME))
+        return false;
 
-    m_transcoder_video.SetCallBack(&enc_done_callback);
+    return true;
+}
 
+// a --parallel part goes to one mpegts file per output, as the input has it
+bool COMXTranscoder::OpenMuxers(const TranscodeJob &job)
+{
     //ADD(truong): Open muxer
-    m_muxer.Open(m_omx_reader.GetFormatCxt(), m_out_filename);
+    for(unsigned int i = 0; i < m_muxer_count; i++)
+        m_out_files.push_back(m_muxer_count > 1 ? OutputName(job.out_filename, i) : job.out_filename);
+    for(unsigned int i = 0; i < m_muxer_count; i++)
+    {
+        // the muxers are reused, nothing is left from the last job
+        m_muxers[i].SetSegmenting(job.part ? 0.0 : job.segment, job.segment_list);
+        m_muxers[i].SetKeepTimestamps(job.part);
+        m_muxers[i].SetRebase(m_range_trim ? (int64_t)job.range_start : 0);
+        if(!m_passthrough)
+        {
+            OMXVideoEncoderConfig encoder = m_config_video.EncoderFor(i);
+            int width, height;
+            VideoOutputSize(i, width, height);
+            m_muxers[i].SetVideoOutput(width, height, encoder.bitrate, encoder.MaxBitrate(),
+                                       av_d2q(m_config_video.output_fps, 1001000));
+        }
+        else
+        {
+            m_muxers[i].SetVideoOutput(0, 0, 0, 0, av_make_q(0, 1));
+        }
+        if(!m_muxers[i].Open(m_omx_reader.GetFormatCxt(), &m_out_files[i][0], m_passthrough,
+                             job.part ? MUX_FORMAT_TS : job.mux_format))
+            return false;
+    }
 
+    if(m_muxer_count > 1 && job.segment > 0.0f && !job.part)
+    {
+        // file_out lists the media playlists of the renditions
+        int audio_bitrate = 0;
+        AVFormatContext *input = m_omx_reader.GetFormatCxt();
+        for(unsigned int i = 0; i < input->nb_streams; i++)
+        {
+            if(m_has_audio && input->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO)
+                audio_bitrate += input->streams[i]->codec->bit_rate;
+        }
+
+        std::vector<OMXMuxerVariant> variants;
+        for(unsigned int i = 0; i < m_muxer_count; i++)
+        {
+            OMXMuxerVariant variant;
+            size_t slash = m_out_files[i].rfind('/');
+            variant.uri       = slash == std::string::npos ? m_out_files[i] : m_out_files[i].substr(slash + 1);
+            variant.bandwidth = m_config_video.EncoderFor(i).MaxBitrate() + audio_bitrate;
+            VideoOutputSize(i, variant.width, variant.height);
+            variants.push_back(variant);
+        }
+        if(!OMXMuxer::WriteMasterPlaylist(job.out_filename.c_str(), variants))
+            return false;
+    }
+    return true;
+}
+
+static double PacketTime(const OMXPacket *pkt)
+{
+    return pkt->pts != DVD_NOPTS_VALUE ? pkt->pts : pkt->dts;
+}
+
+// Video within the job's range. A part: from the first keyframe at or after
+// its start up to the keyframe at its end. A trim: from the keyframe the
+// seek went to, up to the first packet decoded after its end (no frame
+// before the end refers to it), the decoder drops the frames outside.
+bool COMXTranscoder::VideoInRange(const OMXPacket *pkt)
+{
+    if(!m_ranged)
+        return true;
+    if(m_range_video_done)
+        return false;
+
+    double ts  = PacketTime(pkt);
+    double end = m_range_trim ? (pkt->dts != DVD_NOPTS_VALUE ? pkt->dts : pkt->pts) :
+                 pkt->keyframe ? ts : DVD_NOPTS_VALUE;
+    if(m_range_end != DVD_NOPTS_VALUE && end != DVD_NOPTS_VALUE && end >= m_range_end)
+    {
+        m_range_video_done = true;
+        return false;
+    }
+    if(pkt->keyframe && (m_range_trim || (ts != DVD_NOPTS_VALUE && ts >= m_range_start)))
+        m_range_video_started = true;
+    return m_range_video_started;
+}
+
+// audio by its own time, ts as OMXPacket's
+bool COMXTranscoder::AudioInRange(double ts)
+{
+    if(!m_ranged)
+        return true;
+    if(m_range_audio_done)
+        return false;
+    if(ts == DVD_NOPTS_VALUE)
+        return m_range_video_started;
+    if(m_range_end != DVD_NOPTS_VALUE && ts >= m_range_end)
+    {
+        m_range_audio_done = true;
+        return false;
+    }
+    return ts >= m_range_start;
+}
+
+// past the end of the range, nothing more to read
+bool COMXTranscoder::RangeDone()
+{
+    return m_ranged && (m_range_video_done || !m_has_video) && (m_range_audio_done || !m_has_audio);
+}
+
+// DVD_TIME_BASE from the input start, as OMXPacket's
+double COMXTranscoder::AudioTime(AVPacket *pkt)
+{
+    AVStream *stream = m_omx_reader.GetFormatCxt()->streams[pkt->stream_index];
+    int64_t ts = pkt->pts != (int64_t)AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+    return m_omx_reader.ConvertTimestamp(ts, stream->time_base.den, stream->time_base.num);
+}
+
+// After the last packet: EOS through the decoder and the encoders, true
+// once it came out of them (or JOB_EOS_TIMEOUT later, what is muxed stays)
+bool COMXTranscoder::Drained()
+{
+    if(!m_has_video || m_passthrough)
+        return true;
+
+    if(m_eos_start == 0.0)
+    {
+        m_transcoder_video.SubmitEOS();
+        m_eos_start = MonotonicSeconds();
+    }
+    if(m_transcoder_video.IsEOS())
+        return true;
+    if(MonotonicSeconds() - m_eos_start < JOB_EOS_TIMEOUT)
+        return false;
+
+    CLOG(LOGERROR, "%s - no EOS from the encoders after %.0fs\n", __func__, JOB_EOS_TIMEOUT);
+    return true;
+}
+
+bool COMXTranscoder::Transcode(TranscodeResult &result)
+{
     while(true)
     {
-        if(!m_omx_pkt)
+        if(m_omx_reader.IsPrefetching())
+        {
+            // audio is muxed as it comes, never held up by the video decoder
+            AVPacket *pkt;
+            while(!RangeDone() && (pkt = m_omx_reader.ReadAudio(0)) != NULL)
+            {
+                if(AudioInRange(AudioTime(pkt)))
+                {
+                    result.bytes += pkt->size;
+                    for(unsigned int i = 0; m_has_audio && i < m_muxer_count; i++)
+                        m_muxers[i].AddPacket(pkt);
+                }
+                av_packet_free(&pkt);
+            }
+
+            if(!m_omx_pkt && !RangeDone())
+            {
+                m_omx_pkt = m_omx_reader.ReadVideo(0);
+                if(m_omx_pkt && !VideoInRange(m_omx_pkt))
+                {
+                    m_omx_reader.FreePacket(m_omx_pkt);
+                    m_omx_pkt = NULL;
+                    continue;
+                }
+                if(m_omx_pkt)
+                    result.frames++, result.bytes += m_omx_pkt->size;
+            }
+            if(!m_omx_pkt)
+            {
+                bool done = m_omx_reader.PrefetchDone() || RangeDone();
+                if(done && Drained())
+                    break;
+                else if(done)
+                    OMXSleep(10);
+                else
+                    m_omx_reader.WaitForPacket(100);
+                continue;
+            }
+        }
+        else if(!m_omx_pkt && !RangeDone())
+        {
             m_omx_pkt = m_omx_reader.Read();
+            if(m_omx_pkt && m_omx_reader.IsActive(OMXSTREAM_VIDEO, m_omx_pkt->stream_index))
+            {
+                if(!VideoInRange(m_omx_pkt))
+                {
+                    m_omx_reader.FreePacket(m_omx_pkt);
+                    m_omx_pkt = NULL;
+                    continue;
+                }
+                result.frames++;
+            }
+            if(m_omx_pkt)
+                result.bytes += m_omx_pkt->size;
+        }
+
+        // at the end of the input (or of the range) what the decoder/encoders
+        // hold is drained
+        if(!m_omx_pkt && (m_omx_reader.IsEof() || RangeDone()))
+        {
+            if(Drained())
+                break;
+            OMXSleep(10);
+            continue;
+        }
 
-        if(m_has_video && m_omx_pkt && m_omx_reader.IsActive(OMXSTREAM_VIDEO, m_omx_pkt->stream_index))
+        if(m_passthrough && m_omx_pkt && m_omx_reader.IsActive(OMXSTREAM_VIDEO, m_omx_pkt->stream_index))
+        {
+            m_muxers[0].AddPacket(m_omx_pkt);
+            m_omx_reader.FreePacket(m_omx_pkt);
+            m_omx_pkt = NULL;
+        }
+        else if(m_has_video && m_omx_pkt && m_omx_reader.IsActive(OMXSTREAM_VIDEO, m_omx_pkt->stream_index))
         {
-            if(m_transcoder_video.AddPacket(m_omx_pkt))
+            // blocks until the decoder thread makes room, or 100ms
+            if(m_transcoder_video.AddPacket(m_omx_pkt, 100))
                 m_omx_pkt = NULL;
-            else
-                OMXSleep(10);
         }
-        else if(m_has_audio && m_omx_reader.GetCodecType() == AVMEDIA_TYPE_AUDIO)
+        else if(m_has_audio && !m_omx_pkt && !m_omx_reader.IsPrefetching() && m_omx_reader.GetCodecType() == AVMEDIA_TYPE_AUDIO)
         {
             // ADD(truong): Pass audio packet to muxer
+            // the selected audio stream comes back as NULL, its packet is
+            // the reader's; other tracks' OMXPackets are freed below
             AVPacket *pkt = m_omx_reader.GetPacket();
-            m_muxer.AddPacket(pkt);
+            bool in_range = AudioInRange(AudioTime(pkt));
+            for(unsigned int i = 0; in_range && i < m_muxer_count; i++)
+                m_muxers[i].AddPacket(pkt);
             m_omx_reader.FreePacket();
-            m_omx_pkt = NULL;
         }
         else
         {
@@ -201,11 +755,21 @@ int main(int argc, char *argv[])
                 OMXSleep(10);
         }
     }
+    return true;
+}
 
-do_exit:
-
+void COMXTranscoder::Close(const TranscodeJob &job)
+{
+    m_omx_reader.StopPrefetch();
+    // the decoder and its counters go with Close()
+    OMXVideoTransferStats transfer;
+    if(m_transcoder_video.GetTransferStats(transfer) && transfer.frames)
+        printf("Video transfer %s: %u frames to %u outputs (%u dropped), %.0f bytes copied per frame\n",
+               COMXVideo::TransferModeName(transfer.mode), transfer.frames, transfer.outputs,
+               transfer.dropped, transfer.copied_per_frame);
     m_transcoder_video.Close();
-    m_muxer.Close();
+    for(unsigned int i = 0; i < m_muxer_count; i++)
+        m_muxers[i].Close();
   
     if(m_omx_pkt)
     {
@@ -214,12 +778,942 @@ do_exit:
     }
 
     m_omx_reader.Close();
-    vc_tv_show_info(0);
-	bcm_host_deinit();
-	OMX_Deinit();
+
+    for(unsigned int i = 0; i < m_muxer_count; i++)
+    {
+        OMXMuxerStats mux_stats = m_muxers[i].GetStats();
+        printf("Muxer %s: %u packets, queue depth avg %.1f max %u, write latency avg %.0f us max %.0f us\n",
+               i < m_out_files.size() ? m_out_files[i].c_str() : job.out_filename.c_str(),
+               mux_stats.packets, mux_stats.avg_depth, mux_stats.max_depth, mux_stats.avg_write_us, mux_stats.max_write_us);
+    }
+}
+
+bool COMXTranscoder::Plan(const TranscodeJob &job, unsigned int parts, std::vector<double> &starts)
+{
+    starts.clear();
+    // a pipe can be read once only, a trim is short and cut at its own frames
+    if(parts < 2 || IsPipe(job.filename) || job.range_start > 0.0 || job.range_end != DVD_NOPTS_VALUE)
+        return true;
+    if(!OpenInput(job))
+    {
+        m_omx_reader.Close();
+        return false;
+    }
+    ChooseVideo(job);
+
+    // remuxing is bound by I/O, not by an encoder
+    if(m_has_video && !m_passthrough)
+    {
+        std::vector<double> keyframes;
+        int length = m_omx_reader.GetStreamLength();
+        m_omx_reader.ScanKeyframes(keyframes);
+        double duration = length > 0 ? length * 1000.0 : (keyframes.empty() ? 0.0 : keyframes.back());
+
+        // the first keyframe at or after each 1/parts of the duration
+        size_t k = 0;
+        starts.push_back(0.0);
+        for(unsigned int i = 1; i < parts; i++)
+        {
+            double target = duration * i / parts;
+            while(k < keyframes.size() && (keyframes[k] < target || keyframes[k] <= starts.back()))
+                k++;
+            if(k == keyframes.size())
+                break;
+            starts.push_back(keyframes[k]);
+        }
+        if(starts.size() < 2)
+            starts.clear();
+    }
+    m_omx_reader.Close();
+    return true;
+}
+
+bool COMXTranscoder::Stitch(const TranscodeJob &job, const std::vector<std::string> &parts)
+{
+    bool ok = OpenInput(job);
+    if(ok)
+    {
+        // the outputs the parts were encoded to
+        if(m_has_video && !m_config_video.renditions.empty())
+            m_muxer_count = m_config_video.renditions.size();
+        ok = OpenMuxers(job);
+    }
+
+    // the input's audio streams, in the order the muxers took them
+    std::vector<int> audio_streams;
+    AVFormatContext *input = m_omx_reader.GetFormatCxt();
+    for(unsigned int i = 1; ok && i < input->nb_streams; i++)
+    {
+        if(input->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO)
+            audio_streams.push_back(i);
+    }
+
+    for(unsigned int i = 0; ok && i < m_muxer_count; i++)
+    {
+        for(size_t k = 0; ok && k < parts.size(); k++)
+            ok = StitchPart(m_muxer_count > 1 ? OutputName(parts[k], i) : parts[k], m_muxers[i], audio_streams);
+    }
+
+    Close(job);
+    return ok;
+}
+
+// a part's packets into muxer, with the input's stream indexes/time bases
+bool COMXTranscoder::StitchPart(const std::string &file, OMXMuxer &muxer, const std::vector<int> &audio_streams)
+{
+    AVFormatContext *input = m_omx_reader.GetFormatCxt();
+    AVFormatContext *part = NULL;
+    if(avformat_open_input(&part, file.c_str(), NULL, NULL) < 0 || avformat_find_stream_info(part, NULL) < 0)
+    {
+        CLOG(LOGERROR, "%s - can't read %s\n", __func__, file.c_str());
+        avformat_close_input(&part);
+        return false;
+    }
+
+    // part stream to input stream, -1 if not muxed
+    std::vector<int> stream_map(part->nb_streams, -1);
+    unsigned int audio = 0;
+    for(unsigned int i = 0; i < part->nb_streams; i++)
+    {
+        AVMediaType type = part->streams[i]->codec->codec_type;
+        if(type == AVMEDIA_TYPE_VIDEO)
+            stream_map[i] = 0;
+        else if(type == AVMEDIA_TYPE_AUDIO && audio < audio_streams.size())
+            stream_map[i] = audio_streams[audio++];
+    }
+    // OMXMuxer::Write added it to the video
+    int64_t start_time = input->start_time != (int64_t)AV_NOPTS_VALUE ? input->start_time : 0;
+
+    AVPacket pkt;
+    av_init_packet(&pkt);
+    bool ok = true;
+    while(ok && av_read_frame(part, &pkt) >= 0)
+    {
+        int index = pkt.stream_index < (int)stream_map.size() ? stream_map[pkt.stream_index] : -1;
+        AVRational tb = part->streams[pkt.stream_index]->time_base;
+        if(index == 0)
+        {
+            int64_t pts = pkt.pts == (int64_t)AV_NOPTS_VALUE ? AV_NOPTS_VALUE : av_rescale_q(pkt.pts, tb, AV_TIME_BASE_Q) - start_time;
+            int64_t dts = pkt.dts == (int64_t)AV_NOPTS_VALUE ? AV_NOPTS_VALUE : av_rescale_q(pkt.dts, tb, AV_TIME_BASE_Q) - start_time;
+            ok = muxer.AddAnnexB(pkt.data, pkt.size, pts, dts, (pkt.flags & AV_PKT_FLAG_KEY) != 0);
+        }
+        else if(index > 0 && m_has_audio)
+        {
+            AVStream *stream = input->streams[index];
+            // mpegts put ADTS headers on the AAC, the input's has none
+            if(stream->codec->codec_id == AV_CODEC_ID_AAC && stream->codec->extradata_size > 0 &&
+               pkt.size > 9 && (AV_RB16(pkt.data) & 0xfff6) == 0xfff0)
+            {
+                int header = (pkt.data[1] & 1) ? 7 : 9;
+                pkt.data += header;
+                pkt.size -= header;
+            }
+            av_packet_rescale_ts(&pkt, tb, stream->time_base);
+            pkt.stream_index = index;
+            muxer.AddPacket(&pkt);
+        }
+        av_packet_unref(&pkt);
+    }
+
+    avformat_close_input(&part);
+    return ok;
+}
+
+// one line per job, printed and sent back to --listen clients
+static std::string ResultLine(unsigned int id, const TranscodeJob &job, const TranscodeResult &result)
+{
+    double seconds = result.seconds > 0.0 ? result.seconds : 1e-6;
+    return strprintf("job %u %s: %s -> %s, %.2f s, %u frames, %.1f fps, %.2fx realtime, %.2f MB/s in\n",
+                     id, result.ok ? "ok" : "failed", job.filename.c_str(), job.out_filename.c_str(), result.seconds,
+                     result.frames, result.frames / seconds, result.media_seconds / seconds,
+                     result.bytes / seconds / (1024.0 * 1024.0));
+}
+
+// a --listen connection, open until its jobs are done
+struct BatchClient
+{
+    int           fd;
+    unsigned int  pending;
+};
+
+struct QueuedJob
+{
+    unsigned int  id;
+    TranscodeJob  job;
+    BatchClient   *client;  // NULL for --batch
+};
+
+// --batch/--listen: jobs queued by the main thread, run by --jobs workers,
+// each reusing its COMXTranscoder from one job to the next
+class CTranscodeBatch
+{
+public:
+    CTranscodeBatch(int workers);
+    ~CTranscodeBatch();
+    void Add(const TranscodeJob &job, BatchClient *client);
+    void Reply(BatchClient *client, const std::string &line);
+    // until the jobs of client are done, on SIGINT/SIGTERM its queued ones
+    // are dropped and only the running ones are waited for
+    void Wait(BatchClient *client);
+    // runs the queued jobs (or drops them) and stops the workers
+    void Finish(bool drop_queued);
+    void PrintTotals();
+    unsigned int Failed() const { return m_failed; }
+    // the jobs run so far as one, ok when none failed or was dropped
+    TranscodeResult Totals();
+
+private:
+    class CWorker : public OMXThread
+    {
+    public:
+        CWorker(CTranscodeBatch *batch) : m_batch(batch) {}
+        virtual ~CWorker() {}
+        void Process() { m_batch->Work(m_transcoder); }
+    private:
+        CTranscodeBatch *m_batch;
+        COMXTranscoder  m_transcoder;
+    };
+
+    void Work(COMXTranscoder &transcoder);
+    void DropQueued();
+
+    std::vector<CWorker*>   m_workers;
+    std::deque<QueuedJob>   m_jobs;
+    pthread_mutex_t         m_lock;
+    pthread_cond_t          m_cond;     // a job queued or done, or no more coming
+    bool                    m_closed;
+    unsigned int            m_next_id;
+    double                  m_start;
+    // totals
+    unsigned int            m_done;
+    unsigned int            m_failed;
+    unsigned int            m_dropped;
+    unsigned int            m_frames;
+    uint64_t                m_bytes;
+    double                  m_media_seconds;
+};
+
+CTranscodeBatch::CTranscodeBatch(int workers)
+{
+    pthread_mutex_init(&m_lock, NULL);
+    pthread_cond_init(&m_cond, NULL);
+    m_closed        = false;
+    m_next_id       = 1;
+    m_start         = MonotonicSeconds();
+    m_done          = 0;
+    m_failed        = 0;
+    m_dropped       = 0;
+    m_frames        = 0;
+    m_bytes         = 0;
+    m_media_seconds = 0.0;
+
+    for(int i = 0; i < workers; i++)
+    {
+        m_workers.push_back(new CWorker(this));
+        m_workers.back()->Create();
+    }
+}
+
+CTranscodeBatch::~CTranscodeBatch()
+{
+    Finish(true);
+    pthread_mutex_destroy(&m_lock);
+    pthread_cond_destroy(&m_cond);
+}
+
+void CTranscodeBatch::Add(const TranscodeJob &job, BatchClient *client)
+{
+    QueuedJob queued;
+    queued.job    = job;
+    queued.client = client;
+
+    pthread_mutex_lock(&m_lock);
+    queued.id = m_next_id++;
+    if(client)
+        client->pending++;
+    m_jobs.push_back(queued);
+    pthread_cond_broadcast(&m_cond);
+    pthread_mutex_unlock(&m_lock);
+}
+
+void CTranscodeBatch::Reply(BatchClient *client, const std::string &line)
+{
+    if(!client)
+        return;
+    pthread_mutex_lock(&m_lock);
+    // a client that went away must not take the process down with SIGPIPE
+    if(send(client->fd, line.c_str(), line.size(), MSG_NOSIGNAL) < 0)
+        CLOG(LOGERROR, "%s - client %d: %s\n", __func__, client->fd, strerror(errno));
+    pthread_mutex_unlock(&m_lock);
+}
+
+void CTranscodeBatch::Wait(BatchClient *client)
+{
+    pthread_mutex_lock(&m_lock);
+    while(client->pending)
+    {
+        // the signal doesn't wake the wait, g_stop is polled
+        if(g_stop)
+            DropQueued();
+        if(!client->pending)
+            break;
+        struct timespec endtime;
+        clock_gettime(CLOCK_REALTIME, &endtime);
+        endtime.tv_nsec += 100 * 1000000;
+        if(endtime.tv_nsec >= 1000000000)
+        {
+            endtime.tv_sec  += 1;
+            endtime.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&m_cond, &m_lock, &endtime);
+    }
+    pthread_mutex_unlock(&m_lock);
+}
+
+// m_lock held
+void CTranscodeBatch::DropQueued()
+{
+    while(!m_jobs.empty())
+    {
+        if(m_jobs.front().client)
+            m_jobs.front().client->pending--;
+        m_jobs.pop_front();
+        m_dropped++;
+    }
+    pthread_cond_broadcast(&m_cond);
+}
+
+void CTranscodeBatch::Work(COMXTranscoder &transcoder)
+{
+    while(true)
+    {
+        pthread_mutex_lock(&m_lock);
+        while(m_jobs.empty() && !m_closed)
+            pthread_cond_wait(&m_cond, &m_lock);
+        if(m_jobs.empty())
+        {
+            pthread_mutex_unlock(&m_lock);
+            return;
+        }
+        QueuedJob queued = m_jobs.front();
+        m_jobs.pop_front();
+        pthread_mutex_unlock(&m_lock);
+
+        TranscodeResult result;
+        transcoder.Run(queued.job, result);
+        std::string line = ResultLine(queued.id, queued.job, result);
+        printf("%s", line.c_str());
+        Reply(queued.client, line);
+
+        pthread_mutex_lock(&m_lock);
+        m_done++;
+        if(!result.ok)
+            m_failed++;
+        m_frames        += result.frames;
+        m_bytes         += result.bytes;
+        m_media_seconds += result.media_seconds;
+        if(queued.client)
+            queued.client->pending--;
+        pthread_cond_broadcast(&m_cond);
+        pthread_mutex_unlock(&m_lock);
+    }
+}
+
+void CTranscodeBatch::Finish(bool drop_queued)
+{
+    pthread_mutex_lock(&m_lock);
+    m_closed = true;
+    if(drop_queued)
+        DropQueued();
+    pthread_cond_broadcast(&m_cond);
+    pthread_mutex_unlock(&m_lock);
+
+    for(size_t i = 0; i < m_workers.size(); i++)
+    {
+        m_workers[i]->StopThread();
+        delete m_workers[i];
+    }
+    m_workers.clear();
+}
+
+// throughput of the whole batch, wall clock from the start
+void CTranscodeBatch::PrintTotals()
+{
+    double seconds = std::max(MonotonicSeconds() - m_start, 1e-6);
+    printf("Batch: %u jobs (%u failed, %u not run), %.2f s, %u frames, %.1f fps, %.2fx realtime, %.2f MB/s in\n",
+           m_done, m_failed, m_dropped, seconds, m_frames, m_frames / seconds, m_media_seconds / seconds,
+           m_bytes / seconds / (1024.0 * 1024.0));
+}
+
+TranscodeResult CTranscodeBatch::Totals()
+{
+    TranscodeResult totals;
+    pthread_mutex_lock(&m_lock);
+    totals.ok            = !m_failed && !m_dropped;
+    totals.seconds       = MonotonicSeconds() - m_start;
+    totals.media_seconds = m_media_seconds;
+    totals.frames        = m_frames;
+    totals.bytes         = m_bytes;
+    pthread_mutex_unlock(&m_lock);
+    return totals;
+}
+
+// --parallel: the input is cut at keyframes into up to parallel parts, each
+// transcoded by a worker of its own (reader, decoder, encoders, muxers) to
+// mpegts files next to file_out, which are then stitched into file_out
+static bool RunParallel(const TranscodeJob &job, int parallel, TranscodeResult &result)
+{
+    double start = MonotonicSeconds();
+    COMXTranscoder transcoder;
+    std::vector<double> starts;
+
+    result = TranscodeResult();
+    if(!transcoder.Plan(job, parallel, starts))
+        return false;
+    if(starts.empty())
+    {
+        printf("Parallel: not split, transcoded as a whole\n");
+        return transcoder.Run(job, result);
+    }
+    printf("Parallel: %u parts, planned in %.2f s\n", (unsigned int)starts.size(), MonotonicSeconds() - start);
+
+    // a pipe or URL has no directory to put them next to
+    std::string base = IsURL(job.out_filename) || IsPipe(job.out_filename) ?
+                       strprintf("/tmp/omxtranscoder-%d", (int)getpid()) : job.out_filename;
+    std::vector<std::string> parts;
+    CTranscodeBatch batch(starts.size());
+    for(size_t k = 0; k < starts.size(); k++)
+    {
+        TranscodeJob part = job;
+        part.part         = true;
+        part.range_start  = starts[k];
+        part.range_end    = k + 1 < starts.size() ? starts[k + 1] : DVD_NOPTS_VALUE;
+        part.out_filename = base + strprintf(".part%02u.ts", (unsigned int)k);
+        parts.push_back(part.out_filename);
+        batch.Add(part, NULL);
+    }
+    batch.Finish(false);
+
+    result = batch.Totals();
+    double stitch_start = MonotonicSeconds();
+    result.ok = result.ok && transcoder.Stitch(job, parts);
+    printf("Parallel: stitched in %.2f s\n", MonotonicSeconds() - stitch_start);
+
+    unsigned int outputs = job.config_video.renditions.size();
+    for(size_t k = 0; k < parts.size(); k++)
+    {
+        for(unsigned int i = 0; outputs > 1 && i < outputs; i++)
+            unlink(OutputName(parts[k], i).c_str());
+        if(outputs <= 1)
+            unlink(parts[k].c_str());
+    }
+
+    result.seconds = MonotonicSeconds() - start;
+    return result.ok;
+}
+
+static void StopSignal(int)
+{
+    g_stop = 1;
+}
+
+// the other options, --soft-omx/--batch/--listen/--jobs/--parallel only on the command line
+static const int soft_omx_opt = 0x100;
+static const int transfer_opt = 0x101;
+static const int prefetch_opt = 0x102;
+static const int no_passthrough_opt = 0x103;
+static const int format_opt = 0x104;
+static const int segment_opt = 0x105;
+static const int segment_list_opt = 0x106;
+static const int rendition_opt = 0x107;
+static const int size_opt = 0x111;
+static const int target_fps_opt = 0x112;
+static const int batch_opt = 0x113;
+static const int listen_opt = 0x114;
+static const int jobs_opt = 0x115;
+static const int parallel_opt = 0x117;
+static const int start_opt = 0x118;
+static const int duration_opt = 0x119;
+
+static const struct option longopts[] = {
+    { "help",         no_argument,        NULL,          'h' },
+    { "soft-omx",     no_argument,        NULL,          soft_omx_opt },
+    { "transfer",     required_argument,  NULL,          transfer_opt },
+    { "prefetch",     no_argument,        NULL,          prefetch_opt },
+    { "no-passthrough", no_argument,      NULL,          no_passthrough_opt },
+    { "format",       required_argument,  NULL,          format_opt },
+    { "segment",      required_argument,  NULL,          segment_opt },
+    { "segment-list", required_argument,  NULL,          segment_list_opt },
+    { "rendition",    required_argument,  NULL,          rendition_opt },
+    { "size",         required_argument,  NULL,          size_opt },
+    { "target-fps",   required_argument,  NULL,          target_fps_opt },
+    { "bitrate",      required_argument,  NULL,          bitrate_opt },
+    { "peak-bitrate", required_argument,  NULL,          peak_bitrate_opt },
+    { "rate-control", required_argument,  NULL,          rate_control_opt },
+    { "gop",          required_argument,  NULL,          gop_opt },
+    { "idr-period",   required_argument,  NULL,          idr_period_opt },
+    { "profile",      required_argument,  NULL,          profile_opt },
+    { "level",        required_argument,  NULL,          level_opt },
+    { "qp",           required_argument,  NULL,          qp_opt },
+    { "encoder-buffers", required_argument, NULL,        encoder_buffers_opt },
+    { "encoder",      required_argument,  NULL,          encoder_opt },
+    { "batch",        required_argument,  NULL,          batch_opt },
+    { "listen",       required_argument,  NULL,          listen_opt },
+    { "jobs",         required_argument,  NULL,          jobs_opt },
+    { "parallel",     required_argument,  NULL,          parallel_opt },
+    { "start",        required_argument,  NULL,          start_opt },
+    { "duration",     required_argument,  NULL,          duration_opt },
+    { 0, 0, 0, 0 }
+};
+
+// Options of argv into job, and into process when they come from the
+// command line (a job line can't have the process ones). first_arg: the
+// index of the first non option. false on a bad option.
+static bool ParseOptions(int argc, char *argv[], TranscodeJob &job, TranscodeProcess *process, int &first_arg)
+{
+    // a job line's renditions replace the command line's
+    bool renditions_set = false;
+
+    optind = 0;
+    int c;
+    while ((c = getopt_long(argc, argv, "h", longopts, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case soft_omx_opt:
+            if (!process)
+                return false;
+            process->omx_backend = OMX_CORE_BACKEND_SOFT;
+            break;
+        case batch_opt:
+            if (!process)
+                return false;
+            process->batch = optarg;
+            break;
+        case listen_opt:
+            if (!process)
+                return false;
+            process->listen = optarg;
+            break;
+        case jobs_opt:
+            if (!process || (process->jobs = atoi(optarg)) <= 0)
+                return false;
+            break;
+        case parallel_opt:
+            if (!process || (process->parallel = atoi(optarg)) <= 0)
+                return false;
+            break;
+        case prefetch_opt:
+            job.prefetch = true;
+            break;
+        case no_passthrough_opt:
+            job.allow_passthrough = false;
+            break;
+        case format_opt:
+            if (!strcmp(optarg, "ts"))
+                job.mux_format = MUX_FORMAT_TS;
+            else if (!strcmp(optarg, "fmp4"))
+                job.mux_format = MUX_FORMAT_FMP4;
+            else if (!strcmp(optarg, "mp4"))
+                job.mux_format = MUX_FORMAT_MP4;
+            else
+                return false;
+            break;
+        case segment_opt:
+            job.segment = atof(optarg);
+            if (job.segment <= 0.0f)
+                return false;
+            break;
+        case segment_list_opt:
+            job.segment_list = atoi(optarg);
+            if (job.segment_list < 0)
+                return false;
+            break;
+        case rendition_opt:
+        {
+            OMXVideoRendition rendition;
+            if (!renditions_set)
+                job.config_video.renditions.clear();
+            renditions_set = true;
+            if (job.config_video.renditions.size() >= VIDEO_MAX_RENDITIONS || !ParseRendition(optarg, rendition))
+                return false;
+            job.config_video.renditions.push_back(rendition);
+            break;
+        }
+        case size_opt:
+        {
+            char *end;
+            if (!ParseSize(optarg, &end, job.config_video.width, job.config_video.height) || *end ||
+                (!job.config_video.width && !job.config_video.height))
+                return false;
+            break;
+        }
+        case target_fps_opt:
+            job.config_video.output_fps = atof(optarg);
+            if (job.config_video.output_fps <= 0.0f)
+                return false;
+            break;
+        case start_opt:
+            job.start = atof(optarg);
+            if (job.start < 0.0)
+                return false;
+            break;
+        case duration_opt:
+            job.duration = atof(optarg);
+            if (job.duration <= 0.0)
+                return false;
+            break;
+        case bitrate_opt:
+        case peak_bitrate_opt:
+        case rate_control_opt:
+        case gop_opt:
+        case idr_period_opt:
+        case profile_opt:
+        case level_opt:
+        case qp_opt:
+        case encoder_buffers_opt:
+        case encoder_opt:
+            if (!ParseEncoderOption(c, optarg, job.config_video.encoder))
+                return false;
+            break;
+        case transfer_opt:
+            if (!strcmp(optarg, "auto"))
+                job.config_video.transfer_mode = VIDEO_TRANSFER_AUTO;
+            else if (!strcmp(optarg, "tunnel"))
+                job.config_video.transfer_mode = VIDEO_TRANSFER_TUNNEL;
+            else if (!strcmp(optarg, "shared"))
+                job.config_video.transfer_mode = VIDEO_TRANSFER_SHARED;
+            else if (!strcmp(optarg, "copy"))
+                job.config_video.transfer_mode = VIDEO_TRANSFER_COPY;
+            else
+                return false;
+            break;
+        case 'h':
+            if (!process)
+                return false;
+            process->help = true;
+            break;
+        default:
+            return false;
+        }
+    }
+
+    // a job line may change either of the command line's
+    job.range_start = job.start * DVD_TIME_BASE;
+    job.range_end   = job.duration > 0.0 ? (job.start + job.duration) * DVD_TIME_BASE : DVD_NOPTS_VALUE;
+
+    first_arg = optind;
+    return true;
+}
+
+// words of a job line, "..." or '...' around names with spaces, # starts a
+// comment. false on an unterminated quote.
+static bool SplitJobLine(const char *line, std::vector<std::string> &words)
+{
+    const char *p = line;
+
+    words.clear();
+    while(true)
+    {
+        while(*p && isspace((unsigned char)*p))
+            p++;
+        if(!*p || *p == '#')
+            return true;
+
+        std::string word;
+        while(*p && !isspace((unsigned char)*p))
+        {
+            if(*p == '"' || *p == '\'')
+            {
+                char quote = *p++;
+                while(*p && *p != quote)
+                    word += *p++;
+                if(!*p)
+                    return false;
+                p++;
+            }
+            else
+                word += *p++;
+        }
+        words.push_back(word);
+    }
+}
+
+// [OPTIONS] file_in file_out, over the command line's options
+static bool ParseJobLine(const std::vector<std::string> &words, const TranscodeJob &defaults, TranscodeJob &job)
+{
+    std::vector<std::string> args(words);
+    std::vector<char *> argv;
+    argv.push_back((char *)"job");
+    for(size_t i = 0; i < args.size(); i++)
+        argv.push_back(&args[i][0]);
+    argv.push_back(NULL);
+
+    int argc = argv.size() - 1;
+    int first_arg;
+    job = defaults;
+    if(!ParseOptions(argc, &argv[0], job, NULL, first_arg) || first_arg + 2 != argc)
+        return false;
+    job.filename     = argv[first_arg];
+    job.out_filename = argv[first_arg + 1];
+    return true;
+}
+
+// job lines from in until its end (or a stop signal), bad ones are reported
+// and skipped
+static void ReadJobs(FILE *in, const TranscodeJob &defaults, CTranscodeBatch &batch, BatchClient *client)
+{
+    char *line = NULL;
+    size_t size = 0;
+    unsigned int number = 0;
+
+    while(!g_stop && getline(&line, &size, in) >= 0)
+    {
+        std::vector<std::string> words;
+        TranscodeJob job;
+
+        number++;
+        bool split = SplitJobLine(line, words);
+        if(split && words.empty())
+            continue;
+        if(!split || !ParseJobLine(words, defaults, job))
+        {
+            std::string error = strprintf("line %u: bad job: %s", number, line);
+            if(error[error.size() - 1] != '\n')
+                error += '\n';
+            printf("%s", error.c_str());
+            batch.Reply(client, error);
+            continue;
+        }
+        batch.Add(job, client);
+    }
+    free(line);
+}
+
+// --listen: a connection at a time, its job lines are queued as they come
+// and a result line goes back for each. The connection is closed once the
+// client is done sending and its jobs have run.
+static bool ServeSocket(const std::string &path, const TranscodeJob &defaults, CTranscodeBatch &batch)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(addr.sun_path))
+    {
+        printf("Socket path too long: %s\n", path.c_str());
+        return false;
+    }
+    strcpy(addr.sun_path, path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path.c_str());
+    if(fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0)
+    {
+        printf("Can't listen on %s: %s\n", path.c_str(), strerror(errno));
+        if(fd >= 0)
+            close(fd);
+        return false;
+    }
+    printf("Listening on %s\n", path.c_str());
+
+    while(!g_stop)
+    {
+        int client_fd = accept(fd, NULL, NULL);
+        if(client_fd < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            printf("accept on %s: %s\n", path.c_str(), strerror(errno));
+            break;
+        }
+
+        BatchClient client;
+        client.fd      = client_fd;
+        client.pending = 0;
+        FILE *in = fdopen(client_fd, "r");
+        if(in)
+            ReadJobs(in, defaults, batch, &client);
+        batch.Wait(&client);
+        if(in)
+            fclose(in);
+        else
+            close(client_fd);
+    }
+
+    close(fd);
+    unlink(path.c_str());
+    return true;
+}
+
+static void PrintUsage(const char *name)
+{
+    MAIN_PRINT("Usage: %s [OPTIONS] file_in file_out\n", name);
+    MAIN_PRINT("       %s [OPTIONS] --batch file|- [--jobs n]\n", name);
+    MAIN_PRINT("       %s [OPTIONS] --listen socket [--jobs n]\n", name);
+    MAIN_PRINT("       %s [OPTIONS] --parallel n file_in file_out\n", name);
+    MAIN_PRINT("\n");
+    MAIN_PRINT("Options:\n");
+    MAIN_PRINT("    -h / --help             print this help\n");
+    MAIN_PRINT("         --soft-omx         use the libavcodec OMX components instead of VideoCore\n");
+    MAIN_PRINT("         --transfer mode    decoder to encoder frames: auto (default), tunnel, shared, copy\n");
+    MAIN_PRINT("         --prefetch         demux on a separate thread, reading ahead up to %ds/%dMB\n",
+               (int)PREFETCH_MAX_TIME, PREFETCH_MAX_BYTES / (1024 * 1024));
+    MAIN_PRINT("         --no-passthrough   re-encode even when the input H.264 already fits the output\n");
+    MAIN_PRINT("         --format fmt       output container: ts, fmp4, mp4 (default: from file_out, else ts)\n");
+    MAIN_PRINT("         --segment secs     file_out is an HLS playlist, segments of secs cut at keyframes\n");
+    MAIN_PRINT("         --segment-list n   keep the last n segments in the playlist, 0 (default) keeps all\n");
+    MAIN_PRINT("         --rendition WxH[:bitrate][:encoder]  an encoded output (bitrate in bps, or with k/M), up to %d,\n",
+               VIDEO_MAX_RENDITIONS);
+    MAIN_PRINT("                            all from one decode, to file_out_0, file_out_1, ... when several\n");
+    MAIN_PRINT("         --size WxH         output size, e.g. 1280x720, 1280x0 keeps the display aspect\n");
+    MAIN_PRINT("         --target-fps fps   encode at most fps frames/s, decoded frames in between are dropped\n");
+    MAIN_PRINT("         --start secs       transcode from this time of file_in on, the output starts at 0\n");
+    MAIN_PRINT("         --duration secs    transcode this much of file_in (default: to its end)\n");
+    MAIN_PRINT("         --parallel n       cut file_in at keyframes into n parts, transcode them side by side\n");
+    MAIN_PRINT("                            and stitch them into file_out\n");
+    MAIN_PRINT("Encoder:\n");
+    MAIN_PRINT("         --bitrate rate     target bitrate, bps or with k/M (default %dM), a rendition's own wins\n",
+               VIDEO_ENCODER_BITRATE / (1000 * 1000));
+    MAIN_PRINT("         --peak-bitrate rate  VBR peak advertised to players (HLS BANDWIDTH, container max rate)\n");
+    MAIN_PRINT("         --rate-control rc  vbr (default) or cbr\n");
+    MAIN_PRINT("         --gop frames       frames from one I frame to the next (default: the encoder's)\n");
+    MAIN_PRINT("         --idr-period n     every n-th I frame is an IDR (default: the encoder's)\n");
+    MAIN_PRINT("         --profile p        baseline, main, high (default)\n");
+    MAIN_PRINT("         --level l          e.g. 4.1 (default)\n");
+    MAIN_PRINT("         --qp min:max       quantiser bounds, 0 leaves the encoder's\n");
+    MAIN_PRINT("         --encoder-buffers n  encoder output buffers (default %d)\n", VIDEO_ENCODER_BUFFERS);
+    MAIN_PRINT("         --encoder e        hw (VideoCore), sw (libx264, else libopenh264) or a libavcodec\n");
+    MAIN_PRINT("                            encoder name, e.g. libopenh264 (default: hw, sw with --soft-omx)\n");
+    MAIN_PRINT("Batch (one process for many files, the options above are every job's defaults):\n");
+    MAIN_PRINT("         --batch file       a job per line of file (- for stdin): [OPTIONS] file_in file_out\n");
+    MAIN_PRINT("         --listen socket    job lines from connections to a UNIX socket, a result line goes back\n");
+    MAIN_PRINT("                            for each, until SIGINT/SIGTERM\n");
+    MAIN_PRINT("         --jobs n           jobs run side by side (default 1)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    TranscodeJob          m_job;
+    TranscodeProcess      m_process;
+    int                   first_arg;
+    int                   status = EXIT_SUCCESS;
+
+    if (!ParseOptions(argc, argv, m_job, &m_process, first_arg))
+    {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (m_process.help)
+    {
+        PrintUsage(argv[0]);
+        return EXIT_SUCCESS;
+    }
+
+    bool batch = !m_process.batch.empty() || !m_process.listen.empty();
+    if (batch ? first_arg != argc || m_process.parallel > 1 : first_arg + 2 > argc)
+    {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!batch)
+    {
+        m_job.filename     = argv[first_arg];
+        m_job.out_filename = argv[first_arg + 1];
+
+        if(!IsURL(m_job.filename) && !IsPipe(m_job.filename) && !Exists(m_job.filename))
+            return EXIT_FAILURE;
+    }
+
+    if(m_gen_log)
+    {
+        CLog::SetLogLevel(LOG_LEVEL_DEBUG);
+        CLog::Init("./");
+    }
+    else
+    {
+        CLog::SetLogLevel(LOG_LEVEL_NONE);
+    }
+
+#if defined(TARGET_RASPBERRY_PI)
+    if(m_process.omx_backend == OMX_CORE_BACKEND_HW)
+        bcm_host_init();
+#endif
+    // once for every job of the process
+    av_register_all();
+    avformat_network_init();
+
+    if(!COMXCore::Initialize(m_process.omx_backend))
+    {
+        status = EXIT_FAILURE;
+    }
+    else if(batch)
+    {
+        // no restarting of accept/getline, a stop is noticed straight away
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = StopSignal;
+        sigaction(SIGINT, &action, NULL);
+        sigaction(SIGTERM, &action, NULL);
+
+        CTranscodeBatch jobs(m_process.jobs);
+        if(!m_process.listen.empty())
+        {
+            if(!ServeSocket(m_process.listen, m_job, jobs))
+                status = EXIT_FAILURE;
+        }
+        else
+        {
+            FILE *in = m_process.batch == "-" ? stdin : fopen(m_process.batch.c_str(), "r");
+            if(in)
+            {
+                ReadJobs(in, m_job, jobs, NULL);
+                if(in != stdin)
+                    fclose(in);
+            }
+            else
+            {
+                printf("Can't open %s: %s\n", m_process.batch.c_str(), strerror(errno));
+                status = EXIT_FAILURE;
+            }
+        }
+        jobs.Finish(g_stop);
+        jobs.PrintTotals();
+        if(jobs.Failed())
+            status = EXIT_FAILURE;
+    }
+    else
+    {
+        COMXTranscoder transcoder;
+        TranscodeResult result;
+        if(m_process.parallel > 1 ? !RunParallel(m_job, m_process.parallel, result) : !transcoder.Run(m_job, result))
+            status = EXIT_FAILURE;
+        printf("%s", ResultLine(1, m_job, result).c_str());
+    }
+
+    OMXPacketPoolStats pool_stats = COMXPacketPool::GetStats();
+    printf("Packet pool: packets hit/miss %u/%u, payloads hit/miss %u/%u\n",
+           pool_stats.packet_hits, pool_stats.packet_misses, pool_stats.data_hits, pool_stats.data_misses);
+    COMXPacketPool::Clear();
+
+    // should stay flat however long the input is
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) == 0)
+        printf("Peak RSS: %ld kB\n", usage.ru_maxrss);
+
+    COMXCore::Deinitialize();
+#if defined(TARGET_RASPBERRY_PI)
+    if(m_process.omx_backend == OMX_CORE_BACKEND_HW)
+    {
+        vc_tv_show_info(0);
+        bcm_host_deinit();
+    }
+#endif
 
     printf("fuck B-)\n");
 
-    // exit status failure on other cases
-    return EXIT_SUCCESS;
+    if(m_gen_log)
+        CLog::Close();
+
+    return status;
 }
@@ -57,15 +57,15 @@ public:
     try {
       fun_();
     } catch (std::exception& e) {
-      CLog::Log(LOGSEVERE, "Scope_guard exit function threw %s (%s)",
-                typeid(e).name(), e.what());
+      CLOG(LOGSEVERE, "Scope_guard exit function threw %s (%s)",
+           typeid(e).name(), e.what());
 #ifndef NDEBUG
       printf("Scope_guard exit function threw %s (%s)\n",
              typeid(e).name(), e.what());
       abort();
 #endif
     } catch (...) {
-      CLog::Log(LOGSEVERE, "Scope_guard exit function threw an object unrelated to std::exception");
+      CLOG(LOGSEVERE, "Scope_guard exit function threw an object unrelated to std::exception");
 #ifndef NDEBUG
       printf("Scope_guard exit function threw an object unrelated to std::exception\n");
       abort();
@@ -25,6 +25,32 @@
 #include "stat_utf8.h"
 #include "utils/StdString.h"
 
+#include <algorithm>
+#include <vector>
+
+// per thread ring of formatted lines, drained by the writer thread
+#define LOG_RING_LINES   256
+#define LOG_LINE_SIZE    512
+#define LOG_FLUSH_MS     50
+
+typedef struct CLogLine
+{
+  uint64_t     seq;    // global order across the rings
+  uint64_t     stamp;  // usec
+  int          level;
+  char         text[LOG_LINE_SIZE];
+} CLogLine;
+
+typedef struct CLogRing
+{
+  CLogLine        lines[LOG_RING_LINES];
+  unsigned int    head;    // writer thread
+  unsigned int    tail;    // owning thread
+  unsigned int    dropped; // lines lost while the ring was full
+  int             dead;    // its thread exited, the next new thread takes it
+  struct CLogRing *next;
+} CLogRing;
+
 static FILE*       m_file           = NULL;
 static int         m_repeatCount    = 0;
 static int         m_repeatLogLevel = -1;
@@ -32,115 +58,279 @@ static std::string m_repeatLine     = "";
 static int         m_logLevel       = LOG_LEVEL_NONE;
 
 static pthread_mutex_t   m_log_mutex;
+static pthread_cond_t    m_log_cond;
+static pthread_t         m_log_thread;
+static bool              m_log_running  = false;
+static bool              m_log_stop     = false;
+static CLogRing         *m_log_rings    = NULL;
+static uint64_t          m_log_seq      = 0;
+static __thread CLogRing *t_log_ring    = NULL;
+static pthread_key_t     m_log_ring_key;
+static pthread_once_t    m_log_ring_once = PTHREAD_ONCE_INIT;
 
 static char levelNames[][8] =
 {"DEBUG", "INFO", "NOTICE", "WARNING", "ERROR", "SEVERE", "FATAL", "NONE"};
 
+static const char* prefixFormat = "%02.2d:%02.2d:%02.2d T:%" PRIu64 " %7s: ";
+
 CLog::CLog()
 {}
 
 CLog::~CLog()
 {}
 
-void CLog::Close()
+// writer thread only
+static void WriteLine(int loglevel, uint64_t stamp, const char *text)
 {
-  if (m_file)
+  SYSTEMTIME time;
+  time_t sec = stamp / 1000000;
+  time.wHour=(sec/3600) % 24;
+  time.wMinute=(sec/60) % 60;
+  time.wSecond=sec % 60;
+  CStdString strPrefix, strData(text);
+
+  if (m_repeatLogLevel == loglevel && m_repeatLine == strData)
   {
-    fclose(m_file);
-    m_file = NULL;
+    m_repeatCount++;
+    return;
   }
-  m_repeatLine.clear();
-  pthread_mutex_destroy(&m_log_mutex);
+  else if (m_repeatCount)
+  {
+    CStdString strData2;
+    strPrefix.Format(prefixFormat, time.wHour, time.wMinute, time.wSecond, stamp, levelNames[m_repeatLogLevel]);
+
+    strData2.Format("Previous line repeats %d times." LINE_ENDING, m_repeatCount);
+    fputs(strPrefix.c_str(), m_file);
+    fputs(strData2.c_str(), m_file);
+    m_repeatCount = 0;
+  }
+
+  m_repeatLine      = strData;
+  m_repeatLogLevel  = loglevel;
+
+  unsigned int length = 0;
+  while ( length != strData.length() )
+  {
+    length = strData.length();
+    strData.TrimRight(" ");
+    strData.TrimRight('\n');
+    strData.TrimRight("\r");
+  }
+
+  if (!length)
+    return;
+
+  /* fixup newline alignment, number of spaces should equal prefix length */
+  strData.Replace("\n", LINE_ENDING"                                            ");
+  strData += LINE_ENDING;
+
+  strPrefix.Format(prefixFormat, time.wHour, time.wMinute, time.wSecond, stamp, levelNames[loglevel]);
+
+  fputs(strPrefix.c_str(), m_file);
+  fputs(strData.c_str(), m_file);
 }
 
-void CLog::Log(int loglevel, const char *format, ... )
+static bool LineOrder(const CLogLine *a, const CLogLine *b)
 {
-  pthread_mutex_lock(&m_log_mutex);
+  return a->seq < b->seq;
+}
 
-  static const char* prefixFormat = "%02.2d:%02.2d:%02.2d T:%" PRIu64 " %7s: ";
-#if !(defined(_DEBUG) || defined(PROFILE))
-  if (m_logLevel > LOG_LEVEL_NORMAL ||
-     (m_logLevel > LOG_LEVEL_NONE && loglevel >= LOGNOTICE))
-#endif
+// writes every queued line in order, one fflush per batch
+static void FlushRings()
+{
+  std::vector<CLogLine*> lines;
+  std::vector<unsigned int> tails;
+  unsigned int dropped = 0;
+
+  CLogRing *rings = __atomic_load_n(&m_log_rings, __ATOMIC_ACQUIRE);
+  for (CLogRing *ring = rings; ring; ring = ring->next)
   {
-    if (!m_file)
-    {
-      pthread_mutex_unlock(&m_log_mutex);
-      return;
-    }
+    unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    for (unsigned int i = ring->head; i != tail; i++)
+      lines.push_back(&ring->lines[i % LOG_RING_LINES]);
+    tails.push_back(tail);
+    dropped += __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+  }
+
+  std::sort(lines.begin(), lines.end(), LineOrder);
+  for (size_t i = 0; i < lines.size(); i++)
+  {
+    OutputDebugString(lines[i]->text);
+    WriteLine(lines[i]->level, lines[i]->stamp, lines[i]->text);
+  }
+
+  size_t r = 0;
+  for (CLogRing *ring = rings; ring; ring = ring->next, r++)
+    __atomic_store_n(&ring->head, tails[r], __ATOMIC_RELEASE);
 
+  if (dropped)
+  {
     struct timeval now;
     gettimeofday(&now, NULL);
-    SYSTEMTIME time;
-    time.wHour=(now.tv_sec/3600) % 24;
-    time.wMinute=(now.tv_sec/60) % 60;
-    time.wSecond=now.tv_sec % 60;
-    uint64_t stamp = now.tv_usec + now.tv_sec * 1000000;
-    CStdString strPrefix, strData;
-
-    strData.reserve(16384);
-    va_list va;
-    va_start(va, format);
-    strData.FormatV(format,va);
-    va_end(va);
-
-    if (m_repeatLogLevel == loglevel && m_repeatLine == strData)
+    CStdString strData;
+    strData.Format("%u lines dropped, log ring full", dropped);
+    WriteLine(LOGWARNING, now.tv_usec + now.tv_sec * 1000000ULL, strData.c_str());
+  }
+
+  if (!lines.empty() || dropped)
+    fflush(m_file);
+}
+
+static void *LogWriter(void *arg)
+{
+  bool stop = false;
+  while (!stop)
+  {
+    struct timespec endtime;
+    clock_gettime(CLOCK_REALTIME, &endtime);
+    endtime.tv_nsec += LOG_FLUSH_MS * 1000000;
+    if (endtime.tv_nsec >= 1000000000)
     {
-      m_repeatCount++;
-      pthread_mutex_unlock(&m_log_mutex);
-      return;
+      endtime.tv_sec  += 1;
+      endtime.tv_nsec -= 1000000000;
     }
-    else if (m_repeatCount)
+
+    pthread_mutex_lock(&m_log_mutex);
+    if (!m_log_stop)
+      pthread_cond_timedwait(&m_log_cond, &m_log_mutex, &endtime);
+    stop = m_log_stop;
+    pthread_mutex_unlock(&m_log_mutex);
+
+    FlushRings();
+  }
+  return NULL;
+}
+
+// thread exit: the ring goes back for reuse, what is queued in it is still
+// written in order
+static void ReleaseRing(void *arg)
+{
+  CLogRing *ring = (CLogRing *)arg;
+  t_log_ring = NULL;
+  __atomic_store_n(&ring->dead, 1, __ATOMIC_RELEASE);
+}
+
+static void CreateRingKey()
+{
+  pthread_key_create(&m_log_ring_key, ReleaseRing);
+}
+
+// a ring of a thread that exited, else a new one, so threads started per job
+// (batch/daemon mode) don't add a ring each
+static CLogRing *GetRing()
+{
+  if (!t_log_ring)
+  {
+    pthread_once(&m_log_ring_once, CreateRingKey);
+
+    pthread_mutex_lock(&m_log_mutex);
+    CLogRing *ring = m_log_rings;
+    while (ring && !__atomic_load_n(&ring->dead, __ATOMIC_ACQUIRE))
+      ring = ring->next;
+    if (ring)
     {
-      CStdString strData2;
-      strPrefix.Format(prefixFormat, time.wHour, time.wMinute, time.wSecond, stamp, levelNames[m_repeatLogLevel]);
-
-      strData2.Format("Previous line repeats %d times." LINE_ENDING, m_repeatCount);
-      fputs(strPrefix.c_str(), m_file);
-      fputs(strData2.c_str(), m_file);
-      OutputDebugString(strData2);
-      m_repeatCount = 0;
+      ring->dead = 0;
     }
-    
-    m_repeatLine      = strData;
-    m_repeatLogLevel  = loglevel;
-
-    unsigned int length = 0;
-    while ( length != strData.length() )
+    else if ((ring = (CLogRing *)calloc(1, sizeof(CLogRing))) != NULL)
     {
-      length = strData.length();
-      strData.TrimRight(" ");
-      strData.TrimRight('\n');
-      strData.TrimRight("\r");
+      ring->next = m_log_rings;
+      __atomic_store_n(&m_log_rings, ring, __ATOMIC_RELEASE);
     }
+    pthread_mutex_unlock(&m_log_mutex);
+    if (!ring)
+      return NULL;
+    pthread_setspecific(m_log_ring_key, ring);
+    t_log_ring = ring;
+  }
+  return t_log_ring;
+}
 
-    if (!length)
+void CLog::Close()
+{
+  if (m_log_running)
+  {
+    pthread_mutex_lock(&m_log_mutex);
+    m_log_stop = true;
+    pthread_cond_signal(&m_log_cond);
+    pthread_mutex_unlock(&m_log_mutex);
+    pthread_join(m_log_thread, NULL);
+    m_log_running = false;
+  }
+  if (m_file)
+  {
+    fclose(m_file);
+    m_file = NULL;
+  }
+  m_repeatLine.clear();
+  // the writer is gone, the rings of exited threads are freed; live threads
+  // may still hold theirs
+  CLogRing **link = &m_log_rings;
+  while (*link)
+  {
+    CLogRing *ring = *link;
+    if (__atomic_load_n(&ring->dead, __ATOMIC_ACQUIRE))
     {
-      pthread_mutex_unlock(&m_log_mutex);
-      return;
+      *link = ring->next;
+      free(ring);
     }
-    
-    OutputDebugString(strData);
+    else
+      link = &ring->next;
+  }
+  pthread_cond_destroy(&m_log_cond);
+  pthread_mutex_destroy(&m_log_mutex);
+}
 
-    /* fixup newline alignment, number of spaces should equal prefix length */
-    strData.Replace("\n", LINE_ENDING"                                            ");
-    strData += LINE_ENDING;
+bool CLog::Write(int loglevel, const char *format, ... )
+{
+#if !(defined(_DEBUG) || defined(PROFILE))
+  if (!(m_logLevel > LOG_LEVEL_NORMAL ||
+       (m_logLevel > LOG_LEVEL_NONE && loglevel >= LOGNOTICE)))
+    return false;
+#endif
+  if (!m_log_running)
+    return false;
 
-    strPrefix.Format(prefixFormat, time.wHour, time.wMinute, time.wSecond, stamp, levelNames[loglevel]);
+  CLogRing *ring = GetRing();
+  if (!ring)
+    return false;
 
-    fputs(strPrefix.c_str(), m_file);
-    fputs(strData.c_str(), m_file);
-    //fputs(strPrefix.c_str(), stdout);
-    //fputs(strData.c_str(), stdout);
-    fflush(m_file);
+  // %s arguments are often temporaries, so the text is formatted here and
+  // only the prefix/file output is left to the writer thread
+  unsigned int tail = ring->tail;
+  unsigned int used = tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  if (used >= LOG_RING_LINES)
+  {
+    __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&m_log_cond);
+    return false;
   }
 
-  pthread_mutex_unlock(&m_log_mutex);
+  CLogLine &line = ring->lines[tail % LOG_RING_LINES];
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  line.stamp = now.tv_usec + now.tv_sec * 1000000ULL;
+  line.seq   = __atomic_fetch_add(&m_log_seq, 1, __ATOMIC_RELAXED);
+  line.level = loglevel;
+
+  va_list va;
+  va_start(va, format);
+  if (vsnprintf(line.text, sizeof(line.text), format, va) < 0)
+    line.text[0] = 0;
+  va_end(va);
+
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+  // otherwise the writer picks it up within LOG_FLUSH_MS
+  if (used + 1 >= LOG_RING_LINES / 2 || loglevel >= LOGERROR)
+    pthread_cond_signal(&m_log_cond);
+
+  return true;
 }
 
 bool CLog::Init(const char* path)
 {
   pthread_mutex_init(&m_log_mutex, NULL);
+  pthread_cond_init(&m_log_cond, NULL);
   if (m_logLevel > LOG_LEVEL_NONE) { 
   if (!m_file)
   {
@@ -164,6 +354,9 @@ bool CLog::Init(const char* path)
   {
     unsigned char BOM[3] = {0xEF, 0xBB, 0xBF};
     fwrite(BOM, sizeof(BOM), 1, m_file);
+
+    m_log_stop    = false;
+    m_log_running = pthread_create(&m_log_thread, NULL, LogWriter, NULL) == 0;
   }
   }
   return m_file != NULL;
@@ -172,7 +365,7 @@ bool CLog::Init(const char* path)
 void CLog::MemDump(char *pData, int length)
 {
   if (m_logLevel > LOG_LEVEL_NONE) { 
-  Log(LOGDEBUG, "MEM_DUMP: Dumping from %p", pData);
+  CLOG(LOGDEBUG, "MEM_DUMP: Dumping from %p", pData);
   for (int i = 0; i < length; i+=16)
   {
     CStdString strLine;
@@ -199,7 +392,7 @@ void CLog::MemDump(char *pData, int length)
         strLine += '.';
       alpha++;
     }
-    Log(LOGDEBUG, "%s", strLine.c_str());
+    CLOG(LOGDEBUG, "%s", strLine.c_str());
   }
   }
 }
@@ -207,7 +400,7 @@ void CLog::MemDump(char *pData, int length)
 void CLog::SetLogLevel(int level)
 {
   if(m_logLevel > LOG_LEVEL_NONE)
-    CLog::Log(LOGNOTICE, "Log level changed to %d", m_logLevel);
+    CLOG(LOGNOTICE, "Log level changed to %d", m_logLevel);
   m_logLevel = level;
 }
 
@@ -41,6 +41,12 @@
 #define LOGFATAL   6
 #define LOGNONE    7
 
+// Call sites below LOG_MIN_LEVEL are compiled out, arguments included, e.g.
+// build with -DLOG_MIN_LEVEL=LOGERROR to drop the per packet debug lines.
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOGDEBUG
+#endif
+
 #ifdef __GNUC__
 #define ATTRIB_LOG_FORMAT __attribute__((format(printf,2,3)))
 #else
@@ -52,8 +58,11 @@ class CLog
 public:
   CLog();
   virtual ~CLog(void);
+  // flushes what is still queued
   static void Close();
-  static void Log(int loglevel, const char *format, ... ) ATTRIB_LOG_FORMAT;
+  // use CLOG(level, format, ...), see below
+  static bool Write(int loglevel, const char *format, ... ) ATTRIB_LOG_FORMAT;
+  static bool Enabled(int loglevel) { return loglevel >= LOG_MIN_LEVEL; }
   static void MemDump(char *pData, int length);
   static bool Init(const char* path);
   static void SetLogLevel(int level);
@@ -61,3 +70,12 @@ public:
 private:
   static void OutputDebugString(const std::string& line);
 };
+
+// CLOG(level, ...) expands to (CLog::Enabled(level) && CLog::Write(...)), so
+// with a constant level the whole call folds away below LOG_MIN_LEVEL. It is
+// a macro of its own name rather than CLog::Log, which would need a macro
+// named Log rewriting every Log( in the files that include this.
+//
+// Write only formats the message into a per thread ring, a background thread
+// adds the prefix, folds repeated lines and writes to the file in batches.
+#define CLOG(loglevel, ...) (CLog::Enabled(loglevel) && CLog::Write(loglevel, __VA_ARGS__))